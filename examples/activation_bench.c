@@ -0,0 +1,124 @@
+#include "darknet.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "activations.h"
+#include "utils.h"
+
+#define N_BENCH_ACTIVATIONS 15
+
+typedef struct activation_bench_result {
+    ACTIVATION a;
+    double scalar;          // seconds per call of activate_array_scalar.
+    double fast;            // seconds per call of activate_array.
+    double gradient_scalar; // seconds per call of gradient_array_scalar.
+    double gradient_fast;   // seconds per call of gradient_array.
+    double max_abs_error;   // between activate_array and the scalar path.
+} activation_bench_result;
+
+/**
+ * Times one activation path on a copy of the inputs, the copy excluded.
+ */
+static double time_activation(void (*f)(float *, const int, const ACTIVATION),
+        const float *input, float *x, int n, ACTIVATION a, int reps) {
+    double total = 0;
+    for (int r = 0; r < reps; ++r) {
+        memcpy(x, input, n * sizeof(float));
+        double start = what_time_is_it_now();
+        f(x, n, a);
+        total += what_time_is_it_now() - start;
+    }
+    return total / reps;
+}
+
+static double time_gradient(void (*f)(const float *, const int,
+            const ACTIVATION, float *), const float *x, float *delta, int n,
+        ACTIVATION a, int reps) {
+    double total = 0;
+    for (int r = 0; r < reps; ++r) {
+        for (int i = 0; i < n; ++i) delta[i] = 1;
+        double start = what_time_is_it_now();
+        f(x, n, a, delta);
+        total += what_time_is_it_now() - start;
+    }
+    return total / reps;
+}
+
+static activation_bench_result bench_activation(ACTIVATION a,
+        const float *input, int n, int reps) {
+    activation_bench_result r = {0};
+    r.a = a;
+    float *x = calloc(n, sizeof(float));
+    float *ref = calloc(n, sizeof(float));
+    float *delta = calloc(n, sizeof(float));
+    r.scalar = time_activation(activate_array_scalar, input, ref, n, a, reps);
+    r.fast = time_activation(activate_array, input, x, n, a, reps);
+    for (int i = 0; i < n; ++i) {
+        double err = fabs(x[i] - ref[i]);
+        if (err > r.max_abs_error) r.max_abs_error = err;
+    }
+    r.gradient_scalar = time_gradient(gradient_array_scalar, ref, delta, n, a,
+            reps);
+    r.gradient_fast = time_gradient(gradient_array, ref, delta, n, a, reps);
+    free(x);
+    free(ref);
+    free(delta);
+    return r;
+}
+
+static void print_activation_bench_json(FILE *stream, int n,
+        const activation_bench_result *r) {
+    fprintf(stream, "{\"activation\" : \"%s\", \"n\" : %d, \
+\"scalar_ns_per_float\" : %g, \"fast_ns_per_float\" : %g, \"speedup\" : %g, \
+\"gradient_scalar_ns_per_float\" : %g, \"gradient_fast_ns_per_float\" : %g, \
+\"gradient_speedup\" : %g, \"max_abs_error\" : %g}",
+            get_activation_string(r->a), n, 1e9 * r->scalar / n,
+            1e9 * r->fast / n, r->scalar / r->fast,
+            1e9 * r->gradient_scalar / n, 1e9 * r->gradient_fast / n,
+            r->gradient_scalar / r->gradient_fast, r->max_abs_error);
+}
+
+void run_activation_bench(int argc, char **argv) {
+    if (find_arg(argc, argv, "-h")) {
+        fprintf(stderr,
+"usage: %s %s [options]\n\
+Times activate_array and gradient_array against the scalar paths calling\n\
+activate/gradient per float, for every activation, on inputs uniform in\n\
+[-range, range]. Prints the results as json.\n\
+Options are :\n\
+    -n     -> number of floats. default 1048576.\n\
+    -reps  -> number of timed calls. default 50.\n\
+    -range -> bound of the inputs. default 8.\n\
+    -out   -> output file for the json. default stdout.\n",
+                argv[0], argv[1]);
+        return;
+    }
+    int n = find_int_arg(argc, argv, "-n", 1 << 20);
+    int reps = find_int_arg(argc, argv, "-reps", 50);
+    float range = find_float_arg(argc, argv, "-range", 8);
+    char *outfile = find_char_arg(argc, argv, "-out", 0);
+    FILE *outstream = outfile ? fopen(outfile, "w") : stdout;
+    if (!outstream) file_error(outfile);
+
+    float *input = calloc(n, sizeof(float));
+    for (int i = 0; i < n; ++i) input[i] = rand_uniform(-range, range);
+    ACTIVATION activations[N_BENCH_ACTIVATIONS] = {LOGISTIC, LOGGY,
+        HALF_LOGGY, RELU, ELU, SELU, RELIE, RAMP, LINEAR, TANH, PLSE, LEAKY,
+        STAIR, HARDTAN, LHTAN};
+    fprintf(outstream, "{\"n\" : %d, \"reps\" : %d, \"benchmarks\" : [\n",
+            n, reps);
+    for (int k = 0; k < N_BENCH_ACTIVATIONS; ++k) {
+        activation_bench_result r = bench_activation(activations[k], input,
+                n, reps);
+        if (k) fprintf(outstream, ",\n");
+        print_activation_bench_json(outstream, n, &r);
+        fflush(outstream);
+    }
+    fprintf(outstream, "\n]}\n");
+    if (outstream != stdout) fclose(outstream);
+    free(input);
+}
+
+#undef N_BENCH_ACTIVATIONS
@@ -5,12 +5,15 @@
 #include <stdio.h>
 
 #include "utils.h"
+#include "gemm.h"
 
 extern void predict_classifier(char *datacfg, char *cfgfile, char *weightfile, char *filename, int top);
 extern void test_detector(char *datacfg, char *cfgfile, char *weightfile, char *filename, float thresh, float hier_thresh, char *outfile, int fullscreen);
 extern void test_fspt(char *datacfg, char *cfgfile, char *weightfile, char *filename, float yolo_thresh, float fspt_thresh, float hier_thresh, char *outfile, int fullscreen);
 extern void run_yolo(int argc, char **argv);
 extern void run_fspt(int argc, char **argv);
+extern void run_fspt_bench(int argc, char **argv);
+extern void run_activation_bench(int argc, char **argv);
 extern void run_detector(int argc, char **argv);
 extern void run_coco(int argc, char **argv);
 extern void run_nightmare(int argc, char **argv);
@@ -195,6 +198,17 @@ void partial(char *cfgfile, char *weightfile, char *outfile, int max)
     save_weights_upto(net, outfile, max);
 }
 
+/* -fuse folds the batchnorm first, so that fuse_network doesn't write in
+ * the mapped weights of the detectors. */
+void map_weights(char *cfgfile, char *weightfile, char *outfile, int fuse)
+{
+    gpu_index = -1;
+    network *net = load_network(cfgfile, weightfile, 0);
+    if(fuse) fuse_network(net);
+    save_mapped_weights(net, outfile);
+    free_network(net);
+}
+
 void print_weights(char *cfgfile, char *weightfile, int n)
 {
     gpu_index = -1;
@@ -414,6 +428,16 @@ int main(int argc, char **argv)
         fprintf(stderr, "usage: %s <function>\n", argv[0]);
         return 0;
     }
+    /* seeds the random streams of the threads. -rng_seed makes the data
+     * augmentation and the fspt fitting reproducible. Not -seed, which
+     * find_int_arg would take from the subcommands using it. */
+    set_rand_stream_global_seed(find_int_arg(argc, argv, "-rng_seed", time(0)));
+    gemm_set_threads(find_int_arg(argc, argv, "-threads", 0));
+    /* -profile <prefix> times every layer of the networks loaded from a
+     * cfg, printed and saved to <prefix>.json when they are freed. */
+    network_profile_prefix = find_char_arg(argc, argv, "-profile", 0);
+    /* -replicas <n> splits the batches over n threads on the cpu. */
+    network_replicas = find_int_arg(argc, argv, "-replicas", 0);
     gpu_index = find_int_arg(argc, argv, "-i", 0);
     if(find_arg(argc, argv, "-nogpu")) {
         gpu_index = -1;
@@ -445,6 +469,10 @@ int main(int argc, char **argv)
         test_detector("cfg/coco.data", argv[2], argv[3], filename, thresh, .5, outfile, fullscreen);
     } else if (0 == strcmp(argv[1], "fspt")) {
         run_fspt(argc, argv);
+    } else if (0 == strcmp(argv[1], "fspt_bench")) {
+        run_fspt_bench(argc, argv);
+    } else if (0 == strcmp(argv[1], "activation_bench")) {
+        run_activation_bench(argc, argv);
     } else if (0 == strcmp(argv[1], "fspt_test")){
         float yolo_thresh = find_float_arg(argc, argv, "-yolo_thresh", .5);
         float fspt_thresh = find_float_arg(argc, argv, "-fspt_thresh", .5);
@@ -504,6 +532,13 @@ int main(int argc, char **argv)
         print_weights(argv[2], argv[3], atoi(argv[4]));
     } else if (0 == strcmp(argv[1], "partial")){
         partial(argv[2], argv[3], argv[4], atoi(argv[5]));
+    } else if (0 == strcmp(argv[1], "map")){
+        int fuse = find_arg(argc, argv, "-fuse");
+        if(argc < 5){
+            fprintf(stderr, "usage: %s %s [cfg] [weights] [mapped weights] [-fuse]\n", argv[0], argv[1]);
+            return 0;
+        }
+        map_weights(argv[2], argv[3], argv[4], fuse);
     } else if (0 == strcmp(argv[1], "average")){
         average(argc, argv);
     } else if (0 == strcmp(argv[1], "visualize")){
@@ -244,7 +244,9 @@ void validate_detector_flip(char *datacfg, char *cfgfile, char *weightfile, char
     if (mapf) map = read_map(mapf);
 
     network *net = load_network(cfgfile, weightfile, 0);
+    fuse_network(net);
     set_batch_network(net, 2);
+    plan_network_memory(net);
     fprintf(stderr, "Learning Rate: %g, Momentum: %g, Decay: %g\n", net->learning_rate, net->momentum, net->decay);
     srand(time(0));
 
@@ -374,7 +376,9 @@ void validate_detector(char *datacfg, char *cfgfile, char *weightfile, char *out
     if (mapf) map = read_map(mapf);
 
     network *net = load_network(cfgfile, weightfile, 0);
+    fuse_network(net);
     set_batch_network(net, 1);
+    plan_network_memory(net);
     fprintf(stderr, "Learning Rate: %g, Momentum: %g, Decay: %g\n", net->learning_rate, net->momentum, net->decay);
     srand(time(0));
 
@@ -486,10 +490,32 @@ void validate_detector(char *datacfg, char *cfgfile, char *weightfile, char *out
     fprintf(stderr, "Total Detection Time: %f Seconds\n", what_time_is_it_now() - start);
 }
 
+void quantize_detector(char *datacfg, char *cfgfile, char *weightfile, char *outfile, int n)
+{
+    list *options = read_data_cfg(datacfg);
+    char *calib_images = option_find_str(options, "calib", 0);
+    if(!calib_images) calib_images = option_find_str(options, "valid", "data/train.list");
+    list *plist = get_paths(calib_images);
+    char **paths = (char **)list_to_array(plist);
+    if(n <= 0 || n > plist->size) n = plist->size;
+
+    network *net = load_network(cfgfile, weightfile, 0);
+    set_batch_network(net, 1);
+    quantize_network(net, paths, n);
+    save_weights(net, outfile);
+
+    free_network(net);
+    free_ptrs((void **)paths, plist->size);
+    free_list(plist);
+    free_list(options);
+}
+
 void validate_detector_recall(char *cfgfile, char *weightfile)
 {
     network *net = load_network(cfgfile, weightfile, 0);
+    fuse_network(net);
     set_batch_network(net, 1);
+    plan_network_memory(net);
     fprintf(stderr, "Learning Rate: %g, Momentum: %g, Decay: %g\n", net->learning_rate, net->momentum, net->decay);
     srand(time(0));
 
@@ -567,7 +593,9 @@ void test_detector(char *datacfg, char *cfgfile, char *weightfile, char *filenam
 
     image **alphabet = load_alphabet();
     network *net = load_network(cfgfile, weightfile, 0);
+    fuse_network(net);
     set_batch_network(net, 1);
+    plan_network_memory(net);
     srand(2222222);
     double time;
     char buff[256];
@@ -794,6 +822,7 @@ void run_detector(int argc, char **argv)
     int cam_index = find_int_arg(argc, argv, "-c", 0);
     int frame_skip = find_int_arg(argc, argv, "-s", 0);
     int avg = find_int_arg(argc, argv, "-avg", 3);
+    int calib = find_int_arg(argc, argv, "-calib", 100);
     if(argc < 4){
         fprintf(stderr, "usage: %s %s [train/test/valid] [cfg] [weights (optional)]\n", argv[0], argv[1]);
         return;
@@ -838,6 +867,13 @@ void run_detector(int argc, char **argv)
     else if(0==strcmp(argv[2], "valid")) validate_detector(datacfg, cfg, weights, outfile);
     else if(0==strcmp(argv[2], "valid2")) validate_detector_flip(datacfg, cfg, weights, outfile);
     else if(0==strcmp(argv[2], "recall")) validate_detector_recall(cfg, weights);
+    else if(0==strcmp(argv[2], "quantize")){
+        if(!filename){
+            fprintf(stderr, "usage: %s %s quantize [data] [cfg] [weights] [int8 weights] [-calib n]\n", argv[0], argv[1]);
+            return;
+        }
+        quantize_detector(datacfg, cfg, weights, filename, calib);
+    }
     else if(0==strcmp(argv[2], "demo")) {
         list *options = read_data_cfg(datacfg);
         int classes = option_find_int(options, "classes", 20);
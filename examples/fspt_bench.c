@@ -0,0 +1,380 @@
+#include "darknet.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "distance_to_boundary.h"
+#include "fspt.h"
+#include "fspt_criterion.h"
+#include "fspt_score.h"
+#include "gini_utils.h"
+#include "utils.h"
+
+#define N_CLUSTERS 8
+#define N_SUBCLUSTERS 4
+#define N_DATASETS 4
+
+typedef enum {UNIFORM_DATA = 0, CLUSTERED_DATA = 1, MANIFOLD_DATA = 2,
+    STRUCTURED_DATA = 3} BENCH_DATASET;
+
+typedef struct bench_timing {
+    double seconds;
+    double ops;          // number of operations (samples, leaves, calls...)
+} bench_timing;
+
+typedef struct bench_result {
+    BENCH_DATASET dataset;
+    size_t n;
+    int d;
+    size_t n_nodes;
+    int depth;
+    bench_timing fit;
+    bench_timing predict;
+    bench_timing rescore;
+    bench_timing stats;
+    bench_timing dist_to_bound;
+    bench_timing save;
+    bench_timing load;
+    long peak_rss_kb;    // of the process running the case alone.
+} bench_result;
+
+static const char *dataset_to_string(BENCH_DATASET dataset) {
+    switch (dataset) {
+        case UNIFORM_DATA:
+            return "uniform";
+        case CLUSTERED_DATA:
+            return "clustered";
+        case MANIFOLD_DATA:
+            return "manifold";
+        case STRUCTURED_DATA:
+            return "structured";
+        default:
+            return "unknown";
+    }
+}
+
+/**
+ * Reproducible uniform random number in [min, max).
+ */
+static float bench_uniform(unsigned int *seed, float min, float max) {
+    return min + (max - min) * ((float) rand_r(seed) / ((float) RAND_MAX + 1));
+}
+
+/**
+ * Generates a synthetic dataset in [0, 1]^d.
+ * uniform: uniform samples.
+ * clustered: N_CLUSTERS clusters of width 0.05 around random centers.
+ * manifold: samples of a 2d surface x_j = 0.5 + 0.4 sin(a_j t1 + b_j t2 + c_j)
+ *           with a small noise.
+ * structured: N_CLUSTERS clusters of width 0.1, each made of N_SUBCLUSTERS
+ *             subclusters of width 0.02, so the fit grows deep trees with
+ *             empty regions at two scales. The uniform dataset only covers
+ *             the path where the root is never split.
+ *
+ * \param dataset The kind of dataset.
+ * \param n The number of samples.
+ * \param d The number of features.
+ * \param seed The seed of the generator.
+ * \return The samples. Size n * d. Caller must free.
+ */
+static float *make_bench_data(BENCH_DATASET dataset, size_t n, int d,
+        unsigned int seed) {
+    float *X = malloc(n * d * sizeof(float));
+    assert(X);
+    if (dataset == UNIFORM_DATA) {
+        for (size_t i = 0; i < n * d; ++i) X[i] = bench_uniform(&seed, 0, 1);
+    } else if (dataset == CLUSTERED_DATA) {
+        float *centers = malloc(N_CLUSTERS * d * sizeof(float));
+        for (int i = 0; i < N_CLUSTERS * d; ++i)
+            centers[i] = bench_uniform(&seed, .1f, .9f);
+        for (size_t i = 0; i < n; ++i) {
+            const float *c = centers + (rand_r(&seed) % N_CLUSTERS) * d;
+            for (int j = 0; j < d; ++j) {
+                float x = c[j] + bench_uniform(&seed, -.05f, .05f);
+                X[i * d + j] = MIN(MAX(x, 0.f), 1.f);
+            }
+        }
+        free(centers);
+    } else if (dataset == STRUCTURED_DATA) {
+        int n_centers = N_CLUSTERS * N_SUBCLUSTERS;
+        float *centers = malloc(n_centers * d * sizeof(float));
+        for (int c = 0; c < N_CLUSTERS; ++c) {
+            float center[d];
+            for (int j = 0; j < d; ++j)
+                center[j] = bench_uniform(&seed, .15f, .85f);
+            for (int k = 0; k < N_SUBCLUSTERS; ++k) {
+                float *sub = centers + (c * N_SUBCLUSTERS + k) * d;
+                for (int j = 0; j < d; ++j)
+                    sub[j] = center[j] + bench_uniform(&seed, -.05f, .05f);
+            }
+        }
+        for (size_t i = 0; i < n; ++i) {
+            const float *c = centers + (rand_r(&seed) % n_centers) * d;
+            for (int j = 0; j < d; ++j) {
+                float x = c[j] + bench_uniform(&seed, -.01f, .01f);
+                X[i * d + j] = MIN(MAX(x, 0.f), 1.f);
+            }
+        }
+        free(centers);
+    } else {
+        float *a = malloc(3 * d * sizeof(float));
+        for (int i = 0; i < 3 * d; ++i) a[i] = bench_uniform(&seed, -3, 3);
+        for (size_t i = 0; i < n; ++i) {
+            float t1 = bench_uniform(&seed, 0, 1);
+            float t2 = bench_uniform(&seed, 0, 1);
+            for (int j = 0; j < d; ++j) {
+                float x = .5f + .4f * sinf(a[3*j] * t1 + a[3*j + 1] * t2
+                        + a[3*j + 2]) + bench_uniform(&seed, -.01f, .01f);
+                X[i * d + j] = MIN(MAX(x, 0.f), 1.f);
+            }
+        }
+        free(a);
+    }
+    return X;
+}
+
+static void set_bench_args(criterion_args *c_args, score_args *s_args,
+        int d) {
+    *c_args = (criterion_args) {0};
+    c_args->criterion_function = GINI;
+    c_args->merge_nodes = 1;
+    c_args->max_tries_p = 1.f;
+    c_args->max_features_p = 1.f;
+    c_args->gini_gain_thresh = 0.01;
+    c_args->max_depth = 64;
+    c_args->min_samples = d;
+    c_args->min_volume_p = 0.;
+    c_args->min_length_p = 0.0001;
+    c_args->max_consecutive_gain_violations = d;
+    c_args->middle_split = 1;
+    *s_args = (score_args) {0};
+    s_args->score_function = AUTO_DENSITY;
+    s_args->calibration_score = 0.5;
+    s_args->calibration_n_samples_p = 0.75;
+    s_args->calibration_volume_p = 0.;
+    s_args->calibration_feat_length_p = 0.1;
+    s_args->samples_p = 0.8;
+    s_args->auto_calibration_score = 0.8;
+}
+
+/**
+ * Runs all the timed operations on one dataset.
+ */
+static bench_result bench_fspt_case(BENCH_DATASET dataset, size_t n, int d,
+        size_t n_predict, unsigned int seed, const char *tmp_file) {
+    bench_result r = {0};
+    r.dataset = dataset;
+    r.n = n;
+    r.d = d;
+    float *X = make_bench_data(dataset, n, d, seed);
+    float *X_test = make_bench_data(UNIFORM_DATA, n_predict, d, seed + 1);
+    float *lim = malloc(2 * d * sizeof(float));
+    for (int j = 0; j < d; ++j) {
+        lim[2*j] = 0.f;
+        lim[2*j + 1] = 1.f;
+    }
+    /* dist_to_bound_test on the whole dataset (fspt_fit reorders X) */
+    double start = what_time_is_it_now();
+    dist_to_bound_test(d, n, X, lim);
+    r.dist_to_bound = (bench_timing) {what_time_is_it_now() - start, n};
+    /* fit */
+    criterion_args *c_args = malloc(sizeof(criterion_args));
+    score_args *s_args = malloc(sizeof(score_args));
+    set_bench_args(c_args, s_args, d);
+    fspt_t *fspt = make_fspt(d, lim, NULL, gini_criterion,
+            auto_normalized_density_score);
+    start = what_time_is_it_now();
+    fspt_fit(n, X, c_args, s_args, fspt);
+    r.fit = (bench_timing) {what_time_is_it_now() - start, n};
+    r.n_nodes = fspt->n_nodes;
+    r.depth = fspt->depth;
+    /* predict */
+    float *Y = malloc(n_predict * sizeof(float));
+    start = what_time_is_it_now();
+    fspt_predict(n_predict, fspt, X_test, Y);
+    r.predict = (bench_timing) {what_time_is_it_now() - start, n_predict};
+    /* rescore */
+    score_args *rescore_args = malloc(sizeof(score_args));
+    *rescore_args = *s_args;
+    rescore_args->calibration_score = 0.6;
+    start = what_time_is_it_now();
+    fspt_rescore(fspt, rescore_args);
+    r.rescore = (bench_timing)
+        {what_time_is_it_now() - start, rescore_args->n_leaves};
+    free(s_args);
+    /* stats */
+    start = what_time_is_it_now();
+    fspt_stats *stats = get_fspt_stats(fspt, 0, NULL, 0);
+    r.stats = (bench_timing) {what_time_is_it_now() - start, 1};
+    free_fspt_stats(stats);
+    /* save / load */
+    int succ = 1;
+    start = what_time_is_it_now();
+    fspt_save(tmp_file, *fspt, 1, &succ);
+    r.save = (bench_timing) {what_time_is_it_now() - start, 1};
+    fspt_t *loaded = make_fspt(d, copy_float_array(2 * d, lim), NULL,
+            gini_criterion, auto_normalized_density_score);
+    start = what_time_is_it_now();
+    fspt_load(tmp_file, loaded, 1, 1, 1, 1, &succ);
+    r.load = (bench_timing) {what_time_is_it_now() - start, 1};
+    if (!succ) fprintf(stderr, "fspt bench: save/load failed.\n");
+    remove(tmp_file);
+
+    free(loaded->c_args);
+    free(loaded->s_args);
+    free_fspt(loaded);
+    free(c_args);
+    free(rescore_args);
+    free_fspt(fspt); // frees X and lim.
+    free(Y);
+    free(X_test);
+    return r;
+}
+
+/**
+ * Runs bench_fspt_case in a child process. ru_maxrss only grows during the
+ * life of a process, so a case run in the bench process itself would
+ * report the peak of the largest case run before it.
+ */
+static bench_result bench_fspt_case_forked(BENCH_DATASET dataset, size_t n,
+        int d, size_t n_predict, unsigned int seed, const char *tmp_file) {
+    int fds[2];
+    if (pipe(fds)) error("fspt bench: pipe failed");
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid < 0) error("fspt bench: fork failed");
+    if (!pid) {
+        close(fds[0]);
+        bench_result r = bench_fspt_case(dataset, n, d, n_predict, seed,
+                tmp_file);
+        int ok = write(fds[1], &r, sizeof(r)) == sizeof(r);
+        close(fds[1]);
+        _exit(ok ? 0 : 1);
+    }
+    close(fds[1]);
+    bench_result r = {0};
+    size_t got = 0;
+    ssize_t size;
+    while (got < sizeof(r)
+            && (size = read(fds[0], (char *) &r + got, sizeof(r) - got)) > 0)
+        got += size;
+    close(fds[0]);
+    int status = 0;
+    struct rusage usage = {0};
+    if (wait4(pid, &status, 0, &usage) != pid || got != sizeof(r)
+            || !WIFEXITED(status) || WEXITSTATUS(status))
+        error("fspt bench: case failed");
+    r.peak_rss_kb = usage.ru_maxrss;
+    return r;
+}
+
+static void print_bench_timing_json(FILE *stream, const char *name,
+        bench_timing t) {
+    fprintf(stream, "\"%s\" : {\"seconds\" : %g, \"ops\" : %g, \
+\"ops_per_sec\" : %g}", name, t.seconds, t.ops,
+            t.seconds > 0 ? t.ops / t.seconds : 0.);
+}
+
+static void print_bench_result_json(FILE *stream, const bench_result *r) {
+    fprintf(stream, "{\"dataset\" : \"%s\", \"n\" : %zu, \"d\" : %d, \
+\"n_nodes\" : %zu, \"depth\" : %d, ", dataset_to_string(r->dataset), r->n,
+            r->d, r->n_nodes, r->depth);
+    print_bench_timing_json(stream, "fit", r->fit);
+    fprintf(stream, ", ");
+    print_bench_timing_json(stream, "predict", r->predict);
+    fprintf(stream, ", ");
+    print_bench_timing_json(stream, "rescore", r->rescore);
+    fprintf(stream, ", ");
+    print_bench_timing_json(stream, "stats", r->stats);
+    fprintf(stream, ", ");
+    print_bench_timing_json(stream, "dist_to_bound_test", r->dist_to_bound);
+    fprintf(stream, ", ");
+    print_bench_timing_json(stream, "save", r->save);
+    fprintf(stream, ", ");
+    print_bench_timing_json(stream, "load", r->load);
+    fprintf(stream, ", \"peak_rss_kb\" : %ld}", r->peak_rss_kb);
+}
+
+/**
+ * Parses a comma separated list of positive integers.
+ *
+ * \param s The list.
+ * \param n Output parameter. Will contain the size of the list.
+ * \return The values. Caller must free.
+ */
+static size_t *parse_size_list(const char *s, int *n) {
+    *n = 1;
+    for (const char *c = s; *c; ++c) if (*c == ',') ++*n;
+    size_t *values = calloc(*n, sizeof(size_t));
+    for (int i = 0; i < *n; ++i) {
+        values[i] = strtoul(s, NULL, 10);
+        s = strchr(s, ',') + 1;
+    }
+    return values;
+}
+
+void run_fspt_bench(int argc, char **argv) {
+    if (find_arg(argc, argv, "-h")) {
+        fprintf(stderr,
+"usage: %s %s [options]\n\
+Times fspt_fit, fspt_predict, fspt_rescore, get_fspt_stats,\n\
+dist_to_bound_test and save/load on synthetic datasets (uniform, clustered,\n\
+manifold and structured) and prints the results as json. Each case runs\n\
+in its own process and reports the peak resident set size of this process.\n\
+Options are :\n\
+    -n         -> comma separated numbers of samples. default 1000,10000.\n\
+    -d         -> comma separated numbers of features. default 2,8,32.\n\
+    -n_predict -> number of predictions. default 100000.\n\
+    -seed      -> seed of the datasets. default 0.\n\
+    -out       -> output file for the json. default stdout.\n",
+                argv[0], argv[1]);
+        return;
+    }
+    char *n_list = find_char_arg(argc, argv, "-n", "1000,10000");
+    char *d_list = find_char_arg(argc, argv, "-d", "2,8,32");
+    size_t n_predict = find_int_arg(argc, argv, "-n_predict", 100000);
+    unsigned int seed = find_int_arg(argc, argv, "-seed", 0);
+    char *outfile = find_char_arg(argc, argv, "-out", 0);
+    char tmp_file[256];
+    sprintf(tmp_file, "/tmp/fspt_bench_%d.dat", getpid());
+
+    int n_n = 0;
+    int n_d = 0;
+    size_t *ns = parse_size_list(n_list, &n_n);
+    size_t *ds = parse_size_list(d_list, &n_d);
+    FILE *outstream = outfile ? fopen(outfile, "w") : stdout;
+    if (!outstream) file_error(outfile);
+
+    fprintf(outstream, "{\"seed\" : %u, \"n_predict\" : %zu, \
+\"benchmarks\" : [\n", seed, n_predict);
+    int first = 1;
+    long peak_rss = 0;
+    for (int dataset = 0; dataset < N_DATASETS; ++dataset) {
+        for (int i = 0; i < n_n; ++i) {
+            for (int j = 0; j < n_d; ++j) {
+                fprintf(stderr, "fspt bench: %s n = %zu d = %zu...\n",
+                        dataset_to_string(dataset), ns[i], ds[j]);
+                bench_result r = bench_fspt_case_forked(dataset, ns[i],
+                        ds[j], n_predict, seed, tmp_file);
+                if (r.peak_rss_kb > peak_rss) peak_rss = r.peak_rss_kb;
+                if (!first) fprintf(outstream, ",\n");
+                first = 0;
+                print_bench_result_json(outstream, &r);
+                fflush(outstream);
+            }
+        }
+    }
+    fprintf(outstream, "\n], \"peak_rss_kb\" : %ld}\n", peak_rss);
+    if (outstream != stdout) fclose(outstream);
+    free(ns);
+    free(ds);
+}
+
+#undef N_CLUSTERS
+#undef N_SUBCLUSTERS
+#undef N_DATASETS
@@ -572,6 +572,171 @@ static void print_stats(char *datacfg, char *cfgfile, char *weightfile,
     free_list(options);
 }
 
+static void simplify_fspt(char *datacfg, char *cfgfile, char *weightfile,
+        char *save_weights_file, float fspt_thresh, float tolerance) {
+    list *options = read_data_cfg(datacfg);
+    char *backup_directory = option_find_str(options, "backup", "backup/");
+    char *base = basecfg(cfgfile);
+    printf("%s\n", base);
+
+    network *net = load_network(cfgfile, weightfile, 0);
+
+    list *fspt_layers = get_network_layers_by_type(net, FSPT);
+    while (fspt_layers->size > 0) {
+        layer *l = (layer *) list_pop(fspt_layers);
+        fspt_layer_simplify(*l, fspt_thresh, tolerance);
+    }
+    free_list(fspt_layers);
+    if (save_weights_file) {
+        save_weights(net, save_weights_file);
+    } else {
+        char buff[256];
+        sprintf(buff, "%s/%s_simplified.weights", backup_directory, base);
+        save_weights(net, buff);
+    }
+    free_network(net);
+    free_list_contents(options);
+    free_list(options);
+}
+
+/**
+ * Prunes the fspts of weightfile with the stopping rules of cfgfile and
+ * rescores them with the score args of cfgfile.
+ * The fspts of weightfile must have been fitted with looser stopping rules.
+ *
+ * \param extern_c_args Output parameter. If not NULL, will contain the
+ *                      criterion args of each fspt layer. Caller must free.
+ * \param extern_s_args Output parameter. If not NULL, will contain the
+ *                      score args of each fspt layer. Caller must free.
+ */
+static void prune_fspt(char *datacfg, char *cfgfile, char *weightfile,
+        char *save_weights_file, criterion_args **extern_c_args,
+        score_args **extern_s_args) {
+    list *options = read_data_cfg(datacfg);
+    char *backup_directory = option_find_str(options, "backup", "backup/");
+    char *base = basecfg(cfgfile);
+    printf("%s\n", base);
+
+    int old_gpu_index = gpu_index;
+    gpu_index = -1; // no gpu allocation needed to prune.
+    network *net = load_network(cfgfile, weightfile, 0);
+
+    list *fspt_layers = get_network_layers_by_type(net, FSPT);
+    layer **fspt_layers_array = (layer **) list_to_array(fspt_layers);
+    size_t n_layers = fspt_layers->size > 0 ? (size_t) fspt_layers->size : 0;
+    for (int k = 0; k < fspt_layers->size; ++k) {
+        fspt_layer_prune(*fspt_layers_array[k]);
+    }
+    if (extern_c_args) {
+        *extern_c_args = calloc(n_layers, sizeof(criterion_args));
+        for (int k = 0; k < fspt_layers->size; ++k) {
+            layer *l = fspt_layers_array[k];
+            if (!l->fspts[0]->c_args) {
+                error("The fspts have no criterion args, their saved args could not be read.");
+            }
+            (*extern_c_args)[k] = *l->fspts[0]->c_args;
+        }
+    }
+    if (extern_s_args) {
+        *extern_s_args = calloc(n_layers, sizeof(score_args));
+        for (int k = 0; k < fspt_layers->size; ++k) {
+            layer *l = fspt_layers_array[k];
+            if (!l->fspts[0]->s_args) {
+                error("The fspts have no score args, their saved args could not be read.");
+            }
+            (*extern_s_args)[k] = *l->fspts[0]->s_args;
+            (*extern_s_args)[k].score_vol_n_array = NULL;
+            (*extern_s_args)[k].n_threads = l->fspt_score_args.n_threads;
+        }
+    }
+    if (save_weights_file) {
+        save_weights(net, save_weights_file);
+    } else {
+        char buff[256];
+        sprintf(buff, "%s/%s_pruned.weights", backup_directory, base);
+        save_weights(net, buff);
+    }
+    free(fspt_layers_array);
+    free_list(fspt_layers);
+    free_network(net);
+    gpu_index = old_gpu_index;
+    free(base);
+    free_list_contents(options);
+    free_list(options);
+}
+
+/**
+ * Merges the training data extracted in shards by `train -shard` and fits
+ * the fspts on them.
+ *
+ * \param datacfg The data configuration file.
+ * \param cfgfile The network configuration file.
+ * \param weightfile The weights of the network used for the extraction.
+ * \param save_weights_file The output weights. If NULL, saves in
+ *                          <backup>/<cfg>_final.weights.
+ * \param shard_list Comma separated paths of the shard files.
+ * \param dedup If true, drops the samples extracted more than once.
+ * \param refit If true, the fspts are refitted if they already exist.
+ * \param one_thread If true, the fspts are fitted in only one thread.
+ */
+static void merge_fspt(char *datacfg, char *cfgfile, char *weightfile,
+        char *save_weights_file, char *shard_list, int dedup, int refit,
+        int one_thread) {
+    if (!shard_list) error("No shard given. Use -shards <shard1,shard2,...>.");
+    list *options = read_data_cfg(datacfg);
+    char *backup_directory = option_find_str(options, "backup", "backup/");
+    char *base = basecfg(cfgfile);
+    printf("%s\n", base);
+
+    size_t len = strlen(shard_list);
+    size_t max_shards = 1;
+    for (size_t i = 0; i < len; ++i) {
+        if (shard_list[i] == ',') ++max_shards;
+    }
+    char **shards = calloc(max_shards, sizeof(char *));
+    assert(shards);
+    /* strtok skips the empty tokens, so count the shards it returns */
+    int n_shards = 0;
+    for (char *shard = strtok(shard_list, ","); shard;
+            shard = strtok(NULL, ",")) {
+        shards[n_shards++] = shard;
+    }
+    if (!n_shards) error("No shard given. Use -shards <shard1,shard2,...>.");
+
+    int old_gpu_index = gpu_index;
+    gpu_index = -1; // no gpu allocation needed to merge and fit.
+    network *net = load_network(cfgfile, weightfile, 0);
+    list *fspt_layers = get_network_layers_by_type(net, FSPT);
+    if (fspt_layers->size == 0)
+        error("The net must have fspt layers.");
+    int classes = ((layer *) fspt_layers->front->val)->classes;
+    free_list(fspt_layers);
+
+    double time = what_time_is_it_now();
+    if (!merge_fspt_shards(net, n_shards, shards, dedup))
+        error("Cannot merge the fspt shards.");
+    fprintf(stderr, "%d shards merged in %lf seconds. Fitting FSPTs...\n",
+            n_shards, what_time_is_it_now() - time);
+    fspt_layers_set_samples(net, refit, 0);
+    char buff[256];
+    sprintf(buff, "%s/%s_data_extraction.weights", backup_directory, base);
+    save_weights(net, buff);
+    fit_fspts(net, classes, refit, one_thread, 0);
+    if (save_weights_file) {
+        save_weights(net, save_weights_file);
+    } else {
+        sprintf(buff, "%s/%s_final.weights", backup_directory, base);
+        save_weights(net, buff);
+    }
+    fprintf(stderr, "End of FSPT merge\n");
+    free_network(net);
+    gpu_index = old_gpu_index;
+    free(shards);
+    free(base);
+    free_list_contents(options);
+    free_list(options);
+}
+
 void test_fspt(char *datacfg, char *cfgfile, char *weightfile, char *filename,
         float yolo_thresh, float fspt_thresh, float hier_thresh, char *outfile,
         int fullscreen)
@@ -582,7 +747,9 @@ void test_fspt(char *datacfg, char *cfgfile, char *weightfile, char *filename,
 
     image **alphabet = load_alphabet();
     network *net = load_network(cfgfile, weightfile, 0);
+    fuse_network(net);
     set_batch_network(net, 1);
+    plan_network_memory(net);
     srand(2222222);
     double time;
     char buff[256];
@@ -648,8 +815,9 @@ static void train_fspt(char *datacfg, char *cfgfile, char *weightfile,
         int clear, int refit, int ordered,
         int start, int end, int one_thread, int merge, int auto_only,
         int only_fit,
-        int only_score, int print_stats_val, criterion_args **extern_c_args,
-        score_args **extern_s_args) {
+        int only_score, int print_stats_val, char *shard_file,
+        criterion_args **extern_c_args, score_args **extern_s_args,
+        const criterion_args *fit_c_args) {
     list *options = read_data_cfg(datacfg);
     char *train_images = option_find_str(options, "train", "data/train.txt");
     char *backup_directory = option_find_str(options, "backup", "backup/");
@@ -673,6 +841,16 @@ static void train_fspt(char *datacfg, char *cfgfile, char *weightfile,
 #endif
         nets[i] = load_network(cfgfile, weightfile, clear);
         nets[i]->learning_rate *= n_nets;
+        if (fit_c_args) {
+            /* overrides the criterion args of the cfg file */
+            list *l_fspt = get_network_layers_by_type(nets[i], FSPT);
+            layer **l_fspt_array = (layer **) list_to_array(l_fspt);
+            for (int k = 0; k < l_fspt->size; ++k) {
+                l_fspt_array[k]->fspt_criterion_args = fit_c_args[k];
+            }
+            free(l_fspt_array);
+            free_list(l_fspt);
+        }
     }
     srand(time(0));
     network *net = nets[0];
@@ -783,18 +961,28 @@ static void train_fspt(char *datacfg, char *cfgfile, char *weightfile,
 #ifdef GPU
         if(n_nets != 1) sync_nets(nets, n_nets, 0);
 #endif
-        fspt_layers_set_samples(net, refit, merge);
-        merge = 0;
-        char buff[256];
-        sprintf(buff, "%s/%s_data_extraction.weights", backup_directory, base);
-        save_weights(net, buff);
-        fprintf(stderr, "Data extraction done. Fitting FSPTs...\n");
-        fit_fspts(net, classes, refit, one_thread, merge);
+        if (shard_file) {
+            if (!save_fspt_shard(net, shard_file))
+                error("Cannot save the fspt shard.");
+            fprintf(stderr, "Data extraction done. Samples saved in %s.\n",
+                    shard_file);
+        } else {
+            fspt_layers_set_samples(net, refit, merge);
+            merge = 0;
+            char buff[256];
+            sprintf(buff, "%s/%s_data_extraction.weights", backup_directory,
+                    base);
+            save_weights(net, buff);
+            fprintf(stderr, "Data extraction done. Fitting FSPTs...\n");
+            fit_fspts(net, classes, refit, one_thread, merge);
+        }
         free_ptrs((void **)paths, plist->size);
         free_list(plist);
     } // end if (!only_fit && !only_score)
     char buff[256];
-    if (save_weights_file) {
+    if (shard_file) {
+        /* the fspts are fitted by the merge command. */
+    } else if (save_weights_file) {
         save_weights(net, save_weights_file);
     } else {
         sprintf(buff, "%s/%s_final.weights", backup_directory, base);
@@ -807,6 +995,9 @@ static void train_fspt(char *datacfg, char *cfgfile, char *weightfile,
         *extern_c_args = calloc(fspt_layers->size, sizeof(criterion_args));
         for (int k = 0; k < fspt_layers->size; ++k) {
             layer *l = fspt_layers_array[k];
+            if (!l->fspts[0]->c_args) {
+                error("The fspts have no criterion args, their saved args could not be read.");
+            }
             (*extern_c_args)[k] = *l->fspts[0]->c_args;
         }
     }
@@ -814,11 +1005,15 @@ static void train_fspt(char *datacfg, char *cfgfile, char *weightfile,
         *extern_s_args = calloc(fspt_layers->size, sizeof(score_args));
         for (int k = 0; k < fspt_layers->size; ++k) {
             layer *l = fspt_layers_array[k];
+            if (!l->fspts[0]->s_args) {
+                error("The fspts have no score args, their saved args could not be read.");
+            }
             (*extern_s_args)[k] = *l->fspts[0]->s_args;
             (*extern_s_args)[k].score_vol_n_array = NULL;
+            (*extern_s_args)[k].n_threads = l->fspt_score_args.n_threads;
         }
     }
-    if (print_stats_val) {
+    if (print_stats_val && !shard_file) {
         FILE *outstream = outfile ? fopen(outfile, "w") : stderr;
         assert(outstream);
         for (int k = 0; k < fspt_layers->size; ++k) {
@@ -921,6 +1116,83 @@ static pthread_t validate_in_thread(network *net, float yolo_thresh,
     return thread;
 }
 
+/**
+ * Prints the validation data of each threshold pair, and optionally the
+ * statistics of the fspts of net, in outfile_yolo_<thresh>_fspt_<thresh>
+ * or in stderr if outfile is NULL.
+ *
+ * \param val_datas The validation data. Size n_yolo_thresh * n_fspt_thresh.
+ */
+static void print_validation_outputs(network *net, char **names,
+        int classes, int n_yolo_thresh, float *yolo_threshs,
+        int n_fspt_thresh, float *fspt_threshs, validation_data **val_datas,
+        int print_stats_val, char *outfile) {
+    list *fspt_layers = get_network_layers_by_type(net, FSPT);
+    layer **fspt_layers_array = (layer **) list_to_array(fspt_layers);
+    fspt_stats **stats =
+        calloc(fspt_layers->size * classes, sizeof(fspt_stats *));
+    if (print_stats_val) {
+        for (int i = 0; i < fspt_layers->size; ++i) {
+            layer *l = fspt_layers_array[i];
+            for (int j = 0; j < l->classes; ++j) {
+                fprintf(stderr, "Computing fspt stats %s:%s.\n",
+                        l->ref, names[j]);
+                fspt_t *fspt = l->fspts[j];
+                stats[i * classes + j] = get_fspt_stats(fspt, 0, NULL, 1);
+            }
+        }
+    }
+    for (int i = 0; i < n_yolo_thresh; ++i) {
+        for (int j = 0; j < n_fspt_thresh; ++j) {
+            int index = i * n_fspt_thresh + j;
+            validation_data *val_data = val_datas[index];
+            float fspt_thresh = fspt_threshs[j];
+            float yolo_thresh = yolo_threshs[i];
+            fprintf(stderr,"Yolo treshold is %g and fspt threshold is %g.\n",
+                    yolo_thresh, fspt_thresh);
+            FILE *outstream;
+            char outfile2[256] = {0};
+            if (outfile) {
+                sprintf(outfile2,"%s_yolo_%g_fspt_%g",
+                        outfile, yolo_thresh, fspt_thresh);
+                outstream = fopen(outfile2, "w");
+            } else {
+                outstream = stderr;
+            }
+            assert(outstream);
+            if (print_stats_val) {
+                fprintf(stderr, "Print stats...\n");
+                for (int k = 0; k < fspt_layers->size; ++k) {
+                    layer *l = fspt_layers_array[k];
+                    for (int c = 0; c < l->classes; ++c) {
+                        fspt_t *fspt = l->fspts[c];
+                        char buf[256] = {0};
+                        sprintf(buf, "%s class %s", l->ref, names[c]);
+                        print_fspt_criterion_args(outstream, fspt->c_args,
+                                buf);
+                        print_fspt_score_args(outstream, fspt->s_args, NULL);
+                        print_fspt_stats(outstream, stats[k * classes + c],
+                                NULL);
+                    }
+                }
+            }
+            fprintf(stderr, "Print validation...\n");
+            print_validation_data(outstream, val_data, 0, "VALIDATION RESULT");
+            if (outstream != stderr) fclose(outstream);
+        }
+    }
+    for (int k = 0; k < fspt_layers->size; ++k) {
+        for (int c = 0; c < classes; ++c) {
+            if (stats[k * classes + c]) {
+                free_fspt_stats(stats[k * classes + c]);
+            }
+        }
+    }
+    free(fspt_layers_array);
+    free_list(fspt_layers);
+    free(stats);
+}
+
 static void validate_fspt(char *datacfg, char *cfgfile, char *weightfile,
         int n_yolo_thresh, float *yolo_threshs,
         int n_fspt_thresh, float *fspt_threshs, float hier_thresh,
@@ -947,6 +1219,7 @@ static void validate_fspt(char *datacfg, char *cfgfile, char *weightfile,
             cuda_set_device(gpus[i]);
 #endif
         nets[i] = load_network(cfgfile, weightfile, 1);
+        fuse_network(nets[i]);
     }
     srand(time(0));
     network *net = nets[0];
@@ -1055,73 +1328,9 @@ static void validate_fspt(char *datacfg, char *cfgfile, char *weightfile,
         free(threads);
         free_data(val);
     }
-    list *fspt_layers = get_network_layers_by_type(net, FSPT);
-    layer **fspt_layers_array = (layer **) list_to_array(fspt_layers);
-    fspt_stats **stats =
-        calloc(fspt_layers->size * classes, sizeof(fspt_stats *));
-    if (print_stats_val) {
-        for (int i = 0; i < fspt_layers->size; ++i) {
-            layer *l = fspt_layers_array[i];
-            for (int j = 0; j < l->classes; ++j) {
-                fprintf(stderr, "Computing fspt stats %s:%s.\n",
-                        l->ref, names[j]);
-                fspt_t *fspt = l->fspts[j];
-                stats[i * classes + j] = get_fspt_stats(fspt, 0, NULL, 1);
-            }
-        }
-    }
-    for (int i = 0; i < n_yolo_thresh; ++i) {
-        for (int j = 0; j < n_fspt_thresh; ++j) {
-            int index = i * n_fspt_thresh + j;
-            validation_data *val_data = val_datas[index];
-            float fspt_thresh = fspt_threshs[j];
-            float yolo_thresh = yolo_threshs[i];
-            fprintf(stderr,"Yolo treshold is %g and fspt threshold is %g.\n",
-                    yolo_thresh, fspt_thresh);
-            FILE *outstream;
-            char outfile2[256] = {0};
-            if (outfile) {
-                sprintf(outfile2,"%s_yolo_%g_fspt_%g",
-                        outfile, yolo_thresh, fspt_thresh);
-                outstream = fopen(outfile2, "w");
-            } else {
-                outstream = stderr;
-            }
-            assert(outstream);
-            if (print_stats_val) {
-                fprintf(stderr, "Print stats...\n");
-                for (int k = 0; k < fspt_layers->size; ++k) {
-                    layer *l = fspt_layers_array[k];
-                    for (int c = 0; c < l->classes; ++c) {
-                        fspt_t *fspt = l->fspts[c];
-                        char buf[256] = {0};
-                        sprintf(buf, "%s class %s", l->ref, names[c]);
-                        print_fspt_criterion_args(outstream, fspt->c_args,
-                                buf);
-                        print_fspt_score_args(outstream, fspt->s_args, NULL);
-                        print_fspt_stats(outstream, stats[k * classes + c],
-                                NULL);
-                    }
-                }
-            }
-            fprintf(stderr, "Print validation...\n");
-            print_validation_data(outstream, val_data, 0, "VALIDATION RESULT");
-            if (!out_val_data && val_data) {
-                free_validation_data(val_data);
-            }
-            if (outstream != stderr) fclose(outstream);
-        }
-    }
-    for (int k = 0; k < fspt_layers->size; ++k) {
-        for (int c = 0; c < classes; ++c) {
-            if (stats[k * classes + c]) {
-                free_fspt_stats(stats[k * classes + c]);
-            }
-        }
-    }
-    free(fspt_layers_array);
-    free_list(fspt_layers);
-    free(stats);
+    print_validation_outputs(net, names, classes, n_yolo_thresh,
+            yolo_threshs, n_fspt_thresh, fspt_threshs, val_datas,
+            print_stats_val, outfile);
     if (!out_val_data) {
         for (int i = 0; i < n_yolo_thresh * n_fspt_thresh; ++i) {
             free_validation_data(val_datas[i]);
@@ -1147,6 +1356,183 @@ static void validate_fspt(char *datacfg, char *cfgfile, char *weightfile,
             t % 1000);
 }
 
+/**
+ * Validates several configurations with one forward pass of the backbone
+ * per batch. The backbone is the network of the first configuration, loaded
+ * once. The other configurations are views of the backbone with their own
+ * fspt layers, and only their fspt trees are read from their weight files,
+ * so only the fspt detections are computed per configuration. All the
+ * networks must have the same layers (but the fspt layers) and the same
+ * backbone weights.
+ *
+ * \param n_cfg The number of configurations.
+ * \param cfgfiles The configuration files.
+ * \param weightfiles The weight files of the configurations.
+ * \param outfiles The output files of the configurations. May be NULL.
+ * \param out_val_datas Output parameter. out_val_datas[cfg] will contain
+ *                      the validation data of configuration cfg. Size
+ *                      n_yolo_thresh * n_fspt_thresh.
+ * \return 1 if the configurations have been validated. 0 if the networks
+ *         do not have the same layers.
+ */
+static int validate_fspt_shared(char *datacfg, int n_cfg, char **cfgfiles,
+        char **weightfiles, int n_yolo_thresh, float *yolo_threshs,
+        int n_fspt_thresh, float *fspt_threshs, float hier_thresh,
+        float iou_thresh, int ngpus, int *gpus, int ordered,
+        int start, int end, int print_stats_val, char **outfiles,
+        validation_data ***out_val_datas) {
+#ifdef GPU
+    if (ngpus > 0)
+        cuda_set_device(gpus[0]);
+#endif
+    size_t n_nets = n_cfg > 0 ? (size_t) n_cfg : 0;
+    network **nets = calloc(n_nets, sizeof(network *));
+    network *net = load_network(cfgfiles[0], weightfiles[0], 1);
+    fuse_network(net);
+    nets[0] = net;
+    /* the backbone layers must be the same */
+    int same_layers = 1;
+    for (int cfg = 1; cfg < n_cfg && same_layers; ++cfg) {
+        nets[cfg] = parse_network_view_cfg(net, cfgfiles[cfg]);
+        same_layers = nets[cfg] != NULL;
+        if (same_layers && weightfiles[cfg] && weightfiles[cfg][0])
+            load_fspt_weights(nets[cfg], weightfiles[cfg]);
+    }
+    if (!same_layers) {
+        fprintf(stderr,
+                "The configurations do not share the same layers.\n");
+        for (int cfg = 1; cfg < n_cfg; ++cfg)
+            if (nets[cfg]) free_network_view(nets[cfg]);
+        free_network(net);
+        free(nets);
+        return 0;
+    }
+    list *options = read_data_cfg(datacfg);
+    char *valid_images = option_find_str(options, "valid", "data/valid.list");
+    char *name_list = option_find_str(options, "names", "data/names.list");
+    char **names = get_labels(name_list);
+    char *mapf = option_find_str(options, "map", 0);
+    int *map = 0;
+    if (mapf) map = read_map(mapf);
+
+    int imgs = net->batch * net->subdivisions;
+    data val, buffer;
+
+    list *plist = get_paths(valid_images);
+    char **paths = (char **)list_to_array(plist);
+
+    layer l = net->layers[0];
+    for (int i = 0; i < net->n; ++i) {
+        l = net->layers[i];
+        if (l.type == FSPT || l.type == YOLO)
+            break;
+    }
+    if (l.type != FSPT && l.type != YOLO)
+        error("The net must have fspt or yolo layers");
+
+    int classes = l.classes;
+
+    double start_time = what_time_is_it_now();
+
+    float nms = .45;
+
+    load_args args = {0};
+    args.w = net->w;
+    args.h = net->h;
+    args.coords = l.coords;
+    args.paths = paths;
+    args.n = imgs;
+    args.classes = classes;
+    args.jitter = 0;
+    args.num_boxes = l.max_boxes;
+    args.d = &buffer;
+    args.type = DETECTION_DATA;
+    args.threads = N_CORES;
+    args.ordered = ordered;
+    args.beg = (0 <= start && start < plist->size) ? start : 0;
+    args.m = (end && args.beg < end && end < plist->size) ?
+        end : plist->size;
+
+    if (ordered) {
+        net->max_batches = args.m / imgs;
+    }
+
+    int n_thresh = n_yolo_thresh * n_fspt_thresh;
+    for (int cfg = 0; cfg < n_cfg; ++cfg) {
+        out_val_datas[cfg] = calloc(n_thresh, sizeof(validation_data *));
+        for (int i = 0; i < n_yolo_thresh; ++i) {
+            for (int j = 0; j < n_fspt_thresh; ++j) {
+                int index = i * n_fspt_thresh + j;
+                validation_data *val_data =
+                    allocate_validation_data(classes, names);
+                val_data->n_images = net->max_batches * imgs;
+                val_data->classes = classes;
+                val_data->iou_thresh = iou_thresh;
+                val_data->fspt_thresh = fspt_threshs[j];
+                out_val_datas[cfg][index] = val_data;
+            }
+        }
+    }
+
+    pthread_t load_thread = load_data(args);
+    double time;
+    while (get_current_batch(net) < net->max_batches) {
+        time=what_time_is_it_now();
+        pthread_join(load_thread, 0);
+        val = buffer;
+        args.beg = *net->seen;
+        if (get_current_batch(net) < net->max_batches - 1)
+            load_thread = load_data(args);
+        fprintf(stderr, "Loaded: %lf seconds\n", what_time_is_it_now()-time);
+        time=what_time_is_it_now();
+        validate_network_fspt(net, val);
+        /* every configuration reads the same forward pass */
+        pthread_t *threads = calloc(n_nets * n_thresh, sizeof(pthread_t));
+        for (int cfg = 0; cfg < n_cfg; ++cfg) {
+            for (int i = 0; i < n_yolo_thresh; ++i) {
+                for (int j = 0; j < n_fspt_thresh; ++j) {
+                    int index = i * n_fspt_thresh + j;
+                    threads[cfg * n_thresh + index] =
+                        validate_in_thread(nets[cfg], yolo_threshs[i],
+                                fspt_threshs[j], hier_thresh, map, classes,
+                                nms, out_val_datas[cfg][index]);
+                }
+            }
+        }
+        for (int i = 0; i < n_cfg * n_thresh; ++i) {
+            pthread_join(threads[i], 0);
+        }
+        fprintf(stderr,
+                "%ld: %lf seconds, %ld images added to validation of %d configurations.\n",
+                get_current_batch(net), what_time_is_it_now()-time,
+                get_current_batch(net) * imgs, n_cfg);
+        free(threads);
+        free_data(val);
+    }
+    for (int cfg = 0; cfg < n_cfg; ++cfg) {
+        print_validation_outputs(nets[cfg], names, classes, n_yolo_thresh,
+                yolo_threshs, n_fspt_thresh, fspt_threshs, out_val_datas[cfg],
+                print_stats_val, outfiles ? outfiles[cfg] : NULL);
+    }
+
+    free_list_contents(options);
+    free_list(options);
+    free_ptrs((void **) names, classes);
+    for (int cfg = 1; cfg < n_cfg; ++cfg) free_network_view(nets[cfg]);
+    free_network(net);
+    free(nets);
+    free_ptrs((void **) paths, plist->size);
+    free_list(plist);
+
+    long t = 1000l * (what_time_is_it_now() - start_time);
+    fprintf(stderr, "Total Shared Validation Time : %ldh %ldm %lds %ldms.\n",
+            t / 1000 / 60 / 60,
+            t / 1000 / 60 % 60,
+            t / 1000 % 60,
+            t % 1000);
+    return 1;
+}
+
 static double validation_score(const validation_data *v_positif,
         const validation_data *v_negatif) {
     float false_positif_p =
@@ -1290,6 +1676,109 @@ static int cmp_val_cfg(const void *p1, const void *p2) {
         return v1.score < v2.score;
 }
 
+/**
+ * Computes the loosest criterion args of each fspt layer over the
+ * configuration files, if every configuration can be obtained by pruning
+ * fspts fitted with them (see nested_criterion_args).
+ *
+ * \param n_cfg The number of configuration files.
+ * \param cfgfiles The configuration files.
+ * \return The loosest criterion args of each fspt layer or NULL if the
+ *         configurations are not nested. Caller must free.
+ */
+static criterion_args *nested_loosest_criterion_args(int n_cfg,
+        char **cfgfiles) {
+    int old_gpu_index = gpu_index;
+    int n_fspt_layers = 0;
+    int nested = 1;
+    criterion_args *c_args = NULL;
+    int *n_input_layers = NULL;
+    int **input_layers = NULL;
+    for (int cfg = 0; cfg < n_cfg && nested; ++cfg) {
+        gpu_index = -1; // no gpu allocation needed for this net.
+        network *net = load_network(cfgfiles[cfg], NULL, 0);
+        gpu_index = old_gpu_index;
+        list *fspt_layers = get_network_layers_by_type(net, FSPT);
+        layer **fspt_layers_array = (layer **) list_to_array(fspt_layers);
+        if (cfg == 0) {
+            n_fspt_layers = fspt_layers->size;
+            c_args = calloc(n_cfg * n_fspt_layers, sizeof(criterion_args));
+            n_input_layers = calloc(n_fspt_layers, sizeof(int));
+            input_layers = calloc(n_fspt_layers, sizeof(int *));
+            for (int k = 0; k < n_fspt_layers; ++k) {
+                n_input_layers[k] = fspt_layers_array[k]->inputs;
+                input_layers[k] = copy_int_array(n_input_layers[k],
+                        fspt_layers_array[k]->input_layers);
+            }
+        }
+        nested &= fspt_layers->size == n_fspt_layers;
+        for (int k = 0; k < n_fspt_layers && nested; ++k) {
+            layer *l = fspt_layers_array[k];
+            nested &= l->inputs == n_input_layers[k]
+                && equals_int_array(l->inputs, l->input_layers,
+                        input_layers[k]);
+            c_args[k * n_cfg + cfg] = l->fspt_criterion_args;
+        }
+        free(fspt_layers_array);
+        free_list(fspt_layers);
+        gpu_index = -1; // no gpu space to free in this net.
+        free_network(net);
+        gpu_index = old_gpu_index;
+    }
+    criterion_args *loose = NULL;
+    if (nested) {
+        loose = calloc(n_fspt_layers, sizeof(criterion_args));
+        for (int k = 0; k < n_fspt_layers; ++k) {
+            loose[k] = loosest_criterion_args(n_cfg, c_args + k * n_cfg);
+            for (int cfg = 0; cfg < n_cfg; ++cfg) {
+                nested &= nested_criterion_args(loose + k,
+                        c_args + k * n_cfg + cfg);
+            }
+        }
+        if (!nested) {
+            free(loose);
+            loose = NULL;
+        }
+    }
+    free(c_args);
+    free(n_input_layers);
+    free_ptrs((void **) input_layers, n_fspt_layers);
+    return loose;
+}
+
+/**
+ * Sorts the validation configurations of the configuration file cfg by
+ * score and prints them in <outfile>_cfg<cfg>_resume and outfile_json.
+ *
+ * \param val_cfgs All the validation configurations.
+ * \param cfg The configuration file number.
+ * \param n_thresh The number of validation configurations per
+ *                 configuration file.
+ */
+static void print_validation_cfg_resume(validation_cfg *val_cfgs, int cfg,
+        int n_thresh, char *outfile, char *outfile_json) {
+    /* Print resume for this configuration */
+    int beg = cfg * n_thresh;
+    qsort(val_cfgs + beg, n_thresh, sizeof(validation_cfg), cmp_val_cfg);
+    char outfile_resume[512] = {0};
+    sprintf(outfile_resume, "%s_cfg%d_resume", outfile, cfg);
+    FILE *f = fopen(outfile_resume, "w");
+    for (int i = beg; i < beg + n_thresh; ++i) {
+        char title[512] = {0};
+        sprintf(title,
+                "Configuration number %d - fspt thresh %f, yolo thresh %f",
+                i - beg, val_cfgs[i].fspt_thresh, val_cfgs[i].yolo_thresh);
+        print_validation_cfg(f, val_cfgs + i, title);
+    }
+    fclose(f);
+    /* Print json for this configuration */
+    FILE *fjson = fopen(outfile_json, "a");
+    for (int i = beg; i < beg + n_thresh; ++i) {
+        print_json_validation_cfg(fjson, val_cfgs + i, 1);
+    }
+    fclose(fjson);
+}
+
 static void validate_multiple_cfg(char *datacfg_positif, char *datacfg_negatif,
         int n_cfg, char **cfgfiles,
         char *weightfile, char *save_weightfile,
@@ -1297,7 +1786,8 @@ static void validate_multiple_cfg(char *datacfg_positif, char *datacfg_negatif,
         int n_fspt_threshs, float *fspt_threshs, float hier_thresh,
         float iou_thresh, int ngpus, int *gpus, int ordered,
         int start, int end, int one_thread, int auto_only,
-        int print_stats_val, char *outfile) {
+        int nested_pruning, int shared_forward, int print_stats_val,
+        char *outfile) {
 
     validation_cfg *val_cfgs =
         calloc(n_cfg * n_yolo_threshs * n_fspt_threshs, sizeof(validation_cfg));
@@ -1310,6 +1800,29 @@ static void validate_multiple_cfg(char *datacfg_positif, char *datacfg_negatif,
     /* Partial json file */
     char outfile_json[512] = {0};
     sprintf(outfile_json, "%s_part.json", outfile);
+    /* Nested pruning : fit once with the loosest stopping rules */
+    char loose_weightfile[512] = {0};
+    if (nested_pruning) {
+        criterion_args *loose_c_args =
+            nested_loosest_criterion_args(n_cfg, cfgfiles);
+        if (loose_c_args) {
+            fprintf(stderr,
+                    "\nFit once with the loosest stopping rules.\n");
+            char outfile_fit[512] = {0};
+            sprintf(outfile_fit, "%s_loose_fit", outfile);
+            sprintf(loose_weightfile, "%s_loose", save_weightfile);
+            train_fspt(datacfg_positif, cfgfiles[0], weightfile, outfile_fit,
+                    loose_weightfile, gpus, ngpus, 1, 1, ordered, start,
+                    end, one_thread, 0, 0, 0, 0, print_stats_val, NULL, NULL,
+                    NULL, loose_c_args);
+            free(loose_c_args);
+        } else {
+            fprintf(stderr,
+                    "The configurations differ by more than stopping rules. \
+Each configuration is refitted.\n");
+            nested_pruning = 0;
+        }
+    }
 
     for (int cfg = 0; cfg < n_cfg; ++cfg) {
         char *cfgfile = cfgfiles[cfg];
@@ -1322,7 +1835,7 @@ static void validate_multiple_cfg(char *datacfg_positif, char *datacfg_negatif,
         list *fspt_layers = get_network_layers_by_type(net, FSPT);
         layer **fspt_layers_array = (layer **) list_to_array(fspt_layers);
         int n_fspt_layers = fspt_layers->size;
-        if (auto_only) {
+        if (auto_only && !nested_pruning) {
             /* Try to find a weightfile that was similar to avoid refitting. */
             for (int prev_cfg = 0; prev_cfg < cfg; ++prev_cfg) {
                 validation_cfg val_cfg =
@@ -1397,44 +1910,56 @@ static void validate_multiple_cfg(char *datacfg_positif, char *datacfg_negatif,
             }
         }
         /* Refit */
-        fprintf(stderr, "Using weightfile : %s.\n", similar_weightfile);
+        if (!nested_pruning)
+            fprintf(stderr, "Using weightfile : %s.\n", similar_weightfile);
         char outfile_fit[512] = {0};
         sprintf(outfile_fit, "%s_cfg%d_fit", outfile, cfg);
         char save_weightfile2[512] = {0};
         sprintf(save_weightfile2, "%s_cfg%d", save_weightfile, cfg);
         criterion_args *c_args;
         score_args *s_args;
-        train_fspt(datacfg_positif, cfgfile, similar_weightfile, outfile_fit,
-                save_weightfile2, gpus, ngpus, 1, 1, ordered, start,
-                end, one_thread, 0,
-                (auto_only && (similar_weightfile != weightfile)), 0, 0,
-                print_stats_val, &c_args,
-                &s_args);
+        if (nested_pruning) {
+            fprintf(stderr, "Prune weightfile : %s.\n", loose_weightfile);
+            prune_fspt(datacfg_positif, cfgfile, loose_weightfile,
+                    save_weightfile2, &c_args, &s_args);
+        } else {
+            train_fspt(datacfg_positif, cfgfile, similar_weightfile,
+                    outfile_fit, save_weightfile2, gpus, ngpus, 1, 1, ordered,
+                    start, end, one_thread, 0,
+                    (auto_only && (similar_weightfile != weightfile)), 0, 0,
+                    print_stats_val, NULL, &c_args,
+                    &s_args, NULL);
+        }
 
         char outfile_val_positif[512] = {0};
         sprintf(outfile_val_positif, "%s_cfg%d_val_positif", outfile, cfg);
         char outfile_val_negatif[512] = {0};
         sprintf(outfile_val_negatif, "%s_cfg%d_val_negatif", outfile, cfg);
-        validation_data **val_datas_positif;
-        validation_data **val_datas_negatif;
-        validate_fspt(datacfg_positif, cfgfile, save_weightfile2,
-                n_yolo_threshs,
-                yolo_threshs, n_fspt_threshs, fspt_threshs, hier_thresh,
-                iou_thresh, ngpus, gpus, ordered, start, end, print_stats_val,
-                outfile_val_positif, &val_datas_positif);
-        validate_fspt(datacfg_negatif, cfgfile, save_weightfile2,
-                n_yolo_threshs,
-                yolo_threshs, n_fspt_threshs, fspt_threshs, hier_thresh,
-                iou_thresh, ngpus, gpus, ordered, start, end, print_stats_val,
-                outfile_val_negatif, &val_datas_negatif);
+        validation_data **val_datas_positif = NULL;
+        validation_data **val_datas_negatif = NULL;
+        if (!shared_forward) {
+            validate_fspt(datacfg_positif, cfgfile, save_weightfile2,
+                    n_yolo_threshs,
+                    yolo_threshs, n_fspt_threshs, fspt_threshs, hier_thresh,
+                    iou_thresh, ngpus, gpus, ordered, start, end,
+                    print_stats_val, outfile_val_positif, &val_datas_positif);
+            validate_fspt(datacfg_negatif, cfgfile, save_weightfile2,
+                    n_yolo_threshs,
+                    yolo_threshs, n_fspt_threshs, fspt_threshs, hier_thresh,
+                    iou_thresh, ngpus, gpus, ordered, start, end,
+                    print_stats_val, outfile_val_negatif, &val_datas_negatif);
+        }
 
         fprintf(stderr, "Updata validation configuration %d.\n", cfg);
 
         for (int i = 0; i < n_yolo_threshs; ++i) {
             for (int j = 0; j < n_fspt_threshs; ++j) {
                 int index = i * n_fspt_threshs + j;
-                validation_data *val_data_positif = val_datas_positif[index];
-                validation_data *val_data_negatif = val_datas_negatif[index];
+                /* filled after the shared validation if shared_forward */
+                validation_data *val_data_positif =
+                    val_datas_positif ? val_datas_positif[index] : NULL;
+                validation_data *val_data_negatif =
+                    val_datas_negatif ? val_datas_negatif[index] : NULL;
                 float fspt_thresh = fspt_threshs[j];
                 float yolo_thresh = yolo_threshs[i];
                 validation_cfg val_cfg = {0};
@@ -1470,8 +1995,10 @@ static void validate_multiple_cfg(char *datacfg_positif, char *datacfg_negatif,
                         copy_int_array(l->inputs, l->input_layers);
                 }
 
-                val_cfg.score =
-                    validation_score(val_data_positif, val_data_negatif);
+                if (!shared_forward) {
+                    val_cfg.score =
+                        validation_score(val_data_positif, val_data_negatif);
+                }
 
                 int bigindex = cfg * n_fspt_threshs * n_yolo_threshs + index;
                 val_cfgs[bigindex] = val_cfg;
@@ -1479,27 +2006,10 @@ static void validate_multiple_cfg(char *datacfg_positif, char *datacfg_negatif,
         }
         free(fspt_layers_array);
         free_list(fspt_layers);
-        /* Print resume for this configuration */
-        int beg = cfg * n_fspt_threshs * n_yolo_threshs;
-        qsort(val_cfgs + beg, n_yolo_threshs * n_fspt_threshs,
-                sizeof(validation_cfg), cmp_val_cfg);
-        char outfile_resume[512] = {0};
-        sprintf(outfile_resume, "%s_cfg%d_resume", outfile, cfg);
-        FILE *f = fopen(outfile_resume, "w");
-        for (int i = beg; i < beg + n_yolo_threshs * n_fspt_threshs; ++i) { 
-            char title[512] = {0};
-            sprintf(title,
-                    "Configuration number %d - fspt thresh %f, yolo thresh %f",
-                    i - beg, val_cfgs[i].fspt_thresh, val_cfgs[i].yolo_thresh);
-            print_validation_cfg(f, val_cfgs + i, title);       
-        }
-        fclose(f);
-        /* Print json for this configuration */
-        FILE *fjson = fopen(outfile_json, "a");
-        for (int i = beg; i < beg + n_yolo_threshs * n_fspt_threshs; ++i) { 
-            print_json_validation_cfg(fjson, val_cfgs + i, 1);       
+        if (!shared_forward) {
+            print_validation_cfg_resume(val_cfgs, cfg,
+                    n_yolo_threshs * n_fspt_threshs, outfile, outfile_json);
         }
-        fclose(fjson);
         /* Free configuration */
         fprintf(stderr, "Free network configuration %d.\n", cfg);
         free(val_datas_positif);
@@ -1509,6 +2019,69 @@ static void validate_multiple_cfg(char *datacfg_positif, char *datacfg_negatif,
         free_network(net);
         gpu_index = old_gpu_index;
     }
+    /* Validation of all the configurations with a shared forward pass */
+    if (shared_forward) {
+        int n_thresh = n_yolo_threshs * n_fspt_threshs;
+        size_t n_nets = n_cfg > 0 ? (size_t) n_cfg : 0;
+        char **weightfiles = calloc(n_nets, sizeof(char *));
+        char **outfiles_positif = calloc(n_nets, sizeof(char *));
+        char **outfiles_negatif = calloc(n_nets, sizeof(char *));
+        for (int cfg = 0; cfg < n_cfg; ++cfg) {
+            weightfiles[cfg] = val_cfgs[cfg * n_thresh].weightfile;
+            outfiles_positif[cfg] =
+                val_cfgs[cfg * n_thresh].outfile_val_positif;
+            outfiles_negatif[cfg] =
+                val_cfgs[cfg * n_thresh].outfile_val_negatif;
+        }
+        validation_data ***val_datas_positif =
+            calloc(n_nets, sizeof(validation_data **));
+        validation_data ***val_datas_negatif =
+            calloc(n_nets, sizeof(validation_data **));
+        fprintf(stderr, "\nShared validation of %d configurations.\n", n_cfg);
+        int shared_positif = validate_fspt_shared(datacfg_positif, n_cfg,
+                cfgfiles, weightfiles, n_yolo_threshs, yolo_threshs,
+                n_fspt_threshs, fspt_threshs, hier_thresh, iou_thresh, ngpus,
+                gpus, ordered, start, end, print_stats_val, outfiles_positif,
+                val_datas_positif);
+        int shared_negatif = shared_positif
+            && validate_fspt_shared(datacfg_negatif, n_cfg, cfgfiles,
+                    weightfiles, n_yolo_threshs, yolo_threshs, n_fspt_threshs,
+                    fspt_threshs, hier_thresh, iou_thresh, ngpus, gpus,
+                    ordered, start, end, print_stats_val, outfiles_negatif,
+                    val_datas_negatif);
+        for (int cfg = 0; cfg < n_cfg; ++cfg) {
+            if (!shared_positif) {
+                validate_fspt(datacfg_positif, cfgfiles[cfg],
+                        weightfiles[cfg], n_yolo_threshs, yolo_threshs,
+                        n_fspt_threshs, fspt_threshs, hier_thresh, iou_thresh,
+                        ngpus, gpus, ordered, start, end, print_stats_val,
+                        outfiles_positif[cfg], val_datas_positif + cfg);
+            }
+            if (!shared_negatif) {
+                validate_fspt(datacfg_negatif, cfgfiles[cfg],
+                        weightfiles[cfg], n_yolo_threshs, yolo_threshs,
+                        n_fspt_threshs, fspt_threshs, hier_thresh, iou_thresh,
+                        ngpus, gpus, ordered, start, end, print_stats_val,
+                        outfiles_negatif[cfg], val_datas_negatif + cfg);
+            }
+            for (int index = 0; index < n_thresh; ++index) {
+                validation_cfg *val_cfg = val_cfgs + cfg * n_thresh + index;
+                val_cfg->val_data_positif = val_datas_positif[cfg][index];
+                val_cfg->val_data_negatif = val_datas_negatif[cfg][index];
+                val_cfg->score = validation_score(val_cfg->val_data_positif,
+                        val_cfg->val_data_negatif);
+            }
+            print_validation_cfg_resume(val_cfgs, cfg, n_thresh, outfile,
+                    outfile_json);
+            free(val_datas_positif[cfg]);
+            free(val_datas_negatif[cfg]);
+        }
+        free(val_datas_positif);
+        free(val_datas_negatif);
+        free(weightfiles);
+        free(outfiles_positif);
+        free(outfiles_negatif);
+    }
     /* Resume */
     qsort(val_cfgs, n_cfg * n_yolo_threshs * n_fspt_threshs,
             sizeof(validation_cfg), cmp_val_cfg);
@@ -1539,7 +2112,8 @@ static void validate_multiple_cfg(char *datacfg_positif, char *datacfg_negatif,
 void run_fspt(int argc, char **argv) {
     if(argc < 4) {
         fprintf(stderr,
-"usage: %s %s <train/test/valid> <datacfg> <netcfg> [weights]\n\
+"usage: %s %s <train/test/valid/stats/simplify/prune/merge> <datacfg> <netcfg>\n\
+                                                    [weights]\n\
                                                     [inputfile] [options]\n\
    or: %s %s <valid_multiple> <netcfgs> [weights] -pos <negconf>\n\
                                                  -neg <posconf> [options]\n\
@@ -1549,6 +2123,13 @@ With :\n\
     valid -> validate fspt.\n\
     valid_multiple -> validate multiple fspt configurations.\n\
     stats -> print statistics of the fspts.\n\
+    simplify -> collapse the fspt subtrees that take the same decision at\n\
+                the first -fspt_thresh (or whose scores differ by at most\n\
+                -tolerance) and save the weights.\n\
+    prune -> prune the fspts of [weights] with the stopping rules of\n\
+             <netcfg>, rescore them and save the weights.\n\
+    merge -> merge the shards extracted with train -shard and fit the\n\
+             fspts on the merged samples.\n\
 And :\n\
     <datacfg>   -> path to the data configuration file.\n\
     <negconf>   -> path to the data configuration file for negatif validation.\n\
@@ -1581,6 +2162,18 @@ Options are :\n\
     -only_score  -> if set, only scores the fspts.\n\
     -one_thread  -> if set, the fspts are fitted in only one thread instead of\n\
                     one thread per fspt.\n\
+    -tolerance   -> score tolerance for simplify. default 0.\n\
+    -shard       -> train only. Saves the extracted samples to this shard\n\
+                    file instead of fitting. Use with -start and -end to\n\
+                    split the extraction between processes.\n\
+    -shards      -> merge only. Comma separated shard files to merge.\n\
+    -dedup       -> merge only. If set, drops the duplicated samples.\n\
+    -nested_pruning -> valid_multiple only. If the configurations only\n\
+                    differ by stopping rules, fit once with the loosest\n\
+                    rules without merge_nodes and derive each\n\
+                    configuration by pruning, then merging the nodes.\n\
+    -shared_forward -> valid_multiple only. Validate all the configurations\n\
+                    with one forward pass of the network per image.\n\
     -fullscreen  -> unused.\n\
     -print_stats -> if set, print the statistics of the fspts after training.\n",
                 argv[0], argv[1], argv[0], argv[1]);
@@ -1610,6 +2203,12 @@ Options are :\n\
     int merge = find_arg(argc, argv, "-merge") || only_fit;
     int print_stats_val = find_arg(argc, argv, "-print_stats");
     int fullscreen = find_arg(argc, argv, "-fullscreen");
+    float tolerance = find_float_arg(argc, argv, "-tolerance", 0.);
+    int nested_pruning = find_arg(argc, argv, "-nested_pruning");
+    int shared_forward = find_arg(argc, argv, "-shared_forward");
+    char *shard_file = find_char_arg(argc, argv, "-shard", 0);
+    char *shard_list = find_char_arg(argc, argv, "-shards", 0);
+    int dedup = find_arg(argc, argv, "-dedup");
 
     /* gpus */
     int *gpus = 0;
@@ -1689,7 +2288,7 @@ Options are :\n\
                 ngpus, clear,
                 refit_fspts, ordered, start, end, one_thread, merge, auto_only,
                 only_fit,
-                only_score, print_stats_val, NULL, NULL);
+                only_score, print_stats_val, shard_file, NULL, NULL, NULL);
     else if(0==strcmp(argv[2], "valid"))
         validate_fspt(datacfg, cfg, weights, n_yolo_thresh, 
                 yolo_threshs, n_fspt_thresh, fspt_threshs,
@@ -1700,10 +2299,18 @@ Options are :\n\
                 save_weights_file, n_yolo_thresh, 
                 yolo_threshs, n_fspt_thresh, fspt_threshs,
                 hier_thresh, iou_thresh, ngpus, gpus, ordered, start, end,
-                one_thread, auto_only,
+                one_thread, auto_only, nested_pruning, shared_forward,
                 print_stats_val, outfile);
     else if (0 == strcmp(argv[2], "stats"))
         print_stats(datacfg, cfg, weights, outfile, export_score_file);
+    else if (0 == strcmp(argv[2], "simplify"))
+        simplify_fspt(datacfg, cfg, weights, save_weights_file,
+                *fspt_threshs, tolerance);
+    else if (0 == strcmp(argv[2], "prune"))
+        prune_fspt(datacfg, cfg, weights, save_weights_file, NULL, NULL);
+    else if (0 == strcmp(argv[2], "merge"))
+        merge_fspt(datacfg, cfg, weights, save_weights_file, shard_list,
+                dedup, refit_fspts, one_thread);
 
     if (gpus) free(gpus);
     free(fspt_threshs);
@@ -2,7 +2,9 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
+#include <pthread.h>
 
 #include "distance_to_boundary.h"
 #include "list.h"
@@ -10,9 +12,21 @@
 #include "utils.h"
 #include "fspt.h"
 #include "fspt_criterion.h"
+#include "fspt_layer.h"
+#include "fspt_reduction.h"
 #include "fspt_score.h"
+#include "activations.h"
+#include "blas.h"
+#include "connected_layer.h"
+#include "convolutional_layer.h"
+#include "gemm.h"
+#include "gemm_int8.h"
 #include "gini_utils.h"
+#include "mapped_weights.h"
 #include "kolmogorov_smirnov_dist.h"
+#include "profiler.h"
+#include "quantize.h"
+#include "rand_stream.h"
 
 static int eq_float_array(int n, const float *X, const float *Y) {
     for (int i = 0; i < n; ++i) {
@@ -27,6 +41,12 @@ static double acc_int(const void *a) {
     return *pa;
 }
 
+static int cmp_score_vol_n_desc(const void *a, const void *b) {
+    double sa = ((score_vol_n *) a)->score;
+    double sb = ((score_vol_n *) b)->score;
+    return (sa < sb) - (sa > sb);
+}
+
 static int eq_nodes(fspt_node a, fspt_node b) {
     int eq = 1;
     eq &= (a.type == b.type);
@@ -86,6 +106,11 @@ static int eq_fspts(fspt_t a, fspt_t b) {
 }
 
 
+static void *first_of_thread_stream(void *out) {
+    *(uint64_t *) out = rand_stream_next(thread_rand_stream());
+    return 0;
+}
+
 static void print_size_t_array(int lines, int col, size_t *X) {
     for (int i = 0; i < lines; ++i) {
         for (int j = 0; j < col; ++j) {
@@ -242,7 +267,8 @@ void uni_test() {
         fprintf(stderr, "sizeof(fspt_node) = %ld\n", sizeof(fspt_node));
 
         /* load */
-        fspt_t *fspt_loaded = make_fspt(2, feat_lim2, feat_imp2, NULL, NULL);
+        fspt_t *fspt_loaded = make_fspt(2, copy_float_array(4, feat_lim2),
+                copy_float_array(2, feat_imp2), NULL, NULL);
         fspt_load(filename, fspt_loaded, 1, 1, 1, 1, &succ);
         print_fspt(fspt_loaded);
 
@@ -429,6 +455,40 @@ void uni_test() {
         }
     }
 
+    /* binomial tails against the direct sum */
+    {
+        double s_tab[] = {0.01, 0.3, 0.5, 0.93};
+        for (int n = 1; n < 60; n += 7) {
+            for (int t = 0; t < 4; ++t) {
+                long double s = s_tab[t];
+                for (int from = 0; from <= n; from += 3) {
+                    for (int to = from; to <= n; to += 5) {
+                        long double p = 0.;
+                        for (int i = from; i <= to; ++i)
+                            p += expl(log_binomial(n, i)) * powl(s, i)
+                                * powl(1. - s, n - i);
+                        long double q = binomial_range_proba(n, from, to, s);
+                        if (fabsl(p - q) > 1e-12) {
+                            fprintf(stderr,
+                                    "BINOMIAL RANGE n=%d [%d, %d] s=%Lg : %Lg instead of %Lg\n",
+                                    n, from, to, s, q, p);
+                            error("UNI-TEST FAILED");
+                        }
+                    }
+                }
+            }
+        }
+        /* large n : the median of B(n, 1/2) is n/2 */
+        int n = 4000000;
+        long double p = binomial_range_proba(n, 0, n / 2, 0.5);
+        long double q = binomial_range_proba(n, n / 2 + 1, n, 0.5);
+        if (fabsl(p + q - 1.) > 1e-9 || p < 0.5 || p > 0.501) {
+            fprintf(stderr, "BINOMIAL RANGE n=%d : %Lg + %Lg\n", n, p, q);
+            error("UNI-TEST FAILED");
+        }
+        fprintf(stderr, "BINOMIAL TESTS OK!\n");
+    }
+
     /***********************/
     /* Test uniformity     */
     /***********************/
@@ -488,6 +548,7 @@ void uni_test() {
         fspt_fit(n, rand_array, &c_args, &s_args, fspt);
         print_fspt(fspt);
 
+
         fspt_stats *stats = get_fspt_stats(fspt, 0, NULL, 1);
         print_fspt_criterion_args(stderr, &c_args, "FITTED FSPT STATS");
         print_fspt_score_args(stderr, &s_args, NULL);
@@ -497,6 +558,390 @@ void uni_test() {
         free_fspt(fspt);
     }
 
+    /***********************/
+    /* Test accept/simplify*/
+    /***********************/
+
+    {
+        float min = 0.f;
+        float max = 1.f;
+        int d = 2;
+        size_t n = 4000;
+        /* two clusters and a uniform background */
+        float *X = malloc(n * d * sizeof(float));
+        for (size_t i = 0; i < n; ++i) {
+            float *x = X + i * d;
+            if (i % 4 == 0) {
+                x[0] = rand_uniform(min, max);
+                x[1] = rand_uniform(min, max);
+            } else if (i % 4 == 1) {
+                x[0] = rand_uniform(0.7f, 0.8f);
+                x[1] = rand_uniform(0.1f, 0.3f);
+            } else {
+                x[0] = rand_uniform(0.2f, 0.25f);
+                x[1] = rand_uniform(0.6f, 0.9f);
+            }
+        }
+        float *lim = malloc(2 * d * sizeof(float));
+        for (int i = 0; i < d; ++i) {
+            lim[2*i] = min;
+            lim[2*i + 1] = max;
+        }
+        fspt_t *fspt = make_fspt(d, lim, NULL,
+                gini_criterion, auto_normalized_density_score);
+        criterion_args c_args = {0};
+        c_args.fspt = fspt;
+        c_args.max_tries_p = 1.f;
+        c_args.max_features_p = 1.f;
+        c_args.gini_gain_thresh = 0.01f;
+        c_args.max_depth = 30;
+        c_args.min_samples = 5;
+        c_args.min_volume_p = 0.;
+        c_args.min_length_p = 0.;
+        c_args.merge_nodes = 0;
+        c_args.max_consecutive_gain_violations = 5;
+        c_args.middle_split = 1;
+        score_args s_args = {0};
+        s_args.calibration_score = 0.5;
+        s_args.calibration_n_samples_p = 0.75;
+        s_args.calibration_volume_p = 0.05;
+        s_args.samples_p = 0.8;
+        s_args.auto_calibration_score = 0.8;
+        fspt_fit(n, X, &c_args, &s_args, fspt);
+        fprintf(stderr, "fitted fspt: %zu nodes, depth %d.\n",
+                fspt->n_nodes, fspt->depth);
+
+        /* every node is examined once by the criterion */
+        size_t n_examined = 0;
+        for (int i = 0; i < FSPT_PROFILE_MAX_DEPTH; ++i)
+            n_examined += fspt->profile.nodes_per_depth[i];
+        print_fspt_fit_profile(stderr, &fspt->profile);
+        if (n_examined != fspt->n_nodes
+                || fspt->profile.nodes_per_depth[fspt->depth - 1] == 0
+                || fspt->profile.bytes_allocated == 0
+                || fspt->profile.total_time < fspt->profile.split_time) {
+            fprintf(stderr, "FSPT_PROFILE FAILED: %zu nodes examined.\n",
+                    n_examined);
+            error("UNI-TEST FAILED");
+        }
+        fprintf(stderr, "FSPT_PROFILE TESTS OK!\n");
+
+        size_t n_test = 1000;
+        float *X_test = malloc(n_test * d * sizeof(float));
+        for (size_t i = 0; i < n_test * d; ++i)
+            X_test[i] = rand_uniform(min, max);
+        float *Y_test = malloc(n_test * sizeof(float));
+        float *Y_bound = malloc(n_test * sizeof(float));
+        int *accept = malloc(n_test * sizeof(int));
+        fspt_predict(n_test, fspt, X_test, Y_test);
+        float thresholds[] = {0.f, 0.2f, 0.5f, 0.8f, 1.f};
+        for (int t = 0; t < 5; ++t) {
+            float thresh = thresholds[t];
+            fspt_accept(n_test, fspt, X_test, thresh, accept, Y_bound);
+            for (size_t i = 0; i < n_test; ++i) {
+                if (accept[i] != (Y_test[i] >= thresh)
+                        || (accept[i] && Y_bound[i] > Y_test[i])
+                        || (!accept[i] && Y_bound[i] < Y_test[i])) {
+                    fprintf(stderr,
+                            "FSPT_ACCEPT FAILED: thresh = %f, score = %f, accept = %d, bound = %f\n",
+                            thresh, Y_test[i], accept[i], Y_bound[i]);
+                    error("UNI-TEST FAILED");
+                }
+            }
+        }
+        fprintf(stderr, "FSPT_ACCEPT TESTS OK!\n");
+
+        /* simplification must keep the decisions at thresh */
+        float thresh = 0.5f;
+        size_t n_nodes = fspt->n_nodes;
+        /* simplifying a copy leaves the fspt whole */
+        fspt_t copy = *fspt;
+        fspt_copy_nodes(fspt, &copy);
+        size_t removed = fspt_simplify(&copy, thresh, 0.);
+        list *whole = fspt_nodes_to_list(fspt, PRE_ORDER);
+        if (!removed || fspt->n_nodes != n_nodes
+                || (size_t) whole->size != n_nodes) {
+            fprintf(stderr, "FSPT_SIMPLIFY FAILED: the copy changed the fspt\n");
+            error("UNI-TEST FAILED");
+        }
+        free_list(whole);
+        free_fspt_nodes(copy.root);
+        removed = fspt_simplify(fspt, thresh, 0.);
+        fprintf(stderr, "fspt_simplify removed %zu nodes out of %zu.\n",
+                removed, n_nodes);
+        if (fspt->n_nodes + removed != n_nodes) {
+            fprintf(stderr, "FSPT_SIMPLIFY FAILED: n_nodes = %zu\n",
+                    fspt->n_nodes);
+            error("UNI-TEST FAILED");
+        }
+        fspt_predict(n_test, fspt, X_test, Y_bound);
+        for (size_t i = 0; i < n_test; ++i) {
+            if ((Y_bound[i] >= thresh) != (Y_test[i] >= thresh)) {
+                fprintf(stderr,
+                        "FSPT_SIMPLIFY FAILED: score = %f instead of %f\n",
+                        Y_bound[i], Y_test[i]);
+                error("UNI-TEST FAILED");
+            }
+        }
+        free(accept);
+        free(Y_bound);
+        free(Y_test);
+        free(X_test);
+        fspt_stats *stats = get_fspt_stats(fspt, 0, NULL, 1);
+        print_fspt_stats(stderr, stats, "SIMPLIFIED FSPT STATS");
+        free_fspt_stats(stats);
+        fprintf(stderr, "FSPT_SIMPLIFY TESTS OK!\n");
+
+        /* pruning with the fitting rules removes nothing */
+        free_fspt_nodes(fspt->root);
+        fspt_fit(n, X, &c_args, &s_args, fspt);
+        n_nodes = fspt->n_nodes;
+        criterion_args same_c_args = c_args;
+        removed = fspt_prune(fspt, &same_c_args);
+        if (removed || fspt->n_nodes != n_nodes) {
+            fprintf(stderr, "FSPT_PRUNE FAILED: %zu nodes removed.\n",
+                    removed);
+            error("UNI-TEST FAILED");
+        }
+        /* pruning an unmerged fspt with merge_nodes merges it like a fit */
+        criterion_args merge_c_args = c_args;
+        merge_c_args.merge_nodes = 1;
+        fspt_t merged = *fspt;
+        merged.root = NULL;
+        fspt_fit(n, X, &merge_c_args, &s_args, &merged);
+        fspt_t pruned = *fspt;
+        fspt_copy_nodes(fspt, &pruned);
+        criterion_args prune_merge_c_args = merge_c_args;
+        removed = fspt_prune(&pruned, &prune_merge_c_args);
+        fprintf(stderr, "fspt_prune merged %zu nodes out of %zu.\n",
+                removed, n_nodes);
+        if (!removed || pruned.n_nodes != merged.n_nodes
+                || pruned.depth != merged.depth
+                || nested_criterion_args(&merge_c_args, &c_args)
+                || !nested_criterion_args(&c_args, &merge_c_args)) {
+            fprintf(stderr, "FSPT_PRUNE FAILED: %zu nodes after the merge \
+instead of %zu.\n", pruned.n_nodes, merged.n_nodes);
+            error("UNI-TEST FAILED");
+        }
+        free_fspt_nodes(pruned.root);
+        free_fspt_nodes(merged.root);
+        fspt_rescore(fspt, &s_args);
+        /* the gain threshold is ignored when the uniformity is always
+         * tested */
+        pruned = *fspt;
+        fspt_copy_nodes(fspt, &pruned);
+        criterion_args unf_c_args = c_args;
+        unf_c_args.uniformity_test_level = ALLWAYS_TEST_UNIFORMITY;
+        unf_c_args.gini_gain_thresh = 1.;
+        unf_c_args.max_consecutive_gain_violations = 0;
+        unf_c_args.count_max_count_hit = 0;
+        removed = fspt_prune(&pruned, &unf_c_args);
+        free_fspt_nodes(pruned.root);
+        if (removed || unf_c_args.count_max_count_hit) {
+            fprintf(stderr, "FSPT_PRUNE FAILED: %zu nodes removed by the gain.\n",
+                    removed);
+            error("UNI-TEST FAILED");
+        }
+        /* stricter rules */
+        criterion_args strict_c_args = c_args;
+        strict_c_args.max_depth = 6;
+        strict_c_args.min_samples = 20;
+        if (!nested_criterion_args(&c_args, &strict_c_args)
+                || nested_criterion_args(&strict_c_args, &c_args)) {
+            fprintf(stderr, "FSPT_PRUNE FAILED: nested criterion args.\n");
+            error("UNI-TEST FAILED");
+        }
+        removed = fspt_prune(fspt, &strict_c_args);
+        fspt_rescore(fspt, &s_args);
+        fprintf(stderr, "fspt_prune removed %zu nodes out of %zu, depth %d.\n",
+                removed, n_nodes, fspt->depth);
+        if (!removed || fspt->n_nodes + removed != n_nodes
+                || fspt->depth > strict_c_args.max_depth) {
+            fprintf(stderr, "FSPT_PRUNE FAILED: n_nodes = %zu, depth = %d\n",
+                    fspt->n_nodes, fspt->depth);
+            error("UNI-TEST FAILED");
+        }
+        list *nodes = fspt_nodes_to_list(fspt, PRE_ORDER);
+        fspt_node *leaf;
+        while ((leaf = (fspt_node *) list_pop(nodes))) {
+            if (leaf->type == LEAF
+                    && leaf->n_samples + leaf->n_empty
+                    < (size_t) strict_c_args.min_samples
+                    && leaf->parent
+                    && leaf->parent->n_samples + leaf->parent->n_empty
+                    < (size_t) 2 * strict_c_args.min_samples) {
+                fprintf(stderr, "FSPT_PRUNE FAILED: leaf with %zu samples.\n",
+                        leaf->n_samples);
+                error("UNI-TEST FAILED");
+            }
+        }
+        free_list(nodes);
+        fprintf(stderr, "FSPT_PRUNE TESTS OK!\n");
+
+        /* nodes saved by NODE_VERSION 3 load with their score bounds */
+        typedef struct {
+            FSPT_NODE_TYPE type;
+            int n_features;
+            struct fspt_t *fspt;
+            size_t n_empty;
+            size_t n_samples;
+            float *samples;
+            int split_feature;
+            float split_value;
+            struct fspt_node *right;
+            struct fspt_node *left;
+            struct fspt_node *parent;
+            int depth;
+            double score;
+            double volume;
+            double uniformity;
+            int count;
+            NON_SPLIT_CAUSE cause;
+        } node_v3;
+        char *v3_file = "backup/uni_test_node_v3.fspt";
+        FILE *fp = fopen(v3_file, "wb");
+        if (!fp) file_error(v3_file);
+        int succ = 1;
+        fspt_node *root = fspt->root;
+        fspt->root = NULL;
+        fspt_save_file(fp, *fspt, 0, &succ);
+        fspt->root = root;
+        fseek(fp, -(long) sizeof(int), SEEK_CUR);
+        int have_root = 1;
+        int version = 3;
+        size_t node_size = sizeof(node_v3);
+        fwrite(&have_root, sizeof(int), 1, fp);
+        fwrite(&version, sizeof(int), 1, fp);
+        fwrite(&node_size, sizeof(size_t), 1, fp);
+        fwrite(&fspt->n_nodes, sizeof(size_t), 1, fp);
+        nodes = fspt_nodes_to_list(fspt, PRE_ORDER);
+        fspt_node **saved = (fspt_node **) list_to_array(nodes);
+        for (int i = 0; i < nodes->size; ++i) {
+            fspt_node *node = saved[i];
+            node_v3 old = {node->type, node->n_features, NULL, node->n_empty,
+                node->n_samples, NULL, node->split_feature, node->split_value,
+                node->right, node->left, NULL, node->depth, node->score,
+                node->volume, node->uniformity, node->count, node->cause};
+            fwrite(&old, sizeof(node_v3), 1, fp);
+        }
+        fclose(fp);
+        fspt_t *migrated = calloc(1, sizeof(fspt_t));
+        fspt_load(v3_file, migrated, 0, 0, 0, 1, &succ);
+        list *migrated_nodes = fspt_nodes_to_list(migrated, PRE_ORDER);
+        fspt_node **loaded = (fspt_node **) list_to_array(migrated_nodes);
+        if (!succ || migrated_nodes->size != nodes->size) {
+            fprintf(stderr, "NODE MIGRATION FAILED: %d nodes loaded.\n",
+                    migrated_nodes->size);
+            error("UNI-TEST FAILED");
+        }
+        for (int i = 0; i < nodes->size; ++i) {
+            if (loaded[i]->min_score != saved[i]->min_score
+                    || loaded[i]->max_score != saved[i]->max_score
+                    || loaded[i]->score != saved[i]->score) {
+                fprintf(stderr, "NODE MIGRATION FAILED: bounds of node %d.\n",
+                        i);
+                error("UNI-TEST FAILED");
+            }
+        }
+        free(saved);
+        free(loaded);
+        free_list(nodes);
+        free_list(migrated_nodes);
+        free_fspt(migrated);
+        fprintf(stderr, "NODE MIGRATION TESTS OK!\n");
+
+        /* criterion args saved by CRITERION_ARGS_VERSION 6 get defaults */
+        typedef struct {
+            CRITERION_FUNCTION criterion_function;
+            int merge_nodes;
+            fspt_t *fspt;
+            fspt_node *node;
+            int max_depth;
+            size_t count_max_depth_hit;
+            int min_samples;
+            size_t count_min_samples_hit;
+            double min_volume_p;
+            size_t count_min_volume_p_hit;
+            double min_length_p;
+            size_t count_min_length_p_hit;
+            size_t count_max_count_hit;
+            size_t count_no_sample_hit;
+            size_t count_uniformity_hit;
+            int best_index;
+            float best_split;
+            int forbidden_split;
+            int increment_count;
+            int end_of_fitting;
+            float max_tries_p;
+            float max_features_p;
+            double gini_gain_thresh;
+            int max_consecutive_gain_violations;
+            int middle_split;
+            int multi_threads;
+            UNF_TEST_LEVEL uniformity_test_level;
+            float unf_alpha;
+        } criterion_args_v6;
+        char *c_v6_file = "backup/uni_test_criterion_v6.args";
+        fp = fopen(c_v6_file, "wb");
+        if (!fp) file_error(c_v6_file);
+        criterion_args_v6 c_v6 = {0};
+        c_v6.merge_nodes = 1;
+        c_v6.max_depth = c_args.max_depth;
+        c_v6.min_samples = c_args.min_samples;
+        c_v6.gini_gain_thresh = c_args.gini_gain_thresh;
+        c_v6.unf_alpha = 0.05f;
+        int contains_args = 1;
+        version = 6;
+        size_t args_size = sizeof(criterion_args_v6);
+        fwrite(&contains_args, sizeof(int), 1, fp);
+        fwrite(&version, sizeof(int), 1, fp);
+        fwrite(&args_size, sizeof(size_t), 1, fp);
+        fwrite(&c_v6, sizeof(criterion_args_v6), 1, fp);
+        fclose(fp);
+        fp = fopen(c_v6_file, "rb");
+        if (!fp) file_error(c_v6_file);
+        criterion_args *c_migrated = load_criterion_args_file(fp, &succ);
+        fclose(fp);
+        if (!succ || !c_migrated || !c_migrated->merge_nodes
+                || c_migrated->max_depth != c_args.max_depth
+                || c_migrated->min_samples != c_args.min_samples
+                || c_migrated->gini_gain_thresh != c_args.gini_gain_thresh
+                || c_migrated->unf_alpha != 0.05f
+                || c_migrated->sample_weight != 1.
+                || c_migrated->rng || c_migrated->profile) {
+            fprintf(stderr, "CRITERION ARGS MIGRATION FAILED.\n");
+            error("UNI-TEST FAILED");
+        }
+        free(c_migrated);
+        fprintf(stderr, "CRITERION ARGS MIGRATION TESTS OK!\n");
+
+        /* the score thread count stays out of the score args files */
+        char *s_args_file = "backup/uni_test_score.args";
+        fp = fopen(s_args_file, "wb");
+        if (!fp) file_error(s_args_file);
+        score_args threaded_s_args = s_args;
+        threaded_s_args.n_threads = 4;
+        save_score_args_file(fp, &threaded_s_args, &succ);
+        long saved_bytes = ftell(fp);
+        fclose(fp);
+        fp = fopen(s_args_file, "rb");
+        if (!fp) file_error(s_args_file);
+        score_args *s_loaded = load_score_args_file(fp, &succ);
+        fclose(fp);
+        if (!succ || !s_loaded || s_loaded->n_threads != 0
+                || !compare_score_args(s_loaded, &threaded_s_args)
+                || saved_bytes != (long) (2 * sizeof(int) + sizeof(size_t)
+                    + offsetof(score_args, n_threads))) {
+            fprintf(stderr, "SCORE ARGS FILE FAILED: %ld bytes saved.\n",
+                    saved_bytes);
+            error("UNI-TEST FAILED");
+        }
+        free(s_loaded);
+        fprintf(stderr, "SCORE ARGS FILE TESTS OK!\n");
+
+        free_fspt(fspt);
+    }
+
     /***********************/
     /* Test median & Co.   */
     /***********************/
@@ -549,6 +994,1391 @@ void uni_test() {
         free(bins);
     }
 
+    /***********************/
+    /* Test fspt seed      */
+    /***********************/
+
+    {
+        int d = 4;
+        size_t n = 3000;
+        float lim[] = {0.f, 1.f, 0.f, 1.f, 0.f, 1.f, 0.f, 1.f};
+        float *X = malloc(n * d * sizeof(float));
+        for (size_t i = 0; i < n * d; ++i) {
+            X[i] = (i % 3) ? rand_uniform(0.f, 1.f) : rand_uniform(.4f, .6f);
+        }
+        fspt_t *fspts[2];
+        criterion_args c_args[2] = {{0}};
+        score_args s_args[2] = {{0}};
+        for (int k = 0; k < 2; ++k) {
+            fspts[k] = make_fspt(d, copy_float_array(2 * d, lim), NULL,
+                    gini_criterion, auto_normalized_density_score);
+            c_args[k].max_tries_p = .3f;
+            c_args[k].max_features_p = .5f;
+            c_args[k].gini_gain_thresh = 0.01f;
+            c_args[k].max_depth = 12;
+            c_args[k].min_samples = 10;
+            c_args[k].max_consecutive_gain_violations = 2;
+            c_args[k].middle_split = 1;
+            c_args[k].unf_alpha = 0.5;
+            c_args[k].multi_threads = 1;
+            c_args[k].seed = 1234;
+            c_args[k].stream_id = 7;
+            s_args[k].calibration_score = 0.5;
+            s_args[k].calibration_n_samples_p = 0.75;
+            s_args[k].calibration_volume_p = 0.05;
+            s_args[k].samples_p = 0.8;
+            s_args[k].auto_calibration_score = 0.8;
+            /* the stream of the thread must not matter */
+            rand_uniform(0.f, 1.f);
+            fspt_fit(n, copy_float_array(n * d, X), c_args + k, s_args + k,
+                    fspts[k]);
+        }
+        if (!eq_fspts(*fspts[0], *fspts[1])) {
+            fprintf(stderr, "FSPT FITTED TWICE WITH THE SAME SEED DIFFER\n");
+            error("UNI-TEST FAILED");
+        }
+        /* the fspts own their samples */
+        for (int k = 0; k < 2; ++k) free_fspt(fspts[k]);
+        free(X);
+        fprintf(stderr, "FSPT_SEED TESTS OK!\n");
+    }
+
+    {
+        /* the caller and two lazily seeded threads get distinct streams */
+        set_rand_stream_global_seed(1234);
+        uint64_t first[3];
+        first[0] = rand_stream_next(thread_rand_stream());
+        for (int k = 1; k < 3; ++k) {
+            pthread_t thread;
+            pthread_create(&thread, 0, first_of_thread_stream, first + k);
+            pthread_join(thread, 0);
+        }
+        if (first[0] == first[1] || first[0] == first[2]
+                || first[1] == first[2]) {
+            fprintf(stderr, "THREADS SHARE A RANDOM STREAM\n");
+            error("UNI-TEST FAILED");
+        }
+        fprintf(stderr, "RAND_STREAM TESTS OK!\n");
+    }
+
+    /***********************/
+    /* Test gini gains     */
+    /***********************/
+
+    {
+        float bins[] = {0.5f, 0.25f, 0.05f};
+        size_t cdf[] = {2, 3, 1};
+        double gains[3];
+        double expected[] = {0., 0.125, -1.};
+        forbidden_split_cause cause = {0};
+        gini_gains(3, bins, cdf, 0.f, 1.f, 4, 4, 1., 1, 0.01, 0.1, gains,
+                &cause);
+        for (int i = 0; i < 3; ++i) {
+            if (fabs(gains[i] - expected[i]) > 1e-6) {
+                fprintf(stderr, "GINI GAIN %d = %f instead of %f\n", i,
+                        gains[i], expected[i]);
+                error("UNI-TEST FAILED");
+            }
+        }
+        if (cause.count_min_length_p_hit != 1 || cause.count_min_samples_hit
+                || cause.count_min_volume_p_hit) {
+            fprintf(stderr, "GINI GAIN CAUSES (%zu, %zu, %zu)\n",
+                    cause.count_min_samples_hit, cause.count_min_volume_p_hit,
+                    cause.count_min_length_p_hit);
+            error("UNI-TEST FAILED");
+        }
+        fprintf(stderr, "GINI GAINS TESTS OK!\n");
+    }
+
+    /***********************/
+    /* Test reduction      */
+    /***********************/
+
+    {
+        int d = 8;
+        size_t n = 2000;
+        float lim[16];
+        float imp[8];
+        for (int j = 0; j < d; ++j) {
+            lim[2*j] = -0.5f;
+            lim[2*j + 1] = 0.5f;
+            imp[j] = 1.f;
+        }
+        /* features 0, 1 and 5 vary, the others are nearly constant */
+        float *X = malloc(n * d * sizeof(float));
+        for (size_t i = 0; i < n; ++i) {
+            float *x = X + i * d;
+            for (int j = 0; j < d; ++j) x[j] = rand_uniform(-0.01f, 0.01f);
+            x[0] = rand_uniform(-0.5f, 0.5f);
+            x[1] = rand_uniform(-0.5f, 0.5f);
+            x[5] = 0.5f * (x[0] + x[1]);
+        }
+        REDUCTION_METHOD methods[] =
+            {VARIANCE_REDUCTION, PCA_REDUCTION, RANDOM_REDUCTION};
+        char *filename = "backup/uni_test_reduction.dat";
+        for (int m = 0; m < 3; ++m) {
+            int k = 3;
+            fspt_reduction *r = make_fspt_reduction(methods[m], d, k, 42, 0,
+                    lim, imp);
+            fspt_reduction_fit(r, n, X);
+            if (methods[m] == VARIANCE_REDUCTION) {
+                int found = 0;
+                for (int j = 0; j < k; ++j) {
+                    found += r->selected[j] == 0 || r->selected[j] == 1
+                        || r->selected[j] == 5;
+                }
+                if (found != k) {
+                    fprintf(stderr, "VARIANCE REDUCTION SELECTED %d, %d, %d\n",
+                            r->selected[0], r->selected[1], r->selected[2]);
+                    error("UNI-TEST FAILED");
+                }
+            }
+            /* reduced samples must be inside the reduced feature limit */
+            float *Y = malloc(n * k * sizeof(float));
+            fspt_reduction_forward(r, n, X, Y);
+            float *new_lim = fspt_reduction_feature_limit(r);
+            for (size_t i = 0; i < n * k; ++i) {
+                int j = i % k;
+                if (Y[i] < new_lim[2*j] - 1e-5 || Y[i] > new_lim[2*j+1] + 1e-5) {
+                    fprintf(stderr, "%s REDUCTION: %f not in [%f, %f]\n",
+                            reduction_method_to_string(methods[m]), Y[i],
+                            new_lim[2*j], new_lim[2*j+1]);
+                    error("UNI-TEST FAILED");
+                }
+            }
+            /* save / load */
+            int succ = 1;
+            FILE *fp = fopen(filename, "wb");
+            fspt_reduction_save_file(fp, r, &succ);
+            fclose(fp);
+            fspt_reduction *r_loaded = make_fspt_reduction(methods[m], d, k,
+                    0, 0, lim, imp);
+            fp = fopen(filename, "rb");
+            fspt_reduction_load_file(fp, r_loaded, &succ);
+            fclose(fp);
+            /* in place forward */
+            float *X_copy = copy_float_array(n * d, X);
+            fspt_reduction_forward(r_loaded, n, X_copy, X_copy);
+            if (!succ || !eq_float_array(n * k, Y, X_copy)) {
+                fprintf(stderr, "%s REDUCTION SAVE/LOAD FAILED\n",
+                        reduction_method_to_string(methods[m]));
+                error("UNI-TEST FAILED");
+            }
+            free(X_copy);
+            free(new_lim);
+            free(Y);
+            free_fspt_reduction(r_loaded);
+            free_fspt_reduction(r);
+        }
+        free(X);
+        fprintf(stderr, "REDUCTION TESTS OK!\n");
+    }
+
+    /***************************/
+    /* Test fspt shard merging */
+    /***************************/
+
+    {
+        float rows[] = {
+            1.f, 0.f,
+            0.f, 1.f,
+            0.f, 2.f,
+            0.f, 1.f,
+            -1.f, 3.f
+        };
+        float rows_sorted[] = {
+            -1.f, 3.f,
+            0.f, 1.f,
+            0.f, 1.f,
+            0.f, 2.f,
+            1.f, 0.f
+        };
+        qsort_float_rows(5, 2, rows);
+        if (!eq_float_array(2*5, rows, rows_sorted)) {
+            fprintf(stderr, "qsort_float_rows(5, 2, X) = \n");
+            print_array(5, 2, rows);
+            error("UNI-TEST FAILED");
+        }
+
+        char *filenames[] = {"backup/uni_test_shard_0.dat",
+            "backup/uni_test_shard_1.dat"};
+        float shard_0[] = {1.f, 0.f, 0.f, 1.f, 0.f, 1.f};
+        float shard_1[] = {0.f, 1.f, 2.f, 0.f};
+        float *shard_data[] = {shard_0, shard_1};
+        size_t shard_n[] = {3, 2};
+        size_t shard_seen[] = {6, 2};
+        for (int s = 0; s < 2; ++s) {
+            layer l = {0};
+            l.ref = "uni_test";
+            l.classes = 1;
+            l.total = 2;
+            l.fspt_training_data = &shard_data[s];
+            l.fspt_n_training_data = &shard_n[s];
+            l.fspt_n_seen_data = &shard_seen[s];
+            int succ = 1;
+            FILE *fp = fopen(filenames[s], "wb");
+            fspt_layer_save_shard_file(fp, l, &succ);
+            fclose(fp);
+            if (!succ) error("UNI-TEST FAILED");
+        }
+        float merged_sorted[] = {0.f, 1.f, 0.f, 1.f, 0.f, 1.f, 1.f, 0.f,
+            2.f, 0.f};
+        float merged_dedup[] = {0.f, 1.f, 1.f, 0.f, 2.f, 0.f};
+        for (int dedup = 0; dedup < 2; ++dedup) {
+            float *data = NULL;
+            size_t n = 0;
+            size_t n_max = 0;
+            size_t seen = 0;
+            layer l = {0};
+            l.ref = "uni_test";
+            l.classes = 1;
+            l.total = 2;
+            l.fspt_training_data = &data;
+            l.fspt_n_training_data = &n;
+            l.fspt_n_max_training_data = &n_max;
+            l.fspt_n_seen_data = &seen;
+            FILE *fps[2];
+            for (int s = 0; s < 2; ++s) fps[s] = fopen(filenames[s], "rb");
+            int succ = 1;
+            fspt_layer_merge_shard_files(l, 2, fps, dedup, &succ);
+            for (int s = 0; s < 2; ++s) fclose(fps[s]);
+            float *expected = dedup ? merged_dedup : merged_sorted;
+            size_t n_expected = dedup ? 3 : 5;
+            if (!succ || n != n_expected || seen != 8
+                    || !eq_float_array(2 * n, data, expected)) {
+                fprintf(stderr, "SHARD MERGE (dedup = %d) = \n", dedup);
+                print_array(n, 2, data);
+                error("UNI-TEST FAILED");
+            }
+            free(data);
+        }
+        fprintf(stderr, "SHARD TESTS OK!\n");
+    }
+
+    /**********************************/
+    /* Test fspt extraction sampling */
+    /**********************************/
+
+    {
+        FSPT_SAMPLING policies[] = {FSPT_SAMPLING_ALL,
+            FSPT_SAMPLING_RESERVOIR, FSPT_SAMPLING_STRATIFIED};
+        size_t n_seen = 10000;
+        size_t max_samples = 100;
+        for (int p = 0; p < 3; ++p) {
+            float *data = NULL;
+            int *strata = NULL;
+            size_t n = 0;
+            size_t n_max = 0;
+            size_t seen = 0;
+            size_t stratum_seen[3] = {0};
+            size_t stratum_kept[3] = {0};
+            float input[2];
+            layer l = {0};
+            l.ref = "uni_test";
+            l.classes = 1;
+            l.n = 3;
+            l.total = 2;
+            l.fspt_input = input;
+            l.fspt_training_data = &data;
+            l.fspt_training_strata = &strata;
+            l.fspt_n_training_data = &n;
+            l.fspt_n_max_training_data = &n_max;
+            l.fspt_n_seen_data = &seen;
+            l.fspt_stratum_seen = stratum_seen;
+            l.fspt_stratum_kept = stratum_kept;
+            l.fspt_sampling = policies[p];
+            l.fspt_max_samples = max_samples;
+            for (size_t i = 0; i < n_seen; ++i) {
+                /* skewed strata : 10%, 30% and 60% of the samples. */
+                int stratum = i % 10 == 0 ? 0 : (i % 10 < 4 ? 1 : 2);
+                long slot = fspt_sample_slot(l, 0, stratum);
+                if (slot < 0) continue;
+                input[0] = i;
+                input[1] = stratum;
+                copy_fspt_input_to_data(l, 0, slot, stratum);
+            }
+            size_t n_expected = p ? max_samples : n_seen;
+            double weight = fspt_layer_sample_weight(l, 0);
+            int fail = n != n_expected || seen != n_seen
+                || fabs(weight - (double) n_seen / n_expected) > 1e-9;
+            size_t count[3] = {0};
+            for (size_t i = 0; i < n; ++i) {
+                if (strata[i] != (int) data[2 * i + 1]) fail = 1;
+                ++count[strata[i]];
+            }
+            for (int k = 0; k < 3; ++k) {
+                if (count[k] != stratum_kept[k]) fail = 1;
+                double expected = (double) stratum_seen[k] * n / seen;
+                if (policies[p] == FSPT_SAMPLING_STRATIFIED
+                        && fabs(count[k] - expected) > 1.) fail = 1;
+            }
+            if (fail) {
+                fprintf(stderr, "SAMPLING %d : n = %zu, seen = %zu, weight = %g, strata = %zu %zu %zu\n",
+                        p, n, seen, weight, count[0], count[1], count[2]);
+                error("UNI-TEST FAILED");
+            }
+            free(data);
+            free(strata);
+        }
+        criterion_args c_args = {0};
+        c_args.min_samples = 10;
+        c_args.sample_weight = 4.;
+        if (weighted_min_samples(&c_args) != 3) error("UNI-TEST FAILED");
+        c_args.sample_weight = 0.;
+        if (weighted_min_samples(&c_args) != 10) error("UNI-TEST FAILED");
+        fprintf(stderr, "SAMPLING TESTS OK!\n");
+    }
+
+    /***********************/
+    /* Test fspt ensembles */
+    /***********************/
+
+    {
+        int d = 3;
+        int K = 3;
+        size_t n = 3000;
+        float lim[] = {0.f, 1.f, 0.f, 1.f, 0.f, 1.f};
+        layer ls[2];
+        fspt_t *bases[2];
+        float *data = malloc(n * d * sizeof(float));
+        size_t n_data = n;
+        size_t n_max = n;
+        size_t seen = n;
+        for (size_t i = 0; i < n * d; ++i) {
+            data[i] = (i % 2) ? rand_uniform(0.f, 1.f) : rand_uniform(.3f, .5f);
+        }
+        for (int j = 0; j < 2; ++j) {
+            layer l = {0};
+            l.ref = "uni_test";
+            l.classes = 1;
+            l.total = d;
+            l.save_samples = 1;
+            l.load_samples = 1;
+            l.fspt_simplify_thresh = -1.f;
+            bases[j] = make_fspt(d, copy_float_array(2 * d, lim), NULL,
+                    gini_criterion, auto_normalized_density_score);
+            l.fspts = bases + j;
+            l.fspt_training_data = &data;
+            l.fspt_n_training_data = &n_data;
+            l.fspt_n_max_training_data = &n_max;
+            l.fspt_n_seen_data = &seen;
+            l.fspt_criterion_args.gini_gain_thresh = 0.01f;
+            l.fspt_criterion_args.max_depth = 8;
+            l.fspt_criterion_args.min_samples = 10;
+            l.fspt_criterion_args.max_consecutive_gain_violations = 2;
+            l.fspt_criterion_args.middle_split = 1;
+            l.fspt_criterion_args.max_tries_p = 1.f;
+            l.fspt_criterion_args.max_features_p = 1.f;
+            l.fspt_criterion_args.seed = 42;
+            l.fspt_score_args.calibration_score = 0.5;
+            l.fspt_score_args.calibration_n_samples_p = 0.75;
+            l.fspt_score_args.calibration_volume_p = 0.05;
+            l.fspt_score_args.samples_p = 0.8;
+            l.fspt_score_args.auto_calibration_score = 0.8;
+            fspt_layer_make_ensemble(&l, K, 0, ENSEMBLE_MEAN);
+            ls[j] = l;
+        }
+        fspt_layer_fit_class(ls[0], 0, 1, 0);
+        fspt_t *members[3];
+        fspt_layer_members(ls[0], 0, members);
+        size_t total = 0;
+        for (int k = 0; k < K; ++k) {
+            total += members[k]->n_samples;
+            if (!members[k]->root || members[k]->n_samples != n / K
+                    || members[k]->c_args->sample_weight != K) {
+                fprintf(stderr, "ENSEMBLE MEMBER %d : n_samples = %zu\n", k,
+                        members[k]->n_samples);
+                error("UNI-TEST FAILED");
+            }
+        }
+        if (total != n || n_data != 0) error("UNI-TEST FAILED");
+        /* aggregations */
+        size_t n_test = 500;
+        float *X_test = malloc(n_test * d * sizeof(float));
+        for (size_t i = 0; i < n_test * d; ++i)
+            X_test[i] = rand_uniform(0.f, 1.f);
+        float *Y = malloc(n_test * sizeof(float));
+        float *Y_k = malloc(K * n_test * sizeof(float));
+        float *Y_bound = malloc(n_test * sizeof(float));
+        int *accept = malloc(n_test * sizeof(int));
+        for (int k = 0; k < K; ++k)
+            fspt_predict(n_test, members[k], X_test, Y_k + k * n_test);
+        ENSEMBLE_AGGREGATION aggregations[] = {ENSEMBLE_MEAN, ENSEMBLE_MIN};
+        for (int a = 0; a < 2; ++a) {
+            fspt_predict_ensemble(n_test, K, members, aggregations[a],
+                    X_test, Y);
+            fspt_accept_ensemble(n_test, K, members, aggregations[a], X_test,
+                    .5f, accept, Y_bound);
+            for (size_t i = 0; i < n_test; ++i) {
+                float expected = a ? 1.f : 0.f;
+                for (int k = 0; k < K; ++k) {
+                    float y = Y_k[k * n_test + i];
+                    expected = a ? (y < expected ? y : expected)
+                        : expected + y / K;
+                }
+                if (fabs(Y[i] - expected) > 1e-5
+                        || accept[i] != (Y[i] >= .5f)
+                        || (Y_bound[i] >= .5f) != accept[i]) {
+                    fprintf(stderr,
+                            "ENSEMBLE %d : score %f instead of %f, accept %d\n",
+                            a, Y[i], expected, accept[i]);
+                    error("UNI-TEST FAILED");
+                }
+            }
+        }
+        /* save / load */
+        char *filename = "backup/uni_test_ensemble.weights";
+        FILE *fp = fopen(filename, "wb");
+        save_fspt_trees(ls[0], fp);
+        fclose(fp);
+        fp = fopen(filename, "rb");
+        load_fspt_trees(ls[1], fp);
+        fclose(fp);
+        fspt_t *loaded[3];
+        fspt_layer_members(ls[1], 0, loaded);
+        for (int k = 0; k < K; ++k) {
+            if (!eq_fspts(*members[k], *loaded[k])) {
+                fprintf(stderr, "ENSEMBLE MEMBER %d SAVE/LOAD FAILED\n", k);
+                error("UNI-TEST FAILED");
+            }
+        }
+        for (int j = 0; j < 2; ++j) {
+            for (int k = 1; k < K; ++k) free_fspt(ls[j].fspt_ensemble[k]);
+            free(ls[j].fspt_ensemble);
+            free_fspt(bases[j]);
+        }
+        free(X_test);
+        free(Y);
+        free(Y_k);
+        free(Y_bound);
+        free(accept);
+        fprintf(stderr, "ENSEMBLE TESTS OK!\n");
+    }
+
+    /***********************/
+    /* Test compact fspts  */
+    /***********************/
+
+    {
+        int d = 3;
+        size_t n = 4000;
+        float lim[] = {0.f, 1.f, 0.f, 1.f, 0.f, 1.f};
+        float *X = malloc(n * d * sizeof(float));
+        for (size_t i = 0; i < n * d; ++i) {
+            X[i] = (i % 3) ? rand_uniform(0.f, 1.f) : rand_uniform(.2f, .4f);
+        }
+        fspt_t *fspt = make_fspt(d, copy_float_array(2 * d, lim), NULL,
+                gini_criterion, auto_normalized_density_score);
+        criterion_args c_args = {0};
+        score_args s_args = {0};
+        c_args.gini_gain_thresh = 0.01f;
+        c_args.max_depth = 10;
+        c_args.min_samples = 10;
+        c_args.max_consecutive_gain_violations = 2;
+        c_args.middle_split = 1;
+        c_args.max_tries_p = 1.f;
+        c_args.max_features_p = 1.f;
+        s_args.calibration_score = 0.5;
+        s_args.calibration_n_samples_p = 0.75;
+        s_args.calibration_volume_p = 0.05;
+        s_args.samples_p = 0.8;
+        s_args.auto_calibration_score = 0.8;
+        fspt_fit(n, X, &c_args, &s_args, fspt);
+        char *filename = "backup/uni_test_compact.fspt";
+        int succ = 1;
+        fspt_save(filename, *fspt, 1, &succ);
+        fspt_t *compact = make_fspt(d, copy_float_array(2 * d, lim), NULL,
+                gini_criterion, auto_normalized_density_score);
+        fspt_load(filename, compact, 0, 1, 1, 1, &succ);
+        fspt_compact(compact, 1);
+        size_t n_test = 1000;
+        float *X_test = malloc(n_test * d * sizeof(float));
+        for (size_t i = 0; i < n_test * d; ++i)
+            X_test[i] = rand_uniform(0.f, 1.f);
+        float *Y = malloc(n_test * sizeof(float));
+        float *Y_compact = malloc(n_test * sizeof(float));
+        int *accept = malloc(n_test * sizeof(int));
+        int *accept_compact = malloc(n_test * sizeof(int));
+        fspt_predict(n_test, fspt, X_test, Y);
+        fspt_predict(n_test, compact, X_test, Y_compact);
+        fspt_accept(n_test, fspt, X_test, .5f, accept, NULL);
+        fspt_accept(n_test, compact, X_test, .5f, accept_compact, NULL);
+        if (!succ || compact->root || compact->samples
+                || compact->compact->n_nodes != fspt->n_nodes
+                || !eq_float_array(n_test, Y, Y_compact)) {
+            fprintf(stderr, "COMPACT PREDICTION FAILED\n");
+            error("UNI-TEST FAILED");
+        }
+        for (size_t i = 0; i < n_test; ++i) {
+            if (accept[i] != accept_compact[i]) {
+                fprintf(stderr, "COMPACT ACCEPTANCE FAILED\n");
+                error("UNI-TEST FAILED");
+            }
+        }
+        /* leaf bounds */
+        fspt_compact_tree *c = compact->compact;
+        for (size_t i = 0; i < c->n_nodes; ++i) {
+            if (c->nodes[i].split_feature >= 0) continue;
+            fspt_leaf_stats leaf = c->leaves[c->nodes[i].right];
+            const float *b = c->leaf_bounds + c->nodes[i].right * 2 * d;
+            double v = 1.;
+            for (int j = 0; j < d; ++j) v *= b[2*j + 1] - b[2*j];
+            if (fabs(v - leaf.volume) > 1e-6 * (1. + leaf.volume)) {
+                fprintf(stderr, "COMPACT LEAF BOUNDS FAILED\n");
+                error("UNI-TEST FAILED");
+            }
+        }
+        fspt_stats *stats = get_fspt_stats(fspt, 0, NULL, 0);
+        fspt_stats *stats_compact = get_fspt_stats(compact, 0, NULL, 0);
+        if (!stats_compact || stats->n_leaves != stats_compact->n_leaves
+                || stats->depth != stats_compact->depth
+                || fabs(stats->leaves_volume - stats_compact->leaves_volume)
+                    > 1e-9
+                || stats->mean_samples_leaves
+                    != stats_compact->mean_samples_leaves
+                || fabs(stats->mean_score - stats_compact->mean_score) > 1e-9
+                || fspt_memory_size(compact) >= fspt_memory_size(fspt)) {
+            fprintf(stderr, "COMPACT STATS FAILED\n");
+            error("UNI-TEST FAILED");
+        }
+        free_fspt_stats(stats);
+        free_fspt_stats(stats_compact);
+        free_fspt(fspt);
+        free_fspt(compact);
+        free(X_test);
+        free(Y);
+        free(Y_compact);
+        free(accept);
+        free(accept_compact);
+        fprintf(stderr, "COMPACT TESTS OK!\n");
+    }
+
+    /***********************/
+    /* Test rescore        */
+    /***********************/
+
+    {
+        /* selection of the normalization quantile */
+        size_t n = 500;
+        score_vol_n *svn = calloc(n, sizeof(score_vol_n));
+        score_vol_n *sorted = calloc(n, sizeof(score_vol_n));
+        size_t total = 0;
+        for (size_t i = 0; i < n; ++i) {
+            svn[i].score = (double) ((i * 7919) % n) + 1.;
+            svn[i].n_samples = 1 + i % 13;
+            total += svn[i].n_samples;
+        }
+        memcpy(sorted, svn, n * sizeof(score_vol_n));
+        qsort(sorted, n, sizeof(score_vol_n), cmp_score_vol_n_desc);
+        size_t breaks[] = {0, 1, total / 3, total * 4 / 5, total, total + 1};
+        for (int b = 0; b < 6; ++b) {
+            size_t i_sorted = 0, count = 0;
+            for (i_sorted = 0; i_sorted < n; ++i_sorted) {
+                count += sorted[i_sorted].n_samples;
+                if (count >= breaks[b]) break;
+            }
+            if (i_sorted == n) i_sorted = n - 1;
+            size_t k = select_score_vol_n(svn, n, breaks[b]);
+            size_t count_select = 0, count_sorted = 0;
+            for (size_t i = 0; i <= k; ++i) {
+                count_select += svn[i].n_samples;
+                count_sorted += sorted[i].n_samples;
+            }
+            if (k != i_sorted || svn[k].score != sorted[k].score
+                    || count_select != count_sorted) {
+                fprintf(stderr, "RESCORE SELECTION FAILED (break %ld)\n",
+                        breaks[b]);
+                error("UNI-TEST FAILED");
+            }
+        }
+        free(svn);
+        free(sorted);
+
+        /* parallel rescore and variants */
+        int d = 2;
+        n = 20000;
+        float lim[] = {0.f, 1.f, 0.f, 1.f};
+        float *X = malloc(n * d * sizeof(float));
+        for (size_t i = 0; i < n * d; ++i) {
+            X[i] = (i % 2) ? rand_uniform(0.f, 1.f) : rand_uniform(.2f, .4f);
+        }
+        fspt_t *fspt = make_fspt(d, copy_float_array(2 * d, lim), NULL,
+                gini_criterion, auto_normalized_density_score);
+        criterion_args c_args = {0};
+        score_args s_args = {0};
+        c_args.gini_gain_thresh = 0.f;
+        c_args.max_depth = 30;
+        c_args.min_samples = 1;
+        c_args.max_consecutive_gain_violations = 30;
+        c_args.middle_split = 1;
+        c_args.max_tries_p = 1.f;
+        c_args.max_features_p = 1.f;
+        s_args.samples_p = 0.8;
+        s_args.auto_calibration_score = 0.8;
+        s_args.n_threads = 1;
+        fspt_fit(n, X, &c_args, &s_args, fspt);
+        list *leaves = fspt_leaves_to_list(fspt, PRE_ORDER);
+        size_t n_leaves = leaves->size;
+        fspt_node **leaves_array = (fspt_node **) list_to_array(leaves);
+        double *serial = malloc(n_leaves * sizeof(double));
+        for (size_t i = 0; i < n_leaves; ++i)
+            serial[i] = leaves_array[i]->score;
+        score_args s_parallel = s_args;
+        s_parallel.n_threads = 4;
+        fspt_rescore(fspt, &s_parallel);
+        if (n_leaves < 1024) {
+            fprintf(stderr, "RESCORE TOO FEW LEAVES (%ld)\n", n_leaves);
+            error("UNI-TEST FAILED");
+        }
+        for (size_t i = 0; i < n_leaves; ++i) {
+            if (leaves_array[i]->score != serial[i]) {
+                fprintf(stderr, "RESCORE PARALLEL FAILED\n");
+                error("UNI-TEST FAILED");
+            }
+        }
+        int n_variants = 3;
+        double samples_p[] = {0.5, 0.8, 0.95};
+        score_args variants[3];
+        for (int v = 0; v < n_variants; ++v) {
+            variants[v] = s_args;
+            variants[v].samples_p = samples_p[v];
+            variants[v].n_threads = 4;
+        }
+        size_t n_variant_leaves = 0;
+        double *scores = fspt_rescore_variants(fspt, n_variants, variants,
+                &n_variant_leaves);
+        if (n_variant_leaves != n_leaves) {
+            fprintf(stderr, "RESCORE VARIANTS FAILED\n");
+            error("UNI-TEST FAILED");
+        }
+        for (int v = 0; v < n_variants; ++v) {
+            score_args s_v = s_args;
+            s_v.samples_p = samples_p[v];
+            fspt_rescore(fspt, &s_v);
+            for (size_t i = 0; i < n_leaves; ++i) {
+                if (fabs(leaves_array[i]->score - scores[v * n_leaves + i])
+                        > 1e-12) {
+                    fprintf(stderr, "RESCORE VARIANT %d FAILED\n", v);
+                    error("UNI-TEST FAILED");
+                }
+            }
+        }
+        fspt_set_leaf_scores(fspt, scores);
+        for (size_t i = 0; i < n_leaves; ++i) {
+            if (leaves_array[i]->score != scores[i]) {
+                fprintf(stderr, "RESCORE SET SCORES FAILED\n");
+                error("UNI-TEST FAILED");
+            }
+        }
+        free(scores);
+        free(serial);
+        free(leaves_array);
+        free_list(leaves);
+        free_fspt(fspt);
+        fprintf(stderr, "RESCORE TESTS OK!\n");
+    }
+
+    /***********************/
+    /* Test gemm           */
+    /***********************/
+
+    {
+        const char *kernels[] = {"generic", "avx2", "avx512", "neon"};
+        const char *default_kernel = gemm_kernel_name();
+        int shapes[][3] = {{4, 4, 4}, {7, 33, 5}, {13, 17, 300},
+            {150, 530, 70}, {64, 1100, 27}, {300, 20, 513}};
+        float betas[] = {0.f, 1.f, .5f};
+        for (int kn = 0; kn < 4; ++kn) {
+            if (!gemm_set_kernel(kernels[kn])) continue;
+            for (int threads = 1; threads <= 3; threads += 2) {
+                gemm_set_threads(threads);
+                for (int s = 0; s < 6; ++s) {
+                    int M = shapes[s][0], N = shapes[s][1], K = shapes[s][2];
+                    for (int t = 0; t < 4; ++t) {
+                        int TA = t & 1, TB = t >> 1;
+                        int lda = (TA ? M : K) + 3;
+                        int ldb = (TB ? K : N) + 1;
+                        int ldc = N + 2;
+                        float *A = random_matrix(TA ? K : M, lda);
+                        float *B = random_matrix(TB ? N : K, ldb);
+                        float *C = random_matrix(M, ldc);
+                        float *C_ref = copy_float_array(M * ldc, C);
+                        float beta = betas[(s + t) % 3];
+                        gemm_cpu_naive(TA, TB, M, N, K, .7f, A, lda, B, ldb,
+                                beta, C_ref, ldc);
+                        gemm_cpu_packed(TA, TB, M, N, K, .7f, A, lda, B,
+                                ldb, beta, C, ldc);
+                        for (int i = 0; i < M * ldc; ++i) {
+                            if (fabs(C[i] - C_ref[i])
+                                    > 1e-4 * (1. + fabs(C_ref[i]))) {
+                                fprintf(stderr, "GEMM FAILED (%s, %d threads, \
+%dx%dx%d, TA=%d, TB=%d, beta=%g) : %g != %g at %d\n", kernels[kn], threads,
+                                        M, N, K, TA, TB, beta, C[i],
+                                        C_ref[i], i);
+                                error("UNI-TEST FAILED");
+                            }
+                        }
+                        free(A);
+                        free(B);
+                        free(C);
+                        free(C_ref);
+                    }
+                }
+            }
+        }
+        gemm_set_kernel(default_kernel);
+        gemm_set_threads(0);
+        fprintf(stderr, "GEMM TESTS OK!\n");
+    }
+
+    /***********************/
+    /* Test conv algorithms */
+    /***********************/
+
+    {
+        /* c, n, h, w, size, stride, pad, groups */
+        int configs[][8] = {{3, 8, 13, 11, 3, 1, 1, 1}, {16, 20, 9, 14, 3, 1, 1, 1},
+            {32, 16, 30, 30, 3, 1, 1, 2}, {5, 7, 10, 9, 3, 2, 1, 1},
+            {4, 4, 12, 12, 3, 1, 1, 4}, {6, 3, 8, 8, 5, 1, 2, 1},
+            {17, 18, 7, 5, 3, 1, 0, 1}};
+        CONV_ALGORITHM algos[] = {CONV_DIRECT, CONV_WINOGRAD_2X2,
+            CONV_WINOGRAD_4X4};
+        for (int k = 0; k < 7; ++k) {
+            int *cf = configs[k];
+            int batch = 2;
+            convolutional_layer l = make_convolutional_layer(batch, cf[2],
+                    cf[3], cf[0], cf[1], cf[7], cf[4], cf[5], cf[6], LINEAR,
+                    0, 0, 0, 0);
+            for (int i = 0; i < l.nweights; ++i)
+                l.weights[i] = rand_uniform(-1.f, 1.f);
+            network net = {0};
+            net.input = random_matrix(batch, l.inputs);
+            set_convolutional_algorithm(&l, CONV_GEMM);
+            net.workspace = calloc(1, l.workspace_size + 1);
+            forward_convolutional_layer(l, net);
+            float *ref = copy_float_array(batch * l.outputs, l.output);
+            free(net.workspace);
+            for (int a = 0; a < 3; ++a) {
+                set_convolutional_algorithm(&l, algos[a]);
+                if (l.conv_algo != algos[a]) {
+                    if (cf[4] == 3 && cf[5] == 1) {
+                        fprintf(stderr, "CONV ALGO SELECTION FAILED\n");
+                        error("UNI-TEST FAILED");
+                    }
+                    continue;
+                }
+                net.workspace = calloc(1, l.workspace_size + 1);
+                forward_convolutional_layer(l, net);
+                for (int i = 0; i < batch * l.outputs; ++i) {
+                    if (fabs(l.output[i] - ref[i]) > 1e-3 * (1. + fabs(ref[i]))) {
+                        fprintf(stderr, "CONV ALGO %d FAILED (config %d) : \
+%g != %g at %d\n", algos[a], k, l.output[i], ref[i], i);
+                        error("UNI-TEST FAILED");
+                    }
+                }
+                free(net.workspace);
+            }
+            free(ref);
+            free(net.input);
+            free_layer(l);
+        }
+        fprintf(stderr, "CONV ALGORITHMS TESTS OK!\n");
+    }
+
+    /***********************/
+    /* Test batchnorm fusion */
+    /***********************/
+
+    {
+        int M = 37, N = 300, K = 45;
+        float *A = random_matrix(M, K);
+        float *B = random_matrix(K, N);
+        float *bias = random_matrix(1, M);
+        float *C = random_matrix(M, N);
+        float *C_ref = copy_float_array(M * N, C);
+        gemm_cpu_naive(0, 0, M, N, K, 1, A, K, B, N, 0, C_ref, N);
+        for (int i = 0; i < M; ++i) {
+            for (int j = 0; j < N; ++j) C_ref[i * N + j] += bias[i];
+            activate_array(C_ref + i * N, N, LEAKY);
+        }
+        gemm_bias_activate(0, 0, M, N, K, 1, A, K, B, N, 0, C, N, bias, LEAKY);
+        for (int i = 0; i < M * N; ++i) {
+            if (fabs(C[i] - C_ref[i]) > 1e-4 * (1. + fabs(C_ref[i]))) {
+                fprintf(stderr, "GEMM EPILOGUE FAILED : %g != %g at %d\n",
+                        C[i], C_ref[i], i);
+                error("UNI-TEST FAILED");
+            }
+        }
+        free(A);
+        free(B);
+        free(bias);
+        free(C);
+        free(C_ref);
+
+        CONV_ALGORITHM algos[] = {CONV_GEMM, CONV_DIRECT, CONV_WINOGRAD_2X2};
+        int batch = 2;
+        convolutional_layer l = make_convolutional_layer(batch, 12, 10, 8,
+                16, 1, 3, 1, 1, LEAKY, 1, 0, 0, 0);
+        for (int i = 0; i < l.nweights; ++i)
+            l.weights[i] = rand_uniform(-1.f, 1.f);
+        for (int i = 0; i < l.n; ++i) {
+            l.biases[i] = rand_uniform(-1.f, 1.f);
+            l.scales[i] = rand_uniform(.5f, 2.f);
+            l.rolling_mean[i] = rand_uniform(-1.f, 1.f);
+            l.rolling_variance[i] = rand_uniform(.1f, 3.f);
+        }
+        network net = {0};
+        net.input = random_matrix(batch, l.inputs);
+        set_convolutional_algorithm(&l, CONV_GEMM);
+        net.workspace = calloc(1, l.workspace_size + 1);
+        forward_convolutional_layer(l, net);
+        float *ref = copy_float_array(batch * l.outputs, l.output);
+        free(net.workspace);
+        fuse_convolutional_batchnorm(&l);
+        for (int a = 0; a < 3; ++a) {
+            set_convolutional_algorithm(&l, algos[a]);
+            net.workspace = calloc(1, l.workspace_size + 1);
+            forward_convolutional_layer(l, net);
+            for (int i = 0; i < batch * l.outputs; ++i) {
+                if (fabs(l.output[i] - ref[i]) > 1e-3 * (1. + fabs(ref[i]))) {
+                    fprintf(stderr, "BATCHNORM FUSION FAILED (algo %d) : \
+%g != %g at %d\n", algos[a], l.output[i], ref[i], i);
+                    error("UNI-TEST FAILED");
+                }
+            }
+            free(net.workspace);
+        }
+        free(ref);
+        free(net.input);
+        free_layer(l);
+        fprintf(stderr, "BATCHNORM FUSION TESTS OK!\n");
+    }
+
+    /***********************/
+    /* Test memory plan    */
+    /***********************/
+
+    /* with a batch of 1, the concatenations are written in place */
+    for (int batch = 2; batch > 0; --batch) {
+        char *cfgfile = "backup/uni_test_memory_plan.cfg";
+        FILE *fp = fopen(cfgfile, "w");
+        assert(fp);
+        fprintf(fp, "[net]\nbatch=%d\nwidth=32\nheight=32\nchannels=3\n\n"
+                "[convolutional]\nbatch_normalize=1\nfilters=8\nsize=3\n"
+                "stride=1\npad=1\nactivation=leaky\n\n"
+                "[maxpool]\nsize=2\nstride=2\n\n"
+                "[convolutional]\nfilters=16\nsize=3\nstride=1\npad=1\n"
+                "activation=leaky\n\n"
+                "[convolutional]\nfilters=16\nsize=1\nstride=1\npad=1\n"
+                "activation=leaky\n\n"
+                "[shortcut]\nfrom=-2\nactivation=linear\n\n"
+                "[convolutional]\nfilters=18\nsize=1\nstride=1\npad=1\n"
+                "activation=linear\n\n"
+                "[yolo]\nmask=0,1,2\nanchors=10,14,23,27,37,58\n"
+                "classes=1\nnum=3\n\n"
+                "[route]\nlayers=-3\n\n"
+                "[upsample]\nstride=2\n\n"
+                "[route]\nlayers=-1,0\n\n"
+                "[convolutional]\nfilters=18\nsize=3\nstride=1\npad=1\n"
+                "activation=linear\n\n"
+                "[yolo]\nmask=0,1,2\nanchors=10,14,23,27,37,58\n"
+                "classes=1\nnum=3\n", batch);
+        fclose(fp);
+        char *weightfile = "backup/uni_test_memory_plan.weights";
+        network *ref = parse_network_cfg(cfgfile);
+        save_weights(ref, weightfile);
+        network *net = load_network(cfgfile, weightfile, 0);
+        float *input = random_matrix(ref->batch, ref->inputs);
+        network_predict(ref, input);
+        size_t arena = plan_network_memory(net);
+        size_t unplanned = 0;
+        for (int i = 0; i < ref->n; ++i)
+            unplanned += ref->layers[i].outputs * ref->batch * sizeof(float);
+        if (!arena || arena >= unplanned) {
+            fprintf(stderr, "MEMORY PLAN FAILED : arena of %zu bytes for \
+%zu bytes of outputs\n", arena, unplanned);
+            error("UNI-TEST FAILED");
+        }
+        /* twice, to check that the reused slots are overwritten */
+        for (int k = 0; k < 2; ++k) {
+            network_predict(net, input);
+            for (int i = 0; i < net->n; ++i) {
+                if (net->layers[i].type != YOLO) continue;
+                if (!eq_float_array(ref->batch * ref->layers[i].outputs,
+                            ref->layers[i].output, net->layers[i].output)) {
+                    fprintf(stderr, "MEMORY PLAN FAILED : yolo layer %d \
+differs\n", i);
+                    error("UNI-TEST FAILED");
+                }
+            }
+        }
+        layer *ls = net->layers;
+        if (ls[4].output != ls[3].output || ls[7].output != ls[4].output
+                || (batch == 1 && (ls[8].output != ls[9].output
+                        || ls[0].output != ls[9].output + ls[8].outputs))) {
+            fprintf(stderr, "MEMORY PLAN FAILED : missing views\n");
+            error("UNI-TEST FAILED");
+        }
+        if (net->output != net->layers[net->n - 1].output) {
+            fprintf(stderr, "MEMORY PLAN FAILED : wrong network output\n");
+            error("UNI-TEST FAILED");
+        }
+        /* the 1x1 convolution needs no workspace without its backward */
+        if (ls[3].workspace_size || !ref->layers[3].workspace_size) {
+            fprintf(stderr, "MEMORY PLAN FAILED : workspace of %zu bytes\n",
+                    ls[3].workspace_size);
+            error("UNI-TEST FAILED");
+        }
+        free(input);
+        free_network(ref);
+        free_network(net);
+    }
+    fprintf(stderr, "MEMORY PLAN TESTS OK!\n");
+
+    /***********************/
+    /* Test replicas       */
+    /***********************/
+
+    /* 5 images over 3 replicas : 2, 2 and 1 */
+    for (int planned = 0; planned < 2; ++planned) {
+        char *cfgfile = "backup/uni_test_replicas.cfg";
+        FILE *fp = fopen(cfgfile, "w");
+        assert(fp);
+        fprintf(fp, "[net]\nbatch=5\nwidth=32\nheight=32\nchannels=3\n\n"
+                "[convolutional]\nbatch_normalize=1\nfilters=8\nsize=3\n"
+                "stride=1\npad=1\nactivation=leaky\n\n"
+                "[maxpool]\nsize=2\nstride=2\n\n"
+                "[convolutional]\nfilters=8\nsize=3\nstride=1\npad=1\n"
+                "activation=leaky\n\n"
+                "[shortcut]\nfrom=-2\nactivation=linear\n\n"
+                "[upsample]\nstride=2\n\n"
+                "[route]\nlayers=-1,0\n\n"
+                "[convolutional]\nfilters=18\nsize=1\nstride=1\npad=1\n"
+                "activation=linear\n\n"
+                "[yolo]\nmask=0,1,2\nanchors=10,14,23,27,37,58\n"
+                "classes=1\nnum=3\n");
+        fclose(fp);
+        char *weightfile = "backup/uni_test_replicas.weights";
+        network *ref = parse_network_cfg(cfgfile);
+        save_weights(ref, weightfile);
+        network *net = load_network(cfgfile, weightfile, 0);
+        float *input = random_matrix(ref->batch, ref->inputs);
+        network_predict(ref, input);
+        if (planned) plan_network_memory(net);
+        replicate_network(net, 3);
+        /* twice, the replicas are made by the first forward */
+        for (int k = 0; k < 2; ++k) {
+            network_predict(net, input);
+            for (int i = 0; i < net->n; ++i) {
+                if (planned && net->layers[i].type != YOLO) continue;
+                if (!eq_float_array(ref->batch * ref->layers[i].outputs,
+                            ref->layers[i].output, net->layers[i].output)) {
+                    fprintf(stderr, "REPLICAS FAILED (planned %d) : layer \
+%d differs\n", planned, i);
+                    error("UNI-TEST FAILED");
+                }
+            }
+        }
+        free(input);
+        free_network(ref);
+        free_network(net);
+    }
+    {
+        /* the samples of the replicas go through the reservoir of base */
+        float *data[2] = {NULL, NULL};
+        int *strata[2] = {NULL, NULL};
+        size_t n[2] = {0}, n_max[2] = {0}, seen[2] = {0};
+        size_t stratum_seen[2][3] = {{0}}, stratum_kept[2][3] = {{0}};
+        float input[2];
+        layer ls[2];
+        for (int k = 0; k < 2; ++k) {
+            layer l = {0};
+            l.ref = "uni_test";
+            l.classes = 1;
+            l.n = 3;
+            l.total = 2;
+            l.fspt_input = input;
+            l.fspt_training_data = data + k;
+            l.fspt_training_strata = strata + k;
+            l.fspt_n_training_data = n + k;
+            l.fspt_n_max_training_data = n_max + k;
+            l.fspt_n_seen_data = seen + k;
+            l.fspt_stratum_seen = stratum_seen[k];
+            l.fspt_stratum_kept = stratum_kept[k];
+            l.fspt_sampling = k ? FSPT_SAMPLING_ALL : FSPT_SAMPLING_RESERVOIR;
+            l.fspt_max_samples = k ? 0 : 50;
+            ls[k] = l;
+        }
+        for (int batch = 0; batch < 10; ++batch) {
+            for (int i = 0; i < 20; ++i) {
+                int stratum = i % 3;
+                long slot = fspt_sample_slot(ls[1], 0, stratum);
+                input[0] = batch * 20 + i;
+                input[1] = stratum;
+                copy_fspt_input_to_data(ls[1], 0, slot, stratum);
+            }
+            fspt_layer_merge_replica(ls[1], ls[0]);
+        }
+        int fail = n[0] != 50 || seen[0] != 200 || n[1] != 0;
+        for (size_t i = 0; i < n[0]; ++i)
+            if (strata[0][i] != (int) data[0][2 * i + 1]) fail = 1;
+        for (int k = 0; k < 3; ++k)
+            if (stratum_seen[0][k] != (k < 2 ? 70 : 60)) fail = 1;
+        if (fail) {
+            fprintf(stderr, "REPLICAS FAILED : merged %zu samples out of \
+%zu\n", n[0], seen[0]);
+            error("UNI-TEST FAILED");
+        }
+        for (int k = 0; k < 2; ++k) {
+            free(data[k]);
+            free(strata[k]);
+        }
+    }
+    fprintf(stderr, "REPLICAS TESTS OK!\n");
+
+    /***********************/
+    /* Test mapped weights */
+    /***********************/
+
+    for (int fused = 0; fused < 2; ++fused) {
+        char *cfgfile = "backup/uni_test_replicas.cfg";
+        char *mapfile = "backup/uni_test_mapped.weights";
+        network *ref = load_network(cfgfile, "backup/uni_test_replicas.weights", 0);
+        if (fused) fuse_network(ref);
+        save_mapped_weights(ref, mapfile);
+        network *net = load_network(cfgfile, mapfile, 0);
+        char *map = net->weights_map;
+        for (int i = 0; i < net->n; ++i) {
+            layer l = net->layers[i];
+            if (l.type != CONVOLUTIONAL) continue;
+            char *w = (char *) l.weights;
+            if (w < map || w >= map + net->weights_map_size
+                    || (w - map) % MAPPED_WEIGHTS_ALIGN
+                    || l.batch_normalize != ref->layers[i].batch_normalize) {
+                fprintf(stderr, "MAPPED WEIGHTS FAILED : layer %d is not \
+mapped\n", i);
+                error("UNI-TEST FAILED");
+            }
+        }
+        float *input = random_matrix(ref->batch, ref->inputs);
+        network_predict(ref, input);
+        network_predict(net, input);
+        layer out = ref->layers[ref->n - 1];
+        if (!eq_float_array(ref->batch * out.outputs, out.output,
+                    net->layers[net->n - 1].output)) {
+            fprintf(stderr, "MAPPED WEIGHTS FAILED (fused %d) : outputs \
+differ\n", fused);
+            error("UNI-TEST FAILED");
+        }
+        free(input);
+        free_network(ref);
+        free_network(net);
+    }
+    fprintf(stderr, "MAPPED WEIGHTS TESTS OK!\n");
+
+    /***********************/
+    /* Test profiler       */
+    /***********************/
+
+    /* with replicas, the slices of the batch add up to the same flops */
+    for (int replicas = 1; replicas <= 2; ++replicas) {
+        network *net = parse_network_cfg("backup/uni_test_replicas.cfg");
+        profile_network(net);
+        replicate_network(net, replicas);
+        float *input = random_matrix(net->batch, net->inputs);
+        network_predict(net, input);
+        network_predict(net, input);
+        struct network_profile *p = net->profile;
+        int fail = p->n != net->n;
+        int max_thread = 0;
+        for (int i = 0; i < p->n_events; ++i)
+            if (p->events[i].thread > max_thread)
+                max_thread = p->events[i].thread;
+        fail |= max_thread != replicas - 1;
+        for (int i = 0; i < p->n; ++i) {
+            layer_profile lp = p->layers[i];
+            fail |= lp.forward_calls != 2 || lp.backward_calls != 0
+                || lp.type != net->layers[i].type || lp.forward_time < 0;
+        }
+        /* 3x3 convolution of 3 channels to 8 filters on 32x32, batch 5 :
+         * 2 flops per multiply-add, plus the bias of each output */
+        double conv_flops = 2. * 3 * 3 * 3 * 8 * 32 * 32 * 5 + 8 * 32 * 32 * 5;
+        fail |= p->layers[0].flops != 2 * conv_flops
+            || p->layers[0].out_c != 8 || p->layers[0].out_w != 32;
+        if (fail) {
+            fprintf(stderr, "PROFILER FAILED (%d replicas) : %d calls of \
+layer 0, %g flops instead of %g\n", replicas, p->layers[0].forward_calls,
+                    p->layers[0].flops, 2 * conv_flops);
+            error("UNI-TEST FAILED");
+        }
+        free(input);
+        free_network(net);
+    }
+    fprintf(stderr, "PROFILER TESTS OK!\n");
+
+    /***********************/
+    /* Test network views  */
+    /***********************/
+
+    {
+        char *cfgfile = "backup/uni_test_view.cfg";
+        char *weightfile = "backup/uni_test_view.weights";
+        char *backbone = "[net]\nbatch=1\nwidth=32\nheight=32\nchannels=3\n\n"
+            "[convolutional]\nbatch_normalize=1\nfilters=8\nsize=3\n"
+            "stride=1\npad=1\nactivation=leaky\n\n"
+            "[maxpool]\nsize=2\nstride=2\n\n"
+            "[convolutional]\nfilters=18\nsize=1\nstride=1\npad=1\n"
+            "activation=linear\n\n"
+            "[yolo]\nmask=0,1,2\nanchors=10,14,23,27,37,58\n"
+            "classes=1\nnum=3\n\n";
+        FILE *fp = fopen(cfgfile, "w");
+        assert(fp);
+        fprintf(fp, "%s[fspt]\nyolo_layer=-1\nfeature_layers=-2\nscore=density\n",
+                backbone);
+        fclose(fp);
+        network *net = parse_network_cfg(cfgfile);
+        fspt_t *fspt = net->layers[4].fspts[0];
+        int d = fspt->n_features;
+        size_t n = 2000;
+        float *X = malloc(n * d * sizeof(float));
+        for (size_t i = 0; i < n * d; ++i)
+            X[i] = (i % d) ? rand_uniform(-.5f, .5f) : rand_uniform(.05f, .1f);
+        criterion_args c_args = {0};
+        score_args s_args = {0};
+        c_args.gini_gain_thresh = 0.01f;
+        c_args.max_depth = 6;
+        c_args.min_samples = 10;
+        c_args.max_consecutive_gain_violations = 2;
+        c_args.middle_split = 1;
+        c_args.max_tries_p = 1.f;
+        c_args.max_features_p = 1.f;
+        s_args.calibration_score = 0.5;
+        s_args.calibration_n_samples_p = 0.75;
+        s_args.calibration_volume_p = 0.05;
+        s_args.samples_p = 0.8;
+        s_args.auto_calibration_score = 0.8;
+        fspt_fit(n, X, &c_args, &s_args, fspt);
+        save_weights(net, weightfile);
+        /* the fused layers skip the batchnorm params of the file */
+        fuse_network(net);
+        network *view = parse_network_view_cfg(net, cfgfile);
+        assert(view);
+        load_fspt_weights(view, weightfile);
+        fspt_t *loaded = view->layers[4].fspts[0];
+        float *Y = malloc(n * sizeof(float));
+        float *Y_loaded = malloc(n * sizeof(float));
+        fspt_predict(n, fspt, X, Y);
+        fspt_predict(n, loaded, X, Y_loaded);
+        int fail = loaded == fspt || loaded->n_nodes != fspt->n_nodes
+            || !eq_float_array(n, Y, Y_loaded);
+        for (int i = 0; i < 4; ++i)
+            fail |= view->layers[i].output != net->layers[i].output;
+        /* a configuration with other layers has no view */
+        fp = fopen(cfgfile, "w");
+        assert(fp);
+        fprintf(fp, "%s[route]\nlayers=-2\n", backbone);
+        fclose(fp);
+        fail |= parse_network_view_cfg(net, cfgfile) != NULL;
+        if (fail) {
+            fprintf(stderr, "NETWORK VIEW FAILED\n");
+            error("UNI-TEST FAILED");
+        }
+        free(Y);
+        free(Y_loaded);
+        free_network_view(view);
+        free_network(net);
+    }
+    fprintf(stderr, "NETWORK VIEW TESTS OK!\n");
+
+    /***********************/
+    /* Test activations    */
+    /***********************/
+
+    {
+        ACTIVATION activations[] = {LOGISTIC, LOGGY, HALF_LOGGY, RELU, ELU,
+            SELU, RELIE, RAMP, LINEAR, TANH, PLSE, LEAKY, STAIR, HARDTAN,
+            LHTAN};
+        int n = 1003;
+        float *x = calloc(n, sizeof(float));
+        float *ref = calloc(n, sizeof(float));
+        float *delta = calloc(n, sizeof(float));
+        float *delta_ref = calloc(n, sizeof(float));
+        for (int k = 0; k < 15; ++k) {
+            ACTIVATION a = activations[k];
+            for (int i = 0; i < n; ++i)
+                x[i] = ref[i] = i < 5 ? 100.f * (i - 2) : rand_uniform(-10, 10);
+            activate_array(x, n, a);
+            activate_array_scalar(ref, n, a);
+            for (int i = 0; i < n; ++i) {
+                delta[i] = delta_ref[i] = rand_uniform(-1, 1);
+            }
+            gradient_array(ref, n, a, delta);
+            gradient_array_scalar(ref, n, a, delta_ref);
+            for (int i = 0; i < n; ++i) {
+                if (fabs(x[i] - ref[i]) > 5e-7 + 1e-6 * fabs(ref[i])
+                        || fabs(delta[i] - delta_ref[i])
+                        > 1e-6 * (1 + fabs(delta_ref[i]))) {
+                    fprintf(stderr, "ACTIVATION %s FAILED at %d : %g != %g \
+or gradient %g != %g\n", get_activation_string(a), i, x[i], ref[i],
+                            delta[i], delta_ref[i]);
+                    error("UNI-TEST FAILED");
+                }
+            }
+        }
+        free(x);
+        free(ref);
+        free(delta);
+        free(delta_ref);
+        fprintf(stderr, "ACTIVATION TESTS OK!\n");
+    }
+
+    /***********************/
+    /* Test int8           */
+    /***********************/
+
+    {
+        const char *kernels[] = {"generic", "avx2", "avxvnni", "avx512vnni"};
+        const char *default_kernel = qgemm_kernel_name();
+        /* M, N, K, conv size (0 : matrix source), transposed source */
+        int shapes[][5] = {{5, 9, 7, 0, 0}, {37, 300, 45, 0, 0},
+            {16, 3, 130, 0, 1}, {70, 600, 33, 0, 0}, {8, 77, 27, 3, 0},
+            {19, 15, 36, 3, 0}};
+        int conv_shapes[][6] = {{0}, {0}, {0}, {0}, {3, 7, 11, 3, 1, 1},
+            {4, 6, 10, 3, 2, 1}}; /* c, h, w, size, stride, pad */
+        for (int kn = 0; kn < 4; ++kn) {
+            if (!qgemm_set_kernel(kernels[kn])) continue;
+            for (int threads = 1; threads <= 3; threads += 2) {
+                gemm_set_threads(threads);
+                for (int s = 0; s < 6; ++s) {
+                    int M = shapes[s][0], N = shapes[s][1], K = shapes[s][2];
+                    int *cs = conv_shapes[s];
+                    signed char *W = calloc(M * K, 1);
+                    for (int i = 0; i < M * K; ++i) W[i] = rand() % 255 - 127;
+                    int n_src = shapes[s][3] ? cs[0] * cs[1] * cs[2] : K * N;
+                    unsigned char *src = calloc(n_src, 1);
+                    for (int i = 0; i < n_src; ++i) src[i] = 1 + rand() % 255;
+                    qgemm_source B = {src, N, 1, 0, 0, 0, 0, 0, 0, 0};
+                    if (shapes[s][4]) {
+                        B.ld_k = 1;
+                        B.ld_j = K;
+                    }
+                    if (shapes[s][3]) {
+                        qgemm_source conv = {src, 0, 0, cs[0], cs[1], cs[2],
+                            cs[3], cs[4], cs[5],
+                            (cs[2] + 2 * cs[5] - cs[3]) / cs[4] + 1};
+                        B = conv;
+                    }
+                    float *w_scale = random_matrix(1, M);
+                    float *bias = random_matrix(1, M);
+                    float x_scale = .01f;
+                    float *C = calloc(M * N, sizeof(float));
+                    qgemm_weights *packed = qgemm_pack_weights(W, M, K);
+                    ACTIVATION a = (s % 2) ? LEAKY : LINEAR;
+                    qgemm(N, packed, &B, w_scale, x_scale, bias, a, C, N, 1);
+                    for (int i = 0; i < M; ++i) {
+                        for (int j = 0; j < N; ++j) {
+                            long long acc = 0;
+                            for (int k = 0; k < K; ++k) {
+                                int b;
+                                if (!B.size) {
+                                    b = src[k * B.ld_k + j * B.ld_j];
+                                } else {
+                                    int kx = k % cs[3], ky = k / cs[3] % cs[3];
+                                    int ch = k / cs[3] / cs[3];
+                                    int y = j / B.out_w * cs[4] - cs[5] + ky;
+                                    int x = j % B.out_w * cs[4] - cs[5] + kx;
+                                    b = (y < 0 || y >= cs[1] || x < 0
+                                            || x >= cs[2]) ? QGEMM_ZERO
+                                        : src[(ch * cs[1] + y) * cs[2] + x];
+                                }
+                                acc += W[i * K + k] * (b - QGEMM_ZERO);
+                            }
+                            float ref = activate(acc * w_scale[i] * x_scale
+                                    + bias[i], a);
+                            if (fabs(C[i * N + j] - ref) > 1e-5 * (1 + fabs(ref))) {
+                                fprintf(stderr, "QGEMM FAILED (%s, %d threads, \
+shape %d) : %g != %g at %d,%d\n", kernels[kn], threads, s, C[i * N + j], ref,
+                                        i, j);
+                                error("UNI-TEST FAILED");
+                            }
+                        }
+                    }
+                    free(packed);
+                    free(W);
+                    free(src);
+                    free(w_scale);
+                    free(bias);
+                    free(C);
+                }
+            }
+        }
+        qgemm_set_kernel(default_kernel);
+        gemm_set_threads(0);
+
+        /* quantized layers against float, then through a weights file */
+        int batch = 2;
+        layer layers[3];
+        layers[0] = make_convolutional_layer(batch, 14, 12, 16, 24, 1, 3, 1,
+                1, LEAKY, 0, 0, 0, 0);
+        layers[1] = make_convolutional_layer(batch, 14, 12, 24, 20, 1, 1, 1,
+                0, LINEAR, 0, 0, 0, 0);
+        layers[2] = make_connected_layer(batch, 300, 40, LEAKY, 0, 0);
+        for (int k = 0; k < 3; ++k) {
+            layer *l = layers + k;
+            int rows = k < 2 ? l->n : l->outputs;
+            for (int i = 0; i < rows * (k < 2 ? l->nweights / l->n : l->inputs); ++i)
+                l->weights[i] = rand_uniform(-.2f, .2f);
+            for (int i = 0; i < rows; ++i)
+                l->biases[i] = rand_uniform(-.5f, .5f);
+            network net = {0};
+            net.input = random_matrix(batch, l->inputs);
+            net.workspace = calloc(1, l->workspace_size + 1);
+            l->forward(*l, net);
+            float *ref = copy_float_array(batch * l->outputs, l->output);
+            float max_ref = 0, max_err = 0;
+            for (int i = 0; i < batch * l->outputs; ++i)
+                if (fabs(ref[i]) > max_ref) max_ref = fabs(ref[i]);
+            quantize_layer(l, 1.f / 127);
+            fill_cpu(batch * l->outputs, 0, l->output, 1);
+            l->forward(*l, net);
+            for (int i = 0; i < batch * l->outputs; ++i)
+                if (fabs(l->output[i] - ref[i]) > max_err)
+                    max_err = fabs(l->output[i] - ref[i]);
+            if (max_err > .02 * max_ref) {
+                fprintf(stderr, "INT8 LAYER %d FAILED : error %g for outputs \
+up to %g\n", k, max_err, max_ref);
+                error("UNI-TEST FAILED");
+            }
+
+            FILE *fp = tmpfile();
+            network saved = {0};
+            saved.n = 1;
+            saved.layers = l;
+            saved.gpu_index = -1;
+            save_int8_weights(&saved, fp);
+            float *out = copy_float_array(batch * l->outputs, l->output);
+            free_layer_int8(l);
+            rewind(fp);
+            load_int8_weights(&saved, fp);
+            fclose(fp);
+            if (!l->qpacked) {
+                fprintf(stderr, "INT8 WEIGHTS NOT LOADED\n");
+                error("UNI-TEST FAILED");
+            }
+            l->forward(*l, net);
+            if (!eq_float_array(batch * l->outputs, out, l->output)) {
+                fprintf(stderr, "INT8 WEIGHTS RELOAD FAILED\n");
+                error("UNI-TEST FAILED");
+            }
+            free(out);
+            free(ref);
+            free(net.input);
+            free(net.workspace);
+            free_layer(*l);
+        }
+        fprintf(stderr, "INT8 TESTS OK!\n");
+    }
+
     fprintf(stderr, "ALL TESTS OK!\n");
 }
 
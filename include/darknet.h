@@ -7,6 +7,7 @@
 
 #include "fspt.h"
 #include "fspt_criterion.h"
+#include "fspt_reduction.h"
 #include "fspt_score.h"
 #include "list.h"
 
@@ -28,6 +29,10 @@ extern "C" {
 
 #define SECRET_NUM -1234
 extern int gpu_index;
+/* When set, profile_network is enabled on every parsed network. */
+extern char *network_profile_prefix;
+/* When > 1, replicate_network is applied to every parsed network. */
+extern int network_replicas;
 
 typedef struct{
     int classes;
@@ -101,6 +106,14 @@ typedef enum{
     SSE, MASKED, L1, SEG, SMOOTH,WGAN
 } COST_TYPE;
 
+typedef enum{
+    CONV_AUTO, CONV_GEMM, CONV_DIRECT, CONV_WINOGRAD_2X2, CONV_WINOGRAD_4X4
+} CONV_ALGORITHM;
+
+typedef enum{
+    FSPT_SAMPLING_ALL, FSPT_SAMPLING_RESERVOIR, FSPT_SAMPLING_STRATIFIED
+} FSPT_SAMPLING;
+
 typedef struct{
     int batch;
     float learning_rate;
@@ -250,6 +263,15 @@ struct layer{
 
     float * weights;
     float * weight_updates;
+    CONV_ALGORITHM conv_algo;
+    float * winograd_weights;
+
+    /* int8 inference, see quantize_network */
+    signed char * qweights;
+    float * qweight_scales;
+    float qinput_scale;
+    struct qgemm_weights * qpacked;
+    unsigned char * qinput;
 
     float * delta;
     float * output;
@@ -303,11 +325,27 @@ struct layer{
 
     float *fspt_input;
     fspt_t **fspts;
+    int fspt_ensemble_size;        // number of fspts per class.
+    int fspt_ensemble_bootstrap;   // members fitted on bootstrap samples.
+    ENSEMBLE_AGGREGATION fspt_ensemble_aggregation;
+    fspt_t **fspt_ensemble;        // size classes * fspt_ensemble_size. The
+                                   // member 0 of class c is fspts[c].
+    int fspt_compact;              // inference only: compact fspts on load.
+    int fspt_compact_bounds;       // keep the feature limits of the leaves.
     float **fspt_training_data;
     size_t *fspt_n_training_data;
     size_t *fspt_n_max_training_data;
     struct criterion_args fspt_criterion_args;
     struct score_args fspt_score_args;
+    struct fspt_reduction *fspt_reduction;
+    float fspt_simplify_thresh;
+    float fspt_simplify_tolerance;
+    FSPT_SAMPLING fspt_sampling;
+    size_t fspt_max_samples;       // per class. 0 means no cap.
+    size_t *fspt_n_seen_data;      // per class. Samples met during extraction.
+    size_t *fspt_stratum_seen;     // size classes * n. Per anchor mask.
+    size_t *fspt_stratum_kept;     // size classes * n. Per anchor mask.
+    int **fspt_training_strata;    // stratum of each kept sample. -1 if unknown.
     int save_samples;
     int load_samples;
 
@@ -506,6 +544,11 @@ struct network{
     float *truth;
     float *delta;
     float *workspace;
+    float *arena;  // shared layer outputs, see plan_network_memory.
+    struct network_profile *profile;  // see profile_network.
+    struct network_replicas *replicas;  // see replicate_network.
+    void *weights_map;  // mapped weights file, see save_mapped_weights.
+    size_t weights_map_size;
     int train;
     int train_fspt;
     int index;
@@ -604,6 +647,7 @@ typedef struct load_args{
     image *resized;
     data_type type;
     tree *hierarchy;
+    unsigned long seed; // seed of the loading threads. Set by load_data.
 } load_args;
 
 typedef struct{
@@ -699,16 +743,60 @@ int option_find_int(list *l, char *key, int def);
 int option_find_int_quiet(list *l, char *key, int def);
 
 network *parse_network_cfg(char *filename);
+/* Network using the layers of base, except its fspt layers parsed from
+ * filename. Returns 0 when filename doesn't have the layers of base. Free it
+ * with free_network_view, before base. */
+network *parse_network_view_cfg(network *base, char *filename);
 void save_weights(network *net, char *filename);
 void load_weights(network *net, char *filename);
 void save_weights_upto(network *net, char *filename, int cutoff);
+/* Writes the weights with each tensor page aligned. load_weights maps such a
+ * file and the layers use the mapped tensors in place, shared between the
+ * processes until written (copy-on-write). Layers fused before saving are
+ * loaded fused. Recurrent layers are not supported. */
+void save_mapped_weights(network *net, char *filename);
 void load_weights_upto(network *net, char *filename, int start, int cutoff);
+/* Loads only the fspt trees of filename, skipping the weights of the other
+ * layers. */
+void load_fspt_weights(network *net, char *filename);
 
 void zero_objectness(layer l);
 void get_region_detections(layer l, int w, int h, int netw, int neth, float thresh, int *map, float tree_thresh, int relative, detection *dets);
 int get_yolo_detections(layer l, int w, int h, int netw, int neth, float thresh, int *map, int relative, detection *dets);
 void free_network(network *net);
+/* Frees a network made by parse_network_view_cfg and its fspt layers. */
+void free_network_view(network *view);
 void set_batch_network(network *net, int b);
+/* Folds batchnorm into conv/connected weights. Inference only: the network
+ * can no longer be trained afterwards. */
+void fuse_network(network *net);
+/* Inference only. Places the layer outputs whose lifetimes do not overlap in
+ * a shared arena and frees the delta and training buffers. Only the outputs
+ * of the detection layers, of the fspt inputs and of the last layer are valid
+ * after forward_network. The batch can't grow and the network can't be
+ * resized or trained afterwards. Returns the arena size in bytes, 0 if the
+ * network was not planned. */
+size_t plan_network_memory(network *net);
+/* Inference only, on the cpu. Fuses batchnorm, calibrates the input scale of
+ * each conv/connected layer on the n images (letterboxed to the network
+ * size) and quantizes their weights per output channel; these layers then
+ * run in int8. save_weights stores the int8 weights after the float ones. */
+void quantize_network(network *net, char **paths, int n);
+/* Times every layer of forward_network and backward_network and estimates
+ * its flops and bytes, aggregated over the calls. With
+ * network_profile_prefix, the profile is printed and saved in
+ * <prefix>.json and <prefix>.trace.json (chrome://tracing) when the network
+ * is freed or at exit. */
+void profile_network(network *net);
+void print_network_profile(network *net, FILE *stream);
+void save_network_profile(network *net, char *prefix);
+void free_network_profile(network *net);
+/* On the cpu, forward_network splits each batch over n replicas of the
+ * network run by n threads. The replicas share the weights and have their
+ * own per image buffers; the fspt layers extract their samples separately
+ * and merge them afterwards. Inference and fspt extraction only, training
+ * runs on one thread. n < 2 removes the replicas. */
+void replicate_network(network *net, int n);
 void set_temp_network(network *net, float t);
 image load_image(char *filename, int w, int h, int c);
 image load_image_color(char *filename, int w, int h);
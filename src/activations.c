@@ -4,6 +4,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ACTIVATIONS_X86
+#include <immintrin.h>
+#endif
 
 char *get_activation_string(ACTIVATION a)
 {
@@ -102,7 +109,7 @@ float activate(float x, ACTIVATION a)
     return 0;
 }
 
-void activate_array(float *x, const int n, const ACTIVATION a)
+void activate_array_scalar(float *x, const int n, const ACTIVATION a)
 {
     int i;
     for(i = 0; i < n; ++i){
@@ -110,6 +117,217 @@ void activate_array(float *x, const int n, const ACTIVATION a)
     }
 }
 
+/* Cephes expf constants: ln2 split in two for the range reduction and the
+ * degree 5 polynomial of exp(r) - 1 - r on |r| <= ln2/2. */
+#define EXP_HI 88.f
+#define EXP_LO -87.f
+#define EXP_LOG2E 1.44269504088896341f
+#define EXP_C1 .693359375f
+#define EXP_C2 -2.12194440e-4f
+#define EXP_P0 1.9875691500e-4f
+#define EXP_P1 1.3981999507e-3f
+#define EXP_P2 8.3334519073e-3f
+#define EXP_P3 4.1665795894e-2f
+#define EXP_P4 1.6666665459e-1f
+#define EXP_P5 5.0000001201e-1f
+
+float fast_expf(float x)
+{
+    x = x < EXP_HI ? x : EXP_HI;
+    x = x > EXP_LO ? x : EXP_LO;
+    float n = floorf(x*EXP_LOG2E + .5f);
+    float r = x - n*EXP_C1;
+    r = r - n*EXP_C2;
+    float p = EXP_P0;
+    p = p*r + EXP_P1;
+    p = p*r + EXP_P2;
+    p = p*r + EXP_P3;
+    p = p*r + EXP_P4;
+    p = p*r + EXP_P5;
+    p = p*r*r + r + 1;
+    union {int32_t i; float f;} pow2n;
+    pow2n.i = ((int32_t)n + 127) << 23;
+    return p*pow2n.f;
+}
+
+static inline float fast_logistic(float x){return 1.f/(1.f + fast_expf(-x));}
+
+#ifdef ACTIVATIONS_X86
+
+__attribute__((target("avx2,fma")))
+static inline __m256 exp_avx2(__m256 x)
+{
+    x = _mm256_min_ps(x, _mm256_set1_ps(EXP_HI));
+    x = _mm256_max_ps(x, _mm256_set1_ps(EXP_LO));
+    __m256 n = _mm256_floor_ps(_mm256_fmadd_ps(x, _mm256_set1_ps(EXP_LOG2E), _mm256_set1_ps(.5f)));
+    __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(EXP_C1), x);
+    r = _mm256_fnmadd_ps(n, _mm256_set1_ps(EXP_C2), r);
+    __m256 p = _mm256_set1_ps(EXP_P0);
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_P1));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_P2));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_P3));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_P4));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_P5));
+    p = _mm256_fmadd_ps(p, _mm256_mul_ps(r, r), _mm256_add_ps(r, _mm256_set1_ps(1.f)));
+    __m256i e = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+    return _mm256_mul_ps(p, _mm256_castsi256_ps(e));
+}
+
+/* y = scale/(1 + exp(-k x)) + shift covers logistic, loggy, half_loggy and
+ * tanh. */
+__attribute__((target("avx2,fma")))
+static void sigmoid_array_avx2(float *x, int n, float k, float scale, float shift)
+{
+    int i;
+    __m256 one = _mm256_set1_ps(1.f);
+    __m256 vk = _mm256_set1_ps(-k);
+    __m256 vscale = _mm256_set1_ps(scale);
+    __m256 vshift = _mm256_set1_ps(shift);
+    for(i = 0; i + 8 <= n; i += 8){
+        __m256 e = exp_avx2(_mm256_mul_ps(vk, _mm256_loadu_ps(x + i)));
+        __m256 y = _mm256_div_ps(vscale, _mm256_add_ps(one, e));
+        _mm256_storeu_ps(x + i, _mm256_add_ps(y, vshift));
+    }
+    for(; i < n; ++i) x[i] = scale/(1.f + fast_expf(-k*x[i])) + shift;
+}
+
+/* max(x, slope x) is leaky for slope .1 and relu for slope 0 */
+__attribute__((target("avx2,fma")))
+static void leaky_array_avx2(float *x, int n, float slope)
+{
+    int i;
+    __m256 vslope = _mm256_set1_ps(slope);
+    for(i = 0; i + 8 <= n; i += 8){
+        __m256 v = _mm256_loadu_ps(x + i);
+        _mm256_storeu_ps(x + i, _mm256_max_ps(v, _mm256_mul_ps(v, vslope)));
+    }
+    for(; i < n; ++i) x[i] = x[i] > 0 ? x[i] : slope*x[i];
+}
+
+/* y = x >= 0 ? scale x : scale alpha (exp(x) - 1) is elu and selu */
+__attribute__((target("avx2,fma")))
+static void elu_array_avx2(float *x, int n, float scale, float alpha)
+{
+    int i;
+    __m256 vscale = _mm256_set1_ps(scale);
+    __m256 valpha = _mm256_set1_ps(scale*alpha);
+    __m256 one = _mm256_set1_ps(1.f);
+    __m256 zero = _mm256_setzero_ps();
+    for(i = 0; i + 8 <= n; i += 8){
+        __m256 v = _mm256_loadu_ps(x + i);
+        __m256 neg = _mm256_mul_ps(valpha, _mm256_sub_ps(exp_avx2(v), one));
+        __m256 pos = _mm256_mul_ps(vscale, v);
+        _mm256_storeu_ps(x + i, _mm256_blendv_ps(neg, pos, _mm256_cmp_ps(v, zero, _CMP_GE_OQ)));
+    }
+    for(; i < n; ++i) x[i] = x[i] >= 0 ? scale*x[i] : scale*alpha*(fast_expf(x[i]) - 1);
+}
+
+#endif
+
+static int activations_avx2;
+static pthread_once_t activations_once = PTHREAD_ONCE_INIT;
+
+static void activations_init()
+{
+#ifdef ACTIVATIONS_X86
+    __builtin_cpu_init();
+    activations_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+}
+
+static int use_avx2()
+{
+    pthread_once(&activations_once, activations_init);
+    return activations_avx2;
+}
+
+static void sigmoid_array(float *x, int n, float k, float scale, float shift)
+{
+    int i;
+#ifdef ACTIVATIONS_X86
+    if(use_avx2()){
+        sigmoid_array_avx2(x, n, k, scale, shift);
+        return;
+    }
+#endif
+    for(i = 0; i < n; ++i) x[i] = scale/(1.f + fast_expf(-k*x[i])) + shift;
+}
+
+static void elu_array(float *x, int n, float scale, float alpha)
+{
+    int i;
+#ifdef ACTIVATIONS_X86
+    if(use_avx2()){
+        elu_array_avx2(x, n, scale, alpha);
+        return;
+    }
+#endif
+    for(i = 0; i < n; ++i) x[i] = x[i] >= 0 ? scale*x[i] : scale*alpha*(fast_expf(x[i]) - 1);
+}
+
+static void leaky_array(float *x, int n, float slope)
+{
+    int i;
+#ifdef ACTIVATIONS_X86
+    if(use_avx2()){
+        leaky_array_avx2(x, n, slope);
+        return;
+    }
+#endif
+    for(i = 0; i < n; ++i) x[i] = x[i] > 0 ? x[i] : slope*x[i];
+}
+
+/* Dispatches once per call. The loops are branch free so the compiler can
+ * vectorize the ones without a SIMD version. The exponentials use fast_expf,
+ * see activations.h for the error bound. */
+void activate_array(float *x, const int n, const ACTIVATION a)
+{
+    int i;
+    switch(a){
+        case LINEAR:
+            return;
+        case LOGISTIC:
+            sigmoid_array(x, n, 1, 1, 0);
+            return;
+        case LOGGY:
+            sigmoid_array(x, n, 1, 2, -1);
+            return;
+        case HALF_LOGGY:
+            sigmoid_array(x, n, 1, 1, -.5f);
+            return;
+        case TANH:
+            /* tanh(x) = 2 logistic(2x) - 1 */
+            sigmoid_array(x, n, 2, 2, -1);
+            return;
+        case LEAKY:
+            leaky_array(x, n, .1f);
+            return;
+        case RELU:
+            leaky_array(x, n, 0);
+            return;
+        case RELIE:
+            leaky_array(x, n, .01f);
+            return;
+        case RAMP:
+            for(i = 0; i < n; ++i) x[i] = x[i]*(x[i] > 0) + .1f*x[i];
+            return;
+        case ELU:
+            elu_array(x, n, 1, 1);
+            return;
+        case SELU:
+            elu_array(x, n, 1.0507f, 1.6732f);
+            return;
+        case HARDTAN:
+            for(i = 0; i < n; ++i) x[i] = x[i] < -1 ? -1 : (x[i] > 1 ? 1 : x[i]);
+            return;
+        case LHTAN:
+        case PLSE:
+        case STAIR:
+            break;
+    }
+    activate_array_scalar(x, n, a);
+}
+
 float gradient(float x, ACTIVATION a)
 {
     switch(a){
@@ -147,11 +365,39 @@ float gradient(float x, ACTIVATION a)
     return 0;
 }
 
-void gradient_array(const float *x, const int n, const ACTIVATION a, float *delta)
+void gradient_array_scalar(const float *x, const int n, const ACTIVATION a, float *delta)
 {
     int i;
     for(i = 0; i < n; ++i){
         delta[i] *= gradient(x[i], a);
     }
-} 
+}
 
+/* The gradients have no exponential, the type specialized loops are left
+ * to the compiler vectorizer. */
+void gradient_array(const float *x, const int n, const ACTIVATION a, float *delta)
+{
+    int i;
+    switch(a){
+        case LINEAR:
+            return;
+        case LOGISTIC:
+            for(i = 0; i < n; ++i) delta[i] *= (1 - x[i])*x[i];
+            return;
+        case LEAKY:
+            for(i = 0; i < n; ++i) delta[i] *= x[i] > 0 ? 1 : .1f;
+            return;
+        case RELU:
+            for(i = 0; i < n; ++i) delta[i] *= x[i] > 0;
+            return;
+        case RELIE:
+            for(i = 0; i < n; ++i) delta[i] *= x[i] > 0 ? 1 : .01f;
+            return;
+        case TANH:
+            for(i = 0; i < n; ++i) delta[i] *= 1 - x[i]*x[i];
+            return;
+        default:
+            break;
+    }
+    gradient_array_scalar(x, n, a, delta);
+}
@@ -10,7 +10,17 @@ char *get_activation_string(ACTIVATION a);
 float activate(float x, ACTIVATION a);
 float gradient(float x, ACTIVATION a);
 void gradient_array(const float *x, const int n, const ACTIVATION a, float *delta);
+/* Type specialized, with AVX2 kernels for the sigmoids, elu/selu and
+ * leaky/relu. logistic, loggy, half_loggy, tanh, elu and selu use fast_expf
+ * and are within 5e-7 absolutely or 8 ulp of activate, the others within
+ * 1 ulp. */
 void activate_array(float *x, const int n, const ACTIVATION a);
+/* Reference paths calling activate/gradient per element. */
+void activate_array_scalar(float *x, const int n, const ACTIVATION a);
+void gradient_array_scalar(const float *x, const int n, const ACTIVATION a, float *delta);
+/* exp for x in [-87, 88] with a relative error < 1e-7 (float rounding).
+ * Saturates outside. */
+float fast_expf(float x);
 #ifdef GPU
 void activate_array_gpu(float *x, int n, ACTIVATION a);
 void gradient_array_gpu(float *x, int n, ACTIVATION a, float *delta);
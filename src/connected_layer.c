@@ -5,6 +5,7 @@
 #include "cuda.h"
 #include "blas.h"
 #include "gemm.h"
+#include "gemm_int8.h"
 
 #include <math.h>
 #include <stdio.h>
@@ -148,8 +149,22 @@ void update_connected_layer(layer l, update_args a)
     scal_cpu(l.inputs*l.outputs, momentum, l.weight_updates, 1);
 }
 
+/* output[b][o] = activate(W(o, :).input[b] + bias[o]) in int8, the
+ * batchnorm being fused. */
+static void forward_connected_layer_int8(layer l, network net)
+{
+    quantize_u8(net.input, l.inputs*l.batch, l.qinput_scale, l.qinput);
+    qgemm_source b = {l.qinput, 1, l.inputs, 0, 0, 0, 0, 0, 0, 0};
+    qgemm(l.batch, l.qpacked, &b, l.qweight_scales, l.qinput_scale, l.biases,
+            l.activation, l.output, 1, l.outputs);
+}
+
 void forward_connected_layer(layer l, network net)
 {
+    if(l.qpacked){
+        forward_connected_layer_int8(l, net);
+        return;
+    }
     fill_cpu(l.outputs*l.batch, 0, l.output, 1);
     int m = l.batch;
     int k = l.inputs;
@@ -212,6 +227,30 @@ void denormalize_connected_layer(layer l)
 }
 
 
+void fuse_connected_batchnorm(layer *l)
+{
+    if(!l->batch_normalize) return;
+    int i, j;
+    for(i = 0; i < l->outputs; ++i){
+        float scale = l->scales[i]/(sqrt(l->rolling_variance[i]) + .000001f);
+        for(j = 0; j < l->inputs; ++j){
+            l->weights[i*l->inputs + j] *= scale;
+        }
+        l->biases[i] -= l->rolling_mean[i] * scale;
+        l->scales[i] = 1;
+        l->rolling_mean[i] = 0;
+        l->rolling_variance[i] = 1;
+    }
+    l->batch_normalize = 0;
+    /* only used by the batchnorm forward */
+    free(l->x);
+    free(l->x_norm);
+    l->x = l->x_norm = 0;
+#ifdef GPU
+    if(gpu_index >= 0) push_connected_layer(*l);
+#endif
+}
+
 void statistics_connected_layer(layer l)
 {
     if(l.batch_normalize){
@@ -10,6 +10,8 @@ layer make_connected_layer(int batch, int inputs, int outputs, ACTIVATION activa
 void forward_connected_layer(layer l, network net);
 void backward_connected_layer(layer l, network net);
 void update_connected_layer(layer l, update_args a);
+/* Folds the inference batchnorm into the weights and biases. */
+void fuse_connected_batchnorm(layer *l);
 
 #ifdef GPU
 void forward_connected_layer_gpu(layer l, network net);
@@ -281,6 +281,7 @@ void pull_convolutional_layer(layer l)
         cuda_pull_array(l.rolling_mean_gpu, l.rolling_mean, l.n);
         cuda_pull_array(l.rolling_variance_gpu, l.rolling_variance, l.n);
     }
+    transform_convolutional_weights(l);
 }
 
 void push_convolutional_layer(layer l)
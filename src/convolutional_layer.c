@@ -5,7 +5,10 @@
 #include "col2im.h"
 #include "blas.h"
 #include "gemm.h"
+#include "winograd.h"
+#include "gemm_int8.h"
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 
 #ifdef AI2
@@ -83,6 +86,8 @@ image get_convolutional_delta(convolutional_layer l)
     return float_to_image(l.out_w,l.out_h,l.out_c,l.delta);
 }
 
+static size_t get_forward_workspace_size(layer l);
+
 static size_t get_workspace_size(layer l){
 #ifdef CUDNN
     if(gpu_index >= 0){
@@ -115,9 +120,131 @@ static size_t get_workspace_size(layer l){
         return most;
     }
 #endif
+    size_t im2col_size = (size_t)l.out_h*l.out_w*l.size*l.size*l.c/l.groups*sizeof(float);
+#ifdef GPU
+    if(gpu_index >= 0) return im2col_size;
+#endif
+    size_t forward_size = get_forward_workspace_size(l);
+    /* the backward pass always goes through im2col */
+    if(!l.onlyforward && im2col_size > forward_size) return im2col_size;
+    return forward_size;
+}
+
+static int winograd_m(CONV_ALGORITHM algo)
+{
+    return algo == CONV_WINOGRAD_4X4 ? 4 : 2;
+}
+
+static int is_winograd(CONV_ALGORITHM algo)
+{
+    return algo == CONV_WINOGRAD_2X2 || algo == CONV_WINOGRAD_4X4;
+}
+
+static size_t get_forward_workspace_size(layer l)
+{
+    if(l.conv_algo == CONV_DIRECT) return 0;
+    if(is_winograd(l.conv_algo)){
+        return winograd_workspace_size(winograd_m(l.conv_algo), l.n/l.groups, l.c/l.groups, l.out_h, l.out_w);
+    }
+    if(l.size == 1) return 0;
     return (size_t)l.out_h*l.out_w*l.size*l.size*l.c/l.groups*sizeof(float);
 }
 
+CONV_ALGORITHM get_conv_algorithm(char *s)
+{
+    if (strcmp(s, "auto")==0) return CONV_AUTO;
+    if (strcmp(s, "gemm")==0) return CONV_GEMM;
+    if (strcmp(s, "direct")==0) return CONV_DIRECT;
+    if (strcmp(s, "winograd")==0) return CONV_WINOGRAD_2X2;
+    if (strcmp(s, "winograd4")==0) return CONV_WINOGRAD_4X4;
+    fprintf(stderr, "Couldn't find conv algorithm %s, going with auto\n", s);
+    return CONV_AUTO;
+}
+
+CONV_ALGORITHM select_convolutional_algorithm(convolutional_layer l, CONV_ALGORITHM requested)
+{
+    int winograd_ok = l.size == 3 && l.stride == 1 && !l.binary && !l.xnor;
+    int direct_ok = !l.xnor;
+    if(is_winograd(requested) && !winograd_ok){
+        fprintf(stderr, "Winograd needs a 3x3 stride 1 convolution, using gemm\n");
+        return CONV_GEMM;
+    }
+    if(requested == CONV_DIRECT && !direct_ok){
+        fprintf(stderr, "Direct convolution does not support xnor, using gemm\n");
+        return CONV_GEMM;
+    }
+    if(requested != CONV_AUTO) return requested;
+    /* the transforms are amortized over the channels but run on one
+     * thread : with several gemm threads im2col + gemm scales better */
+    if(winograd_ok && gemm_get_threads() == 1 && l.c/l.groups >= 128
+            && l.n/l.groups >= 64 && l.out_h*l.out_w >= 400) return CONV_WINOGRAD_2X2;
+    /* depthwise : the gemm would have a single row */
+    if(direct_ok && l.size > 1 && l.c/l.groups == 1) return CONV_DIRECT;
+    return CONV_GEMM;
+}
+
+void transform_convolutional_weights(convolutional_layer l)
+{
+    if(!is_winograd(l.conv_algo) || !l.winograd_weights) return;
+    int m = winograd_m(l.conv_algo);
+    int j;
+    for(j = 0; j < l.groups; ++j){
+        winograd_transform_weights(m, l.weights + j*l.nweights/l.groups,
+                l.n/l.groups, l.c/l.groups,
+                l.winograd_weights + j*winograd_weights_size(m, l.n/l.groups, l.c/l.groups));
+    }
+}
+
+void set_convolutional_algorithm(convolutional_layer *l, CONV_ALGORITHM algo)
+{
+    l->conv_algo = select_convolutional_algorithm(*l, algo);
+    free(l->winograd_weights);
+    l->winograd_weights = 0;
+    if(is_winograd(l->conv_algo)){
+        int m = winograd_m(l->conv_algo);
+        l->winograd_weights = calloc(l->groups*winograd_weights_size(m, l->n/l->groups, l->c/l->groups), sizeof(float));
+        transform_convolutional_weights(*l);
+    }
+    l->workspace_size = get_workspace_size(*l);
+}
+
+void set_convolutional_forward_only(convolutional_layer *l)
+{
+    l->onlyforward = 1;
+    l->workspace_size = get_workspace_size(*l);
+}
+
+static void direct_convolution(const float *im, int c, int h, int w, int size,
+        int stride, int pad, const float *weights, int n, int out_h, int out_w,
+        float *output)
+{
+    int f, ch, ky, kx, y, x;
+    for(f = 0; f < n; ++f){
+        float *out = output + f*out_h*out_w;
+        for(ch = 0; ch < c; ++ch){
+            const float *plane = im + ch*h*w;
+            for(ky = 0; ky < size; ++ky){
+                for(kx = 0; kx < size; ++kx){
+                    float weight = weights[((f*c + ch)*size + ky)*size + kx];
+                    /* output columns reading inside the image */
+                    int x_lo = 0, x_hi = out_w;
+                    while(x_lo < out_w && x_lo*stride + kx - pad < 0) ++x_lo;
+                    while(x_hi > x_lo && (x_hi - 1)*stride + kx - pad >= w) --x_hi;
+                    for(y = 0; y < out_h; ++y){
+                        int iy = y*stride + ky - pad;
+                        if(iy < 0 || iy >= h) continue;
+                        const float *row = plane + iy*w + kx - pad;
+                        float *o = out + y*out_w;
+                        for(x = x_lo; x < x_hi; ++x){
+                            o[x] += weight*row[x*stride];
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
 #ifdef GPU
 #ifdef CUDNN
 void cudnn_convolutional_setup(layer *l)
@@ -320,7 +447,7 @@ convolutional_layer make_convolutional_layer(int batch, int h, int w, int c, int
 #endif
     }
 #endif
-    l.workspace_size = get_workspace_size(l);
+    set_convolutional_algorithm(&l, CONV_AUTO);
     l.activation = activation;
 
     fprintf(stderr, "conv  %5d %2d x%2d /%2d  %4d x%4d x%4d   ->  %4d x%4d x%4d  %5.3f BFLOPs\n", n, size, size, stride, w, h, c, l.out_w, l.out_h, l.out_c, (2.0 * l.n * l.size*l.size*l.c/l.groups * l.out_h*l.out_w)/1000000000.);
@@ -341,6 +468,34 @@ void denormalize_convolutional_layer(convolutional_layer l)
         l.rolling_mean[i] = 0;
         l.rolling_variance[i] = 1;
     }
+    transform_convolutional_weights(l);
+}
+
+void fuse_convolutional_batchnorm(convolutional_layer *l)
+{
+    if(!l->batch_normalize) return;
+    int i, j;
+    int size = l->c/l->groups*l->size*l->size;
+    for(i = 0; i < l->n; ++i){
+        /* same epsilon as normalize_cpu so the folded layer matches forward */
+        float scale = l->scales[i]/(sqrt(l->rolling_variance[i]) + .000001f);
+        for(j = 0; j < size; ++j){
+            l->weights[i*size + j] *= scale;
+        }
+        l->biases[i] -= l->rolling_mean[i] * scale;
+        l->scales[i] = 1;
+        l->rolling_mean[i] = 0;
+        l->rolling_variance[i] = 1;
+    }
+    l->batch_normalize = 0;
+    /* only used by the batchnorm forward */
+    free(l->x);
+    free(l->x_norm);
+    l->x = l->x_norm = 0;
+    transform_convolutional_weights(*l);
+#ifdef GPU
+    if(gpu_index >= 0) push_convolutional_layer(*l);
+#endif
 }
 
 /*
@@ -383,6 +538,7 @@ void resize_convolutional_layer(convolutional_layer *l, int w, int h)
 
     l->output = realloc(l->output, l->batch*l->outputs*sizeof(float));
     l->delta  = realloc(l->delta,  l->batch*l->outputs*sizeof(float));
+    if(l->qinput) l->qinput = realloc(l->qinput, l->batch*l->inputs);
     if(l->batch_normalize){
         l->x = realloc(l->x, l->batch*l->outputs*sizeof(float));
         l->x_norm  = realloc(l->x_norm, l->batch*l->outputs*sizeof(float));
@@ -433,6 +589,17 @@ void scale_bias(float *output, float *scales, int batch, int n, int size)
     }
 }
 
+/* one pass of output[i][j] = activate(output[i][j] + biases[i]) */
+static void bias_activate(float *output, float *biases, int n, int size, ACTIVATION a)
+{
+    int i, j;
+    for(i = 0; i < n; ++i){
+        float *out = output + i*size;
+        for(j = 0; j < size; ++j) out[j] += biases[i];
+        if(a != LINEAR) activate_array(out, size, a);
+    }
+}
+
 void backward_bias(float *bias_updates, float *delta, int batch, int n, int size)
 {
     int i,b;
@@ -443,12 +610,29 @@ void backward_bias(float *bias_updates, float *delta, int batch, int n, int size
     }
 }
 
+/* int8 weights, bias and activation applied in the qgemm epilogue. The
+ * batchnorm was fused before quantizing. */
+static void forward_convolutional_layer_int8(convolutional_layer l, network net)
+{
+    int i;
+    int n = l.out_w*l.out_h;
+    quantize_u8(net.input, l.inputs*l.batch, l.qinput_scale, l.qinput);
+    for(i = 0; i < l.batch; ++i){
+        qgemm_source b = {l.qinput + i*l.inputs, n, 1, l.c, l.h, l.w, l.size, l.stride, l.pad, l.out_w};
+        if(l.size == 1 && l.stride == 1 && l.pad == 0) b.size = 0;
+        qgemm(n, l.qpacked, &b, l.qweight_scales, l.qinput_scale, l.biases,
+                l.activation, l.output + i*l.outputs, n, 1);
+    }
+}
+
 void forward_convolutional_layer(convolutional_layer l, network net)
 {
     int i, j;
 
-    fill_cpu(l.outputs*l.batch, 0, l.output, 1);
-
+    if(l.qpacked){
+        forward_convolutional_layer_int8(l, net);
+        return;
+    }
     if(l.xnor){
         binarize_weights(l.weights, l.n, l.c/l.groups*l.size*l.size, l.binary_weights);
         swap_binary(&l);
@@ -459,6 +643,8 @@ void forward_convolutional_layer(convolutional_layer l, network net)
     int m = l.n/l.groups;
     int k = l.size*l.size*l.c/l.groups;
     int n = l.out_w*l.out_h;
+    /* without batchnorm, bias and activation are fused in the convolution */
+    int fused = !l.batch_normalize;
     for(i = 0; i < l.batch; ++i){
         for(j = 0; j < l.groups; ++j){
             float *a = l.weights + j*l.nweights/l.groups;
@@ -466,22 +652,37 @@ void forward_convolutional_layer(convolutional_layer l, network net)
             float *c = l.output + (i*l.groups + j)*n*m;
             float *im =  net.input + (i*l.groups + j)*l.c/l.groups*l.h*l.w;
 
+            if (is_winograd(l.conv_algo) || l.conv_algo == CONV_DIRECT) {
+                if (is_winograd(l.conv_algo)) {
+                    int wm = winograd_m(l.conv_algo);
+                    winograd_convolution(wm, im, l.c/l.groups, l.h, l.w, l.pad,
+                            l.winograd_weights + j*winograd_weights_size(wm, m, l.c/l.groups),
+                            m, l.out_h, l.out_w, net.workspace, c);
+                } else {
+                    fill_cpu(n*m, 0, c, 1);
+                    direct_convolution(im, l.c/l.groups, l.h, l.w, l.size, l.stride,
+                            l.pad, a, m, l.out_h, l.out_w, c);
+                }
+                if (fused) bias_activate(c, l.biases + j*m, m, n, l.activation);
+                continue;
+            }
             if (l.size == 1) {
                 b = im;
             } else {
                 im2col_cpu(im, l.c/l.groups, l.h, l.w, l.size, l.stride, l.pad, b);
             }
-            gemm(0,0,m,n,k,1,a,k,b,n,1,c,n);
+            if (fused) {
+                gemm_bias_activate(0,0,m,n,k,1,a,k,b,n,0,c,n, l.biases + j*m, l.activation);
+            } else {
+                gemm(0,0,m,n,k,1,a,k,b,n,0,c,n);
+            }
         }
     }
 
     if(l.batch_normalize){
         forward_batchnorm_layer(l, net);
-    } else {
-        add_bias(l.output, l.biases, l.batch, l.n, l.out_h*l.out_w);
+        activate_array(l.output, l.outputs*l.batch, l.activation);
     }
-
-    activate_array(l.output, l.outputs*l.batch, l.activation);
     if(l.binary || l.xnor) swap_binary(&l);
 }
 
@@ -554,6 +755,7 @@ void update_convolutional_layer(convolutional_layer l, update_args a)
     axpy_cpu(l.nweights, -decay*batch, l.weights, 1, l.weight_updates, 1);
     axpy_cpu(l.nweights, learning_rate/batch, l.weight_updates, 1, l.weights, 1);
     scal_cpu(l.nweights, momentum, l.weight_updates, 1);
+    transform_convolutional_weights(l);
 }
 
 
@@ -574,6 +776,7 @@ void rgbgr_weights(convolutional_layer l)
             rgbgr_image(im);
         }
     }
+    transform_convolutional_weights(l);
 }
 
 void rescale_weights(convolutional_layer l, float scale, float trans)
@@ -587,6 +790,7 @@ void rescale_weights(convolutional_layer l, float scale, float trans)
             l.biases[i] += sum*trans;
         }
     }
+    transform_convolutional_weights(l);
 }
 
 image *get_weights(convolutional_layer l)
@@ -27,6 +27,17 @@ void cudnn_convolutional_setup(layer *l);
 
 convolutional_layer make_convolutional_layer(int batch, int h, int w, int c, int n, int groups, int size, int stride, int padding, ACTIVATION activation, int batch_normalize, int binary, int xnor, int adam);
 void resize_convolutional_layer(convolutional_layer *layer, int w, int h);
+/* Picks the cpu forward algorithm (CONV_AUTO chooses by shape) and
+ * updates the transformed weights and the workspace size. */
+void set_convolutional_algorithm(convolutional_layer *layer, CONV_ALGORITHM algo);
+void set_convolutional_forward_only(convolutional_layer *layer);
+CONV_ALGORITHM select_convolutional_algorithm(convolutional_layer layer, CONV_ALGORITHM requested);
+/* Must be called after any change of layer.weights. */
+void transform_convolutional_weights(convolutional_layer layer);
+CONV_ALGORITHM get_conv_algorithm(char *s);
+/* Folds the inference batchnorm into the weights and biases and clears
+ * batch_normalize, so that forward fuses bias and activation. */
+void fuse_convolutional_batchnorm(convolutional_layer *layer);
 void forward_convolutional_layer(const convolutional_layer layer, network net);
 void update_convolutional_layer(convolutional_layer layer, update_args a);
 image *visualize_convolutional_layer(convolutional_layer layer, char *window, image *prev_weights);
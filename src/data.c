@@ -29,7 +29,7 @@ char **get_random_paths_indexes(char **paths, int n, int m, int *indexes)
     int i;
     pthread_mutex_lock(&mutex);
     for(i = 0; i < n; ++i){
-        int index = rand()%m;
+        int index = rand_int(0, m - 1);
         indexes[i] = index;
         random_paths[i] = paths[index];
         if(i == 0) printf("%s\n", paths[index]);
@@ -62,13 +62,12 @@ char **get_random_paths(char **paths, int n, int m)
 {
     char **random_paths = calloc(n, sizeof(char*));
     int i;
-    pthread_mutex_lock(&mutex);
+    /* no lock : each loading thread draws from its own stream. */
     for(i = 0; i < n; ++i){
-        int index = rand()%m;
+        int index = rand_int(0, m - 1);
         random_paths[i] = paths[index];
         //if(i == 0) printf("%s\n", paths[index]);
     }
-    pthread_mutex_unlock(&mutex);
     return random_paths;
 }
 
@@ -137,7 +136,7 @@ matrix load_image_augment_paths(char **paths, int n, int min, int max, int size,
         } else {
             crop = random_augment_image(im, angle, aspect, min, max, size, size);
         }
-        int flip = rand()%2;
+        int flip = rand_int(0, 1);
         if (flip) flip_image(crop);
         random_distort_image(crop, hue, saturation, exposure);
 
@@ -190,7 +189,7 @@ void randomize_boxes(box_label *b, int n)
     int i;
     for(i = 0; i < n; ++i){
         box_label swap = b[i];
-        int index = rand()%n;
+        int index = rand_int(0, n - 1);
         b[i] = b[index];
         b[index] = swap;
     }
@@ -774,7 +773,7 @@ data load_data_seg(int n, char **paths, int m, int w, int h, int classes, int mi
         augment_args a = random_augment_args(orig, angle, aspect, min, max, w, h);
         image sized = rotate_crop_image(orig, a.rad, a.scale, a.w, a.h, a.dx, a.dy, a.aspect);
 
-        int flip = rand()%2;
+        int flip = rand_int(0, 1);
         if(flip) flip_image(sized);
         random_distort_image(sized, hue, saturation, exposure);
         d.X.vals[i] = sized.data;
@@ -819,7 +818,7 @@ data load_data_iseg(int n, char **paths, int m, int w, int h, int classes, int b
         augment_args a = random_augment_args(orig, angle, aspect, min, max, w, h);
         image sized = rotate_crop_image(orig, a.rad, a.scale, a.w, a.h, a.dx, a.dy, a.aspect);
 
-        int flip = rand()%2;
+        int flip = rand_int(0, 1);
         if(flip) flip_image(sized);
         random_distort_image(sized, hue, saturation, exposure);
         d.X.vals[i] = sized.data;
@@ -859,7 +858,7 @@ data load_data_mask(int n, char **paths, int m, int w, int h, int classes, int b
         augment_args a = random_augment_args(orig, angle, aspect, min, max, w, h);
         image sized = rotate_crop_image(orig, a.rad, a.scale, a.w, a.h, a.dx, a.dy, a.aspect);
 
-        int flip = rand()%2;
+        int flip = rand_int(0, 1);
         if(flip) flip_image(sized);
         random_distort_image(sized, hue, saturation, exposure);
         d.X.vals[i] = sized.data;
@@ -915,7 +914,7 @@ data load_data_region(int n, char **paths, int m, int w, int h, int size, int cl
         float sx = (float)swidth  / ow;
         float sy = (float)sheight / oh;
 
-        int flip = rand()%2;
+        int flip = rand_int(0, 1);
         image cropped = crop_image(orig, pleft, ptop, swidth, sheight);
 
         float dx = ((float)pleft/ow)/sx;
@@ -1001,7 +1000,7 @@ data load_data_compare(int n, char **paths, int m, int classes, int w, int h)
 
 data load_data_swag(char **paths, int n, int classes, float jitter)
 {
-    int index = rand()%n;
+    int index = rand_int(0, n - 1);
     char *random_path = paths[index];
 
     image orig = load_image_color(random_path, 0, 0);
@@ -1034,7 +1033,7 @@ data load_data_swag(char **paths, int n, int classes, float jitter)
     float sx = (float)swidth  / w;
     float sy = (float)sheight / h;
 
-    int flip = rand()%2;
+    int flip = rand_int(0, 1);
     image cropped = crop_image(orig, pleft, ptop, swidth, sheight);
 
     float dx = ((float)pleft/w)/sx;
@@ -1102,7 +1101,7 @@ data load_data_detection(int n, char **paths, int m, int beg, int ordered, int w
 
         random_distort_image(sized, hue, saturation, exposure);
 
-        int flip = rand()%2;
+        int flip = rand_int(0, 1);
         if(flip) flip_image(sized);
         d.X.vals[i] = sized.data;
 
@@ -1119,6 +1118,7 @@ void *load_thread(void *ptr)
 {
     //printf("Loading data: %d\n", rand());
     load_args a = *(struct load_args*)ptr;
+    if (a.seed) thread_rand_stream_seed(a.seed);
     if(a.exposure == 0) a.exposure = 1;
     if(a.saturation == 0) a.saturation = 1;
     if(a.aspect == 0) a.aspect = 1;
@@ -1160,11 +1160,21 @@ void *load_thread(void *ptr)
     return 0;
 }
 
+/**
+ * Draws the seed of a loading thread from the stream of the calling
+ * thread. Never 0, which means no explicit seed.
+ */
+static unsigned long draw_load_seed()
+{
+    return rand_stream_next(thread_rand_stream()) | 1;
+}
+
 pthread_t load_data_in_thread(load_args args)
 {
     pthread_t thread;
     struct load_args *ptr = calloc(1, sizeof(struct load_args));
     *ptr = args;
+    if (!ptr->seed) ptr->seed = draw_load_seed();
     if(pthread_create(&thread, 0, load_thread, ptr)) error("Thread creation failed");
     return thread;
 }
@@ -1180,8 +1190,10 @@ void *load_threads(void *ptr)
     data *buffers = calloc(args.threads, sizeof(data));
     pthread_t *threads = calloc(args.threads, sizeof(pthread_t));
     int beg = args.beg;
+    if (args.seed) thread_rand_stream_seed(args.seed);
     for(i = 0; i < args.threads; ++i){
         args.d = buffers + i;
+        args.seed = draw_load_seed();
         args.n = (i+1) * total/args.threads - i * total/args.threads;
         if (args.ordered) {
             args.beg = beg;
@@ -1215,6 +1227,7 @@ pthread_t load_data(load_args args)
     pthread_t thread;
     struct load_args *ptr = calloc(1, sizeof(struct load_args));
     *ptr = args;
+    ptr->seed = draw_load_seed();
     if(pthread_create(&thread, 0, load_threads, ptr)) error("Thread creation failed");
     return thread;
 }
@@ -1277,7 +1290,7 @@ data load_data_super(char **paths, int n, int m, int w, int h, int scale)
     for(i = 0; i < n; ++i){
         image im = load_image_color(paths[i], 0, 0);
         image crop = random_crop_image(im, w*scale, h*scale);
-        int flip = rand()%2;
+        int flip = rand_int(0, 1);
         if (flip) flip_image(crop);
         image resize = resize_image(crop, w, h);
         d.X.vals[i] = resize.data;
@@ -1483,7 +1496,7 @@ void get_random_batch(data d, int n, float *X, float *y)
 {
     int j;
     for(j = 0; j < n; ++j){
-        int index = rand()%d.X.rows;
+        int index = rand_int(0, d.X.rows - 1);
         memcpy(X+j*d.X.cols, d.X.vals[index], d.X.cols*sizeof(float));
         memcpy(y+j*d.y.cols, d.y.vals[index], d.y.cols*sizeof(float));
     }
@@ -1595,7 +1608,7 @@ void randomize_data(data d)
 {
     int i;
     for(i = d.X.rows-1; i > 0; --i){
-        int index = rand()%i;
+        int index = rand_int(0, i - 1);
         float *swap = d.X.vals[index];
         d.X.vals[index] = d.X.vals[i];
         d.X.vals[i] = swap;
@@ -1672,7 +1685,7 @@ data get_random_data(data d, int num)
 
     int i;
     for(i = 0; i < num; ++i){
-        int index = rand()%d.X.rows;
+        int index = rand_int(0, d.X.rows - 1);
         r.X.vals[i] = d.X.vals[index];
         r.y.vals[i] = d.y.vals[index];
     }
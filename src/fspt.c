@@ -4,10 +4,12 @@
 #include <float.h>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "distance_to_boundary.h"
 #include "fspt_criterion.h"
 #include "fspt_score.h"
+#include "gemm.h"
 #include "list.h"
 #include "uniformity.h"
 #include "utils.h"
@@ -19,7 +21,8 @@
 #define INT_FORMAT "%12d"
 #define LINTFORMAT "%12ld"
 #define LEFTINTFOR "%-12d"
-#define NODE_VERSION 3
+#define NODE_VERSION 5
+#define MIN_LEAVES_PER_SCORE_THREAD 256
 
 /**
  * Computes the volume of a feature space.
@@ -375,9 +378,60 @@ static int cmp_score_vol_n(const void *n1, const void *n2) {
         return (node1->score < node2->score);
 }
 
+/**
+ * Rebuilds the subtree of the compact node i as fspt_nodes without samples.
+ * Only the fields used by get_fspt_stats are filled. The score of the inner
+ * nodes is unknown and set to their min_score.
+ *
+ * \param fspt The compact fspt.
+ * \param i The index of the compact node.
+ * \param parent The parent of the new node.
+ * \param depth The depth of the new node.
+ * \return The new node.
+ */
+static fspt_node *expand_compact_node(fspt_t *fspt, size_t i,
+        fspt_node *parent, int depth) {
+    const fspt_compact_tree *c = fspt->compact;
+    const fspt_compact_node *cn = c->nodes + i;
+    fspt_node *node = calloc(1, sizeof(fspt_node));
+    node->n_features = fspt->n_features;
+    node->fspt = fspt;
+    node->parent = parent;
+    node->depth = depth;
+    node->min_score = cn->min_score;
+    node->max_score = cn->max_score;
+    if (cn->split_feature < 0) {
+        const fspt_leaf_stats *leaf = c->leaves + cn->right;
+        node->type = LEAF;
+        node->n_samples = leaf->n_samples;
+        node->volume = leaf->volume;
+        node->score = leaf->score;
+        node->cause = leaf->cause;
+        return node;
+    }
+    node->type = INNER;
+    node->cause = SPLIT;
+    node->split_feature = cn->split_feature;
+    node->split_value = cn->split_value;
+    node->score = cn->min_score;
+    node->left = expand_compact_node(fspt, i + 1, node, depth + 1);
+    node->right = expand_compact_node(fspt, cn->right, node, depth + 1);
+    node->n_samples = node->left->n_samples + node->right->n_samples;
+    node->volume = node->left->volume + node->right->volume;
+    return node;
+}
+
 fspt_stats *get_fspt_stats(fspt_t *fspt, int n_thresh, double *fspt_thresh,
         int do_uniformity_test) {
     if (!fspt) return NULL;
+    if (!fspt->root && fspt->compact && fspt->compact->n_nodes) {
+        /* The statistics are computed on a sample-free copy of the tree. */
+        fspt->root = expand_compact_node(fspt, 0, NULL, 1);
+        fspt_stats *stats = get_fspt_stats(fspt, n_thresh, fspt_thresh, 0);
+        free_fspt_nodes(fspt->root);
+        fspt->root = NULL;
+        return stats;
+    }
     if (!fspt->root) return NULL;
     /** Default values for thresh if NULL **/
     fspt_stats *stats = calloc(1, sizeof(fspt_stats));
@@ -481,7 +535,7 @@ fspt_stats *get_fspt_stats(fspt_t *fspt, int n_thresh, double *fspt_thresh,
         stats->mean_depth_leaves += node->depth;
         stats->mean_score += node->score;
         double unf_score = 0;
-        if (do_uniformity_test) {
+        if (do_uniformity_test && node->samples) {
             /*
             if (node->n_samples > (size_t) n_features) {
                 struct unf_options options = {0};
@@ -735,6 +789,9 @@ static char *cause_to_string(NON_SPLIT_CAUSE c) {
         case UNIFORMITY:
             return " UNIFORMITY ";
             break;
+        case SIMPLIFY:
+            return "  SIMPLIFY  ";
+            break;
         default:
             return "????????????";
     }
@@ -1022,6 +1079,12 @@ void free_fspt(fspt_t *fspt) {
     if (fspt->feature_importance) free((float *) fspt->feature_importance);
     free_fspt_nodes(fspt->root);
     if (fspt->samples) free(fspt->samples);
+    if (fspt->compact) {
+        free(fspt->compact->nodes);
+        free(fspt->compact->leaves);
+        if (fspt->compact->leaf_bounds) free(fspt->compact->leaf_bounds);
+        free(fspt->compact);
+    }
     //TODO : free c_args/s_args
     free(fspt);
 }
@@ -1092,7 +1155,35 @@ static void merge_nodes(fspt_t *fspt) {
     free_list(nodes);
 }
 
+/**
+ * Finds the leaf of a compact fspt where x falls.
+ *
+ * \param c The compact fspt. Must have at least one node.
+ * \param x The input.
+ * \return The leaf.
+ */
+static const fspt_compact_node *compact_leaf(const fspt_compact_tree *c,
+        const float *x) {
+    const fspt_compact_node *nodes = c->nodes;
+    size_t i = 0;
+    while (nodes[i].split_feature >= 0) {
+        if (x[nodes[i].split_feature] <= nodes[i].split_value)
+            ++i;
+        else
+            i = nodes[i].right;
+    }
+    return nodes + i;
+}
+
 void fspt_predict(size_t n, const fspt_t *fspt, const float *X, float *Y) {
+    if (fspt->compact) {
+        const fspt_compact_tree *c = fspt->compact;
+        for (size_t i = 0; i < n; i++) {
+            Y[i] = c->n_nodes ?
+                compact_leaf(c, X + i * fspt->n_features)->split_value : 0.f;
+        }
+        return;
+    }
     fspt_node **nodes = malloc(n * sizeof(fspt_node *));
     fspt_decision_func(n, fspt, X, nodes);
     for (size_t i = 0; i < n; i++) {
@@ -1106,6 +1197,560 @@ void fspt_predict(size_t n, const fspt_t *fspt, const float *X, float *Y) {
     free(nodes);
 }
 
+void fspt_accept(size_t n, const fspt_t *fspt, const float *X,
+        float thresh, int *accept, float *Y) {
+    int n_features = fspt->n_features;
+    if (fspt->compact) {
+        const fspt_compact_tree *c = fspt->compact;
+        for (size_t i = 0; i < n; i++) {
+            const float *x = X + i * n_features;
+            float score = 0.;
+            if (c->n_nodes) {
+                const fspt_compact_node *node = c->nodes;
+                while (node->split_feature >= 0
+                        && node->min_score < thresh
+                        && node->max_score >= thresh) {
+                    if (x[node->split_feature] <= node->split_value)
+                        ++node;
+                    else
+                        node = c->nodes + node->right;
+                }
+                if (node->split_feature < 0)
+                    score = node->split_value;
+                else if (node->min_score >= thresh)
+                    score = node->min_score;
+                else
+                    score = node->max_score;
+            }
+            accept[i] = score >= thresh;
+            if (Y) Y[i] = score;
+        }
+        return;
+    }
+    for (size_t i = 0; i < n; i++) {
+        const float *x = X + i * n_features;
+        const fspt_node *node = fspt->root;
+        float score = 0.;
+        if (node) {
+            while (node->type != LEAF
+                    && (float) node->min_score < thresh
+                    && (float) node->max_score >= thresh) {
+                if (x[node->split_feature] <= node->split_value) {
+                    node = node->left;
+                } else {
+                    node = node->right;
+                }
+            }
+            if (node->type == LEAF)
+                score = node->score;
+            else if ((float) node->min_score >= thresh)
+                score = node->min_score;
+            else
+                score = node->max_score;
+        }
+        accept[i] = score >= thresh;
+        if (Y) Y[i] = score;
+    }
+}
+
+void fspt_predict_ensemble(size_t n, int n_fspts, fspt_t *const *fspts,
+        ENSEMBLE_AGGREGATION aggregation, const float *X, float *Y) {
+    if (n_fspts == 1) {
+        fspt_predict(n, fspts[0], X, Y);
+        return;
+    }
+    size_t n_samples = 0;
+    for (int k = 0; k < n_fspts; ++k) n_samples += fspts[k]->n_samples;
+    float *Y_k = malloc(n * sizeof(float));
+    int first = 1;
+    for (size_t i = 0; i < n; ++i) Y[i] = 0.f;
+    for (int k = 0; k < n_fspts; ++k) {
+        if (!fspts[k]->n_samples) continue;
+        fspt_predict(n, fspts[k], X, Y_k);
+        if (aggregation == ENSEMBLE_MIN) {
+            for (size_t i = 0; i < n; ++i)
+                if (first || Y_k[i] < Y[i]) Y[i] = Y_k[i];
+        } else {
+            float w = (double) fspts[k]->n_samples / n_samples;
+            for (size_t i = 0; i < n; ++i) Y[i] += w * Y_k[i];
+        }
+        first = 0;
+    }
+    free(Y_k);
+}
+
+void fspt_accept_ensemble(size_t n, int n_fspts, fspt_t *const *fspts,
+        ENSEMBLE_AGGREGATION aggregation, const float *X, float thresh,
+        int *accept, float *Y) {
+    if (n_fspts == 1) {
+        fspt_accept(n, fspts[0], X, thresh, accept, Y);
+        return;
+    }
+    if (aggregation == ENSEMBLE_MEAN) {
+        float *scores = Y ? Y : malloc(n * sizeof(float));
+        fspt_predict_ensemble(n, n_fspts, fspts, aggregation, X, scores);
+        for (size_t i = 0; i < n; ++i) accept[i] = scores[i] >= thresh;
+        if (!Y) free(scores);
+        return;
+    }
+    int n_features = fspts[0]->n_features;
+    for (size_t i = 0; i < n; ++i) {
+        const float *x = X + i * n_features;
+        int acc = 1;
+        int first = 1;
+        float score = 0.f;
+        for (int k = 0; k < n_fspts && acc; ++k) {
+            if (!fspts[k]->n_samples) continue;
+            float score_k;
+            fspt_accept(1, fspts[k], x, thresh, &acc, &score_k);
+            if (first || score_k < score) score = score_k;
+            first = 0;
+        }
+        accept[i] = first ? 0.f >= thresh : acc;
+        if (Y) Y[i] = score;
+    }
+}
+
+/**
+ * Copies the subtree of node in pre-order in the compact fspt c.
+ *
+ * \param node The root of the subtree.
+ * \param c The compact fspt. Its arrays must be large enough.
+ * \param n_features The number of features.
+ * \param bounds The feature limits of node. Restored on return.
+ * \return The index of node in c->nodes.
+ */
+static size_t compact_subtree(const fspt_node *node, fspt_compact_tree *c,
+        int n_features, float *bounds) {
+    size_t index = c->n_nodes++;
+    fspt_compact_node *cn = c->nodes + index;
+    cn->min_score = node->min_score;
+    cn->max_score = node->max_score;
+    if (node->type == LEAF) {
+        cn->split_feature = -1;
+        cn->split_value = node->score;
+        cn->min_score = cn->max_score = node->score;
+        cn->right = c->n_leaves;
+        c->leaves[c->n_leaves] = (fspt_leaf_stats) {node->n_samples,
+            node->volume, node->score, node->depth, node->cause};
+        if (c->leaf_bounds)
+            memcpy(c->leaf_bounds + c->n_leaves * 2 * n_features, bounds,
+                    2 * n_features * sizeof(float));
+        ++c->n_leaves;
+        return index;
+    }
+    int f = node->split_feature;
+    cn->split_feature = f;
+    cn->split_value = node->split_value;
+    float old = bounds[2*f + 1];
+    bounds[2*f + 1] = node->split_value;
+    compact_subtree(node->left, c, n_features, bounds);
+    bounds[2*f + 1] = old;
+    old = bounds[2*f];
+    bounds[2*f] = node->split_value;
+    size_t right = compact_subtree(node->right, c, n_features, bounds);
+    bounds[2*f] = old;
+    c->nodes[index].right = right;
+    return index;
+}
+
+/**
+ * Counts the nodes and the leaves of a subtree.
+ */
+static void count_nodes(const fspt_node *node, size_t *n_nodes,
+        size_t *n_leaves) {
+    if (!node) return;
+    ++*n_nodes;
+    if (node->type == LEAF) {
+        ++*n_leaves;
+        return;
+    }
+    count_nodes(node->left, n_nodes, n_leaves);
+    count_nodes(node->right, n_nodes, n_leaves);
+}
+
+void fspt_compact(fspt_t *fspt, int cache_bounds) {
+    if (fspt->compact) return;
+    fspt_compact_tree *c = calloc(1, sizeof(fspt_compact_tree));
+    size_t n_nodes = 0;
+    size_t n_leaves = 0;
+    count_nodes(fspt->root, &n_nodes, &n_leaves);
+    if (n_nodes) {
+        int n_features = fspt->n_features;
+        c->nodes = malloc(n_nodes * sizeof(fspt_compact_node));
+        c->leaves = malloc(n_leaves * sizeof(fspt_leaf_stats));
+        if (cache_bounds)
+            c->leaf_bounds = malloc(n_leaves * 2 * n_features * sizeof(float));
+        float *bounds = copy_float_array(2 * n_features, fspt->feature_limit);
+        compact_subtree(fspt->root, c, n_features, bounds);
+        free(bounds);
+    }
+    free_fspt_nodes(fspt->root);
+    fspt->root = NULL;
+    if (fspt->samples) free(fspt->samples);
+    fspt->samples = NULL;
+    fspt->compact = c;
+}
+
+size_t fspt_memory_size(const fspt_t *fspt) {
+    size_t size = sizeof(fspt_t) + 3 * fspt->n_features * sizeof(float);
+    size_t n_nodes = 0;
+    size_t n_leaves = 0;
+    count_nodes(fspt->root, &n_nodes, &n_leaves);
+    size += n_nodes * sizeof(fspt_node);
+    if (fspt->samples)
+        size += fspt->n_samples * fspt->n_features * sizeof(float);
+    const fspt_compact_tree *c = fspt->compact;
+    if (c) {
+        size += sizeof(fspt_compact_tree)
+            + c->n_nodes * sizeof(fspt_compact_node)
+            + c->n_leaves * sizeof(fspt_leaf_stats);
+        if (c->leaf_bounds)
+            size += c->n_leaves * 2 * fspt->n_features * sizeof(float);
+    }
+    return size;
+}
+
+ENSEMBLE_AGGREGATION string_to_ensemble_aggregation(const char *s) {
+    if (strcmp(s, "min") == 0) return ENSEMBLE_MIN;
+    return ENSEMBLE_MEAN;
+}
+
+/**
+ * Computes recursively the min_score and max_score of the subtrees.
+ * The scores of the leaves must be computed.
+ *
+ * \param node The root of the subtree.
+ */
+static void compute_score_bounds(fspt_node *node) {
+    if (!node) return;
+    if (node->type == LEAF) {
+        node->min_score = node->score;
+        node->max_score = node->score;
+        return;
+    }
+    compute_score_bounds(node->left);
+    compute_score_bounds(node->right);
+    node->min_score = MIN(node->left->min_score, node->right->min_score);
+    node->max_score = MAX(node->left->max_score, node->right->max_score);
+}
+
+/**
+ * Sums the score * volume and the volume of the leaves of a subtree.
+ *
+ * \param node The root of the subtree.
+ * \param volume Output parameter. Will be increased by the volume of the
+ *               leaves.
+ * \return The sum of score * volume of the leaves.
+ */
+static double leaves_score_volume(const fspt_node *node, double *volume) {
+    if (node->type == LEAF) {
+        *volume += node->volume;
+        return node->score * node->volume;
+    }
+    return leaves_score_volume(node->left, volume)
+        + leaves_score_volume(node->right, volume);
+}
+
+/**
+ * Helper function to collapse the subtrees in fspt_simplify.
+ * This function does not update the fspt (like depth or n_nodes).
+ *
+ * \param node The root of the subtree to recursively simplify.
+ * \param thresh see fspt_simplify.
+ * \param tolerance see fspt_simplify.
+ */
+static void recursive_simplify(fspt_node *node, float thresh,
+        double tolerance) {
+    if (!node || node->type == LEAF) return;
+    int same_side = thresh >= 0
+        && ((float) node->min_score >= thresh
+                || (float) node->max_score < thresh);
+    int close_scores = tolerance > 0
+        && node->max_score - node->min_score <= tolerance;
+    if (!same_side && !close_scores) {
+        recursive_simplify(node->left, thresh, tolerance);
+        recursive_simplify(node->right, thresh, tolerance);
+        return;
+    }
+    double volume = 0;
+    double score = leaves_score_volume(node, &volume);
+    score = volume > 0 ? score / volume
+        : (node->min_score + node->max_score) / 2;
+    /* keeps the decision even with rounding errors */
+    score = MIN(MAX(score, node->min_score), node->max_score);
+    free_fspt_nodes(node->right);
+    free_fspt_nodes(node->left);
+    node->right = NULL;
+    node->left = NULL;
+    node->type = LEAF;
+    node->cause = SIMPLIFY;
+    node->split_feature = 0;
+    node->split_value = 0.f;
+    node->score = score;
+    node->min_score = score;
+    node->max_score = score;
+}
+
+/**
+ * Recomputes fspt->n_nodes and fspt->depth after collapsing subtrees.
+ *
+ * \param fspt The fspt.
+ * \return The number of removed nodes.
+ */
+static size_t update_fspt_size(fspt_t *fspt) {
+    size_t n_nodes = fspt->n_nodes;
+    list *nodes = fspt_nodes_to_list(fspt, PRE_ORDER);
+    fspt->n_nodes = nodes->size;
+    fspt_node *current_node;
+    int depth = 0;
+    while ((current_node = (fspt_node *) list_pop(nodes))) {
+        if (current_node->depth > depth) depth = current_node->depth;
+    }
+    fspt->depth = depth;
+    free_list(nodes);
+    return n_nodes - fspt->n_nodes;
+}
+
+/**
+ * Copies recursively the nodes of a subtree. The copies point to the same
+ * samples.
+ *
+ * \param node The root of the subtree to copy.
+ * \param parent The parent of the copy.
+ * \param fspt The fspt that contains the copy.
+ * \return The copy of node.
+ */
+static fspt_node *copy_fspt_nodes(const fspt_node *node, fspt_node *parent,
+        fspt_t *fspt) {
+    if (!node) return NULL;
+    fspt_node *copy = malloc(sizeof(fspt_node));
+    if (!copy) malloc_error();
+    *copy = *node;
+    copy->parent = parent;
+    copy->fspt = fspt;
+    copy->left = copy_fspt_nodes(node->left, copy, fspt);
+    copy->right = copy_fspt_nodes(node->right, copy, fspt);
+    return copy;
+}
+
+void fspt_copy_nodes(const fspt_t *fspt, fspt_t *copy) {
+    copy->root = copy_fspt_nodes(fspt->root, NULL, copy);
+}
+
+size_t fspt_simplify(fspt_t *fspt, float thresh, double tolerance) {
+    if (!fspt->root) return 0;
+    recursive_simplify(fspt->root, thresh, tolerance);
+    compute_score_bounds(fspt->root);
+    return update_fspt_size(fspt);
+}
+
+/**
+ * Helper function to collapse the nodes in fspt_prune.
+ * This function does not update the fspt (like depth or n_nodes).
+ *
+ * \param node The root of the subtree to recursively prune.
+ * \param c_args The stricter criterion args.
+ * \param count The number of consecutive gain threshold violations of the
+ *              ancestors of node.
+ */
+static void recursive_prune(fspt_node *node, criterion_args *c_args,
+        int count) {
+    if (!node || node->type == LEAF) return;
+    fspt_t *fspt = node->fspt;
+    /* as in gini_criterion, the gain threshold is ignored when the
+     * uniformity is always tested */
+    int violation =
+        c_args->uniformity_test_level != ALLWAYS_TEST_UNIFORMITY
+        && node->gain < c_args->gini_gain_thresh;
+    NON_SPLIT_CAUSE cause = SPLIT;
+    if (node->n_samples + node->n_empty
+            < (size_t) 2 * weighted_min_samples(c_args)) {
+        ++c_args->count_min_samples_hit;
+        cause = MIN_SAMPLES;
+    } else if (node->depth >= c_args->max_depth) {
+        ++c_args->count_max_depth_hit;
+        cause = MAX_DEPTH;
+    } else if (node->volume < 2 * c_args->min_volume_p * fspt->volume) {
+        ++c_args->count_min_volume_p_hit;
+        cause = MIN_VOLUME;
+    } else if (violation
+            && count >= c_args->max_consecutive_gain_violations) {
+        ++c_args->count_max_count_hit;
+        cause = MAX_COUNT;
+    } else if (c_args->min_length_p > 0.) {
+        float *feature_limit = get_feature_limit(node);
+        if (!respect_min_lenght_p(fspt->n_features, fspt->feature_limit,
+                    feature_limit, c_args->min_length_p)) {
+            ++c_args->count_min_length_p_hit;
+            cause = MIN_LENGTH;
+        }
+        free(feature_limit);
+    }
+    if (cause == SPLIT) {
+        count = violation ? count + 1 : 0;
+        recursive_prune(node->left, c_args, count);
+        recursive_prune(node->right, c_args, count);
+        return;
+    }
+    free_fspt_nodes(node->right);
+    free_fspt_nodes(node->left);
+    node->right = NULL;
+    node->left = NULL;
+    node->type = LEAF;
+    node->cause = cause;
+    node->split_feature = 0;
+    node->split_value = 0.f;
+    node->gain = 0.;
+}
+
+/**
+ * Helper function to recompute the gain violation counts of a pruned fspt
+ * before merging its nodes. The counts are the ones fspt_fit would have
+ * set with c_args, after their propagation (see propagate_count).
+ *
+ * \param node The root of the subtree to recount.
+ * \param c_args The criterion args of the pruning.
+ * \param count The count inherited from the parent of node.
+ * \return The count of node.
+ */
+static int recursive_recount(fspt_node *node, criterion_args *c_args,
+        int count) {
+    node->count = count;
+    if (node->type == LEAF) return count;
+    int violation =
+        c_args->uniformity_test_level != ALLWAYS_TEST_UNIFORMITY
+        && node->gain < c_args->gini_gain_thresh;
+    node->count = violation ? count + 1 : 0;
+    int left = recursive_recount(node->left, c_args, node->count);
+    int right = recursive_recount(node->right, c_args, node->count);
+    if (node->count) node->count = left < right ? left : right;
+    return node->count;
+}
+
+size_t fspt_prune(fspt_t *fspt, criterion_args *c_args) {
+    c_args->fspt = fspt;
+    fspt->c_args = c_args;
+    if (!fspt->root) return 0;
+    recursive_prune(fspt->root, c_args, 0);
+    if (c_args->merge_nodes) {
+        recursive_recount(fspt->root, c_args, 0);
+        recursive_merge_nodes(fspt->root);
+    }
+    return update_fspt_size(fspt);
+}
+
+typedef struct score_leaves_args {
+    fspt_t *fspt;
+    fspt_node **leaves;
+    size_t n_leaves;
+    size_t start;
+    size_t end;
+    int n_variants;
+    score_args *variants;              // size n_variants.
+    double *scores;                    // size n_variants * n_leaves or NULL.
+    score_vol_n **score_vol_n_arrays;  // size n_variants or NULL.
+} score_leaves_args;
+
+static void score_leaves_range(score_leaves_args *a) {
+    fspt_t *fspt = a->fspt;
+    for (size_t i = a->start; i < a->end; ++i) {
+        fspt_node *leaf = a->leaves[i];
+        for (int v = 0; v < a->n_variants; ++v) {
+            score_args *s_args = a->variants + v;
+            s_args->node = leaf;
+            double score = fspt->score(s_args);
+            if (a->scores)
+                a->scores[v * a->n_leaves + i] = score;
+            else
+                leaf->score = score;
+            if (a->score_vol_n_arrays && a->score_vol_n_arrays[v]) {
+                a->score_vol_n_arrays[v][i] =
+                    (score_vol_n) {
+                        score,
+                        leaf->volume / fspt->volume,
+                        leaf->n_samples,
+                        leaf->cause,
+                        0.   // TODO: compute uniformity score
+                    };
+            }
+        }
+    }
+}
+
+static void score_leaves_task(void *arg, int task, void *buffer) {
+    score_leaves_range((score_leaves_args *) arg + task);
+}
+
+/**
+ * Scores the leaves for each score args of variants. The scores are stored
+ * in the leaves when scores is NULL. The first leaf is scored with the
+ * given variants so that the lazy initializations of the score functions
+ * happen once, the other leaves are split in up to variants[0].n_threads
+ * contiguous ranges scored on the gemm thread pool with private copies of
+ * the variants.
+ */
+static void score_leaves(fspt_t *fspt, fspt_node **leaves, size_t n_leaves,
+        int n_variants, score_args *variants, double *scores,
+        score_vol_n **score_vol_n_arrays) {
+    if (!n_leaves) return;
+    score_leaves_args a = {fspt, leaves, n_leaves, 0, 1, n_variants,
+        variants, scores, score_vol_n_arrays};
+    score_leaves_range(&a);
+    size_t n_threads = variants[0].n_threads > 1 ? variants[0].n_threads : 1;
+    if (n_threads > (n_leaves - 1) / MIN_LEAVES_PER_SCORE_THREAD)
+        n_threads = (n_leaves - 1) / MIN_LEAVES_PER_SCORE_THREAD;
+    if (n_threads <= 1) {
+        a.start = 1;
+        a.end = n_leaves;
+        score_leaves_range(&a);
+        return;
+    }
+    score_leaves_args *args = calloc(n_threads, sizeof(score_leaves_args));
+    score_args *copies = calloc(n_threads * n_variants, sizeof(score_args));
+    size_t chunk = (n_leaves - 1 + n_threads - 1) / n_threads;
+    for (size_t t = 0; t < n_threads; ++t) {
+        memcpy(copies + t * n_variants, variants,
+                n_variants * sizeof(score_args));
+        args[t] = a;
+        args[t].variants = copies + t * n_variants;
+        args[t].start = MIN(1 + t * chunk, n_leaves);
+        args[t].end = MIN(1 + (t + 1) * chunk, n_leaves);
+    }
+    gemm_parallel_for(n_threads, score_leaves_task, args);
+    free(copies);
+    free(args);
+}
+
+/**
+ * Scores the leaves of fspt with s_args and normalizes the scores if the
+ * score function needs it.
+ */
+static void score_and_normalize_leaves(fspt_t *fspt, score_args *s_args,
+        fspt_node **leaves, size_t n_leaves, int score, double *score_time,
+        double *normalize_time) {
+    score_vol_n *score_vol_n_array = NULL;
+    if (s_args->need_normalize)
+        score_vol_n_array = calloc(n_leaves, sizeof(score_vol_n));
+    double start = what_time_is_it_now();
+    if (score)
+        score_leaves(fspt, leaves, n_leaves, 1, s_args, NULL,
+                &score_vol_n_array);
+    if (score_time) *score_time += what_time_is_it_now() - start;
+    if (s_args->need_normalize) {
+        start = what_time_is_it_now();
+        s_args->normalize_pass = 1;
+        s_args->score_vol_n_array = score_vol_n_array;
+        score_leaves(fspt, leaves, n_leaves, 1, s_args, NULL, NULL);
+        if (normalize_time) *normalize_time += what_time_is_it_now() - start;
+    }
+    compute_score_bounds(fspt->root);
+    free(score_vol_n_array);
+    /* s_args can be reused to fit or rescore */
+    s_args->score_vol_n_array = NULL;
+    s_args->normalize_pass = 0;
+}
+
 void fspt_rescore(fspt_t *fspt, score_args *s_args) {
     s_args->fspt = fspt;
     fspt->s_args = s_args;
@@ -1116,42 +1761,72 @@ void fspt_rescore(fspt_t *fspt, score_args *s_args) {
     list *leaves = fspt_leaves_to_list(fspt, PRE_ORDER);
     s_args->n_leaves = leaves->size;
     fspt_node **leaves_array = (fspt_node **) list_to_array(leaves);
-    score_vol_n *score_vol_n_array = NULL;;
-    if (s_args->need_normalize)
-        score_vol_n_array = calloc(leaves->size, sizeof(score_vol_n));
-    for (int i = 0; i < leaves->size; ++i) {
-        fspt_node *leaf = leaves_array[i];
-        s_args->node = leaf;
-        leaf->score = fspt->score(s_args);
-        if (s_args->need_normalize) {
-            score_vol_n_array[i] =
-                (score_vol_n) {
-                    leaf->score,
-                    leaf->volume / fspt->volume,
-                    leaf->n_samples,
-                    leaf->cause,
-                    0.   // TODO: compute uniformity score
-                };
-        }
+    score_and_normalize_leaves(fspt, s_args, leaves_array, leaves->size, 1,
+            NULL, NULL);
+    free(leaves_array);
+    free_list(leaves);
+}
+
+double *fspt_rescore_variants(fspt_t *fspt, int n_variants,
+        score_args *variants, size_t *n_leaves) {
+    list *leaves = fspt_leaves_to_list(fspt, PRE_ORDER);
+    size_t n = leaves->size;
+    fspt_node **leaves_array = (fspt_node **) list_to_array(leaves);
+    score_vol_n **score_vol_n_arrays =
+        calloc(n_variants, sizeof(score_vol_n *));
+    for (int v = 0; v < n_variants; ++v) {
+        score_args *s_args = variants + v;
+        s_args->fspt = fspt;
+        s_args->discover = 1;
+        fspt->score(s_args);
+        s_args->n_leaves = n;
+        s_args->normalize_pass = 0;
+        if (s_args->need_normalize)
+            score_vol_n_arrays[v] = calloc(n, sizeof(score_vol_n));
     }
-    /* normalize */
-    if (s_args->need_normalize) {
-        s_args->normalize_pass = 1;
-        qsort(score_vol_n_array, leaves->size, sizeof(score_vol_n),
-                cmp_score_vol_n);
-        s_args->score_vol_n_array = score_vol_n_array;
-        for (int i = 0; i < leaves->size; ++i) {
-            s_args->node = leaves_array[i];
-            leaves_array[i]->score = fspt->score(s_args);
-        }
+    double *scores = calloc(n_variants * n, sizeof(double));
+    score_leaves(fspt, leaves_array, n, n_variants, variants, scores,
+            score_vol_n_arrays);
+    for (int v = 0; v < n_variants; ++v) {
+        score_args *s_args = variants + v;
+        if (!s_args->need_normalize) continue;
+        s_args->score_vol_n_array = score_vol_n_arrays[v];
+        for (size_t i = 0; i < n; ++i)
+            scores[v * n + i] =
+                fspt_normalize_score(s_args, scores[v * n + i]);
+        s_args->score_vol_n_array = NULL;
+        free(score_vol_n_arrays[v]);
+    }
+    free(score_vol_n_arrays);
+    free(leaves_array);
+    free_list(leaves);
+    if (n_leaves) *n_leaves = n;
+    return scores;
+}
+
+void fspt_set_leaf_scores(fspt_t *fspt, const double *scores) {
+    list *leaves = fspt_leaves_to_list(fspt, PRE_ORDER);
+    fspt_node **leaves_array = (fspt_node **) list_to_array(leaves);
+    for (int i = 0; i < leaves->size; ++i) {
+        leaves_array[i]->score = scores[i];
     }
-    free(score_vol_n_array);
     free(leaves_array);
     free_list(leaves);
+    compute_score_bounds(fspt->root);
 }
 
 void fspt_fit(size_t n_samples, float *X, criterion_args *c_args,
         score_args *s_args, fspt_t *fspt) {
+    double fit_start = what_time_is_it_now();
+    double start;
+    fspt_fit_profile *profile = &fspt->profile;
+    *profile = (fspt_fit_profile) {0};
+    c_args->profile = profile;
+    /* The fit only draws from its own stream : it is reproducible whatever
+     * the number of fspts fitted in parallel. */
+    rand_stream rng;
+    rand_stream_seed(&rng, c_args->seed, c_args->stream_id);
+    c_args->rng = &rng;
     c_args->fspt = fspt;
     s_args->fspt = fspt;
     // TODO: what to do to have no double free ?
@@ -1168,6 +1843,7 @@ void fspt_fit(size_t n_samples, float *X, criterion_args *c_args,
     root->fspt = fspt;
     root->parent = NULL;
     root->volume = fspt->volume;
+    profile->bytes_allocated += sizeof(fspt_node);
     /* Update fspt */
     fspt->n_nodes = 1;
     fspt->n_samples = n_samples;
@@ -1185,13 +1861,23 @@ void fspt_fit(size_t n_samples, float *X, criterion_args *c_args,
         s_args->node = root;
         root->score = fspt->score(s_args);
     }
-    if (!n_samples) return;
+    if (!n_samples) {
+        compute_score_bounds(root);
+        profile->nodes_per_depth[0] = 1;
+        profile->total_time = what_time_is_it_now() - fit_start;
+        c_args->rng = NULL;
+        return;
+    }
 
     list *fifo = make_list(); // fifo of the nodes to examine
     list_insert(fifo, (void *)root);
     while (fifo->size > 0) {
         fspt_node *current_node = (fspt_node *) list_pop(fifo);
         c_args->node = current_node;
+        int depth_index = current_node->depth - 1;
+        if (depth_index >= FSPT_PROFILE_MAX_DEPTH)
+            depth_index = FSPT_PROFILE_MAX_DEPTH - 1;
+        ++profile->nodes_per_depth[depth_index];
         fspt->criterion(c_args);
         if (c_args->forbidden_split) {
             debug_print(
@@ -1199,20 +1885,32 @@ void fspt_fit(size_t n_samples, float *X, criterion_args *c_args,
                     current_node, current_node->depth,
                     current_node->n_samples);
             if (s_args->score_during_fit) {
+                start = what_time_is_it_now();
                 s_args->node = current_node;
                 current_node->score = fspt->score(s_args);
+                profile->score_time += what_time_is_it_now() - start;
             }
         } else {
+            start = what_time_is_it_now();
             fspt_node *left = calloc(1, sizeof(fspt_node));
             fspt_node *right = calloc(1, sizeof(fspt_node));
             fspt_split(fspt, current_node, c_args->best_index,
                     c_args->best_split, left, right);
+            current_node->gain = c_args->best_gain;
+            profile->split_time += what_time_is_it_now() - start;
+            profile->bytes_allocated += 2 * sizeof(fspt_node)
+                + 2 * fspt->n_features * sizeof(float);
             if (c_args->increment_count) {
                 ++current_node->count;
                 left->count = current_node->count;
                 right->count = current_node->count;
             }
-            propagate_count(fspt, current_node);
+            if (current_node->count)
+                propagate_count(fspt, current_node);
+            else if (current_node->parent)
+                /* the criterion reset the count of a split without gain
+                 * violation, the chain of violations above it ends. */
+                propagate_count(fspt, current_node->parent);
             list_insert_front(fifo, right);
             list_insert_front(fifo, left);
         }
@@ -1224,39 +1922,15 @@ void fspt_fit(size_t n_samples, float *X, criterion_args *c_args,
     list *leaves = fspt_leaves_to_list(fspt, PRE_ORDER);
     s_args->n_leaves = leaves->size;
     fspt_node **leaves_array = (fspt_node **) list_to_array(leaves);
-    score_vol_n *score_vol_n_array = NULL;;
-    if (s_args->need_normalize)
-        score_vol_n_array = calloc(leaves->size, sizeof(score_vol_n));
-    if (!s_args->score_during_fit) {
-        for (int i = 0; i < leaves->size; ++i) {
-            fspt_node *leaf = leaves_array[i];
-            s_args->node = leaf;
-            leaf->score = fspt->score(s_args);
-            if (s_args->need_normalize) {
-                score_vol_n_array[i] =
-                    (score_vol_n) {
-                        leaf->score,
-                        leaf->volume / fspt->volume,
-                        leaf->n_samples,
-                        leaf->cause,
-                        0. //TODO: compute uniformity score
-                    };
-            }
-        }
-    }
-    if (s_args->need_normalize) {
-        s_args->normalize_pass = 1;
-        qsort(score_vol_n_array, leaves->size, sizeof(score_vol_n),
-                cmp_score_vol_n);
-        s_args->score_vol_n_array = score_vol_n_array;
-        for (int i = 0; i < leaves->size; ++i) {
-            s_args->node = leaves_array[i];
-            leaves_array[i]->score = fspt->score(s_args);
-        }
-    }
-    free(score_vol_n_array);
+    profile->bytes_allocated += leaves->size * (sizeof(fspt_node *)
+            + (s_args->need_normalize ? sizeof(score_vol_n) : 0));
+    score_and_normalize_leaves(fspt, s_args, leaves_array, leaves->size,
+            !s_args->score_during_fit, &profile->score_time,
+            &profile->normalize_time);
     free(leaves_array);
     free_list(leaves);
+    profile->total_time = what_time_is_it_now() - fit_start;
+    c_args->rng = NULL;
 }
 
 /**
@@ -1328,25 +2002,134 @@ void fspt_save(const char *filename, fspt_t fspt, int save_samples, int *succ){
     fclose(fp);
 }
 
+/**
+ * Node layout of NODE_VERSION 3, before the score bounds and the gain.
+ */
+typedef struct fspt_node_v3 {
+    FSPT_NODE_TYPE type;
+    int n_features;
+    struct fspt_t *fspt;
+    size_t n_empty;
+    size_t n_samples;
+    float *samples;
+    int split_feature;
+    float split_value;
+    struct fspt_node *right;
+    struct fspt_node *left;
+    struct fspt_node *parent;
+    int depth;
+    double score;
+    double volume;
+    double uniformity;
+    int count;
+    NON_SPLIT_CAUSE cause;
+} fspt_node_v3;
+
+/**
+ * Node layout of NODE_VERSION 4, before the gain.
+ */
+typedef struct fspt_node_v4 {
+    FSPT_NODE_TYPE type;
+    int n_features;
+    struct fspt_t *fspt;
+    size_t n_empty;
+    size_t n_samples;
+    float *samples;
+    int split_feature;
+    float split_value;
+    struct fspt_node *right;
+    struct fspt_node *left;
+    struct fspt_node *parent;
+    int depth;
+    double score;
+    double min_score;
+    double max_score;
+    double volume;
+    double uniformity;
+    int count;
+    NON_SPLIT_CAUSE cause;
+} fspt_node_v4;
+
+/**
+ * Size of a saved node of the given version, 0 if the version can't be
+ * loaded.
+ */
+static size_t node_version_size(int version) {
+    switch (version) {
+        case 3: return sizeof(fspt_node_v3);
+        case 4: return sizeof(fspt_node_v4);
+        case NODE_VERSION: return sizeof(fspt_node);
+        default: return 0;
+    }
+}
+
+/**
+ * Reads a node saved with the given version into node. The score bounds of
+ * version 3 are computed once the tree is loaded. The gain of the splits
+ * is unknown before version 5 : it is set to HUGE_VAL so pruning never
+ * takes it for a gain threshold violation.
+ */
+#define COPY_NODE_FIELDS(dst, src) do { \
+    (dst)->type = (src).type; \
+    (dst)->n_features = (src).n_features; \
+    (dst)->n_empty = (src).n_empty; \
+    (dst)->n_samples = (src).n_samples; \
+    (dst)->split_feature = (src).split_feature; \
+    (dst)->split_value = (src).split_value; \
+    (dst)->right = (src).right; \
+    (dst)->left = (src).left; \
+    (dst)->depth = (src).depth; \
+    (dst)->score = (src).score; \
+    (dst)->volume = (src).volume; \
+    (dst)->uniformity = (src).uniformity; \
+    (dst)->count = (src).count; \
+    (dst)->cause = (src).cause; \
+} while (0)
+
+static int read_node(FILE *fp, int version, fspt_node *node) {
+    if (version == NODE_VERSION)
+        return fread(node, sizeof(fspt_node), 1, fp) == 1;
+    memset(node, 0, sizeof(fspt_node));
+    node->gain = HUGE_VAL;
+    if (version == 4) {
+        fspt_node_v4 old;
+        if (fread(&old, sizeof(old), 1, fp) != 1) return 0;
+        COPY_NODE_FIELDS(node, old);
+        node->min_score = old.min_score;
+        node->max_score = old.max_score;
+    } else {
+        fspt_node_v3 old;
+        if (fread(&old, sizeof(old), 1, fp) != 1) return 0;
+        COPY_NODE_FIELDS(node, old);
+    }
+    return 1;
+}
+
+#undef COPY_NODE_FIELDS
+
 /**
  * Recursively loads from node in fp.
  *
  * \param fp A file pointer. Open and close file is caller's responsibility.
+ * \param version The NODE_VERSION of the saved nodes.
  * \param succ Output parameter. Will contain 1 if successfully load,
  *             0 otherwise.
  * \param n_samples The number of samples in samples.
  * \param samples A pointer to already existing and orderer samples or NULL.
  * \return Pointer to the newly created fspt_node.
  */
-static fspt_node * pre_order_node_load(FILE *fp, size_t n_samples,
+static fspt_node * pre_order_node_load(FILE *fp, int version, size_t n_samples,
         float *samples, fspt_node *parent, fspt_t * fspt, int *succ) {
     /* load node */
     fspt_node *node = malloc(sizeof(fspt_node));
-    *succ &= fread(node, sizeof(fspt_node), 1, fp);
-    if (!*succ) return NULL;
-    /* point on samples */
+    *succ &= read_node(fp, version, node);
+    if (!*succ) {
+        free(node);
+        return NULL;
+    }
+    /* point on samples. Without samples, keeps the saved counts. */
     node->samples = samples;
-    node->n_samples = n_samples;
+    if (samples) node->n_samples = n_samples;
     node->parent = parent;
     node->fspt = fspt;
     /* load children */
@@ -1369,11 +2152,11 @@ static fspt_node * pre_order_node_load(FILE *fp, size_t n_samples,
         }
     }
     if (node->left)
-        node->left = pre_order_node_load(fp, n_samples_l, samples_l, node,
-                fspt, succ);
+        node->left = pre_order_node_load(fp, version, n_samples_l, samples_l,
+                node, fspt, succ);
     if (node->right)
-        node->right = pre_order_node_load(fp, n_samples_r, samples_r, node,
-                fspt, succ);
+        node->right = pre_order_node_load(fp, version, n_samples_r, samples_r,
+                node, fspt, succ);
     return node;
 }
 
@@ -1461,12 +2244,16 @@ void fspt_load_file(FILE *fp, fspt_t *fspt, int load_samples, int load_c_args,
         *succ &= fread(&version, sizeof(int), 1, fp);
         *succ &= fread(&size, sizeof(size_t), 1, fp);
         *succ &= fread(&n_nodes, sizeof(size_t), 1, fp);
-        if (load_root && version == NODE_VERSION
-                && size == sizeof(fspt_node)
+        if (load_root && node_version_size(version)
+                && size == node_version_size(version)
                 && *succ) {
             fspt->root =
-                pre_order_node_load(fp, new_n_samples, fspt->samples, NULL,
-                        fspt, succ);
+                pre_order_node_load(fp, version, new_n_samples, fspt->samples,
+                        NULL, fspt, succ);
+            if (version < NODE_VERSION)
+                fprintf(stderr, "Nodes of version %d migrated to version %d.\n",
+                        version, NODE_VERSION);
+            if (version < 4 && *succ) compute_score_bounds(fspt->root);
         } else if (*succ) {
             fseek(fp, size * n_nodes, SEEK_CUR);
             if (load_root)
@@ -1498,3 +2285,4 @@ void fspt_load(const char *filename, fspt_t *fspt, int load_samples,
 #undef LINTFORMAT
 #undef LEFTINTFOR
 #undef NODE_VERSION
+#undef MIN_LEAVES_PER_SCORE_THREAD
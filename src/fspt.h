@@ -21,10 +21,32 @@ typedef enum {ALL_NODES = 0, LEAF = 1, INNER = 2} FSPT_NODE_TYPE;
 typedef enum {PRE_ORDER, IN_ORDER, POST_ORDER} FSPT_TRAVERSAL;
 typedef enum {UNKNOWN_CAUSE = 0, SPLIT = 1, MAX_DEPTH = 2, MIN_SAMPLES = 3,
     MIN_VOLUME = 4, MIN_LENGTH = 5, MAX_COUNT = 6, NO_SAMPLE = 7, MERGE = 8,
-    UNIFORMITY}
+    UNIFORMITY = 9, SIMPLIFY = 10}
     NON_SPLIT_CAUSE;
+typedef enum {ENSEMBLE_MEAN = 0, ENSEMBLE_MIN = 1} ENSEMBLE_AGGREGATION;
 
 
+#define FSPT_PROFILE_MAX_DEPTH 64
+
+/**
+ * Profiling counters filled during fspt_fit. Times are in seconds.
+ * The per feature phases (sort, hist and gain) are summed over the
+ * features, so they are cumulated thread times when multi_threads is set.
+ */
+typedef struct fspt_fit_profile {
+    double sort_time;        // sorting the samples of the candidate features.
+    double hist_time;        // building the split point histograms.
+    double gain_time;        // evaluating the gini gains.
+    double uniformity_time;  // uniformity tests.
+    double split_time;       // partitioning the samples of split nodes.
+    double score_time;       // scoring the leaves.
+    double normalize_time;   // normalization pass of the scores.
+    double total_time;       // whole fspt_fit.
+    size_t bytes_allocated;  // cumulated size of the fitting allocations.
+    size_t nodes_per_depth[FSPT_PROFILE_MAX_DEPTH]; // index depth - 1. Last
+                                                    // bucket gathers deeper.
+} fspt_fit_profile;
+
 struct fspt_node;
 struct fspt_t;
 struct criterion_args;
@@ -52,12 +74,50 @@ typedef struct fspt_node {
     struct fspt_node *parent;  // the parent node
     int depth;
     double score;
+    double min_score;   // min score of the leaves of the subtree
+    double max_score;   // max score of the leaves of the subtree
     double volume;
     double uniformity;
     int count;          // keeps the successive violation of gain threshold
+    double gain;        // gain of the split given by the criterion (INNER)
     NON_SPLIT_CAUSE cause;
 } fspt_node;
 
+/**
+ * Node of a compact fspt. The nodes are stored in pre-order : the left
+ * child of an inner node follows it.
+ */
+typedef struct fspt_compact_node {
+    int split_feature;   // -1 for a leaf.
+    float split_value;   // split of an inner node or score of a leaf.
+    unsigned int right;  // index of the right child or of the leaf stats.
+    float min_score;     // min score of the leaves of the subtree.
+    float max_score;     // max score of the leaves of the subtree.
+} fspt_compact_node;
+
+/**
+ * Statistics kept for each leaf of a compact fspt.
+ */
+typedef struct fspt_leaf_stats {
+    size_t n_samples;
+    double volume;
+    double score;
+    int depth;
+    NON_SPLIT_CAUSE cause;
+} fspt_leaf_stats;
+
+/**
+ * Inference-only representation of a fitted fspt : packed nodes and leaf
+ * statistics, without samples nor parent pointers. See fspt_compact.
+ */
+typedef struct fspt_compact_tree {
+    size_t n_nodes;
+    fspt_compact_node *nodes;   // size n_nodes. Pre-order.
+    size_t n_leaves;
+    fspt_leaf_stats *leaves;    // size n_leaves. Pre-order.
+    float *leaf_bounds;         // size n_leaves * 2 * n_features or NULL.
+} fspt_compact_tree;
+
 /**
  * Feature Space Partitioning Tree.
  */
@@ -78,6 +138,8 @@ typedef struct fspt_t {
     double volume;      // total volume of the fspt
     struct criterion_args *c_args;
     struct score_args *s_args;
+    fspt_compact_tree *compact; // set by fspt_compact. Then root is NULL.
+    fspt_fit_profile profile;   // filled by fspt_fit. Not saved.
 } fspt_t;
 
 typedef struct score_vol_n {
@@ -262,6 +324,92 @@ extern void fspt_decision_func(size_t n, const fspt_t *fspt, const float *X,
  */ 
 extern void fspt_predict(size_t n, const fspt_t *fspt, const float *X, float *Y);
 
+/**
+ * Tells for each input X if its score is greater or equal to thresh.
+ * The traversal stops as soon as all the leaves of the current subtree
+ * are on the same side of the threshold (see min_score and max_score of
+ * the nodes).
+ *
+ * \param n The number of test samples in X.
+ * \param fspt The feature space partitioning tree.
+ * \param X Size (n * fspt->n_features), containing the inputs to test.
+ * \param thresh The decision threshold.
+ * \param accept Output parameter of size n. Will be filled by 1 if the
+ *               score is greater or equal to thresh, 0 otherwise.
+ * \param Y Optional output parameter of size n. Will be filled by the score
+ *          of the leaf if it is reached, otherwise by the min_score (if
+ *          accepted) or the max_score (if rejected) of the subtree where
+ *          the traversal stopped. Can be NULL.
+ */
+extern void fspt_accept(size_t n, const fspt_t *fspt, const float *X,
+        float thresh, int *accept, float *Y);
+
+/**
+ * Gives the score of an ensemble of fspts for each input X.
+ * ENSEMBLE_MEAN averages the scores of the fspts weighted by their number
+ * of training samples, ENSEMBLE_MIN keeps the lowest score. The fspts with
+ * no training sample are ignored.
+ *
+ * \param n The number of test samples in X.
+ * \param n_fspts The number of fspts in the ensemble.
+ * \param fspts The fspts. They must have the same features.
+ * \param aggregation How the scores of the fspts are aggregated.
+ * \param X Size (n * n_features), containing the inputs to test.
+ * \param Y Output parameter of size n. Will be filled by the scores.
+ */
+extern void fspt_predict_ensemble(size_t n, int n_fspts, fspt_t *const *fspts,
+        ENSEMBLE_AGGREGATION aggregation, const float *X, float *Y);
+
+/**
+ * Tells for each input X if the score of an ensemble of fspts is greater or
+ * equal to thresh. With ENSEMBLE_MIN, the fspts are traversed as in
+ * fspt_accept and the first rejection stops the evaluation of the input.
+ * With ENSEMBLE_MEAN, the exact scores are computed.
+ *
+ * \param n The number of test samples in X.
+ * \param n_fspts The number of fspts in the ensemble.
+ * \param fspts The fspts. They must have the same features.
+ * \param aggregation How the scores of the fspts are aggregated.
+ * \param X Size (n * n_features), containing the inputs to test.
+ * \param thresh The decision threshold.
+ * \param accept Output parameter of size n. See fspt_accept.
+ * \param Y Optional output parameter of size n. Will be filled by the score
+ *          or a bound of the score on the same side of the threshold. Can
+ *          be NULL.
+ */
+extern void fspt_accept_ensemble(size_t n, int n_fspts, fspt_t *const *fspts,
+        ENSEMBLE_AGGREGATION aggregation, const float *X, float thresh,
+        int *accept, float *Y);
+
+/**
+ * Turns a fitted fspt into its inference-only representation. The samples
+ * and the nodes are freed and replaced by fspt->compact. fspt_predict,
+ * fspt_accept and get_fspt_stats keep working, but the fspt cannot be
+ * refitted, rescored nor saved anymore.
+ *
+ * \param fspt The fspt.
+ * \param cache_bounds If true, the feature limits of each leaf are stored in
+ *                     fspt->compact->leaf_bounds.
+ */
+extern void fspt_compact(fspt_t *fspt, int cache_bounds);
+
+/**
+ * Gives the memory used by a fspt, samples included.
+ *
+ * \param fspt The fspt.
+ * \return The number of bytes allocated for fspt.
+ */
+extern size_t fspt_memory_size(const fspt_t *fspt);
+
+/**
+ * Maps the string names of the aggregations ("mean" or "min") to the
+ * ensemble aggregation.
+ *
+ * \param s The string name.
+ * \return The corresponding aggregation or ENSEMBLE_MEAN.
+ */
+extern ENSEMBLE_AGGREGATION string_to_ensemble_aggregation(const char *s);
+
 /**
  * Fits the feature space partitioning tree to the data X.
  *
@@ -275,13 +423,87 @@ extern void fspt_fit(size_t n_samples, float *X, struct criterion_args *c_args,
         struct score_args *s_args, fspt_t *fspt);
 
 /**
- * Recompute the score of the leaves without fitting.
+ * Recompute the score of the leaves without fitting. The leaves are scored
+ * by up to s_args->n_threads threads.
  *
  * \param fspt The fspt.
  * \param s_args The new score arguments.
  */
 extern void fspt_rescore(fspt_t *fspt, struct score_args *s_args);
 
+/**
+ * Computes the scores of the leaves for several score arguments in one
+ * pass over the leaves, without modifying the fspt. The variants must be
+ * arguments of fspt->score, typically a sweep over calibration_score,
+ * samples_p or volume_penalization. The leaves are scored by up to
+ * variants[0].n_threads threads.
+ *
+ * \param fspt The fspt.
+ * \param n_variants The number of score arguments.
+ * \param variants The score arguments. Size n_variants.
+ * \param n_leaves Output parameter. Will contain the number of leaves if not
+ *                 NULL.
+ * \return The scores. Size n_variants * n_leaves. The score of the i-th leaf
+ *         in pre-order for the variant v is at index v * n_leaves + i.
+ *         Caller must free.
+ */
+extern double *fspt_rescore_variants(fspt_t *fspt, int n_variants,
+        struct score_args *variants, size_t *n_leaves);
+
+/**
+ * Sets the scores of the leaves, for instance one row of the scores
+ * returned by fspt_rescore_variants, and updates the score bounds.
+ *
+ * \param fspt The fspt.
+ * \param scores The scores of the leaves in pre-order.
+ */
+extern void fspt_set_leaf_scores(fspt_t *fspt, const double *scores);
+
+/**
+ * Copies the nodes of fspt to copy, usually a copy of the fspt_t struct
+ * itself, such that copy can be simplified or pruned without changing fspt.
+ * The copied nodes share the samples of fspt and are freed with
+ * free_fspt_nodes(copy->root).
+ *
+ * \param fspt The fspt to copy.
+ * \param copy The fspt receiving the nodes. Its root is overwritten.
+ */
+extern void fspt_copy_nodes(const fspt_t *fspt, fspt_t *copy);
+
+/**
+ * Collapses into single leaves the subtrees whose leaves all take the same
+ * decision. A collapsed leaf keeps the samples, volume and depth of the
+ * subtree root and takes the volume weighted mean score of the removed
+ * leaves. Its cause is SIMPLIFY.
+ * The scores and score bounds of the nodes must be computed.
+ *
+ * \param fspt The fitted fspt.
+ * \param thresh If >= 0, the subtrees whose leaves are all on the same side
+ *               of thresh are collapsed. The decisions at thresh are kept.
+ * \param tolerance If > 0, the subtrees whose leaf scores differ by at most
+ *                  tolerance are collapsed.
+ * \return The number of removed nodes.
+ */
+extern size_t fspt_simplify(fspt_t *fspt, float thresh, double tolerance);
+
+/**
+ * Collapses the inner nodes that would not have been split with the
+ * stopping rules of c_args (max_depth, min_samples, min_volume_p,
+ * min_length_p, gini_gain_thresh and max_consecutive_gain_violations).
+ * Pruning a tree fitted with looser stopping rules approximates a refit
+ * with c_args: the splits themselves are not recomputed. The collapsed
+ * nodes take the cause of the violated rule and the hit counters of c_args
+ * are incremented. If c_args->merge_nodes, the gain violation counts are
+ * recomputed with c_args and the nodes are merged as at the end of
+ * fspt_fit, so the fspt should have been fitted without merge_nodes.
+ * The scores must be recomputed with fspt_rescore.
+ *
+ * \param fspt The fitted fspt.
+ * \param c_args The stricter criterion args. Becomes fspt->c_args.
+ * \return The number of removed nodes.
+ */
+extern size_t fspt_prune(fspt_t *fspt, struct criterion_args *c_args);
+
 /**
  * Save the fspt to a file.
  *
@@ -395,6 +617,16 @@ extern void print_fspt_stats(FILE *stream, fspt_stats *stats, char *title);
  */
 extern list *fspt_nodes_to_list(fspt_t *fspt, FSPT_TRAVERSAL traversal);
 
+/**
+ * Creates a list with the leaves of a fspt. The traversal mode can be
+ * customized. The caller must free the list.
+ *
+ * \param fspt The fspt.
+ * \param traversal The mode of traversal @see FSPT_TRAVERSAL.
+ * \return The list of the leaves.
+ */
+extern list *fspt_leaves_to_list(fspt_t *fspt, FSPT_TRAVERSAL traversal);
+
 /**
  * Extract a bunch of statistics about an fspt. @see fspt_stats.
  * The fspt_stats returned must be freed by the caller @see free_fspt_stats().
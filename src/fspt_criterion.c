@@ -1,5 +1,6 @@
 #include "fspt_criterion.h"
 
+#include <math.h>
 #include <stdlib.h>
 
 #include "fspt.h"
@@ -11,7 +12,7 @@
 #define POINTER_FORMAT "%-16p"
 #define INTEGER_FORMAT "%-16d"
 #define LONG_INTFORMAT "%-16ld"
-#define CRITERION_ARGS_VERSION 6
+#define CRITERION_ARGS_VERSION 11
 
 
 int respect_min_lenght_p(int n_features, const float* fspt_lim,
@@ -31,6 +32,12 @@ int respect_min_lenght_p(int n_features, const float* fspt_lim,
     return 1;
 }
 
+int weighted_min_samples(const criterion_args *args) {
+    if (args->sample_weight <= 1.) return args->min_samples;
+    int min_samples = ceil(args->min_samples / args->sample_weight);
+    return min_samples > 1 ? min_samples : 1;
+}
+
 void determine_cause(int n, forbidden_split_cause *causes,
         criterion_args *args) {
     size_t tab[4] = {0};
@@ -67,6 +74,45 @@ void determine_cause(int n, forbidden_split_cause *causes,
     }
 }
 
+/**
+ * Returns the number of used buckets of p->nodes_per_depth.
+ */
+static int profile_depth(const fspt_fit_profile *p) {
+    int depth = FSPT_PROFILE_MAX_DEPTH;
+    while (depth > 0 && !p->nodes_per_depth[depth - 1]) --depth;
+    return depth;
+}
+
+static void print_fspt_fit_profile_json(FILE *stream,
+        const fspt_fit_profile *p) {
+    fprintf(stream, "{\"sort_time\" : %g, \"hist_time\" : %g, \
+\"gain_time\" : %g, \"uniformity_time\" : %g, \"split_time\" : %g, \
+\"score_time\" : %g, \"normalize_time\" : %g, \"total_time\" : %g, \
+\"bytes_allocated\" : %ld, \"nodes_per_depth\" : [",
+    p->sort_time, p->hist_time, p->gain_time, p->uniformity_time,
+    p->split_time, p->score_time, p->normalize_time, p->total_time,
+    p->bytes_allocated);
+    int depth = profile_depth(p);
+    for (int i = 0; i < depth; ++i) {
+        fprintf(stream, i ? ", %ld" : "%ld", p->nodes_per_depth[i]);
+    }
+    fprintf(stream, "]}");
+}
+
+void print_fspt_fit_profile(FILE *stream, const fspt_fit_profile *p) {
+    fprintf(stream, "sort %.3fs, hist %.3fs, gain %.3fs, uniformity %.3fs, \
+split %.3fs, score %.3fs, normalize %.3fs, total %.3fs, %.1f MB allocated, \
+nodes per depth :",
+    p->sort_time, p->hist_time, p->gain_time, p->uniformity_time,
+    p->split_time, p->score_time, p->normalize_time, p->total_time,
+    p->bytes_allocated / (1024. * 1024.));
+    int depth = profile_depth(p);
+    for (int i = 0; i < depth; ++i) {
+        fprintf(stream, " %ld", p->nodes_per_depth[i]);
+    }
+    fprintf(stream, "\n");
+}
+
 void print_fspt_criterion_args_json(FILE *stream, criterion_args a) {
     fprintf(stream, "{\"merge_nodes\" : %d, \"criterion_function\" : %d, \
 \"fspt\" : \"%p\", \"node\" : \"%p\", \
@@ -77,13 +123,16 @@ void print_fspt_criterion_args_json(FILE *stream, criterion_args a) {
 \"count_max_count_hit\" : %ld, \
 \"count_no_sample_hit\" : %ld, \
 \"count_uniformity_hit\" : %ld, \
-\"best_index\" : %d, \"best_split\" : %g, \"forbidden_split\" : %d, \
+\"best_index\" : %d, \"best_split\" : %g, \"best_gain\" : %g, \
+\"forbidden_split\" : %d, \
 \"increment_count\" : %d, \"end_of_fitting\" : %d, \"max_tries_p\" : %g, \
 \"max_features_p\" : %g, \
 \"gini_gain_thresh\" : %g, \"max_consecutive_gain_violations\" : %d, \
 \"middle_split\" : %d, \
 \"multi_threads\" : %d, \
-\"uniformity_test_level\" : %d, \"unf_alpha\" : %g}",
+\"uniformity_test_level\" : %d, \"unf_alpha\" : %g, \
+\"seed\" : %u, \"stream_id\" : %u, \"sample_weight\" : %g, \
+\"profile\" : ",
     a.merge_nodes, a.criterion_function,
     a.fspt, a.node,
     a.max_depth, a.count_max_depth_hit,
@@ -93,11 +142,17 @@ void print_fspt_criterion_args_json(FILE *stream, criterion_args a) {
     a.count_max_count_hit,
     a.count_no_sample_hit,
     a.count_uniformity_hit,
-    a.best_index, a.best_split, a.forbidden_split,
+    a.best_index, a.best_split, a.best_gain, a.forbidden_split,
     a.increment_count, a.end_of_fitting, a.max_tries_p, a.max_features_p,
     a.gini_gain_thresh, a.max_consecutive_gain_violations, a.middle_split,
     a.multi_threads,
-    a.uniformity_test_level, a.unf_alpha);
+    a.uniformity_test_level, a.unf_alpha, a.seed, a.stream_id,
+    a.sample_weight);
+    if (a.profile)
+        print_fspt_fit_profile_json(stream, a.profile);
+    else
+        fprintf(stream, "null");
+    fprintf(stream, "}");
 }
 
 void print_fspt_criterion_args(FILE *stream, const criterion_args *a,
@@ -133,6 +188,7 @@ void print_fspt_criterion_args(FILE *stream, const criterion_args *a,
 │                   max_depth │"INTEGER_FORMAT"│\n\
 │         count_max_depth_hit │"LONG_INTFORMAT"│\n\
 │                 min_samples │"INTEGER_FORMAT"│\n\
+│               sample_weight │"FLOAT_FORMAT__"│\n\
 │       count_min_samples_hit │"LONG_INTFORMAT"│\n\
 │                min_volume_p │"FLOAT_FORMAT__"│\n\
 │      count_min_volume_p_hit │"LONG_INTFORMAT"│\n\
@@ -157,11 +213,13 @@ void print_fspt_criterion_args(FILE *stream, const criterion_args *a,
 │               multi_threads │"INTEGER_FORMAT"│\n\
 │       uniformity_test_level │"INTEGER_FORMAT"│\n\
 │                   unf_alpha │"FLOAT_FORMAT__"│\n\
+│                        seed │"INTEGER_FORMAT"│\n\
+│                   stream_id │"INTEGER_FORMAT"│\n\
 └─────────────────────────────┴────────────────┘\n\n",
     a->merge_nodes, a->criterion_function,
     a->fspt, a->node,
     a->max_depth, a->count_max_depth_hit,
-    a->min_samples, a->count_min_samples_hit,
+    a->min_samples, a->sample_weight, a->count_min_samples_hit,
     a->min_volume_p, a->count_min_volume_p_hit,
     a->min_length_p, a->count_min_length_p_hit,
     a->count_max_count_hit,
@@ -171,7 +229,7 @@ void print_fspt_criterion_args(FILE *stream, const criterion_args *a,
     a->increment_count, a->end_of_fitting, a->max_tries_p, a->max_features_p,
     a->gini_gain_thresh, a->max_consecutive_gain_violations, a->middle_split,
     a->multi_threads,
-    a->uniformity_test_level, a->unf_alpha);
+    a->uniformity_test_level, a->unf_alpha, a->seed, a->stream_id);
 }
 
 int compare_criterion_args(const criterion_args *c1, const criterion_args *c2){
@@ -194,11 +252,50 @@ int compare_criterion_args(const criterion_args *c1, const criterion_args *c2){
             && c1->middle_split == c2->middle_split
             && c1->uniformity_test_level == c2->uniformity_test_level
             && c1->unf_alpha == c2->unf_alpha
+            && c1->seed == c2->seed
              );
     }
     return r;
 }
 
+int nested_criterion_args(const criterion_args *loose,
+        const criterion_args *strict) {
+    if (!loose || !strict) return 0;
+    return loose->criterion_function == strict->criterion_function
+        && !loose->merge_nodes
+        && loose->max_tries_p == strict->max_tries_p
+        && loose->max_features_p == strict->max_features_p
+        && loose->middle_split == strict->middle_split
+        && loose->uniformity_test_level == strict->uniformity_test_level
+        && loose->unf_alpha == strict->unf_alpha
+        && loose->seed == strict->seed
+        && loose->max_depth >= strict->max_depth
+        && loose->min_samples <= strict->min_samples
+        && loose->min_volume_p <= strict->min_volume_p
+        && loose->min_length_p <= strict->min_length_p
+        && loose->gini_gain_thresh <= strict->gini_gain_thresh
+        && loose->max_consecutive_gain_violations
+            >= strict->max_consecutive_gain_violations;
+}
+
+criterion_args loosest_criterion_args(int n, const criterion_args *c) {
+    criterion_args loose = c[0];
+    /* the nodes are merged after the pruning */
+    loose.merge_nodes = 0;
+    for (int i = 1; i < n; ++i) {
+        loose.max_depth = MAX(loose.max_depth, c[i].max_depth);
+        loose.min_samples = MIN(loose.min_samples, c[i].min_samples);
+        loose.min_volume_p = MIN(loose.min_volume_p, c[i].min_volume_p);
+        loose.min_length_p = MIN(loose.min_length_p, c[i].min_length_p);
+        loose.gini_gain_thresh =
+            MIN(loose.gini_gain_thresh, c[i].gini_gain_thresh);
+        loose.max_consecutive_gain_violations =
+            MAX(loose.max_consecutive_gain_violations,
+                    c[i].max_consecutive_gain_violations);
+    }
+    return loose;
+}
+
 void save_criterion_args_file(FILE *fp, criterion_args *c, int *succ) {
     int contains_args = 0;
     int version = CRITERION_ARGS_VERSION;
@@ -214,6 +311,85 @@ void save_criterion_args_file(FILE *fp, criterion_args *c, int *succ) {
     }
 }
 
+/**
+ * @brief Layout of the criterion args saved with version 6, before the
+ * sample weight, the best gain, the random stream and the fit profile.
+ */
+typedef struct criterion_args_v6 {
+    CRITERION_FUNCTION criterion_function;
+    int merge_nodes;
+    fspt_t *fspt;
+    fspt_node *node;
+    int max_depth;
+    size_t count_max_depth_hit;
+    int min_samples;
+    size_t count_min_samples_hit;
+    double min_volume_p;
+    size_t count_min_volume_p_hit;
+    double min_length_p;
+    size_t count_min_length_p_hit;
+    size_t count_max_count_hit;
+    size_t count_no_sample_hit;
+    size_t count_uniformity_hit;
+    int best_index;
+    float best_split;
+    int forbidden_split;
+    int increment_count;
+    int end_of_fitting;
+    float max_tries_p;
+    float max_features_p;
+    double gini_gain_thresh;
+    int max_consecutive_gain_violations;
+    int middle_split;
+    int multi_threads;
+    UNF_TEST_LEVEL uniformity_test_level;
+    float unf_alpha;
+} criterion_args_v6;
+
+/**
+ * @brief Reads criterion args saved with version 6. The fields added since
+ * then get their defaults: unweighted samples, no gain, stream 0 of seed 0.
+ */
+static criterion_args *load_criterion_args_v6(FILE *fp, int *succ) {
+    criterion_args_v6 old;
+    *succ &= fread(&old, sizeof(criterion_args_v6), 1, fp);
+    criterion_args *c = calloc(1, sizeof(criterion_args));
+    if (!c) malloc_error();
+    c->criterion_function = old.criterion_function;
+    c->merge_nodes = old.merge_nodes;
+    c->fspt = old.fspt;
+    c->node = old.node;
+    c->max_depth = old.max_depth;
+    c->count_max_depth_hit = old.count_max_depth_hit;
+    c->min_samples = old.min_samples;
+    c->sample_weight = 1.;
+    c->count_min_samples_hit = old.count_min_samples_hit;
+    c->min_volume_p = old.min_volume_p;
+    c->count_min_volume_p_hit = old.count_min_volume_p_hit;
+    c->min_length_p = old.min_length_p;
+    c->count_min_length_p_hit = old.count_min_length_p_hit;
+    c->count_max_count_hit = old.count_max_count_hit;
+    c->count_no_sample_hit = old.count_no_sample_hit;
+    c->count_uniformity_hit = old.count_uniformity_hit;
+    c->best_index = old.best_index;
+    c->best_split = old.best_split;
+    c->best_gain = 0.;
+    c->forbidden_split = old.forbidden_split;
+    c->increment_count = old.increment_count;
+    c->end_of_fitting = old.end_of_fitting;
+    c->max_tries_p = old.max_tries_p;
+    c->max_features_p = old.max_features_p;
+    c->gini_gain_thresh = old.gini_gain_thresh;
+    c->max_consecutive_gain_violations = old.max_consecutive_gain_violations;
+    c->middle_split = old.middle_split;
+    c->multi_threads = old.multi_threads;
+    c->uniformity_test_level = old.uniformity_test_level;
+    c->unf_alpha = old.unf_alpha;
+    c->seed = 0;
+    c->stream_id = 0;
+    return c;
+}
+
 criterion_args *load_criterion_args_file(FILE *fp, int *succ) {
     criterion_args *c = NULL;
     int contains_args = 0;
@@ -223,11 +399,20 @@ criterion_args *load_criterion_args_file(FILE *fp, int *succ) {
     if (contains_args == 1) {
         *succ &= fread(&version, sizeof(int), 1, fp);
         *succ &= fread(&size, sizeof(size_t), 1, fp);
+        /* version 10 kept the fit profile in place of its pointer */
+        size_t kept = offsetof(criterion_args, profile);
+        size_t v10_size = kept + sizeof(fspt_fit_profile);
         if (version == CRITERION_ARGS_VERSION
                 && size == sizeof(criterion_args)
                 && *succ) {
             c = malloc(sizeof(criterion_args));
             *succ &= fread(c, sizeof(criterion_args), 1, fp);
+        } else if (version == 10 && size == v10_size && *succ) {
+            c = malloc(sizeof(criterion_args));
+            *succ &= fread(c, kept, 1, fp);
+            fseek(fp, size - kept, SEEK_CUR);
+        } else if (version == 6 && size == sizeof(criterion_args_v6) && *succ) {
+            c = load_criterion_args_v6(fp, succ);
         } else if (*succ) {
             fseek(fp, size, SEEK_CUR);
             fprintf(stderr, "Wrong criterion args version (%d) or size \
@@ -240,6 +425,11 @@ criterion_args *load_criterion_args_file(FILE *fp, int *succ) {
         fprintf(stderr, "ERROR : in load_criterion_args_file - contains_args = %d.\n",
                 contains_args);
     }
+    /* the saved pointers are meaningless */
+    if (c) {
+        c->rng = NULL;
+        c->profile = NULL;
+    }
     return c;
 }
 
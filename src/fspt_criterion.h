@@ -4,6 +4,7 @@
 #include <stddef.h>
 
 #include "fspt.h"
+#include "rand_stream.h"
 
 typedef enum CRITERION_FUNCTION {
     UNKNOWN_CRITERION_FUNC = 0,
@@ -33,6 +34,8 @@ typedef struct criterion_args {
     int max_depth;
     size_t count_max_depth_hit;
     int min_samples;
+    double sample_weight;     // extracted samples represented by one
+                              // training sample. 0 or 1 when not capped.
     size_t count_min_samples_hit;
     double min_volume_p;
     size_t count_min_volume_p_hit;
@@ -43,6 +46,7 @@ typedef struct criterion_args {
     size_t count_uniformity_hit;
     int best_index;
     float best_split;
+    double best_gain;
     int forbidden_split;
     int increment_count;
     int end_of_fitting;
@@ -55,6 +59,12 @@ typedef struct criterion_args {
     int multi_threads;
     UNF_TEST_LEVEL uniformity_test_level;
     float unf_alpha;
+    /* randomness of the fit */
+    unsigned int seed;        // seed of the fit. A seed gives one fspt.
+    unsigned int stream_id;   // stream of the fspt among the ones sharing
+                              // the seed (e.g. its class). Not compared.
+    rand_stream *rng;         // set by fspt_fit for the criterion function.
+    fspt_fit_profile *profile; // set by fspt_fit to &fspt->profile.
 } criterion_args;
 
 
@@ -68,6 +78,17 @@ extern int respect_min_lenght_p(int n_features, const float* fspt_lim,
 extern void determine_cause(int n, forbidden_split_cause *causes,
         criterion_args *args);
 
+/**
+ * Gives min_samples expressed in training samples. When the training
+ * samples were capped during extraction, each one stands for
+ * args->sample_weight extracted samples and the threshold is scaled down
+ * accordingly.
+ *
+ * \param args The criterion arguments.
+ * \return The minimum number of training samples per child (>= 1).
+ */
+extern int weighted_min_samples(const criterion_args *args);
+
 /**
  * maps the string names of the functions to the criterion functions
  * number.
@@ -97,6 +118,32 @@ extern criterion_func string_to_fspt_criterion(char *s);
 extern int compare_criterion_args(const criterion_args *c1,
         const criterion_args *c2);
 
+/**
+ * Tells if a fspt fitted with loose can be pruned into a fspt fitted with
+ * strict (see fspt_prune). That is to say, the two criterion args only
+ * differ by stopping rules and the rules of strict are at least as strict
+ * as the ones of loose. The fspt must have been fitted without merge_nodes
+ * since the merged nodes can not be pruned, strict may merge them after
+ * the pruning.
+ *
+ * \param loose The criterion args of the fitted fspt.
+ * \param strict The criterion args of the pruned fspt.
+ * \return 1 if the criterion args are nested. 0 otherwise.
+ */
+extern int nested_criterion_args(const criterion_args *loose,
+        const criterion_args *strict);
+
+/**
+ * Computes the loosest stopping rules of n criterion args. The other
+ * arguments are taken from the first one, except merge_nodes which is
+ * unset so that the fitted fspts can be pruned.
+ *
+ * \param n The number of criterion args. Must be > 0.
+ * \param c The criterion args.
+ * \return The loosest criterion args.
+ */
+extern criterion_args loosest_criterion_args(int n, const criterion_args *c);
+
 /**
  * Prints a criterion_args to a file as json format.
  *
@@ -105,6 +152,14 @@ extern int compare_criterion_args(const criterion_args *c1,
  */
 extern void print_fspt_criterion_args_json(FILE *stream, criterion_args a);
 
+/**
+ * Prints a fitting profile on one line, for the fit logs.
+ *
+ * \param stream The output stream.
+ * \param p The profile.
+ */
+extern void print_fspt_fit_profile(FILE *stream, const fspt_fit_profile *p);
+
 /**
  * Prints a criterion_args to a file.
  *
@@ -118,6 +173,10 @@ extern void print_fspt_criterion_args(FILE *stream, const criterion_args *a,
 #ifdef DEBUG
 extern void hist(size_t n, size_t step, const float *X, float lower_bond,
                  size_t *n_bins, size_t *cdf, float *bins);
+extern void gini_gains(size_t n, const float *bins, const size_t *cdf,
+        float min, float max, size_t n_samples, size_t n_empty,
+        double node_volume, int min_samples, double min_volume,
+        double min_length_p, double *gains, forbidden_split_cause *cause);
 #endif
 
 #endif /* GINI_H */
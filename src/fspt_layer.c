@@ -2,6 +2,7 @@
 
 #include <assert.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -15,12 +16,18 @@
 #include "utils.h"
 #include "yolo_layer.h"
 
+#ifndef DEBUG
+#define unit_static static
+#else /* DEBUG */
+#define unit_static
+#endif
+
 layer make_fspt_layer(int inputs, int *input_layers,
         int yolo_layer, network *net, 
         float *feature_limit, float *feature_importance,
         criterion_func criterion, score_func score, int batch,
         criterion_args c_args_template, score_args s_args_template,
-        ACTIVATION activation) {
+        ACTIVATION activation, fspt_reduction *reduction) {
     layer l = {0};
     l.type = FSPT;
     l.noloss = 1;
@@ -56,17 +63,29 @@ layer make_fspt_layer(int inputs, int *input_layers,
     l.fspt_n_training_data = calloc(l.classes, sizeof(size_t));
     l.fspt_n_max_training_data = calloc(l.classes, sizeof(size_t));
     l.fspt_training_data = calloc(l.classes, sizeof(float *));
+    l.fspt_n_seen_data = calloc(l.classes, sizeof(size_t));
+    l.fspt_stratum_seen = calloc(l.classes * l.n, sizeof(size_t));
+    l.fspt_stratum_kept = calloc(l.classes * l.n, sizeof(size_t));
+    l.fspt_training_strata = calloc(l.classes, sizeof(int *));
 
+    l.fspt_ensemble_size = 1;
     l.fspt_criterion_args = c_args_template;
     l.fspt_score_args = s_args_template;
 
+    /* Until the reduction is fitted, the fspts use the bounds of the
+     * first n_features inputs as placeholder. */
+    l.fspt_reduction = reduction;
+    int n_features = reduction ? reduction->n_outputs : l.total;
+    if (reduction) assert(reduction->n_inputs == l.total);
     if (l.classes > 0)
-        l.fspts[0] = make_fspt(l.total, feature_limit, feature_importance,
+        l.fspts[0] = make_fspt(n_features, feature_limit, feature_importance,
                 criterion, score);
     for (int i = 1; i < l.classes; ++i) {
-        float *local_feat_imp = copy_float_array(l.total, feature_importance);
-        float *local_feat_lim = copy_float_array(2 * l.total, feature_limit);
-        l.fspts[i] = make_fspt(l.total, local_feat_lim, local_feat_imp,
+        float *local_feat_imp = copy_float_array(n_features,
+                feature_importance);
+        float *local_feat_lim = copy_float_array(2 * n_features,
+                feature_limit);
+        l.fspts[i] = make_fspt(n_features, local_feat_lim, local_feat_imp,
                 criterion, score);
     }
 
@@ -84,6 +103,10 @@ layer make_fspt_layer(int inputs, int *input_layers,
     for(int i = 0; i < inputs; i++) fprintf(stderr, "%d,", input_layers[i]);
     fprintf(stderr, "    yolo layer : %d      trees : %d\n", yolo_layer,
             l.classes);
+    if (reduction)
+        fprintf(stderr, "          %s reduction : %d -> %d features\n",
+                reduction_method_to_string(reduction->method), l.total,
+                n_features);
 
     return l;
 }
@@ -108,9 +131,24 @@ static int entry_index(layer l, int batch, int location, int entry)
     return batch*l.outputs + n*l.w*l.h*(4+l.classes+1) + entry*l.w*l.h + loc;
 }
 
+/**
+ * Gives the number of features of one sample stored in the training data of
+ * the layer l. It is l.total until the reduction of the layer is fitted and
+ * then the number of reduced features.
+ *
+ * \param l The fspt layer.
+ * \return The size of a sample.
+ */
+static int fspt_sample_size(layer l) {
+    if (l.fspt_reduction && l.fspt_reduction->fitted)
+        return l.fspt_reduction->n_outputs;
+    return l.total;
+}
+
 /**
  * Realloc space for more input data corresponding to class `class` on layer l.
- * num * l.total * sizeof(float) is allocated.
+ * num * fspt_sample_size(l) * sizeof(float) is allocated. The strata of the
+ * new samples are set to -1 (unknown).
  *
  * \param l The layer that we want to realloc space.
  * \param classe The classe of the data.
@@ -123,10 +161,140 @@ static void realloc_fspt_data(layer l, int classe, size_t num, int relative) {
     if (relative) {
         num += l.fspt_n_max_training_data[classe];
     }
+    size_t old = l.fspt_n_max_training_data[classe];
     l.fspt_n_max_training_data[classe] = num;
     assert(num >= l.fspt_n_training_data[classe]);
-    l.fspt_training_data[classe]
-        = realloc(l.fspt_training_data[classe], l.total * num * sizeof(float));
+    l.fspt_training_data[classe] = realloc(l.fspt_training_data[classe],
+            fspt_sample_size(l) * num * sizeof(float));
+    if (l.fspt_training_strata) {
+        int *strata = realloc(l.fspt_training_strata[classe],
+                num * sizeof(int));
+        for (size_t i = old; i < num; ++i) strata[i] = -1;
+        l.fspt_training_strata[classe] = strata;
+    }
+}
+
+void fspt_layer_reset_sampling(layer l, int classe) {
+    if (l.fspt_n_seen_data) l.fspt_n_seen_data[classe] = 0;
+    for (int k = 0; l.fspt_stratum_seen && k < l.n; ++k) {
+        l.fspt_stratum_seen[classe * l.n + k] = 0;
+        l.fspt_stratum_kept[classe * l.n + k] = 0;
+    }
+    if (l.fspt_training_strata && l.fspt_training_strata[classe]) {
+        for (size_t i = 0; i < l.fspt_n_max_training_data[classe]; ++i)
+            l.fspt_training_strata[classe][i] = -1;
+    }
+}
+
+double fspt_layer_sample_weight(layer l, int classe) {
+    size_t kept = l.fspt_n_training_data[classe];
+    size_t seen = l.fspt_n_seen_data ? l.fspt_n_seen_data[classe] : 0;
+    if (!kept || seen <= kept) return 1.;
+    return (double) seen / kept;
+}
+
+/**
+ * Picks, among the kept samples of class classe, the one to evict for a
+ * new sample in stratified sampling. The victim belongs to the stratum
+ * which is the most over-represented with respect to the proportional
+ * allocation of l.fspt_max_samples.
+ *
+ * \param l The fspt layer.
+ * \param classe The classe.
+ * \param r The random stream.
+ * \return The index of the victim in l.fspt_training_data[classe].
+ */
+static size_t stratified_victim(layer l, int classe, rand_stream *r) {
+    size_t n = l.fspt_n_training_data[classe];
+    size_t seen = l.fspt_n_seen_data[classe];
+    const size_t *stratum_seen = l.fspt_stratum_seen + classe * l.n;
+    const size_t *stratum_kept = l.fspt_stratum_kept + classe * l.n;
+    const int *strata = l.fspt_training_strata[classe];
+    int target = -1;
+    double best = 0.;
+    for (int k = 0; k < l.n; ++k) {
+        if (!stratum_kept[k]) continue;
+        double excess = (double) stratum_kept[k] * seen
+            - (double) stratum_seen[k] * l.fspt_max_samples;
+        if (target < 0 || excess > best) {
+            target = k;
+            best = excess;
+        }
+    }
+    size_t victim = rand_stream_next(r) % n;
+    if (target < 0) return victim;
+    /* Rejection first, the target stratum holds a large share of n. */
+    for (int tries = 0; tries < 64; ++tries) {
+        if (strata[victim] == target) return victim;
+        victim = rand_stream_next(r) % n;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        size_t j = (victim + i) % n;
+        if (strata[j] == target) return j;
+    }
+    return victim;
+}
+
+/**
+ * Tells where the next sample of class classe in stratum stratum must be
+ * stored according to l.fspt_sampling, and counts it as met.
+ * With FSPT_SAMPLING_ALL or below l.fspt_max_samples, the sample is
+ * appended. Otherwise the sample is kept with probability
+ * l.fspt_max_samples / (number of samples met) (reservoir sampling,
+ * Algorithm R) and replaces a random sample (FSPT_SAMPLING_RESERVOIR) or a
+ * sample of the most over-represented stratum (FSPT_SAMPLING_STRATIFIED).
+ * Every sample met has the same probability to be kept, so the kept
+ * samples all have the weight fspt_layer_sample_weight.
+ *
+ * \param l The fspt layer.
+ * \param classe The classe of the sample.
+ * \param stratum The stratum of the sample (anchor mask index in the yolo
+ *                layer). 0 <= stratum < l.n.
+ * \return The index where to store the sample in
+ *         l.fspt_training_data[classe], or -1 if the sample is dropped.
+ */
+unit_static long fspt_sample_slot(layer l, int classe, int stratum) {
+    size_t seen = ++l.fspt_n_seen_data[classe];
+    size_t n = l.fspt_n_training_data[classe];
+    ++l.fspt_stratum_seen[classe * l.n + stratum];
+    if (l.fspt_sampling == FSPT_SAMPLING_ALL || !l.fspt_max_samples
+            || n < l.fspt_max_samples)
+        return n;
+    rand_stream *r = thread_rand_stream();
+    if (rand_stream_next(r) % seen >= l.fspt_max_samples) return -1;
+    if (l.fspt_sampling == FSPT_SAMPLING_STRATIFIED)
+        return stratified_victim(l, classe, r);
+    return rand_stream_next(r) % n;
+}
+
+void fspt_layer_members(layer l, int class, fspt_t **members) {
+    members[0] = l.fspts[class];
+    for (int k = 1; k < l.fspt_ensemble_size; ++k)
+        members[k] = l.fspt_ensemble[class * l.fspt_ensemble_size + k];
+}
+
+void fspt_layer_make_ensemble(layer *l, int size, int bootstrap,
+        ENSEMBLE_AGGREGATION aggregation) {
+    assert(size >= 1);
+    l->fspt_ensemble_size = size;
+    l->fspt_ensemble_bootstrap = bootstrap;
+    l->fspt_ensemble_aggregation = aggregation;
+    if (size == 1) return;
+    l->fspt_ensemble = calloc(l->classes * size, sizeof(fspt_t *));
+    for (int class = 0; class < l->classes; ++class) {
+        fspt_t *base = l->fspts[class];
+        for (int k = 1; k < size; ++k) {
+            l->fspt_ensemble[class * size + k] = make_fspt(base->n_features,
+                    copy_float_array(2 * base->n_features,
+                        base->feature_limit),
+                    copy_float_array(base->n_features,
+                        base->feature_importance),
+                    base->criterion, base->score);
+        }
+    }
+    fprintf(stderr, "          ensemble of %d fspts per class (%s, %s)\n",
+            size, bootstrap ? "bootstrap" : "disjoint shards",
+            aggregation == ENSEMBLE_MIN ? "min" : "mean");
 }
 
 /**
@@ -142,13 +310,50 @@ static void realloc_fspt_data(layer l, int classe, size_t num, int relative) {
  */
 static float fspt_get_score(layer l, int classe) {
     float score = 0;
-    fspt_predict(1, l.fspts[classe], l.fspt_input, &score);
+    if (l.fspt_ensemble_size > 1) {
+        fspt_t *members[l.fspt_ensemble_size];
+        fspt_layer_members(l, classe, members);
+        fspt_predict_ensemble(1, l.fspt_ensemble_size, members,
+                l.fspt_ensemble_aggregation, l.fspt_input, &score);
+    } else {
+        fspt_predict(1, l.fspts[classe], l.fspt_input, &score);
+    }
     return score;
 }
 
+/**
+ * Tells if the score from the fspt of the layer l corresponding to classe
+ * classe is greater or equal to thresh, without computing the exact score
+ * when the whole subtree is on one side of the threshold.
+ * See @fspt_get_score and @fspt_accept.
+ *
+ * \param l The fspt layer.
+ * \param classe The classe that determine the fspt to use.
+ * \param thresh The threshold.
+ * \param score Output parameter. Will contain the score or a bound of the
+ *              score on the same side of the threshold.
+ * \return 1 if accepted, 0 otherwise.
+ */
+static int fspt_get_acceptance(layer l, int classe, float thresh,
+        float *score) {
+    int accept = 0;
+    if (l.fspt_ensemble_size > 1) {
+        fspt_t *members[l.fspt_ensemble_size];
+        fspt_layer_members(l, classe, members);
+        fspt_accept_ensemble(1, l.fspt_ensemble_size, members,
+                l.fspt_ensemble_aggregation, l.fspt_input, thresh, &accept,
+                score);
+    } else {
+        fspt_accept(1, l.fspts[classe], l.fspt_input, thresh, &accept, score);
+    }
+    return accept;
+}
+
 /**
  * Updates the row fspt_input of layer l with the content of the feature layers
  * at relative width x, height h and througth all the channels.
+ * If the reduction of the layer is fitted, it is applied after the
+ * activation and only the fspt_sample_size(l) first values are relevent.
  * The float values pointed by l.fspt_input or l.fspt_input_gpu are modified.
  * But if GPU is defined, l.fspt_input_gpu is not pulled by this function.
  *
@@ -182,38 +387,70 @@ static void update_fspt_input(layer l, network *net, float x, float y, int b) {
 #endif
         fspt_input_offset += input_layer.out_c;
     }
+    fspt_reduction *reduction = l.fspt_reduction;
 #ifdef GPU
     activate_array_gpu(l.fspt_input_gpu, l.total, l.activation);
     //cuda_pull_array(l.fspt_input_gpu, l.fspt_input, l.total);
+    if (reduction && reduction->fitted) {
+        cuda_pull_array(l.fspt_input_gpu, l.fspt_input, l.total);
+        fspt_reduction_forward(reduction, 1, l.fspt_input, l.fspt_input);
+        cuda_push_array(l.fspt_input_gpu, l.fspt_input, reduction->n_outputs);
+    }
 #else
     activate_array(l.fspt_input, l.total, l.activation);
+    if (reduction && reduction->fitted)
+        fspt_reduction_forward(reduction, 1, l.fspt_input, l.fspt_input);
 #endif
 
 }
 
 /**
- * Copies the content of l.fspt_input to l.fspt_training_data[classe].
- * Make sure the content of l.fspt_input is related to the classe
- * classe.
+ * Copies sample to l.fspt_training_data[classe] at index slot.
+ * See fspt_sample_slot.
  *
  * \param l The fspt layer.
- * \param classe The classe represented by l.fspt_input.
+ * \param classe The classe of the sample.
+ * \param slot The index of the sample. Either l.fspt_n_training_data[classe]
+ *             to append it or the index of the sample it replaces.
+ * \param stratum The stratum of the sample.
+ * \param sample The fspt_sample_size(l) features of the sample.
  */
-static void copy_fspt_input_to_data(layer l, int classe) {
+static void store_fspt_sample(layer l, int classe, size_t slot, int stratum,
+        const float *sample) {
     size_t n = l.fspt_n_training_data[classe];
     size_t n_max = l.fspt_n_max_training_data[classe];
-    if (n_max == n) {
+    if (slot == n && n_max == n) {
         realloc_fspt_data(l, classe, 0, 1);
         debug_print("Realloc space for data (n, n_max) = (%zu, %zu)", n, n_max);
     }
-    float *entry = l.fspt_training_data[classe]
-        + l.fspt_n_training_data[classe] * l.total;
+    int size = fspt_sample_size(l);
+    float *entry = l.fspt_training_data[classe] + slot * size;
+    memcpy(entry, sample, size * sizeof(float));
+    int *strata = l.fspt_training_strata[classe];
+    if (slot < n && strata[slot] >= 0)
+        --l.fspt_stratum_kept[classe * l.n + strata[slot]];
+    strata[slot] = stratum;
+    ++l.fspt_stratum_kept[classe * l.n + stratum];
+    if (slot == n) l.fspt_n_training_data[classe] += 1;
+}
+
+/**
+ * Copies the content of l.fspt_input to l.fspt_training_data[classe] at
+ * index slot. Make sure the content of l.fspt_input is related to the classe
+ * classe. See fspt_sample_slot.
+ *
+ * \param l The fspt layer.
+ * \param classe The classe represented by l.fspt_input.
+ * \param slot The index of the sample. Either l.fspt_n_training_data[classe]
+ *             to append it or the index of the sample it replaces.
+ * \param stratum The stratum of l.fspt_input.
+ */
+unit_static void copy_fspt_input_to_data(layer l, int classe, size_t slot,
+        int stratum) {
 #ifdef GPU
-    cuda_pull_array(l.fspt_input_gpu, entry, l.total);
-#else
-    copy_cpu(l.total, l.fspt_input, 1, entry, 1);
+    cuda_pull_array(l.fspt_input_gpu, l.fspt_input, fspt_sample_size(l));
 #endif
-    l.fspt_n_training_data[classe] += 1;
+    store_fspt_sample(l, classe, slot, stratum, l.fspt_input);
 }
 
 
@@ -234,8 +471,10 @@ int *get_fspt_detections_batch(layer l, int w, int h, network *net,
                     l.total);
 #endif
             int class = max_index(det->prob, l.classes);
-            det->fspt_score = fspt_get_score(l, class);
-            if (suppress && det->fspt_score < fspt_thresh) {
+            if (!suppress) {
+                det->fspt_score = fspt_get_score(l, class);
+            } else if (!fspt_get_acceptance(l, class, fspt_thresh,
+                        &det->fspt_score)) {
                 detection tmp_det = *det;
                 dets[b][i] = dets[b][count[b] - 1];
                 dets[b][count[b] - 1] = tmp_det;
@@ -283,8 +522,7 @@ void fspt_predict_truth(layer l, network net, detection **dets, int **n_boxes)
                         yolo.biases[2*mask_n]/net.w,
                         yolo.biases[2*mask_n+1]/net.h);
                 update_fspt_input(l, &net, truth.x, truth.y, b);
-                fspt_predict(1, l.fspts[class], l.fspt_input,
-                        &dets[b][count[b]].fspt_score);
+                dets[b][count[b]].fspt_score = fspt_get_score(l, class);
                 dets[b][count[b]].prob[class] = 1.f;
                 dets[b][count[b]].bbox.x = truth.x;
                 dets[b][count[b]].bbox.y = truth.y;
@@ -345,8 +583,11 @@ void forward_fspt_layer(layer l, network net)
                             truth.x, truth.y, truth.w, truth.h, mask_n,
                             yolo.biases[2*mask_n]/net.w,
                             yolo.biases[2*mask_n+1]/net.h);
-                    update_fspt_input(l, &net, truth.x, truth.y, b);
-                    copy_fspt_input_to_data(l, class);
+                    long slot = fspt_sample_slot(l, class, mask_n);
+                    if (slot >= 0) {
+                        update_fspt_input(l, &net, truth.x, truth.y, b);
+                        copy_fspt_input_to_data(l, class, slot, mask_n);
+                    }
                 }
                 ++t;
             }
@@ -388,8 +629,11 @@ void forward_fspt_layer_gpu(const layer l, network net) {
                             truth.x, truth.y, truth.w, truth.h, mask_n,
                             yolo.biases[2*mask_n]/net.w,
                             yolo.biases[2*mask_n+1]/net.h);
-                    update_fspt_input(l, &net, truth.x, truth.y, b);
-                    copy_fspt_input_to_data(l, class);
+                    long slot = fspt_sample_slot(l, class, mask_n);
+                    if (slot >= 0) {
+                        update_fspt_input(l, &net, truth.x, truth.y, b);
+                        copy_fspt_input_to_data(l, class, slot, mask_n);
+                    }
                 }
                 ++t;
             }
@@ -399,21 +643,218 @@ void forward_fspt_layer_gpu(const layer l, network net) {
 }
 #endif
 
+/**
+ * Writes the name of the member k of the ensemble of class class in the
+ * logs : "ref:class" for a single fspt and "ref:class.k" for an ensemble.
+ *
+ * \param l The fspt layer.
+ * \param class The class.
+ * \param k The index of the member.
+ * \param buf Output parameter. Size 256.
+ */
+static void member_label(layer l, int class, int k, char *buf) {
+    if (l.fspt_ensemble_size > 1)
+        snprintf(buf, 256, "%s:%d.%d", l.ref, class, k);
+    else
+        snprintf(buf, 256, "%s:%d", l.ref, class);
+}
+
+/**
+ * Simplifies one fspt of layer l. See fspt_simplify.
+ *
+ * \param label The name of the fspt in the logs.
+ * \param fspt The fspt.
+ * \param thresh The decision threshold.
+ * \param tolerance The tolerance on the scores.
+ */
+static void simplify_member(const char *label, fspt_t *fspt, float thresh,
+        float tolerance) {
+    if (!fspt->root || (thresh < 0 && tolerance <= 0)) return;
+    size_t n_nodes = fspt->n_nodes;
+    int depth = fspt->depth;
+    size_t removed = fspt_simplify(fspt, thresh, tolerance);
+    fprintf(stderr,
+            "[Fspt %s]: simplified with thresh = %g, tolerance = %g. n_nodes = %ld -> %ld (-%.1f%%), depth = %d -> %d.\n",
+            label, thresh, tolerance, n_nodes, fspt->n_nodes,
+            n_nodes ? 100. * removed / n_nodes : 0., depth, fspt->depth);
+}
+
+/**
+ * Saves the member k of the ensemble of class class. With
+ * l.fspt_simplify_thresh or l.fspt_simplify_tolerance, a simplified copy is
+ * saved and the fspt in memory is left whole, so it can still be rescored
+ * or simplified with other thresholds.
+ *
+ * \param l The fspt layer.
+ * \param class The class.
+ * \param k The index of the member.
+ * \param fp The file.
+ */
+static void save_member(layer l, int class, int k, FILE *fp) {
+    fspt_t *fspt = k ? l.fspt_ensemble[class * l.fspt_ensemble_size + k]
+        : l.fspts[class];
+    int succ = 1;
+    if (!fspt->root
+            || (l.fspt_simplify_thresh < 0 && l.fspt_simplify_tolerance <= 0)) {
+        fspt_save_file(fp, *fspt, l.save_samples, &succ);
+        return;
+    }
+    char label[256];
+    member_label(l, class, k, label);
+    fspt_t simplified = *fspt;
+    fspt_copy_nodes(fspt, &simplified);
+    simplify_member(label, &simplified, l.fspt_simplify_thresh,
+            l.fspt_simplify_tolerance);
+    fspt_save_file(fp, simplified, l.save_samples, &succ);
+    free_fspt_nodes(simplified.root);
+}
+
+/* Precedes the ensemble size in the weights files. */
+#define FSPT_ENSEMBLE_MAGIC 0x45545046 /* "FPTE" */
+
+/**
+ * Fails with error() if the fspts of l are compact : they have no nodes nor
+ * samples left to save, fit, rescore, prune or simplify.
+ *
+ * \param l The fspt layer.
+ * \param what The forbidden operation, for the message.
+ */
+static void check_not_compact(layer l, const char *what) {
+    if (!l.fspt_compact) return;
+    fprintf(stderr, "[Fspt %s]: compact fspts cannot be %s.\n", l.ref, what);
+    error("Compact fspts are inference only");
+}
+
 void save_fspt_trees(layer l, FILE *fp) {
-    for (int i = 0; i < l.classes; ++i) {
+    check_not_compact(l, "saved");
+    if (l.fspt_reduction) {
         int succ = 1;
-        fspt_save_file(fp, *l.fspts[i], l.save_samples, &succ);
+        fspt_reduction_save_file(fp, l.fspt_reduction, &succ);
+    }
+    int size = l.fspt_ensemble_size;
+    int header[2] = {FSPT_ENSEMBLE_MAGIC, size};
+    fwrite(header, sizeof(int), 2, fp);
+    for (int i = 0; i < l.classes; ++i) {
+        save_member(l, i, 0, fp);
+    }
+    /* The other members of the ensembles follow the base fspts. */
+    for (int i = 0; size > 1 && i < l.classes; ++i) {
+        for (int k = 1; k < size; ++k) {
+            save_member(l, i, k, fp);
+        }
     }
 }
 
 void load_fspt_trees(layer l, FILE *fp) {
+    if (l.fspt_reduction) {
+        int succ = 1;
+        fspt_reduction_load_file(fp, l.fspt_reduction, &succ);
+    }
+    /* The files saved before the ensembles have no ensemble size. */
+    int size = l.fspt_ensemble_size;
+    int header[2] = {0, 1};
+    if (fread(header, sizeof(int), 1, fp) != 1) {
+        header[1] = 1;
+    } else if (header[0] != FSPT_ENSEMBLE_MAGIC) {
+        fseek(fp, -(long) sizeof(int), SEEK_CUR);
+        header[1] = 1;
+    } else if (fread(header + 1, sizeof(int), 1, fp) != 1) {
+        error("Can't read the fspt ensemble size");
+    }
+    if (header[1] != size) {
+        fprintf(stderr,
+                "[Fspt %s]: ensembles of %d fspts saved, %d in the cfg.\n",
+                l.ref, header[1], size);
+        error("Fspt ensemble size mismatch");
+    }
+    /* An inference-only layer never reads the samples. */
+    int load_samples = l.fspt_compact ? 0 : l.load_samples;
     for (int i = 0; i < l.classes; ++i) {
         int succ = 1;
-        fspt_load_file(fp, l.fspts[i], l.load_samples, 1, 1, 1, &succ);
+        fspt_load_file(fp, l.fspts[i], load_samples, 1, 1, 1, &succ);
+    }
+    for (int i = 0; size > 1 && i < l.classes; ++i) {
+        for (int k = 1; k < size; ++k) {
+            int succ = 1;
+            fspt_load_file(fp, l.fspt_ensemble[i * size + k],
+                    load_samples, 1, 1, 1, &succ);
+        }
+    }
+    if (!l.fspt_compact) return;
+    size_t bytes = 0;
+    for (int i = 0; i < l.classes; ++i) {
+        fspt_t *members[size > 1 ? size : 1];
+        fspt_layer_members(l, i, members);
+        for (int k = 0; k < size || k == 0; ++k) {
+            fspt_compact(members[k], l.fspt_compact_bounds);
+            bytes += fspt_memory_size(members[k]);
+        }
+    }
+    fprintf(stderr, "[Fspt %s]: compact fspts loaded, %.1f KB.\n", l.ref,
+            bytes / 1024.);
+}
+
+void fspt_layer_fit_reduction(layer l) {
+    fspt_reduction *r = l.fspt_reduction;
+    if (!r || r->fitted) return;
+    int d = r->n_inputs;
+    /* Gathers at most r->max_samples samples among all the classes. */
+    size_t n_total = 0;
+    for (int class = 0; class < l.classes; ++class)
+        n_total += l.fspt_n_training_data[class];
+    if (!n_total) {
+        fprintf(stderr, "[Fspt %s]: no data to fit the reduction.\n", l.ref);
+        return;
+    }
+    size_t step = 1;
+    if (r->max_samples && n_total > r->max_samples)
+        step = (n_total + r->max_samples - 1) / r->max_samples;
+    float *X = malloc((n_total / step + 1) * d * sizeof(float));
+    size_t n = 0;
+    size_t k = 0;
+    for (int class = 0; class < l.classes; ++class) {
+        for (size_t i = 0; i < l.fspt_n_training_data[class]; ++i, ++k) {
+            if (k % step) continue;
+            copy_cpu(d, l.fspt_training_data[class] + i * d, 1, X + n * d, 1);
+            ++n;
+        }
+    }
+    double start = what_time_is_it_now();
+    fspt_reduction_fit(r, n, X);
+    free(X);
+    fprintf(stderr,
+            "[Fspt %s]: %s reduction %d -> %d fitted on %ld samples in %lf seconds.\n",
+            l.ref, reduction_method_to_string(r->method), d, r->n_outputs, n,
+            what_time_is_it_now() - start);
+    /* Resets the feature space of the fspts. */
+    for (int class = 0; class < l.classes; ++class) {
+        fspt_t *old = l.fspts[class];
+        l.fspts[class] = make_fspt(r->n_outputs,
+                fspt_reduction_feature_limit(r),
+                fspt_reduction_feature_importance(r),
+                old->criterion, old->score);
+        if (old->samples == l.fspt_training_data[class]) old->samples = NULL;
+        free_fspt(old);
+        for (int k = 1; k < l.fspt_ensemble_size; ++k) {
+            fspt_t **member = l.fspt_ensemble + class * l.fspt_ensemble_size + k;
+            old = *member;
+            *member = make_fspt(r->n_outputs, fspt_reduction_feature_limit(r),
+                    fspt_reduction_feature_importance(r), old->criterion,
+                    old->score);
+            free_fspt(old);
+        }
+    }
+    /* Reduces the extracted data in place. */
+    for (int class = 0; class < l.classes; ++class) {
+        if (!l.fspt_training_data[class]) continue;
+        fspt_reduction_forward(r, l.fspt_n_training_data[class],
+                l.fspt_training_data[class], l.fspt_training_data[class]);
+        realloc_fspt_data(l, class, l.fspt_n_max_training_data[class], 0);
     }
 }
 
 void fspt_layer_set_samples_class(layer l, int class, int refit, int merge) {
+    check_not_compact(l, "refitted");
     fspt_t *fspt = l.fspts[class];
     if (refit || !fspt->root) {
         if (fspt->root) {
@@ -427,8 +868,9 @@ void fspt_layer_set_samples_class(layer l, int class, int refit, int merge) {
             if (n + size_base > max) {
                 realloc_fspt_data(l, class, n + size_base, 0);
             }
-            copy_cpu(size_base * l.total, fspt->samples, 1,
-                    l.fspt_training_data[class] + n * l.total, 1);
+            int size = fspt_sample_size(l);
+            copy_cpu(size_base * size, fspt->samples, 1,
+                    l.fspt_training_data[class] + n * size, 1);
             n += size_base;
         } else {
             if (fspt->samples && fspt->samples != l.fspt_training_data[class])
@@ -440,75 +882,259 @@ void fspt_layer_set_samples_class(layer l, int class, int refit, int merge) {
     }
 }
 
+void fspt_layer_simplify_class(layer l, int class, float thresh,
+        float tolerance) {
+    check_not_compact(l, "simplified");
+    fspt_t *members[l.fspt_ensemble_size > 1 ? l.fspt_ensemble_size : 1];
+    fspt_layer_members(l, class, members);
+    for (int k = 0; k < l.fspt_ensemble_size || k == 0; ++k) {
+        char label[256];
+        member_label(l, class, k, label);
+        simplify_member(label, members[k], thresh, tolerance);
+    }
+}
+
+void fspt_layer_simplify(layer l, float thresh, float tolerance) {
+    for (int class = 0; class < l.classes; ++class) {
+        fspt_layer_simplify_class(l, class, thresh, tolerance);
+    }
+}
+
 void fspt_layer_rescore_class(layer l, int class) {
-    fspt_t *fspt = l.fspts[class];
-    assert(fspt);
+    check_not_compact(l, "rescored");
+    fspt_t *members[l.fspt_ensemble_size > 1 ? l.fspt_ensemble_size : 1];
+    fspt_layer_members(l, class, members);
+    for (int k = 0; k < l.fspt_ensemble_size || k == 0; ++k) {
+        fspt_t *fspt = members[k];
+        assert(fspt);
+        char label[256];
+        member_label(l, class, k, label);
+        score_args *s_args = calloc(1, sizeof(score_args)); 
+        *s_args = l.fspt_score_args;
+        double start = what_time_is_it_now();
+        fprintf(stderr, "[Fspt %s]: Start rescore...\n", label);
+        fspt_rescore(fspt, s_args);
+        long t = (what_time_is_it_now() - start) * 1000;
+        fprintf(stderr,
+                "[Fspt %s]: rescore successful in %ldh %ldm %lds %ldms.\n",
+                label, t / (60 * 60 * 1000), t / (60 * 1000) % 60,
+                t / 1000 % 60, t % 1000);
+#ifdef DEBUG
+        if (fspt->root->type == INNER && fspt->depth < 10)
+            print_fspt(fspt);
+#endif
+    }
+}
+
+typedef struct member_fit_args {
+    layer l;
+    int class;
+    int k;
+    fspt_t *fspt;
+    size_t n;
+    float *X;
+    double weight;
+} member_fit_args;
+
+/**
+ * Fits the member k of the ensemble of class class on n samples. The
+ * member takes the ownership of X.
+ *
+ * \param ptr A member_fit_args. Freed.
+ * \return NULL.
+ */
+static void *fit_member(void *ptr) {
+    member_fit_args a = *(member_fit_args *) ptr;
+    free(ptr);
+    layer l = a.l;
+    char label[256];
+    member_label(l, a.class, a.k, label);
+    criterion_args *c_args = calloc(1, sizeof(criterion_args)); 
     score_args *s_args = calloc(1, sizeof(score_args)); 
+    *c_args = l.fspt_criterion_args;
     *s_args = l.fspt_score_args;
+    c_args->stream_id = l.fspt_ensemble_size > 1 ?
+        a.class * l.fspt_ensemble_size + a.k : a.class;
+    c_args->sample_weight = a.weight;
     double start = what_time_is_it_now();
-    fprintf(stderr, "[Fspt %s:%d]: Start rescore...\n",
-            l.ref, class);
-    fspt_rescore(fspt, s_args);
+    fprintf(stderr,
+            "[Fspt %s]: Start fitting with n_samples = %ld (sample weight %g)...\n",
+            label, a.n, a.weight);
+    fspt_fit(a.n, a.X, c_args, s_args, a.fspt);
     long t = (what_time_is_it_now() - start) * 1000;
     fprintf(stderr,
-            "[Fspt %s:%d]: rescore successful in %ldh %ldm %lds %ldms.\n",
-            l.ref, class, t / (60 * 60 * 1000), t / (60 * 1000) % 60,
-            t / 1000 % 60, t % 1000);
+            "[Fspt %s]: fit successful in %ldh %ldm %lds %ldms. n_nodes = %ld, depth = %d.\n",
+            label, t / (60 * 60 * 1000), t / (60 * 1000) % 60,
+            t / 1000 % 60, t % 1000, a.fspt->n_nodes, a.fspt->depth);
+    flockfile(stderr);
+    fprintf(stderr, "[Fspt %s]: fit profile : ", label);
+    print_fspt_fit_profile(stderr, &a.fspt->profile);
+    funlockfile(stderr);
 #ifdef DEBUG
-    if (fspt->root->type == INNER && fspt->depth < 10)
-        print_fspt(fspt);
+    if (a.fspt->root->type == INNER && a.fspt->depth < 10)
+        print_fspt(a.fspt);
 #endif
+    return NULL;
 }
 
-void fspt_layer_fit_class(layer l, int class, int refit, int merge) {
-    fspt_t *fspt = l.fspts[class];
-    if (refit || !fspt->root) {
-        if (fspt->root) {
-            free_fspt_nodes(fspt->root);
-            fspt->root = NULL;
+/**
+ * Splits the n samples of X between the members of the ensemble of class
+ * class and fits them concurrently, one thread per member. The members get
+ * disjoint shards of a shuffle of X or, with l.fspt_ensemble_bootstrap,
+ * n / l.fspt_ensemble_size samples drawn with replacement. The sample
+ * weight of a member is rescaled by n / (its number of samples), such that
+ * min_samples keeps the same meaning as with a single fspt. X is freed.
+ *
+ * \param l The fspt layer.
+ * \param class The class.
+ * \param n The number of samples.
+ * \param X The samples. Size n * fspt_sample_size(l).
+ * \param weight The weight of the samples of X.
+ */
+static void fit_ensemble(layer l, int class, size_t n, float *X,
+        double weight) {
+    int K = l.fspt_ensemble_size;
+    int size = fspt_sample_size(l);
+    fspt_t *members[K];
+    fspt_layer_members(l, class, members);
+    /* The shards depend on the seed of the fit, not on the thread. */
+    rand_stream r;
+    rand_stream_seed(&r, l.fspt_criterion_args.seed, class);
+    if (!l.fspt_ensemble_bootstrap) {
+        float *tmp = malloc(size * sizeof(float));
+        for (size_t i = n; i > 1; --i) {
+            size_t j = rand_stream_next(&r) % i;
+            if (j == i - 1) continue;
+            memcpy(tmp, X + j * size, size * sizeof(float));
+            memcpy(X + j * size, X + (i - 1) * size, size * sizeof(float));
+            memcpy(X + (i - 1) * size, tmp, size * sizeof(float));
         }
-        size_t n = l.fspt_n_training_data[class];
-        if (merge) {
-            size_t size_base = fspt->n_samples;
-            size_t max = l.fspt_n_max_training_data[class];
-            if (n + size_base > max) {
-                realloc_fspt_data(l, class, n + size_base, 0);
+        free(tmp);
+    }
+    pthread_t *threads = calloc(K, sizeof(pthread_t));
+    for (int k = 0; k < K; ++k) {
+        size_t n_k;
+        float *X_k;
+        if (l.fspt_ensemble_bootstrap) {
+            n_k = n ? (n + K - 1) / K : 0;
+            X_k = malloc((n_k ? n_k : 1) * size * sizeof(float));
+            for (size_t i = 0; i < n_k; ++i) {
+                size_t j = rand_stream_next(&r) % n;
+                memcpy(X_k + i * size, X + j * size, size * sizeof(float));
             }
-            copy_cpu(size_base * l.total, fspt->samples, 1,
-                    l.fspt_training_data[class] + n * l.total, 1);
-            n += size_base;
         } else {
-            if (fspt->samples && fspt->samples != l.fspt_training_data[class])
-                free(fspt->samples);
+            size_t begin = k * n / K;
+            n_k = (k + 1) * n / K - begin;
+            X_k = malloc((n_k ? n_k : 1) * size * sizeof(float));
+            memcpy(X_k, X + begin * size, n_k * size * sizeof(float));
         }
-        float *X = l.fspt_training_data[class];
-        criterion_args *c_args = calloc(1, sizeof(criterion_args)); 
-        score_args *s_args = calloc(1, sizeof(score_args)); 
+        member_fit_args *ptr = calloc(1, sizeof(member_fit_args));
+        ptr->l = l;
+        ptr->class = class;
+        ptr->k = k;
+        ptr->fspt = members[k];
+        ptr->n = n_k;
+        ptr->X = X_k;
+        ptr->weight = n_k ? weight * n / n_k : weight;
+        if (pthread_create(threads + k, 0, fit_member, ptr))
+            error("Thread creation failed");
+    }
+    for (int k = 0; k < K; ++k) pthread_join(threads[k], 0);
+    free(threads);
+    free(X);
+}
+
+void fspt_layer_fit_class(layer l, int class, int refit, int merge) {
+    check_not_compact(l, "fitted");
+    int K = l.fspt_ensemble_size > 1 ? l.fspt_ensemble_size : 1;
+    fspt_t *members[K];
+    fspt_layer_members(l, class, members);
+    fspt_t *fspt = l.fspts[class];
+    if (!refit && fspt->root) return;
+    size_t n = l.fspt_n_training_data[class];
+    double weight = fspt_layer_sample_weight(l, class);
+    if (merge) {
+        size_t size_base = 0;
+        for (int k = 0; k < K; ++k) size_base += members[k]->n_samples;
+        size_t max = l.fspt_n_max_training_data[class];
+        if (n + size_base > max) {
+            realloc_fspt_data(l, class, n + size_base, 0);
+        }
+        int size = fspt_sample_size(l);
+        double represented = weight * n;
+        for (int k = 0; k < K; ++k) {
+            fspt_t *m = members[k];
+            copy_cpu(m->n_samples * size, m->samples, 1,
+                    l.fspt_training_data[class] + n * size, 1);
+            represented += (m->c_args && m->c_args->sample_weight > 1. ?
+                    m->c_args->sample_weight : 1.) * m->n_samples;
+            n += m->n_samples;
+        }
+        if (n) weight = represented / n;
+    }
+    for (int k = 0; k < K; ++k) {
+        fspt_t *m = members[k];
+        if (m->root) {
+            free_fspt_nodes(m->root);
+            m->root = NULL;
+        }
+        if (m->samples && m->samples != l.fspt_training_data[class])
+            free(m->samples);
+        m->samples = NULL;
+        m->n_samples = 0;
+    }
+    float *X = l.fspt_training_data[class];
+    fspt_layer_reset_sampling(l, class);
+    l.fspt_training_data[class] = NULL;
+    l.fspt_n_training_data[class] = 0;
+    l.fspt_n_max_training_data[class] = 0;
+    if (l.fspt_training_strata) {
+        free(l.fspt_training_strata[class]);
+        l.fspt_training_strata[class] = NULL;
+    }
+    if (K == 1) {
+        member_fit_args *ptr = calloc(1, sizeof(member_fit_args));
+        ptr->l = l;
+        ptr->class = class;
+        ptr->fspt = fspt;
+        ptr->n = n;
+        ptr->X = X;
+        ptr->weight = weight;
+        fit_member(ptr);
+    } else {
+        fit_ensemble(l, class, n, X, weight);
+    }
+}
+
+void fspt_layer_prune_class(layer l, int class) {
+    check_not_compact(l, "pruned");
+    fspt_t *members[l.fspt_ensemble_size > 1 ? l.fspt_ensemble_size : 1];
+    fspt_layer_members(l, class, members);
+    for (int k = 0; k < l.fspt_ensemble_size || k == 0; ++k) {
+        fspt_t *fspt = members[k];
+        assert(fspt);
+        char label[256];
+        member_label(l, class, k, label);
+        criterion_args *c_args = calloc(1, sizeof(criterion_args));
         *c_args = l.fspt_criterion_args;
-        *s_args = l.fspt_score_args;
-        double start = what_time_is_it_now();
-        fprintf(stderr, "[Fspt %s:%d]: Start fitting with n_samples = %ld...\n",
-                l.ref, class, n);
-        fspt_fit(n, X, c_args, s_args, fspt);
-        l.fspt_training_data[class] = NULL;
-        l.fspt_n_training_data[class] = 0;
-        l.fspt_n_max_training_data[class] = 0;
-        long t = (what_time_is_it_now() - start) * 1000;
+        if (fspt->c_args) c_args->sample_weight = fspt->c_args->sample_weight;
+        size_t n_nodes = fspt->n_nodes;
+        size_t removed = fspt_prune(fspt, c_args);
         fprintf(stderr,
-                "[Fspt %s:%d]: fit successful in %ldh %ldm %lds %ldms. n_nodes = %ld, depth = %d.\n",
-                l.ref, class, t / (60 * 60 * 1000), t / (60 * 1000) % 60,
-                t / 1000 % 60, t % 1000, fspt->n_nodes, fspt->depth);
+                "[Fspt %s]: pruned %ld nodes out of %ld. n_nodes = %ld, depth = %d.\n",
+                label, removed, n_nodes, fspt->n_nodes, fspt->depth);
     }
-#ifdef DEBUG
-    if (fspt->root->type == INNER && fspt->depth < 10)
-        print_fspt(fspt);
-#endif
+    fspt_layer_rescore_class(l, class);
 }
 
 void fspt_layer_fit(layer l, int refit, int merge) {
+    fspt_layer_fit_reduction(l);
     for (int class = 0; class < l.classes; ++class) {
         fspt_layer_fit_class(l, class, refit, merge);
     }
+    if (!l.fspts[0]->c_args || !l.fspts[0]->s_args) {
+        error("fspt_layer_fit: the fspts have no criterion or score args, their saved args could not be read.");
+    }
     l.fspt_criterion_args = *l.fspts[0]->c_args;
     l.fspt_score_args = *l.fspts[0]->s_args;
 }
@@ -517,16 +1143,161 @@ void fspt_layer_rescore(layer l) {
     for (int class = 0; class < l.classes; ++class) {
         fspt_layer_rescore_class(l, class);
     }
+    if (!l.fspts[0]->c_args || !l.fspts[0]->s_args) {
+        error("fspt_layer_rescore: the fspts have no criterion or score args, their saved args could not be read.");
+    }
     l.fspt_criterion_args = *l.fspts[0]->c_args;
     l.fspt_score_args = *l.fspts[0]->s_args;
 }
 
+void fspt_layer_prune(layer l) {
+    for (int class = 0; class < l.classes; ++class) {
+        fspt_layer_prune_class(l, class);
+    }
+}
+
 void fspt_layer_set_samples(layer l, int refit, int merge) {
+    fspt_layer_fit_reduction(l);
     for (int class = 0; class < l.classes; ++class) {
         fspt_layer_set_samples_class(l, class, refit, merge);
     }
 }
 
+#define FSPT_SHARD_VERSION 2
+#define FSPT_SHARD_BUFFER_ROWS 1024
+
+void fspt_layer_save_shard_file(FILE *fp, layer l, int *succ) {
+    int version = FSPT_SHARD_VERSION;
+    int size = fspt_sample_size(l);
+    *succ &= fwrite(&version, sizeof(int), 1, fp);
+    *succ &= fwrite(&l.classes, sizeof(int), 1, fp);
+    *succ &= fwrite(&size, sizeof(int), 1, fp);
+    for (int class = 0; class < l.classes; ++class) {
+        size_t n = l.fspt_n_training_data[class];
+        size_t seen = l.fspt_n_seen_data ? l.fspt_n_seen_data[class] : n;
+        *succ &= fwrite(&n, sizeof(size_t), 1, fp);
+        *succ &= fwrite(&seen, sizeof(size_t), 1, fp);
+        if (!n) continue;
+        qsort_float_rows(n, size, l.fspt_training_data[class]);
+        /* The sort loses the strata of the samples. */
+        for (size_t i = 0; l.fspt_training_strata
+                && l.fspt_training_strata[class] && i < n; ++i)
+            l.fspt_training_strata[class][i] = -1;
+        *succ &= (fwrite(l.fspt_training_data[class], sizeof(float),
+                    n * size, fp) == n * size);
+    }
+}
+
+/**
+ * Bounded read buffer on the samples of one class in a shard file.
+ */
+typedef struct shard_reader {
+    FILE *fp;
+    size_t remaining;  // samples of the class not read from fp yet.
+    size_t pos;        // index of the current sample in buf.
+    size_t n_buf;      // number of samples in buf.
+    float *buf;        // size FSPT_SHARD_BUFFER_ROWS * sample size.
+} shard_reader;
+
+/**
+ * Makes sure the reader has a current sample, refilling its buffer from
+ * the file if needed.
+ *
+ * \param r The reader.
+ * \param size The sample size.
+ * \param succ Output parameter. Set to 0 on a short read.
+ * \return 1 if r->buf + r->pos * size is a valid sample, 0 if the class
+ *         is exhausted.
+ */
+static int shard_reader_fill(shard_reader *r, int size, int *succ) {
+    if (r->pos < r->n_buf) return 1;
+    if (!r->remaining) return 0;
+    size_t k = r->remaining < FSPT_SHARD_BUFFER_ROWS ?
+        r->remaining : FSPT_SHARD_BUFFER_ROWS;
+    if (fread(r->buf, sizeof(float), k * size, r->fp) != k * size) {
+        *succ = 0;
+        r->remaining = 0;
+        r->n_buf = 0;
+        return 0;
+    }
+    r->remaining -= k;
+    r->n_buf = k;
+    r->pos = 0;
+    return 1;
+}
+
+void fspt_layer_merge_shard_files(layer l, int n_shards, FILE **fps,
+        int dedup, int *succ) {
+    if (n_shards <= 0) return;
+    int size = fspt_sample_size(l);
+    for (int s = 0; s < n_shards; ++s) {
+        int version = 0;
+        int classes = 0;
+        int shard_size = 0;
+        *succ &= fread(&version, sizeof(int), 1, fps[s]);
+        *succ &= fread(&classes, sizeof(int), 1, fps[s]);
+        *succ &= fread(&shard_size, sizeof(int), 1, fps[s]);
+        if (version != FSPT_SHARD_VERSION || classes != l.classes
+                || shard_size != size) {
+            fprintf(stderr,
+                    "[Fspt %s]: shard %d incompatible (version %d, %d classes, sample size %d).\n",
+                    l.ref, s, version, classes, shard_size);
+            *succ = 0;
+        }
+    }
+    if (!*succ) return;
+    shard_reader *readers = calloc((size_t) n_shards, sizeof(shard_reader));
+    for (int s = 0; s < n_shards; ++s) {
+        readers[s].fp = fps[s];
+        readers[s].buf = malloc(FSPT_SHARD_BUFFER_ROWS * size * sizeof(float));
+    }
+    for (int class = 0; class < l.classes && *succ; ++class) {
+        size_t total = 0;
+        for (int s = 0; s < n_shards; ++s) {
+            size_t seen = 0;
+            *succ &= fread(&readers[s].remaining, sizeof(size_t), 1, fps[s]);
+            *succ &= fread(&seen, sizeof(size_t), 1, fps[s]);
+            if (l.fspt_n_seen_data) l.fspt_n_seen_data[class] += seen;
+            readers[s].pos = 0;
+            readers[s].n_buf = 0;
+            total += readers[s].remaining;
+        }
+        if (!*succ) break;
+        size_t n_start = l.fspt_n_training_data[class];
+        if (total && n_start + total > l.fspt_n_max_training_data[class])
+            realloc_fspt_data(l, class, n_start + total, 0);
+        float *data = l.fspt_training_data[class];
+        size_t n = n_start;
+        size_t n_dup = 0;
+        while (1) {
+            int best = -1;
+            for (int s = 0; s < n_shards; ++s) {
+                if (!shard_reader_fill(readers + s, size, succ)) continue;
+                if (best < 0 || cmp_float_rows(size,
+                            readers[s].buf + readers[s].pos * size,
+                            readers[best].buf + readers[best].pos * size) < 0)
+                    best = s;
+            }
+            if (best < 0) break;
+            const float *row = readers[best].buf + readers[best].pos * size;
+            ++readers[best].pos;
+            if (dedup && n > n_start
+                    && !cmp_float_rows(size, row, data + (n - 1) * size)) {
+                ++n_dup;
+                continue;
+            }
+            copy_cpu(size, (float *) row, 1, data + n * size, 1);
+            ++n;
+        }
+        l.fspt_n_training_data[class] = n;
+        fprintf(stderr,
+                "[Fspt %s]: class %d, %zu samples merged from %d shards, %zu duplicates dropped.\n",
+                l.ref, class, n - n_start, n_shards, n_dup);
+    }
+    for (int s = 0; s < n_shards; ++s) free(readers[s].buf);
+    free(readers);
+}
+
 void merge_training_data(layer l, layer base) {
     for (int class = 0; class < l.classes; ++class) {
         size_t size_l = l.fspt_n_training_data[class];
@@ -535,7 +1306,30 @@ void merge_training_data(layer l, layer base) {
         if (size_l + size_base > max_base) {
             realloc_fspt_data(base, class, size_l, 1);
         }
-        copy_cpu(size_l * l.total, l.fspt_training_data[class], 1,
-                base.fspt_training_data[class] + size_base * l.total, 1);
+        int size = fspt_sample_size(l);
+        assert(size == fspt_sample_size(base));
+        copy_cpu(size_l * size, l.fspt_training_data[class], 1,
+                base.fspt_training_data[class] + size_base * size, 1);
+        base.fspt_n_seen_data[class] += l.fspt_n_seen_data[class];
+    }
+}
+
+void fspt_layer_merge_replica(layer replica, layer base) {
+    int size = fspt_sample_size(base);
+    assert(size == fspt_sample_size(replica));
+    for (int class = 0; class < base.classes; ++class) {
+        size_t n = replica.fspt_n_training_data[class];
+        const float *data = replica.fspt_training_data[class];
+        const int *strata = replica.fspt_training_strata[class];
+        for (size_t i = 0; i < n; ++i) {
+            long slot = fspt_sample_slot(base, class, strata[i]);
+            if (slot >= 0)
+                store_fspt_sample(base, class, slot, strata[i],
+                        data + i * size);
+        }
+        replica.fspt_n_training_data[class] = 0;
+        fspt_layer_reset_sampling(replica, class);
     }
 }
+
+#undef unit_static
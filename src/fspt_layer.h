@@ -34,6 +34,11 @@
  * \param activation The activation function applied to the input features
  *                   before storing them as input for fspts. Useful to restrict
  *                   the inputs to feature_limit.
+ * \param reduction Optional dimensionality reduction applied to the
+ *                  activated features. If not NULL, the fspts have
+ *                  reduction->n_outputs features and their feature_limit
+ *                  and feature_importance are derived from the ones of the
+ *                  reduction when it is fitted. The layer takes ownership.
  * \return The newly created fspt_layer.
  */
 extern layer make_fspt_layer(int inputs, int *input_layers,
@@ -41,7 +46,7 @@ extern layer make_fspt_layer(int inputs, int *input_layers,
         float *feature_limit, float *feature_importance,
         criterion_func criterion, score_func score, int batch,
         criterion_args c_args_template, score_args s_args_template,
-        ACTIVATION activation);
+        ACTIVATION activation, fspt_reduction *reduction);
 
 /**
  * Forward for the fspt layer.
@@ -91,7 +96,10 @@ extern void resize_fspt_layer(layer *l, int w, int h);
  * \param map ?
  * \param relative ?
  * \param suppress If true, the yolo detections that does not excceed the
- *                 fspt threshold are not part of the output.
+ *                 fspt threshold are not part of the output. The decision
+ *                 uses fspt_accept, so the fspt_score of the kept
+ *                 detections may only be a lower bound (>= fspt_thresh) of
+ *                 their exact score.
  * \param dets Size batches. Output parameter. Will be filled with the
  *             detections for each images of the batch. Make sure to allocate
  *             enought space.
@@ -120,8 +128,24 @@ extern void fspt_predict_truth(layer l, network net, detection **dets,
         int **n_boxes);
 
 /**
- * Saves all the fspts to a file. Opening and closing the file is the 
+ * Fits the dimensionality reduction of the layer on the extracted training
+ * data of all the classes, reduces these data in place and resets the
+ * feature space of the fspts accordingly.
+ * Does nothing if the layer has no reduction or if it is already fitted.
+ *
+ * \param l The fspt layer.
+ */
+extern void fspt_layer_fit_reduction(layer l);
+
+/**
+ * Saves all the fspts to a file, preceded by the reduction of the layer if
+ * any and by the ensemble size. Opening and closing the file is the 
  * responsibility of the caller.
+ * With l.fspt_simplify_thresh or l.fspt_simplify_tolerance, simplified
+ * copies of the fspts are saved (see @fspt_simplify) and the fspts in
+ * memory are unchanged.
+ * Fails with error() on compact fspts, which cannot be saved, nor fitted,
+ * rescored, pruned or simplified.
  *
  * \param l The fspt layer.
  * \param fp The file pointer.
@@ -129,8 +153,13 @@ extern void fspt_predict_truth(layer l, network net, detection **dets,
 extern void save_fspt_trees(layer l, FILE *fp);
 
 /**
- * Load all the fspts from a file. Opening and closing the file is the 
+ * Load all the fspts from a file, preceded by the reduction of the layer if
+ * any. Opening and closing the file is the 
  * responsibility of the caller.
+ * Fails with error() when the saved ensemble size is not the one of the
+ * layer. The files saved without ensemble size hold single fspts.
+ * With l.fspt_compact (inference only), the samples are skipped and the
+ * fspts are compacted (see fspt_compact).
  *
  * \param l The fspt layer.
  * \param fp The file pointer.
@@ -148,6 +177,51 @@ extern void load_fspt_trees(layer l, FILE *fp);
 extern void fspt_layer_set_samples_class(layer l, int class, int refit,
         int merge);
 
+/**
+ * Turns the fspt of each class of l into an ensemble of size fspts. The
+ * members are fitted concurrently on disjoint shards (or bootstrap samples)
+ * of the training data of their class and their scores are aggregated.
+ * The new members copy the feature space of l.fspts.
+ *
+ * \param l The fspt layer.
+ * \param size The number of fspts per class. 1 keeps a single fspt.
+ * \param bootstrap If true, the members are fitted on bootstrap samples
+ *                  instead of disjoint shards.
+ * \param aggregation How the scores of the members are aggregated.
+ */
+extern void fspt_layer_make_ensemble(layer *l, int size, int bootstrap,
+        ENSEMBLE_AGGREGATION aggregation);
+
+/**
+ * Gives the members of the ensemble of class class. The member 0 is
+ * l.fspts[class].
+ *
+ * \param l The fspt layer.
+ * \param class The class.
+ * \param members Output parameter. Size max(1, l.fspt_ensemble_size).
+ */
+extern void fspt_layer_members(layer l, int class, fspt_t **members);
+
+/**
+ * Gives the number of extracted samples represented by one training sample
+ * of class class. It is greater than 1 when l.fspt_max_samples capped the
+ * extraction (see the [fspt] options sampling and max_samples_per_class).
+ *
+ * \param l The fspt layer.
+ * \param class The class.
+ * \return The weight of the training samples of class class.
+ */
+extern double fspt_layer_sample_weight(layer l, int class);
+
+/**
+ * Forgets the number of samples of class class met during extraction and
+ * the strata of its training samples.
+ *
+ * \param l The fspt layer.
+ * \param class The class.
+ */
+extern void fspt_layer_reset_sampling(layer l, int class);
+
 /**
  * Fits the fspt of class class of the fspt layer.
  * The data must be already extracted.
@@ -167,6 +241,39 @@ extern void fspt_layer_fit_class(layer l, int class, int refit, int merge);
  */
 extern void fspt_layer_rescore_class(layer l, int class);
 
+/**
+ * Prunes the fspt of class class with the stopping rules of
+ * l.fspt_criterion_args (see @fspt_prune) and rescores it with
+ * l.fspt_score_args. The fspt must have been fitted with looser stopping
+ * rules.
+ *
+ * \param l The fspt layer.
+ * \param class The class to prune.
+ */
+extern void fspt_layer_prune_class(layer l, int class);
+
+/**
+ * Collapses the subtrees of the fspt of class class whose leaves all take
+ * the same decision. See @fspt_simplify.
+ *
+ * \param l The fspt layer.
+ * \param class The class to simplify.
+ * \param thresh The deployment threshold. Negative to disable.
+ * \param tolerance The score tolerance. 0 to disable.
+ */
+extern void fspt_layer_simplify_class(layer l, int class, float thresh,
+        float tolerance);
+
+/**
+ * Collapses the subtrees of the fspts of the layer whose leaves all take
+ * the same decision. See @fspt_simplify.
+ *
+ * \param l The fspt layer.
+ * \param thresh The deployment threshold. Negative to disable.
+ * \param tolerance The score tolerance. 0 to disable.
+ */
+extern void fspt_layer_simplify(layer l, float thresh, float tolerance);
+
 /**
  * Sets the training data for all the class but don't fit.
  *
@@ -193,6 +300,45 @@ extern void fspt_layer_fit(layer l, int refit, int merge);
  */
 extern void fspt_layer_rescore(layer l);
 
+/**
+ * Prunes and rescores the fspts of the fspt layer.
+ *
+ * \param l The fspt layer.
+ */
+extern void fspt_layer_prune(layer l);
+
+/**
+ * Saves the extracted training data of all the classes to a shard file.
+ * The samples of each class are sorted in place in lexicographic order
+ * before being written so that shards can be merged in a streaming way by
+ * fspt_layer_merge_shard_files. Opening and closing the file is the
+ * responsibility of the caller.
+ *
+ * \param fp The file pointer.
+ * \param l The fspt layer.
+ * \param succ Output parameter. Will contain 1 if successfully save,
+ *             0 otherwise.
+ */
+extern void fspt_layer_save_shard_file(FILE *fp, layer l, int *succ);
+
+/**
+ * K-way merges the training data of n_shards shard files written by
+ * fspt_layer_save_shard_file. The merged samples are appended to the
+ * training data of the layer. Shards are read through bounded buffers so
+ * that only the merged output is held in memory. Opening and closing the
+ * files is the responsibility of the caller.
+ *
+ * \param l The fspt layer.
+ * \param n_shards The number of shard files.
+ * \param fps The file pointers, positioned at the section of the layer.
+ * \param dedup If true, drops the samples equal to the previous merged
+ *              sample of the same class.
+ * \param succ Output parameter. Will contain 1 if successfully merged,
+ *             0 otherwise.
+ */
+extern void fspt_layer_merge_shard_files(layer l, int n_shards, FILE **fps,
+        int dedup, int *succ);
+
 /**
  * Merges the training data in layer l and base.
  * the training data of layer l are appended to the training data
@@ -203,4 +349,21 @@ extern void fspt_layer_rescore(layer l);
  */
 extern void merge_training_data(layer l, layer base);
 
+/**
+ * Moves the samples extracted by a replica of the fspt layer base (see
+ * replicate_network) to base. The replica keeps all its samples and each
+ * one goes through the sampling policy of base, as if base had met it.
+ * The training data of the replica are emptied.
+ *
+ * \param replica Fspt layer of a replica, with FSPT_SAMPLING_ALL.
+ * \param base Fspt layer of the replicated network.
+ */
+extern void fspt_layer_merge_replica(layer replica, layer base);
+
+#ifdef DEBUG
+extern long fspt_sample_slot(layer l, int classe, int stratum);
+extern void copy_fspt_input_to_data(layer l, int classe, size_t slot,
+        int stratum);
+#endif
+
 #endif /* FSPT_LAYER_H */
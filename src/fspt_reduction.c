@@ -0,0 +1,380 @@
+#include "fspt_reduction.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gemm.h"
+#include "utils.h"
+
+#define REDUCTION_VERSION 1
+#define PCA_ITERATIONS 64
+
+typedef struct {
+    int index;
+    double score;
+} index_score;
+
+fspt_reduction *make_fspt_reduction(REDUCTION_METHOD method,
+        int n_inputs, int n_outputs, unsigned int seed, size_t max_samples,
+        const float *feature_limit, const float *feature_importance) {
+    assert(0 < n_outputs && n_outputs <= n_inputs);
+    fspt_reduction *r = calloc(1, sizeof(fspt_reduction));
+    r->method = method;
+    r->n_inputs = n_inputs;
+    r->n_outputs = n_outputs;
+    r->seed = seed;
+    r->max_samples = max_samples;
+    r->feature_limit = copy_float_array(2 * n_inputs, feature_limit);
+    r->feature_importance = copy_float_array(n_inputs, feature_importance);
+    r->workspace = calloc(n_inputs, sizeof(float));
+    return r;
+}
+
+void free_fspt_reduction(fspt_reduction *r) {
+    if (!r) return;
+    free(r->feature_limit);
+    free(r->feature_importance);
+    free(r->selected);
+    free(r->mean);
+    free(r->weights);
+    free(r->workspace);
+    free(r);
+}
+
+/**
+ * Helper function for qsort, decreasing order of the score.
+ */
+static int cmp_index_score(const void *p1, const void *p2) {
+    double s1 = ((const index_score *) p1)->score;
+    double s2 = ((const index_score *) p2)->score;
+    return (s1 < s2) - (s1 > s2);
+}
+
+/**
+ * Computes the mean of the n samples of X.
+ *
+ * \param d The number of features.
+ * \param n The number of samples.
+ * \param X The samples. Size n * d.
+ * \return The mean. Size d. Caller must free.
+ */
+static float *mean_samples(int d, size_t n, const float *X) {
+    double *acc = calloc(d, sizeof(double));
+    for (size_t i = 0; i < n; ++i) {
+        for (int j = 0; j < d; ++j) acc[j] += X[i * d + j];
+    }
+    float *mean = calloc(d, sizeof(float));
+    for (int j = 0; j < d; ++j) mean[j] = n ? acc[j] / n : 0.;
+    free(acc);
+    return mean;
+}
+
+/**
+ * Keeps the channels with the highest variance. The variance is weighted by
+ * the feature importance unless all the importances are null.
+ */
+static void fit_variance(fspt_reduction *r, size_t n, const float *X) {
+    int d = r->n_inputs;
+    float *mean = mean_samples(d, n, X);
+    index_score *scores = calloc(d, sizeof(index_score));
+    int use_importance = 0;
+    for (int j = 0; j < d; ++j) use_importance |= r->feature_importance[j] != 0;
+    for (size_t i = 0; i < n; ++i) {
+        for (int j = 0; j < d; ++j) {
+            double diff = X[i * d + j] - mean[j];
+            scores[j].score += diff * diff;
+        }
+    }
+    for (int j = 0; j < d; ++j) {
+        scores[j].index = j;
+        if (use_importance) scores[j].score *= r->feature_importance[j];
+    }
+    qsort(scores, d, sizeof(index_score), cmp_index_score);
+    r->selected = calloc(r->n_outputs, sizeof(int));
+    for (int j = 0; j < r->n_outputs; ++j) r->selected[j] = scores[j].index;
+    free(scores);
+    free(mean);
+}
+
+/**
+ * Orthonormalizes in place the k columns of the d x k row major matrix Q
+ * (modified Gram-Schmidt). A degenerated column is replaced by a random
+ * direction.
+ */
+static void orthonormalize_columns(int d, int k, float *Q,
+        unsigned int *seed) {
+    for (int j = 0; j < k; ++j) {
+        for (int p = 0; p < j; ++p) {
+            double dot = 0;
+            for (int i = 0; i < d; ++i) dot += Q[i * k + j] * Q[i * k + p];
+            for (int i = 0; i < d; ++i) Q[i * k + j] -= dot * Q[i * k + p];
+        }
+        double norm = 0;
+        for (int i = 0; i < d; ++i) norm += Q[i * k + j] * Q[i * k + j];
+        norm = sqrt(norm);
+        if (norm < 1e-12) {
+            for (int i = 0; i < d; ++i)
+                Q[i * k + j] = (float) rand_r(seed) / RAND_MAX - .5f;
+            --j;
+            continue;
+        }
+        for (int i = 0; i < d; ++i) Q[i * k + j] /= norm;
+    }
+}
+
+/**
+ * Projects on the first principal components. The covariance matrix is
+ * computed with gemm and its dominant eigenvectors are found by orthogonal
+ * (subspace) iterations.
+ */
+static void fit_pca(fspt_reduction *r, size_t n, const float *X) {
+    int d = r->n_inputs;
+    int k = r->n_outputs;
+    unsigned int seed = r->seed;
+    r->mean = mean_samples(d, n, X);
+    float *Xc = malloc(n * d * sizeof(float));
+    for (size_t i = 0; i < n; ++i) {
+        for (int j = 0; j < d; ++j) Xc[i * d + j] = X[i * d + j] - r->mean[j];
+    }
+    float *cov = calloc(d * d, sizeof(float));
+    float alpha = n > 1 ? 1.f / (n - 1) : 1.f;
+    gemm(1, 0, d, d, n, alpha, Xc, d, Xc, d, 0, cov, d);
+    free(Xc);
+
+    float *Q = malloc(d * k * sizeof(float));
+    float *Z = calloc(d * k, sizeof(float));
+    for (int i = 0; i < d * k; ++i) Q[i] = (float) rand_r(&seed) / RAND_MAX - .5f;
+    orthonormalize_columns(d, k, Q, &seed);
+    for (int it = 0; it < PCA_ITERATIONS; ++it) {
+        gemm(0, 0, d, k, d, 1, cov, d, Q, k, 0, Z, k);
+        float *tmp = Q;
+        Q = Z;
+        Z = tmp;
+        orthonormalize_columns(d, k, Q, &seed);
+    }
+    /* explained variance */
+    gemm(0, 0, d, k, d, 1, cov, d, Q, k, 0, Z, k);
+    double trace = 0;
+    for (int i = 0; i < d; ++i) trace += cov[i * d + i];
+    double explained = 0;
+    for (int j = 0; j < k; ++j) {
+        for (int i = 0; i < d; ++i) explained += Q[i * k + j] * Z[i * k + j];
+    }
+    fprintf(stderr, "PCA reduction %d -> %d: %.2f%% of variance explained.\n",
+            d, k, trace > 0 ? 100. * explained / trace : 100.);
+
+    r->weights = malloc(k * d * sizeof(float));
+    for (int j = 0; j < k; ++j) {
+        for (int i = 0; i < d; ++i) r->weights[j * d + i] = Q[i * k + j];
+    }
+    free(Q);
+    free(Z);
+    free(cov);
+}
+
+/**
+ * Sparse random projection (Achlioptas): the weights are sqrt(3/k) * {1, 0,
+ * -1} with probabilities {1/6, 2/3, 1/6}.
+ */
+static void fit_random(fspt_reduction *r) {
+    int d = r->n_inputs;
+    int k = r->n_outputs;
+    unsigned int seed = r->seed;
+    float scale = sqrt(3. / k);
+    r->weights = calloc(k * d, sizeof(float));
+    for (int i = 0; i < k * d; ++i) {
+        int u = rand_r(&seed) % 6;
+        if (u == 0) r->weights[i] = scale;
+        else if (u == 1) r->weights[i] = -scale;
+    }
+}
+
+void fspt_reduction_fit(fspt_reduction *r, size_t n, const float *X) {
+    free(r->selected);
+    free(r->mean);
+    free(r->weights);
+    r->selected = NULL;
+    r->mean = NULL;
+    r->weights = NULL;
+    switch (r->method) {
+        case VARIANCE_REDUCTION:
+            fit_variance(r, n, X);
+            break;
+        case PCA_REDUCTION:
+            fit_pca(r, n, X);
+            break;
+        case RANDOM_REDUCTION:
+            fit_random(r);
+            break;
+        default:
+            error("fspt_reduction_fit: unknown reduction method.");
+    }
+    r->fitted = 1;
+}
+
+void fspt_reduction_forward(fspt_reduction *r, size_t n, const float *X,
+        float *Y) {
+    assert(r->fitted);
+    int d = r->n_inputs;
+    int k = r->n_outputs;
+    float *x = r->workspace;
+    for (size_t i = 0; i < n; ++i) {
+        /* row i of Y never overlaps the rows > i of X. */
+        memcpy(x, X + i * d, d * sizeof(float));
+        float *y = Y + i * k;
+        if (r->method == VARIANCE_REDUCTION) {
+            for (int j = 0; j < k; ++j) y[j] = x[r->selected[j]];
+            continue;
+        }
+        if (r->mean) {
+            for (int p = 0; p < d; ++p) x[p] -= r->mean[p];
+        }
+        for (int j = 0; j < k; ++j) {
+            const float *w = r->weights + j * d;
+            float sum = 0;
+            for (int p = 0; p < d; ++p) sum += w[p] * x[p];
+            y[j] = sum;
+        }
+    }
+}
+
+float *fspt_reduction_feature_limit(const fspt_reduction *r) {
+    assert(r->fitted);
+    int d = r->n_inputs;
+    int k = r->n_outputs;
+    const float *lim = r->feature_limit;
+    float *new_lim = calloc(2 * k, sizeof(float));
+    for (int j = 0; j < k; ++j) {
+        if (r->method == VARIANCE_REDUCTION) {
+            new_lim[2*j] = lim[2 * r->selected[j]];
+            new_lim[2*j + 1] = lim[2 * r->selected[j] + 1];
+            continue;
+        }
+        double min = 0;
+        double max = 0;
+        for (int p = 0; p < d; ++p) {
+            float w = r->weights[j * d + p];
+            float m = r->mean ? r->mean[p] : 0.f;
+            double a = w * (lim[2*p] - m);
+            double b = w * (lim[2*p + 1] - m);
+            min += MIN(a, b);
+            max += MAX(a, b);
+        }
+        new_lim[2*j] = min;
+        new_lim[2*j + 1] = max;
+    }
+    return new_lim;
+}
+
+float *fspt_reduction_feature_importance(const fspt_reduction *r) {
+    assert(r->fitted);
+    int d = r->n_inputs;
+    int k = r->n_outputs;
+    float *imp = calloc(k, sizeof(float));
+    for (int j = 0; j < k; ++j) {
+        if (r->method == VARIANCE_REDUCTION) {
+            imp[j] = r->feature_importance[r->selected[j]];
+            continue;
+        }
+        double sum = 0;
+        double sum_w = 0;
+        for (int p = 0; p < d; ++p) {
+            double w = fabs(r->weights[j * d + p]);
+            sum += w * r->feature_importance[p];
+            sum_w += w;
+        }
+        imp[j] = safe_divd(sum, sum_w);
+    }
+    return imp;
+}
+
+void fspt_reduction_save_file(FILE *fp, const fspt_reduction *r, int *succ) {
+    int version = REDUCTION_VERSION;
+    int method = r->method;
+    *succ &= fwrite(&version, sizeof(int), 1, fp);
+    *succ &= fwrite(&method, sizeof(int), 1, fp);
+    *succ &= fwrite(&r->n_inputs, sizeof(int), 1, fp);
+    *succ &= fwrite(&r->n_outputs, sizeof(int), 1, fp);
+    *succ &= fwrite(&r->fitted, sizeof(int), 1, fp);
+    if (!r->fitted) return;
+    size_t d = r->n_inputs;
+    size_t k = r->n_outputs;
+    if (r->method == VARIANCE_REDUCTION) {
+        *succ &= (fwrite(r->selected, sizeof(int), k, fp) == k);
+    } else {
+        int have_mean = r->mean != NULL;
+        *succ &= fwrite(&have_mean, sizeof(int), 1, fp);
+        if (have_mean)
+            *succ &= (fwrite(r->mean, sizeof(float), d, fp) == d);
+        *succ &= (fwrite(r->weights, sizeof(float), k * d, fp) == k * d);
+    }
+}
+
+void fspt_reduction_load_file(FILE *fp, fspt_reduction *r, int *succ) {
+    int version = 0;
+    int method = 0;
+    int n_inputs = 0;
+    int n_outputs = 0;
+    int fitted = 0;
+    *succ &= fread(&version, sizeof(int), 1, fp);
+    *succ &= fread(&method, sizeof(int), 1, fp);
+    *succ &= fread(&n_inputs, sizeof(int), 1, fp);
+    *succ &= fread(&n_outputs, sizeof(int), 1, fp);
+    *succ &= fread(&fitted, sizeof(int), 1, fp);
+    if (!*succ || version != REDUCTION_VERSION || method != (int) r->method
+            || n_inputs != r->n_inputs || n_outputs != r->n_outputs) {
+        fprintf(stderr, "Wrong reduction version (%d), method (%s) or size \
+(%d -> %d instead of %d -> %d).\n", version,
+                reduction_method_to_string(method), n_inputs, n_outputs,
+                r->n_inputs, r->n_outputs);
+        error("fspt_reduction_load_file: incompatible reduction.");
+    }
+    if (!fitted) return;
+    size_t d = n_inputs;
+    size_t k = n_outputs;
+    free(r->selected);
+    free(r->mean);
+    free(r->weights);
+    r->selected = NULL;
+    r->mean = NULL;
+    r->weights = NULL;
+    if (r->method == VARIANCE_REDUCTION) {
+        r->selected = malloc(k * sizeof(int));
+        *succ &= (fread(r->selected, sizeof(int), k, fp) == k);
+    } else {
+        int have_mean = 0;
+        *succ &= fread(&have_mean, sizeof(int), 1, fp);
+        if (have_mean) {
+            r->mean = malloc(d * sizeof(float));
+            *succ &= (fread(r->mean, sizeof(float), d, fp) == d);
+        }
+        r->weights = malloc(k * d * sizeof(float));
+        *succ &= (fread(r->weights, sizeof(float), k * d, fp) == k * d);
+    }
+    r->fitted = *succ;
+}
+
+REDUCTION_METHOD string_to_reduction_method(const char *s) {
+    if (strcmp(s, "variance") == 0) return VARIANCE_REDUCTION;
+    if (strcmp(s, "pca") == 0) return PCA_REDUCTION;
+    if (strcmp(s, "random") == 0) return RANDOM_REDUCTION;
+    return NO_REDUCTION;
+}
+
+const char *reduction_method_to_string(REDUCTION_METHOD m) {
+    switch (m) {
+        case VARIANCE_REDUCTION:
+            return "variance";
+        case PCA_REDUCTION:
+            return "pca";
+        case RANDOM_REDUCTION:
+            return "random";
+        default:
+            return "none";
+    }
+}
+
+#undef REDUCTION_VERSION
+#undef PCA_ITERATIONS
@@ -0,0 +1,133 @@
+#ifndef FSPT_REDUCTION_H
+#define FSPT_REDUCTION_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+typedef enum REDUCTION_METHOD {
+    NO_REDUCTION = 0,
+    VARIANCE_REDUCTION = 1,
+    PCA_REDUCTION = 2,
+    RANDOM_REDUCTION = 3
+} REDUCTION_METHOD;
+
+/**
+ * Dimensionality reduction applied to the features extracted by a fspt
+ * layer before they reach the fspts.
+ * The reduction maps n_inputs features (l.total) to n_outputs features.
+ * VARIANCE_REDUCTION keeps the n_outputs channels with the highest
+ * variance * importance, PCA_REDUCTION projects on the n_outputs first
+ * principal components and RANDOM_REDUCTION uses a seeded sparse random
+ * projection (Achlioptas).
+ */
+typedef struct fspt_reduction {
+    REDUCTION_METHOD method;
+    int n_inputs;
+    int n_outputs;
+    unsigned int seed;
+    size_t max_samples;   // max number of samples used to fit.
+    int fitted;
+    float *feature_limit;       // size 2 * n_inputs. Bounds of the inputs.
+    float *feature_importance;  // size n_inputs.
+    int *selected;   // VARIANCE_REDUCTION. size n_outputs.
+    float *mean;     // PCA_REDUCTION. size n_inputs.
+    float *weights;  // PCA/RANDOM_REDUCTION. size n_outputs * n_inputs.
+    float *workspace; // size n_inputs.
+} fspt_reduction;
+
+/**
+ * Creates an unfitted reduction.
+ *
+ * \param method The reduction method.
+ * \param n_inputs The number of input features.
+ * \param n_outputs The number of output features. Must be <= n_inputs.
+ * \param seed The seed for PCA initialization and random projection.
+ * \param max_samples Maximum number of samples used to fit the reduction.
+ * \param feature_limit The bounds of the input features. Size 2*n_inputs.
+ *                      Copied.
+ * \param feature_importance The importance of the input features. Size
+ *                           n_inputs. Copied.
+ * \return The newly created reduction.
+ */
+extern fspt_reduction *make_fspt_reduction(REDUCTION_METHOD method,
+        int n_inputs, int n_outputs, unsigned int seed, size_t max_samples,
+        const float *feature_limit, const float *feature_importance);
+
+/**
+ * Fits the reduction on samples.
+ *
+ * \param r The reduction.
+ * \param n The number of samples.
+ * \param X The samples. Size n * r->n_inputs.
+ */
+extern void fspt_reduction_fit(fspt_reduction *r, size_t n, const float *X);
+
+/**
+ * Applies the reduction on n samples. X and Y may be the same array, in
+ * which case the samples are reduced in place (rows are then packed with
+ * a stride of r->n_outputs).
+ *
+ * \param r The fitted reduction.
+ * \param n The number of samples.
+ * \param X The samples. Size n * r->n_inputs.
+ * \param Y Output parameter. Size n * r->n_outputs.
+ */
+extern void fspt_reduction_forward(fspt_reduction *r, size_t n,
+        const float *X, float *Y);
+
+/**
+ * Computes the bounds of the reduced features such that every input
+ * inside r->feature_limit is mapped inside them.
+ *
+ * \param r The fitted reduction.
+ * \return The new bounds. Size 2 * r->n_outputs. Caller must free.
+ */
+extern float *fspt_reduction_feature_limit(const fspt_reduction *r);
+
+/**
+ * Computes the importance of the reduced features as the average of the
+ * input importances weighted by the absolute projection weights.
+ *
+ * \param r The fitted reduction.
+ * \return The new importances. Size r->n_outputs. Caller must free.
+ */
+extern float *fspt_reduction_feature_importance(const fspt_reduction *r);
+
+/**
+ * Saves a reduction. Opening and closing the file is the responsibility of
+ * the caller.
+ *
+ * \param fp The file pointer.
+ * \param r The reduction.
+ * \param succ Output parameter. Will contain 1 if successfully save,
+ *             0 otherwise.
+ */
+extern void fspt_reduction_save_file(FILE *fp, const fspt_reduction *r,
+        int *succ);
+
+/**
+ * Loads a reduction saved by fspt_reduction_save_file into r. The method
+ * and the dimensions must match. Opening and closing the file is the
+ * responsibility of the caller.
+ *
+ * \param fp The file pointer.
+ * \param r The reduction.
+ * \param succ Output parameter. Will contain 1 if successfully load,
+ *             0 otherwise.
+ */
+extern void fspt_reduction_load_file(FILE *fp, fspt_reduction *r, int *succ);
+
+extern void free_fspt_reduction(fspt_reduction *r);
+
+/**
+ * Maps the string names of the reductions to the reduction method.
+ *
+ * \param s The string name of a reduction ("none", "variance", "pca" or
+ *          "random").
+ * \return The corresponding method or NO_REDUCTION.
+ */
+extern REDUCTION_METHOD string_to_reduction_method(const char *s);
+
+extern const char *reduction_method_to_string(REDUCTION_METHOD m);
+
+#endif /* FSPT_REDUCTION_H */
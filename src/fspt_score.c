@@ -13,6 +13,14 @@
 #define INTEGER_FORMAT "%-16d"
 #define LONGINT_FORMAT "%-16ld"
 #define SCORE_ARGS_VERSION 4
+/* the runtime knobs at the end of score_args are not saved */
+#define SAVED_SCORE_ARGS_SIZE offsetof(score_args, n_threads)
+
+#ifndef DEBUG
+#define unit_static static
+#else
+#define unit_static
+#endif
 
 static double auto_normalize(density_normalize_args a, double raw_score) {
     if (!a.verification_passed) return 0.;
@@ -20,6 +28,57 @@ static double auto_normalize(density_normalize_args a, double raw_score) {
     return score;
 }
 
+static void swap_score_vol_n(score_vol_n *a, size_t i, size_t j) {
+    score_vol_n tmp = a[i];
+    a[i] = a[j];
+    a[j] = tmp;
+}
+
+unit_static size_t select_score_vol_n(score_vol_n *a, size_t n,
+        size_t samples_break) {
+    size_t lo = 0;
+    size_t hi = n;
+    size_t samples_count = 0;
+    while (hi - lo > 1) {
+        /* median of three pivot */
+        size_t mid = lo + (hi - lo) / 2;
+        double s0 = a[lo].score, s1 = a[mid].score, s2 = a[hi - 1].score;
+        double pivot = s0 > s1
+            ? (s1 > s2 ? s1 : (s0 > s2 ? s2 : s0))
+            : (s0 > s2 ? s0 : (s1 > s2 ? s2 : s1));
+        /* three-way partition : [lo, lt) > pivot, [lt, gt) == pivot and
+         * [gt, hi) < pivot */
+        size_t lt = lo, i = lo, gt = hi;
+        size_t n_greater = 0, n_equal = 0;
+        while (i < gt) {
+            if (a[i].score > pivot) {
+                n_greater += a[i].n_samples;
+                swap_score_vol_n(a, lt++, i++);
+            } else if (a[i].score < pivot) {
+                swap_score_vol_n(a, i, --gt);
+            } else {
+                n_equal += a[i].n_samples;
+                ++i;
+            }
+        }
+        if (lt > lo && samples_count + n_greater >= samples_break) {
+            hi = lt;
+        } else if (samples_count + n_greater + n_equal >= samples_break) {
+            samples_count += n_greater;
+            for (i = lt; i < gt; ++i) {
+                samples_count += a[i].n_samples;
+                if (samples_count >= samples_break) return i;
+            }
+            return gt - 1;
+        } else {
+            samples_count += n_greater + n_equal;
+            lo = gt;
+        }
+    }
+    if (lo >= n) return n - 1;
+    return lo;
+}
+
 static void compute_norm_args(score_args *s_args) {
     if (!s_args->fspt->n_samples || !s_args->n_leaves) {
         s_args->norm_args.verification_passed = 0;
@@ -30,16 +89,18 @@ static void compute_norm_args(score_args *s_args) {
     size_t samples_count = 0;
     size_t uniform_leaves = 0;
     double volume_p_count = 0.;
-    size_t i_break = 0;
-    for (i_break = 0; i_break < s_args->n_leaves; ++i_break) {
-        score_vol_n svn = s_args->score_vol_n_array[i_break];
+    /* the leaves with the highest scores holding samples_p of the samples
+     * are moved to [0, i_break] and the leaf i_break holds the quantile */
+    size_t i_break = select_score_vol_n(s_args->score_vol_n_array,
+            s_args->n_leaves, samples_break);
+    for (size_t i = 0; i <= i_break; ++i) {
+        score_vol_n svn = s_args->score_vol_n_array[i];
         samples_count += svn.n_samples;
         volume_p_count += svn.volume_p;
         if (svn.cause == MERGE
                 || svn.cause == MAX_COUNT
                 || svn.cause == UNIFORMITY)
             ++uniform_leaves;
-        if (samples_count >= samples_break) break;
     }
     debug_assert(s_args->score_vol_n_array[i_break].score >= 0);
     s_args->norm_args.verification_passed = 1;
@@ -89,11 +150,7 @@ double auto_normalized_density_score(score_args *args) {
         return 0.;
     }
     if (args->normalize_pass) {
-        if (args->compute_norm_args) {
-            compute_norm_args(args);
-            args->compute_norm_args = 0;
-        }
-        return auto_normalize(args->norm_args, node->score);
+        return fspt_normalize_score(args, node->score);
     } else {
         if (fspt->n_samples == 0) return 0.;
         double score = ((double) node->n_samples / fspt->n_samples)
@@ -102,6 +159,14 @@ double auto_normalized_density_score(score_args *args) {
     }
 }
 
+double fspt_normalize_score(score_args *args, double raw_score) {
+    if (args->compute_norm_args) {
+        compute_norm_args(args);
+        args->compute_norm_args = 0;
+    }
+    return auto_normalize(args->norm_args, raw_score);
+}
+
 double density_score(score_args *args) {
     fspt_node *node = args->node;
     fspt_t *fspt = args->fspt;
@@ -177,7 +242,7 @@ void print_fspt_score_args_json(FILE *stream, score_args a) {
 \"score_during_fit\" : %d, \"score_function\" : %d, \
 \"fspt\" : \"%p\", \"node\" : \"%p\", \"discover\" : %d, \"need_normalize\" : %d, \
 \"normalize_pass\" : %d, \"n_leaves\" : %ld, \
-\"score_vol_n_array\" : \"%p\", \
+\"score_vol_n_array\" : \"%p\", \"n_threads\" : %d, \
 \"compute_euristic_hyperparam\" : %d, \"euristic_hyperparam\" : %g, \
 \"exponential_normalization\" : %d, \
 \"calibration_score\" : %g, \"calibration_n_samples_p\" : %g, \
@@ -192,7 +257,7 @@ void print_fspt_score_args_json(FILE *stream, score_args a) {
     a.score_during_fit, a.score_function,
     a.fspt, a.node, a.discover, a.need_normalize,
     a.normalize_pass, a.n_leaves,
-    a.score_vol_n_array,
+    a.score_vol_n_array, a.n_threads,
     a.compute_euristic_hyperparam, a.euristic_hyperparam,
     a.exponential_normalization,
     a.calibration_score, a.calibration_n_samples_p, a.calibration_volume_p,
@@ -239,6 +304,7 @@ void print_fspt_score_args(FILE *stream, const score_args *a,
 │              normalize_pass │"INTEGER_FORMAT"│\n\
 │                    n_leaves │"LONGINT_FORMAT"│\n\
 │           score_vol_n_array │"POINTER_FORMAT"│\n\
+│                   n_threads │"INTEGER_FORMAT"│\n\
 ├─────────────────────────────┴────────────────┤\n\
 │         Messages for euristic_score          │\n\
 ├─────────────────────────────┬────────────────┤\n\
@@ -269,7 +335,7 @@ void print_fspt_score_args(FILE *stream, const score_args *a,
     a->score_during_fit, a->score_function,
     a->fspt, a->node, a->discover, a->need_normalize,
     a->normalize_pass, a->n_leaves,
-    a->score_vol_n_array,
+    a->score_vol_n_array, a->n_threads,
     a->compute_euristic_hyperparam, a->euristic_hyperparam,
     a->exponential_normalization,
     a->calibration_score, a->calibration_n_samples_p, a->calibration_volume_p,
@@ -316,11 +382,11 @@ void save_score_args_file(FILE *fp, score_args *s, int *succ) {
     int version = SCORE_ARGS_VERSION;
     if (s) {
         contains_args = 1;
-        size_t size = sizeof(score_args);
+        size_t size = SAVED_SCORE_ARGS_SIZE;
         *succ &= fwrite(&contains_args, sizeof(int), 1, fp);
         *succ &= fwrite(&version, sizeof(int), 1, fp);
         *succ &= fwrite(&size, sizeof(size_t), 1, fp);
-        *succ &= fwrite(s, sizeof(score_args), 1, fp);
+        *succ &= fwrite(s, SAVED_SCORE_ARGS_SIZE, 1, fp);
     } else {
         *succ &= fwrite(&contains_args, sizeof(int), 1, fp);
     }
@@ -336,15 +402,16 @@ score_args *load_score_args_file(FILE *fp, int *succ) {
         *succ &= fread(&version, sizeof(int), 1, fp);
         *succ &= fread(&size, sizeof(size_t), 1, fp);
         if (version == SCORE_ARGS_VERSION
-                && size == sizeof(score_args)
+                && size == SAVED_SCORE_ARGS_SIZE
                 && *succ) {
-            s = malloc(sizeof(score_args));
-            *succ &= fread(s, sizeof(score_args), 1, fp);
+            s = calloc(1, sizeof(score_args));
+            if (!s) malloc_error();
+            *succ &= fread(s, SAVED_SCORE_ARGS_SIZE, 1, fp);
         } else if (*succ) {
             fseek(fp, size, SEEK_CUR);
             fprintf(stderr, "Wrong score args version (%d) or size\
-(saved size = %ld and sizeof(score_args) = %ld).\n",
-                    version, size, sizeof(score_args));
+(saved size = %ld and expected size = %ld).\n",
+                    version, size, SAVED_SCORE_ARGS_SIZE);
         } else {
             fseek(fp, size, SEEK_CUR);
         }
@@ -384,4 +451,5 @@ score_func string_to_fspt_score(char *s) {
 #undef INTEGER_FORMAT
 #undef LONGINT_FORMAT
 #undef SCORE_ARGS_VERSION
-
+#undef SAVED_SCORE_ARGS_SIZE
+#undef unit_static
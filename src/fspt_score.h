@@ -46,6 +46,8 @@ typedef struct score_args {
     double verify_n_uniform_p_thresh;
     double auto_calibration_score;
     density_normalize_args norm_args;
+    /* runtime knobs, not saved with the args */
+    int n_threads;  // number of ranges of leaves scored on the gemm pool.
 } score_args;
 
 
@@ -133,6 +135,20 @@ extern double density_score(score_args *args);
  */
 extern double auto_normalized_density_score(score_args *args);
 
+/**
+ * Normalizes a raw score of a score function that needs normalization
+ * (args->need_normalize is set after the discover call).
+ * The first call computes the normalization arguments from
+ * args->score_vol_n_array, which must then contain the raw scores of the
+ * args->n_leaves leaves. The leaves holding the highest scores are found
+ * by selection and the array is partially reordered.
+ *
+ * \param args The score arguments.
+ * \param raw_score The raw score of a leaf.
+ * \return The normalized score.
+ */
+extern double fspt_normalize_score(score_args *args, double raw_score);
+
 /**
  * An euristic score function called "euristic".
  * This score is :
@@ -149,4 +165,9 @@ extern double auto_normalized_density_score(score_args *args);
  */
 extern double euristic_score(score_args *args);
 
+#ifdef DEBUG
+extern size_t select_score_vol_n(score_vol_n *a, size_t n,
+        size_t samples_break);
+#endif
+
 #endif /* FSPT_SCORE_H */
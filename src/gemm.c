@@ -4,6 +4,18 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GEMM_X86
+#include <immintrin.h>
+#endif
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define GEMM_NEON
+#include <arm_neon.h>
+#endif
 
 void gemm_bin(int M, int N, int K, float ALPHA, 
         char  *A, int lda, 
@@ -142,17 +154,16 @@ void gemm_tt(int M, int N, int K, float ALPHA,
 }
 
 
-void gemm_cpu(int TA, int TB, int M, int N, int K, float ALPHA, 
+void gemm_cpu_naive(int TA, int TB, int M, int N, int K, float ALPHA, 
         float *A, int lda, 
         float *B, int ldb,
         float BETA,
         float *C, int ldc)
 {
-    //printf("cpu: %d %d %d %d %d %f %d %d %f %d\n",TA, TB, M, N, K, ALPHA, lda, ldb, BETA, ldc);
     int i, j;
     for(i = 0; i < M; ++i){
         for(j = 0; j < N; ++j){
-            C[i*ldc + j] *= BETA;
+            C[i*ldc + j] = BETA ? BETA*C[i*ldc + j] : 0;
         }
     }
     if(!TA && !TB)
@@ -165,6 +176,621 @@ void gemm_cpu(int TA, int TB, int M, int N, int K, float ALPHA,
         gemm_tt(M, N, K, ALPHA,A,lda, B, ldb,C,ldc);
 }
 
+/*
+ * Packed GEMM. C is cut in GEMM_MC x GEMM_NC tiles that are independent
+ * tasks for the thread pool. For each GEMM_KC panel of K, a task packs its
+ * block of A (scaled by ALPHA) in MR row panels and its block of B in NR
+ * column panels, then runs the micro-kernel on every MR x NR sub-tile.
+ * The micro-kernel applies BETA on the first K panel only : C is read and
+ * written once per K panel and never scaled separately. Panels are zero
+ * padded so the kernels always compute full tiles; the borders of C go
+ * through a small buffer.
+ */
+
+#define GEMM_MAX_MR 8
+#define GEMM_MAX_NR 32
+#define GEMM_MC 144
+#define GEMM_KC 256
+#define GEMM_NC 512
+#define GEMM_MIN_FLOPS (32*32*32)
+
+typedef void (*gemm_kernel_t)(int k, const float *a, const float *b,
+        float *c, int ldc, float beta);
+
+typedef struct {
+    const char *name;
+    int mr;
+    int nr;
+    gemm_kernel_t kernel;
+} gemm_kernel_info;
+
+/* beta == 0 overwrites c without reading it */
+static void gemm_kernel_generic(int k, const float *a, const float *b,
+        float *c, int ldc, float beta)
+{
+    float acc[4][16] = {{0}};
+    int p, i, j;
+    for(p = 0; p < k; ++p){
+        for(i = 0; i < 4; ++i){
+            float ai = a[p*4 + i];
+            for(j = 0; j < 16; ++j){
+                acc[i][j] += ai*b[p*16 + j];
+            }
+        }
+    }
+    for(i = 0; i < 4; ++i){
+        for(j = 0; j < 16; ++j){
+            c[i*ldc + j] = beta ? acc[i][j] + beta*c[i*ldc + j] : acc[i][j];
+        }
+    }
+}
+
+#ifdef GEMM_X86
+
+__attribute__((target("avx2,fma")))
+static void gemm_kernel_avx2(int k, const float *a, const float *b,
+        float *c, int ldc, float beta)
+{
+    __m256 acc[6][2];
+    int p, i;
+    for(i = 0; i < 6; ++i){
+        acc[i][0] = _mm256_setzero_ps();
+        acc[i][1] = _mm256_setzero_ps();
+    }
+    for(p = 0; p < k; ++p){
+        __m256 b0 = _mm256_loadu_ps(b + p*16);
+        __m256 b1 = _mm256_loadu_ps(b + p*16 + 8);
+        for(i = 0; i < 6; ++i){
+            __m256 ai = _mm256_broadcast_ss(a + p*6 + i);
+            acc[i][0] = _mm256_fmadd_ps(ai, b0, acc[i][0]);
+            acc[i][1] = _mm256_fmadd_ps(ai, b1, acc[i][1]);
+        }
+    }
+    __m256 vbeta = _mm256_set1_ps(beta);
+    for(i = 0; i < 6; ++i){
+        float *ci = c + i*ldc;
+        if(beta){
+            acc[i][0] = _mm256_fmadd_ps(vbeta, _mm256_loadu_ps(ci), acc[i][0]);
+            acc[i][1] = _mm256_fmadd_ps(vbeta, _mm256_loadu_ps(ci + 8), acc[i][1]);
+        }
+        _mm256_storeu_ps(ci, acc[i][0]);
+        _mm256_storeu_ps(ci + 8, acc[i][1]);
+    }
+}
+
+__attribute__((target("avx512f")))
+static void gemm_kernel_avx512(int k, const float *a, const float *b,
+        float *c, int ldc, float beta)
+{
+    __m512 acc[8][2];
+    int p, i;
+    for(i = 0; i < 8; ++i){
+        acc[i][0] = _mm512_setzero_ps();
+        acc[i][1] = _mm512_setzero_ps();
+    }
+    for(p = 0; p < k; ++p){
+        __m512 b0 = _mm512_loadu_ps(b + p*32);
+        __m512 b1 = _mm512_loadu_ps(b + p*32 + 16);
+        for(i = 0; i < 8; ++i){
+            __m512 ai = _mm512_set1_ps(a[p*8 + i]);
+            acc[i][0] = _mm512_fmadd_ps(ai, b0, acc[i][0]);
+            acc[i][1] = _mm512_fmadd_ps(ai, b1, acc[i][1]);
+        }
+    }
+    __m512 vbeta = _mm512_set1_ps(beta);
+    for(i = 0; i < 8; ++i){
+        float *ci = c + i*ldc;
+        if(beta){
+            acc[i][0] = _mm512_fmadd_ps(vbeta, _mm512_loadu_ps(ci), acc[i][0]);
+            acc[i][1] = _mm512_fmadd_ps(vbeta, _mm512_loadu_ps(ci + 16), acc[i][1]);
+        }
+        _mm512_storeu_ps(ci, acc[i][0]);
+        _mm512_storeu_ps(ci + 16, acc[i][1]);
+    }
+}
+#endif
+
+#ifdef GEMM_NEON
+
+static void gemm_kernel_neon(int k, const float *a, const float *b,
+        float *c, int ldc, float beta)
+{
+    float32x4_t acc[6][4];
+    int p, i, j;
+    for(i = 0; i < 6; ++i){
+        for(j = 0; j < 4; ++j) acc[i][j] = vdupq_n_f32(0);
+    }
+    for(p = 0; p < k; ++p){
+        float32x4_t bj[4];
+        for(j = 0; j < 4; ++j) bj[j] = vld1q_f32(b + p*16 + 4*j);
+        for(i = 0; i < 6; ++i){
+            float32x4_t ai = vdupq_n_f32(a[p*6 + i]);
+            for(j = 0; j < 4; ++j) acc[i][j] = vfmaq_f32(acc[i][j], ai, bj[j]);
+        }
+    }
+    for(i = 0; i < 6; ++i){
+        float *ci = c + i*ldc;
+        for(j = 0; j < 4; ++j){
+            if(beta) acc[i][j] = vfmaq_n_f32(acc[i][j], vld1q_f32(ci + 4*j), beta);
+            vst1q_f32(ci + 4*j, acc[i][j]);
+        }
+    }
+}
+#endif
+
+static gemm_kernel_info gemm_select_kernel()
+{
+#ifdef GEMM_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f")){
+        gemm_kernel_info k = {"avx512", 8, 32, gemm_kernel_avx512};
+        return k;
+    }
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")){
+        gemm_kernel_info k = {"avx2", 6, 16, gemm_kernel_avx2};
+        return k;
+    }
+#endif
+#ifdef GEMM_NEON
+    gemm_kernel_info neon = {"neon", 6, 16, gemm_kernel_neon};
+    return neon;
+#endif
+    gemm_kernel_info k = {"generic", 4, 16, gemm_kernel_generic};
+    return k;
+}
+
+static gemm_kernel_info gemm_kernel_used;
+static pthread_once_t gemm_kernel_once = PTHREAD_ONCE_INIT;
+
+static void gemm_init_kernel()
+{
+    gemm_kernel_used = gemm_select_kernel();
+}
+
+static gemm_kernel_info gemm_get_kernel()
+{
+    pthread_once(&gemm_kernel_once, gemm_init_kernel);
+    return gemm_kernel_used;
+}
+
+const char *gemm_kernel_name()
+{
+    return gemm_get_kernel().name;
+}
+
+#ifdef DEBUG
+int gemm_set_kernel(const char *name)
+{
+    gemm_kernel_info k = {0};
+    if(!strcmp(name, "generic")){
+        gemm_kernel_info g = {"generic", 4, 16, gemm_kernel_generic};
+        k = g;
+    }
+#ifdef GEMM_X86
+    if(!strcmp(name, "avx2") && __builtin_cpu_supports("avx2")
+            && __builtin_cpu_supports("fma")){
+        gemm_kernel_info a = {"avx2", 6, 16, gemm_kernel_avx2};
+        k = a;
+    }
+    if(!strcmp(name, "avx512") && __builtin_cpu_supports("avx512f")){
+        gemm_kernel_info a = {"avx512", 8, 32, gemm_kernel_avx512};
+        k = a;
+    }
+#endif
+#ifdef GEMM_NEON
+    if(!strcmp(name, "neon")){
+        gemm_kernel_info n = {"neon", 6, 16, gemm_kernel_neon};
+        k = n;
+    }
+#endif
+    if(!k.kernel) return 0;
+    pthread_once(&gemm_kernel_once, gemm_init_kernel);
+    gemm_kernel_used = k;
+    return 1;
+}
+#endif
+
+/* dst[panel][p][r] = ALPHA*A(i + panel*mr + r, p) */
+static void gemm_pack_a(int TA, int mb, int kb, float ALPHA, const float *A,
+        int lda, int mr, float *dst)
+{
+    int i, p, r;
+    for(i = 0; i < mb; i += mr){
+        int rows = (mb - i < mr) ? mb - i : mr;
+        for(p = 0; p < kb; ++p){
+            for(r = 0; r < rows; ++r){
+                float v = TA ? A[p*lda + i + r] : A[(i + r)*lda + p];
+                dst[p*mr + r] = ALPHA*v;
+            }
+            for(; r < mr; ++r) dst[p*mr + r] = 0;
+        }
+        dst += kb*mr;
+    }
+}
+
+/* dst[panel][p][c] = B(p, j + panel*nr + c) */
+static void gemm_pack_b(int TB, int kb, int nb, const float *B, int ldb,
+        int nr, float *dst)
+{
+    int j, p, c;
+    for(j = 0; j < nb; j += nr){
+        int cols = (nb - j < nr) ? nb - j : nr;
+        for(p = 0; p < kb; ++p){
+            if(!TB){
+                const float *row = B + p*ldb + j;
+                for(c = 0; c < cols; ++c) dst[p*nr + c] = row[c];
+            } else {
+                for(c = 0; c < cols; ++c) dst[p*nr + c] = B[(j + c)*ldb + p];
+            }
+            for(; c < nr; ++c) dst[p*nr + c] = 0;
+        }
+        dst += kb*nr;
+    }
+}
+
+typedef struct {
+    int TA, TB, M, N, K;
+    float ALPHA, BETA;
+    const float *A, *B;
+    float *C;
+    int lda, ldb, ldc;
+    gemm_kernel_info kernel;
+    int m_tiles;
+    int n_tasks;
+    int next_task;
+    /* epilogue C = activate(C + bias[row]) after the last K panel */
+    int epilogue;
+    const float *bias;
+    ACTIVATION activation;
+    /* tasks of gemm_parallel_for, run instead of the gemm when set */
+    void (*task)(void *arg, int task, void *buffer);
+    void *arg;
+} gemm_job;
+
+static void gemm_epilogue(float *C, int ldc, int rows, int cols,
+        const float *bias, ACTIVATION a)
+{
+    int r, c;
+    for(r = 0; r < rows; ++r){
+        float *row = C + r*ldc;
+        if(bias){
+            for(c = 0; c < cols; ++c) row[c] += bias[r];
+        }
+        if(a != LINEAR) activate_array(row, cols, a);
+    }
+}
+
+static size_t gemm_buffer_size()
+{
+    return (GEMM_MC + GEMM_MAX_MR)*GEMM_KC + GEMM_KC*(GEMM_NC + GEMM_MAX_NR);
+}
+
+static void gemm_run_task(gemm_job *job, int task, float *buffer)
+{
+    gemm_kernel_info k = job->kernel;
+    int mr = k.mr, nr = k.nr;
+    int i0 = (task % job->m_tiles)*GEMM_MC;
+    int j0 = (task / job->m_tiles)*GEMM_NC;
+    int mb = (job->M - i0 < GEMM_MC) ? job->M - i0 : GEMM_MC;
+    int nb = (job->N - j0 < GEMM_NC) ? job->N - j0 : GEMM_NC;
+    float *pa = buffer;
+    float *pb = buffer + (GEMM_MC + GEMM_MAX_MR)*GEMM_KC;
+    float edge[GEMM_MAX_MR*GEMM_MAX_NR];
+    int p0, i, j, r, c;
+    for(p0 = 0; p0 < job->K; p0 += GEMM_KC){
+        int kb = (job->K - p0 < GEMM_KC) ? job->K - p0 : GEMM_KC;
+        float beta = p0 ? 1 : job->BETA;
+        int last = p0 + kb >= job->K;
+        const float *A = job->TA ? job->A + p0*job->lda + i0
+            : job->A + i0*job->lda + p0;
+        const float *B = job->TB ? job->B + j0*job->ldb + p0
+            : job->B + p0*job->ldb + j0;
+        gemm_pack_a(job->TA, mb, kb, job->ALPHA, A, job->lda, mr, pa);
+        gemm_pack_b(job->TB, kb, nb, B, job->ldb, nr, pb);
+        for(j = 0; j < nb; j += nr){
+            int cols = (nb - j < nr) ? nb - j : nr;
+            for(i = 0; i < mb; i += mr){
+                int rows = (mb - i < mr) ? mb - i : mr;
+                float *C = job->C + (i0 + i)*job->ldc + j0 + j;
+                const float *a = pa + i*kb;
+                const float *b = pb + j*kb;
+                if(rows == mr && cols == nr){
+                    k.kernel(kb, a, b, C, job->ldc, beta);
+                } else {
+                    k.kernel(kb, a, b, edge, nr, 0);
+                    for(r = 0; r < rows; ++r){
+                        for(c = 0; c < cols; ++c){
+                            float *cij = C + r*job->ldc + c;
+                            *cij = beta ? edge[r*nr + c] + beta*(*cij) : edge[r*nr + c];
+                        }
+                    }
+                }
+                if(last && job->epilogue){
+                    gemm_epilogue(C, job->ldc, rows, cols,
+                            job->bias ? job->bias + i0 + i : 0, job->activation);
+                }
+            }
+        }
+    }
+}
+
+static void gemm_run_tasks(gemm_job *job, float *buffer)
+{
+    int task;
+    while((task = __atomic_fetch_add(&job->next_task, 1, __ATOMIC_RELAXED))
+            < job->n_tasks){
+        if(job->task) job->task(job->arg, task, buffer);
+        else gemm_run_task(job, task, buffer);
+    }
+}
+
+/*
+ * Persistent pool of n_threads - 1 workers, the calling thread being the
+ * last one. A single job runs at a time : a caller finding the pool busy
+ * (concurrent inference threads) runs its gemm alone.
+ */
+typedef struct {
+    int n_threads;
+    pthread_t *threads;
+    float **buffers;
+    pthread_mutex_t job_mutex;
+    pthread_mutex_t mutex;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    gemm_job *job;
+    unsigned long generation;
+    int n_done;
+    int quit;
+} gemm_pool_t;
+
+static gemm_pool_t gemm_pool = {0, 0, 0, PTHREAD_MUTEX_INITIALIZER,
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+    PTHREAD_COND_INITIALIZER, 0, 0, 0, 0};
+static int gemm_requested_threads = 0;
+
+typedef struct {
+    gemm_pool_t *pool;
+    float *buffer;
+    unsigned long generation;   // of the pool when the worker started.
+} gemm_worker_args;
+
+static void *gemm_worker(void *ptr)
+{
+    gemm_worker_args args = *(gemm_worker_args *)ptr;
+    free(ptr);
+    gemm_pool_t *pool = args.pool;
+    unsigned long seen = args.generation;
+    while(1){
+        pthread_mutex_lock(&pool->mutex);
+        while(!pool->quit && pool->generation == seen){
+            pthread_cond_wait(&pool->start, &pool->mutex);
+        }
+        if(pool->quit){
+            pthread_mutex_unlock(&pool->mutex);
+            return 0;
+        }
+        seen = pool->generation;
+        gemm_job *job = pool->job;
+        pthread_mutex_unlock(&pool->mutex);
+        gemm_run_tasks(job, args.buffer);
+        pthread_mutex_lock(&pool->mutex);
+        if(++pool->n_done == pool->n_threads - 1){
+            pthread_cond_signal(&pool->done);
+        }
+        pthread_mutex_unlock(&pool->mutex);
+    }
+}
+
+/* job_mutex must be held */
+static void gemm_pool_stop(gemm_pool_t *pool)
+{
+    int i;
+    pthread_mutex_lock(&pool->mutex);
+    pool->quit = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->mutex);
+    for(i = 0; i < pool->n_threads - 1; ++i){
+        pthread_join(pool->threads[i], 0);
+    }
+    for(i = 0; i < pool->n_threads; ++i){
+        free(pool->buffers[i]);
+    }
+    free(pool->threads);
+    free(pool->buffers);
+    pool->threads = 0;
+    pool->buffers = 0;
+    pool->n_threads = 0;
+    pool->quit = 0;
+}
+
+/* job_mutex must be held */
+static void gemm_pool_start(gemm_pool_t *pool, int n_threads)
+{
+    int i;
+    pool->n_threads = n_threads;
+    pool->threads = calloc(n_threads, sizeof(pthread_t));
+    pool->buffers = calloc(n_threads, sizeof(float *));
+    for(i = 0; i < n_threads; ++i){
+        pool->buffers[i] = calloc(gemm_buffer_size(), sizeof(float));
+    }
+    for(i = 0; i < n_threads - 1; ++i){
+        gemm_worker_args *args = calloc(1, sizeof(gemm_worker_args));
+        args->pool = pool;
+        args->buffer = pool->buffers[i + 1];
+        args->generation = pool->generation;
+        if(pthread_create(pool->threads + i, 0, gemm_worker, args)){
+            error("Thread creation failed");
+        }
+    }
+}
+
+void gemm_set_threads(int n)
+{
+    pthread_mutex_lock(&gemm_pool.job_mutex);
+    gemm_requested_threads = n;
+    if(gemm_pool.n_threads && gemm_pool.n_threads != n){
+        gemm_pool_stop(&gemm_pool);
+    }
+    pthread_mutex_unlock(&gemm_pool.job_mutex);
+}
+
+int gemm_get_threads()
+{
+    if(gemm_requested_threads > 0) return gemm_requested_threads;
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? n : 1;
+}
+
+/* Scratch of the calling thread while its gemms run alone, see
+ * gemm_run_alone. */
+static __thread float *gemm_alone_buffer = 0;
+
+void gemm_run_alone(int alone)
+{
+    if(alone && !gemm_alone_buffer){
+        gemm_alone_buffer = calloc(gemm_buffer_size(), sizeof(float));
+        if(!gemm_alone_buffer) malloc_error();
+    } else if(!alone){
+        free(gemm_alone_buffer);
+        gemm_alone_buffer = 0;
+    }
+}
+
+/* Scratch of the calling thread when it runs a job without the pool, freed
+ * when the thread exits. */
+static __thread float *gemm_local_buffer = 0;
+static pthread_key_t gemm_local_key;
+static pthread_once_t gemm_local_once = PTHREAD_ONCE_INIT;
+
+static void gemm_init_local_key(void)
+{
+    pthread_key_create(&gemm_local_key, free);
+}
+
+static float *gemm_get_local_buffer(void)
+{
+    if(!gemm_local_buffer){
+        pthread_once(&gemm_local_once, gemm_init_local_key);
+        gemm_local_buffer = calloc(gemm_buffer_size(), sizeof(float));
+        if(!gemm_local_buffer) malloc_error();
+        pthread_setspecific(gemm_local_key, gemm_local_buffer);
+    }
+    return gemm_local_buffer;
+}
+
+/* Runs the tasks of job on the pool, or alone when the pool is busy. */
+static void gemm_run_job(gemm_job *job)
+{
+    if(gemm_alone_buffer){
+        gemm_run_tasks(job, gemm_alone_buffer);
+        return;
+    }
+    int n_threads = gemm_get_threads();
+    if(n_threads > 1 && job->n_tasks > 1
+            && !pthread_mutex_trylock(&gemm_pool.job_mutex)){
+        gemm_pool_t *pool = &gemm_pool;
+        if(pool->n_threads != n_threads){
+            if(pool->n_threads) gemm_pool_stop(pool);
+            gemm_pool_start(pool, n_threads);
+        }
+        pthread_mutex_lock(&pool->mutex);
+        pool->job = job;
+        pool->n_done = 0;
+        ++pool->generation;
+        pthread_cond_broadcast(&pool->start);
+        pthread_mutex_unlock(&pool->mutex);
+        gemm_run_tasks(job, pool->buffers[0]);
+        pthread_mutex_lock(&pool->mutex);
+        while(pool->n_done < pool->n_threads - 1){
+            pthread_cond_wait(&pool->done, &pool->mutex);
+        }
+        pthread_mutex_unlock(&pool->mutex);
+        pthread_mutex_unlock(&gemm_pool.job_mutex);
+        return;
+    }
+    gemm_run_tasks(job, gemm_get_local_buffer());
+}
+
+void gemm_parallel_for(int n_tasks, void (*task)(void *arg, int task, void *buffer),
+        void *arg)
+{
+    gemm_job job = {0};
+    job.n_tasks = n_tasks;
+    job.task = task;
+    job.arg = arg;
+    if(n_tasks > 0) gemm_run_job(&job);
+}
+
+size_t gemm_parallel_buffer_size()
+{
+    return gemm_buffer_size()*sizeof(float);
+}
+
+static void gemm_packed(int TA, int TB, int M, int N, int K, float ALPHA, 
+        float *A, int lda, 
+        float *B, int ldb,
+        float BETA,
+        float *C, int ldc,
+        int epilogue, const float *bias, ACTIVATION a)
+{
+    int i, j;
+    if(M <= 0 || N <= 0) return;
+    if(K <= 0){
+        for(i = 0; i < M; ++i){
+            for(j = 0; j < N; ++j){
+                C[i*ldc + j] = BETA ? BETA*C[i*ldc + j] : 0;
+            }
+        }
+        if(epilogue) gemm_epilogue(C, ldc, M, N, bias, a);
+        return;
+    }
+    int m_tiles = (M + GEMM_MC - 1)/GEMM_MC;
+    int n_tasks = m_tiles*((N + GEMM_NC - 1)/GEMM_NC);
+    gemm_job job = {TA, TB, M, N, K, ALPHA, BETA, A, B, C, lda, ldb, ldc,
+        gemm_get_kernel(), m_tiles, n_tasks, 0, epilogue, bias, a, 0, 0};
+    gemm_run_job(&job);
+}
+
+void gemm_cpu_packed(int TA, int TB, int M, int N, int K, float ALPHA, 
+        float *A, int lda, 
+        float *B, int ldb,
+        float BETA,
+        float *C, int ldc)
+{
+    gemm_packed(TA, TB, M, N, K, ALPHA, A, lda, B, ldb, BETA, C, ldc, 0, 0, LINEAR);
+}
+
+void gemm_bias_activate(int TA, int TB, int M, int N, int K, float ALPHA, 
+        float *A, int lda, 
+        float *B, int ldb,
+        float BETA,
+        float *C, int ldc,
+        float *bias, ACTIVATION a)
+{
+    if(M < 4 || (long)M*N*K < GEMM_MIN_FLOPS){
+        gemm_cpu_naive(TA, TB, M, N, K, ALPHA, A, lda, B, ldb, BETA, C, ldc);
+        gemm_epilogue(C, ldc, M, N, bias, a);
+        return;
+    }
+    gemm_packed(TA, TB, M, N, K, ALPHA, A, lda, B, ldb, BETA, C, ldc, 1, bias, a);
+}
+
+void gemm_cpu(int TA, int TB, int M, int N, int K, float ALPHA, 
+        float *A, int lda, 
+        float *B, int ldb,
+        float BETA,
+        float *C, int ldc)
+{
+    //printf("cpu: %d %d %d %d %d %f %d %d %f %d\n",TA, TB, M, N, K, ALPHA, lda, ldb, BETA, ldc);
+    /* matrix-vector products and tiny products do not amortize the
+     * packing */
+    if(M < 4 || (long)M*N*K < GEMM_MIN_FLOPS){
+        gemm_cpu_naive(TA, TB, M, N, K, ALPHA, A, lda, B, ldb, BETA, C, ldc);
+        return;
+    }
+    gemm_cpu_packed(TA, TB, M, N, K, ALPHA, A, lda, B, ldb, BETA, C, ldc);
+}
+
 #ifdef GPU
 
 #include <math.h>
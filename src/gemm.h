@@ -1,6 +1,10 @@
 #ifndef GEMM_H
 #define GEMM_H
 
+#include <stddef.h>
+
+#include "activations.h"
+
 void gemm_bin(int M, int N, int K, float ALPHA, 
         char  *A, int lda, 
         float *B, int ldb,
@@ -18,6 +22,59 @@ void gemm_cpu(int TA, int TB, int M, int N, int K, float ALPHA,
         float BETA,
         float *C, int ldc);
 
+/* Reference triple loops, parallel with OPENMP=1 only.
+ * BETA == 0 overwrites C without reading it. */
+void gemm_cpu_naive(int TA, int TB, int M, int N, int K, float ALPHA, 
+        float *A, int lda, 
+        float *B, int ldb,
+        float BETA,
+        float *C, int ldc);
+
+/* Packed and cache blocked gemm running on the gemm thread pool.
+ * BETA == 0 overwrites C without reading it. */
+void gemm_cpu_packed(int TA, int TB, int M, int N, int K, float ALPHA, 
+        float *A, int lda, 
+        float *B, int ldb,
+        float BETA,
+        float *C, int ldc);
+
+/* gemm_cpu followed by C[i][j] = activate(C[i][j] + bias[i], a). The packed
+ * path applies it on each tile after its last K panel, while the tile is in
+ * cache. bias may be NULL. */
+void gemm_bias_activate(int TA, int TB, int M, int N, int K, float ALPHA, 
+        float *A, int lda, 
+        float *B, int ldb,
+        float BETA,
+        float *C, int ldc,
+        float *bias, ACTIVATION a);
+
+/* Sets the number of threads of gemm_cpu, the calling thread included.
+ * n <= 0 uses all the online processors (default). */
+void gemm_set_threads(int n);
+int gemm_get_threads();
+
+/* While alone is set, the gemms called by this thread run on it without the
+ * pool, for threads which already split the work between them (network
+ * replicas). */
+void gemm_run_alone(int alone);
+
+/* Runs task(arg, t, buffer) for t in [0, n_tasks) on the gemm thread pool,
+ * the calling thread included, and returns when all are done. buffer is a
+ * scratch area of gemm_parallel_buffer_size() bytes owned by the running
+ * thread. */
+void gemm_parallel_for(int n_tasks, void (*task)(void *arg, int task, void *buffer),
+        void *arg);
+size_t gemm_parallel_buffer_size();
+
+/* Name of the micro-kernel selected for this cpu (avx512, avx2, neon or
+ * generic). */
+const char *gemm_kernel_name();
+
+#ifdef DEBUG
+/* Forces a micro-kernel. Returns 0 if it is not supported by this cpu. */
+int gemm_set_kernel(const char *name);
+#endif
+
 #ifdef GPU
 void gemm_gpu(int TA, int TB, int M, int N, int K, float ALPHA, 
         float *A_gpu, int lda, 
@@ -0,0 +1,469 @@
+#include "gemm_int8.h"
+#include "gemm.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define QGEMM_X86
+#include <immintrin.h>
+#endif
+
+/*
+ * The weights are packed once in MR row panels, K being cut in groups of 4
+ * bytes : panel[p][r] holds W(r, 4p..4p+3). A task packs the whole depth of
+ * a block of columns of B in NR column panels, panel[p][c] holding
+ * B(4p..4p+3, c), then runs the micro-kernel on every MR x NR tile over the
+ * full depth. The int32 tile stays in registers until the epilogue
+ * requantizes it to floats. K is padded with zero weights and the borders
+ * of B with QGEMM_ZERO, so the kernels always compute full tiles.
+ */
+
+#define QGEMM_MAX_MR 8
+#define QGEMM_MAX_NR 16
+#define QGEMM_NC 512
+
+/* c[r*nr + j] = sum_p a[p][r] . b[p][j], full depth */
+typedef void (*qgemm_kernel_t)(int k4, const void *a, const unsigned char *b, int *c);
+
+typedef struct {
+    const char *name;
+    int mr;
+    int nr;
+    int a16;    // weights packed in int16 instead of int8.
+    qgemm_kernel_t kernel;
+} qgemm_kernel_info;
+
+struct qgemm_weights {
+    qgemm_kernel_info kernel;
+    int M, K, k4;
+    size_t panel_size;   // bytes of a packed MR row panel.
+    int *compensation;   // QGEMM_ZERO*sum_k W(i, k)
+    void *a;
+};
+
+static void qgemm_kernel_generic(int k4, const void *a, const unsigned char *b, int *c)
+{
+    const signed char *pa = a;
+    int acc[4][8] = {{0}};
+    int p, r, j, t;
+    for(p = 0; p < k4; ++p){
+        for(r = 0; r < 4; ++r){
+            const signed char *w = pa + (p*4 + r)*4;
+            for(j = 0; j < 8; ++j){
+                const unsigned char *x = b + (p*8 + j)*4;
+                int s = 0;
+                for(t = 0; t < 4; ++t) s += w[t]*x[t];
+                acc[r][j] += s;
+            }
+        }
+    }
+    memcpy(c, acc, sizeof(acc));
+}
+
+#ifdef QGEMM_X86
+
+/* int16 weights against the 4 byte groups of 8 columns widened to int16 :
+ * each madd gives the two partial sums of a column, folded by hadd. */
+__attribute__((target("avx2")))
+static void qgemm_kernel_avx2(int k4, const void *a, const unsigned char *b, int *c)
+{
+    const long long *pa = a;
+    __m256i lo[4], hi[4];
+    int p, r;
+    for(r = 0; r < 4; ++r){
+        lo[r] = _mm256_setzero_si256();
+        hi[r] = _mm256_setzero_si256();
+    }
+    for(p = 0; p < k4; ++p){
+        __m256i b0 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(b + p*32)));
+        __m256i b1 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(b + p*32 + 16)));
+        for(r = 0; r < 4; ++r){
+            __m256i w = _mm256_set1_epi64x(pa[p*4 + r]);
+            lo[r] = _mm256_add_epi32(lo[r], _mm256_madd_epi16(b0, w));
+            hi[r] = _mm256_add_epi32(hi[r], _mm256_madd_epi16(b1, w));
+        }
+    }
+    for(r = 0; r < 4; ++r){
+        __m256i s = _mm256_permute4x64_epi64(_mm256_hadd_epi32(lo[r], hi[r]), 0xD8);
+        _mm256_storeu_si256((__m256i *)(c + r*8), s);
+    }
+}
+
+__attribute__((target("avx2,avxvnni")))
+static void qgemm_kernel_avxvnni(int k4, const void *a, const unsigned char *b, int *c)
+{
+    const int *pa = a;
+    __m256i acc[8];
+    int p, r;
+    for(r = 0; r < 8; ++r) acc[r] = _mm256_setzero_si256();
+    for(p = 0; p < k4; ++p){
+        __m256i x = _mm256_loadu_si256((const __m256i *)(b + p*32));
+        for(r = 0; r < 8; ++r){
+            acc[r] = _mm256_dpbusd_avx_epi32(acc[r], x, _mm256_set1_epi32(pa[p*8 + r]));
+        }
+    }
+    for(r = 0; r < 8; ++r) _mm256_storeu_si256((__m256i *)(c + r*8), acc[r]);
+}
+
+__attribute__((target("avx512f,avx512vnni")))
+static void qgemm_kernel_avx512vnni(int k4, const void *a, const unsigned char *b, int *c)
+{
+    const int *pa = a;
+    __m512i acc[8];
+    int p, r;
+    for(r = 0; r < 8; ++r) acc[r] = _mm512_setzero_si512();
+    for(p = 0; p < k4; ++p){
+        __m512i x = _mm512_loadu_si512((const void *)(b + p*64));
+        for(r = 0; r < 8; ++r){
+            acc[r] = _mm512_dpbusd_epi32(acc[r], x, _mm512_set1_epi32(pa[p*8 + r]));
+        }
+    }
+    for(r = 0; r < 8; ++r) _mm512_storeu_si512((void *)(c + r*16), acc[r]);
+}
+
+#endif
+
+static qgemm_kernel_info qgemm_select_kernel()
+{
+    qgemm_kernel_info k = {"generic", 4, 8, 0, qgemm_kernel_generic};
+#ifdef QGEMM_X86
+    if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vnni")){
+        qgemm_kernel_info v = {"avx512vnni", 8, 16, 0, qgemm_kernel_avx512vnni};
+        return v;
+    }
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("avxvnni")){
+        qgemm_kernel_info v = {"avxvnni", 8, 8, 0, qgemm_kernel_avxvnni};
+        return v;
+    }
+    if(__builtin_cpu_supports("avx2")){
+        qgemm_kernel_info v = {"avx2", 4, 8, 1, qgemm_kernel_avx2};
+        return v;
+    }
+#endif
+    return k;
+}
+
+static qgemm_kernel_info qgemm_kernel_used;
+static pthread_once_t qgemm_kernel_once = PTHREAD_ONCE_INIT;
+
+static void qgemm_init_kernel()
+{
+    qgemm_kernel_used = qgemm_select_kernel();
+}
+
+static qgemm_kernel_info qgemm_get_kernel()
+{
+    pthread_once(&qgemm_kernel_once, qgemm_init_kernel);
+    return qgemm_kernel_used;
+}
+
+const char *qgemm_kernel_name()
+{
+    return qgemm_get_kernel().name;
+}
+
+#ifdef DEBUG
+int qgemm_set_kernel(const char *name)
+{
+    qgemm_kernel_info k = {0};
+    if(!strcmp(name, "generic")){
+        qgemm_kernel_info g = {"generic", 4, 8, 0, qgemm_kernel_generic};
+        k = g;
+    }
+#ifdef QGEMM_X86
+    if(!strcmp(name, "avx2") && __builtin_cpu_supports("avx2")){
+        qgemm_kernel_info v = {"avx2", 4, 8, 1, qgemm_kernel_avx2};
+        k = v;
+    }
+    if(!strcmp(name, "avxvnni") && __builtin_cpu_supports("avx2")
+            && __builtin_cpu_supports("avxvnni")){
+        qgemm_kernel_info v = {"avxvnni", 8, 8, 0, qgemm_kernel_avxvnni};
+        k = v;
+    }
+    if(!strcmp(name, "avx512vnni") && __builtin_cpu_supports("avx512f")
+            && __builtin_cpu_supports("avx512vnni")){
+        qgemm_kernel_info v = {"avx512vnni", 8, 16, 0, qgemm_kernel_avx512vnni};
+        k = v;
+    }
+#endif
+    if(!k.kernel) return 0;
+    pthread_once(&qgemm_kernel_once, qgemm_init_kernel);
+    qgemm_kernel_used = k;
+    return 1;
+}
+#endif
+
+qgemm_weights *qgemm_pack_weights(const signed char *W, int M, int K)
+{
+    qgemm_kernel_info k = qgemm_get_kernel();
+    int k4 = (K + 3)/4;
+    int panels = (M + k.mr - 1)/k.mr;
+    size_t elem = k.a16 ? sizeof(short) : 1;
+    size_t panel_size = (size_t)k4*4*k.mr*elem;
+    size_t header = (sizeof(qgemm_weights) + 63)/64*64;
+    size_t comp = ((size_t)panels*k.mr*sizeof(int) + 63)/64*64;
+    qgemm_weights *w = calloc(1, header + comp + panels*panel_size);
+    if(!w) malloc_error();
+    w->kernel = k;
+    w->M = M;
+    w->K = K;
+    w->k4 = k4;
+    w->panel_size = panel_size;
+    w->compensation = (int *)((char *)w + header);
+    w->a = (char *)w + header + comp;
+    int i, p, r, t;
+    for(i = 0; i < M; ++i){
+        int sum = 0;
+        for(p = 0; p < K; ++p) sum += W[(size_t)i*K + p];
+        w->compensation[i] = QGEMM_ZERO*sum;
+    }
+    for(i = 0; i < panels; ++i){
+        char *panel = (char *)w->a + i*panel_size;
+        for(p = 0; p < k4; ++p){
+            for(r = 0; r < k.mr; ++r){
+                int row = i*k.mr + r;
+                for(t = 0; t < 4; ++t){
+                    int col = p*4 + t;
+                    signed char v = (row < M && col < K) ? W[(size_t)row*K + col] : 0;
+                    if(k.a16) ((short *)panel)[(p*k.mr + r)*4 + t] = v;
+                    else ((signed char *)panel)[(p*k.mr + r)*4 + t] = v;
+                }
+            }
+        }
+    }
+    return w;
+}
+
+void quantize_u8(const float *x, int n, float scale, unsigned char *q)
+{
+    int i;
+    float inv = scale ? 1.f/scale : 0;
+    for(i = 0; i < n; ++i){
+        float v = x[i]*inv;
+        v = (v < -127) ? -127 : (v > 127) ? 127 : v;
+        /* v + QGEMM_ZERO is in [1, 255] : truncation rounds */
+        q[i] = (unsigned char)(int)(v + (QGEMM_ZERO + .5f));
+    }
+}
+
+/* Row k of the im2col matrix for the columns [j0, j0 + nb), padding
+ * reading QGEMM_ZERO. */
+static void qgemm_im2col_row(const qgemm_source *s, int k, int j0, int nb,
+        unsigned char *dst)
+{
+    int kx = k % s->size;
+    int ky = (k / s->size) % s->size;
+    int ch = k / s->size / s->size;
+    const unsigned char *im = s->data + (size_t)ch*s->h*s->w;
+    int col = j0;
+    while(col < j0 + nb){
+        int oy = col / s->out_w;
+        int ox = col % s->out_w;
+        int run = s->out_w - ox;
+        if(run > j0 + nb - col) run = j0 + nb - col;
+        int y = oy*s->stride - s->pad + ky;
+        int x = ox*s->stride - s->pad + kx;
+        int c = 0;
+        if(y < 0 || y >= s->h){
+            memset(dst, QGEMM_ZERO, run);
+        } else if(s->stride == 1){
+            const unsigned char *row = im + y*s->w;
+            for(; c < run && x + c < 0; ++c) dst[c] = QGEMM_ZERO;
+            int end = s->w - x;
+            if(end > run) end = run;
+            if(end > c) memcpy(dst + c, row + x + c, end - c);
+            for(c = end > c ? end : c; c < run; ++c) dst[c] = QGEMM_ZERO;
+        } else {
+            const unsigned char *row = im + y*s->w;
+            for(; c < run; ++c, x += s->stride){
+                dst[c] = (x >= 0 && x < s->w) ? row[x] : QGEMM_ZERO;
+            }
+        }
+        dst += run;
+        col += run;
+    }
+}
+
+/* dst[c][t] = rows[t][c] for c < nr */
+static void qgemm_interleave(const unsigned char **rows, int nr, unsigned char *dst)
+{
+#ifdef __SSE2__
+    if(nr == 16){
+        __m128i a = _mm_loadu_si128((const __m128i *)rows[0]);
+        __m128i b = _mm_loadu_si128((const __m128i *)rows[1]);
+        __m128i c = _mm_loadu_si128((const __m128i *)rows[2]);
+        __m128i d = _mm_loadu_si128((const __m128i *)rows[3]);
+        __m128i ab = _mm_unpacklo_epi8(a, b), cd = _mm_unpacklo_epi8(c, d);
+        _mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi16(ab, cd));
+        _mm_storeu_si128((__m128i *)(dst + 16), _mm_unpackhi_epi16(ab, cd));
+        ab = _mm_unpackhi_epi8(a, b);
+        cd = _mm_unpackhi_epi8(c, d);
+        _mm_storeu_si128((__m128i *)(dst + 32), _mm_unpacklo_epi16(ab, cd));
+        _mm_storeu_si128((__m128i *)(dst + 48), _mm_unpackhi_epi16(ab, cd));
+        return;
+    }
+    if(nr == 8){
+        __m128i ab = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)rows[0]),
+                _mm_loadl_epi64((const __m128i *)rows[1]));
+        __m128i cd = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)rows[2]),
+                _mm_loadl_epi64((const __m128i *)rows[3]));
+        _mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi16(ab, cd));
+        _mm_storeu_si128((__m128i *)(dst + 16), _mm_unpackhi_epi16(ab, cd));
+        return;
+    }
+#endif
+    int c, t;
+    for(c = 0; c < nr; ++c){
+        for(t = 0; t < 4; ++t) dst[c*4 + t] = rows[t][c];
+    }
+}
+
+/*
+ * dst[panel][p][c] = B(4p..4p+3, j0 + panel*nr + c). Rows of B are read in
+ * place when contiguous, else gathered in rows, a small buffer of 5 padded
+ * rows, then interleaved by 4.
+ */
+static void qgemm_pack_b(const qgemm_source *s, int K, int k4, int j0, int nb,
+        int nr, unsigned char *rows, unsigned char *dst)
+{
+    int j, p, t, c;
+    int nbp = (nb + nr - 1)/nr*nr;
+    size_t panel = (size_t)k4*4*nr;
+    if(!s->size && s->ld_k == 1){
+        /* columns of B are contiguous : 4 bytes of a column at once */
+        for(j = 0; j < nbp; j += nr){
+            for(c = 0; c < nr; ++c){
+                unsigned char *d = dst + (j/nr)*panel + c*4;
+                if(j + c >= nb){
+                    for(p = 0; p < k4; ++p) memset(d + p*4*nr, QGEMM_ZERO, 4);
+                    continue;
+                }
+                const unsigned char *src = s->data + (size_t)(j0 + j + c)*s->ld_j;
+                for(p = 0; p < K/4; ++p) memcpy(d + p*4*nr, src + p*4, 4);
+                for(; p < k4; ++p){
+                    for(t = 0; t < 4; ++t) d[p*4*nr + t] = (p*4 + t < K) ? src[p*4 + t] : QGEMM_ZERO;
+                }
+            }
+        }
+        return;
+    }
+    const unsigned char *r[4];
+    unsigned char *zero = rows + 4*nbp;
+    memset(zero, QGEMM_ZERO, nbp);
+    for(p = 0; p < k4; ++p){
+        for(t = 0; t < 4; ++t){
+            int k = p*4 + t;
+            unsigned char *row = rows + t*nbp;
+            if(k >= K){
+                r[t] = zero;
+            } else if(s->size){
+                qgemm_im2col_row(s, k, j0, nb, row);
+                memset(row + nb, QGEMM_ZERO, nbp - nb);
+                r[t] = row;
+            } else if(s->ld_j == 1 && nb == nbp){
+                r[t] = s->data + (size_t)k*s->ld_k + j0;
+            } else {
+                const unsigned char *src = s->data + (size_t)k*s->ld_k + (size_t)j0*s->ld_j;
+                for(c = 0; c < nb; ++c) row[c] = src[(size_t)c*s->ld_j];
+                memset(row + nb, QGEMM_ZERO, nbp - nb);
+                r[t] = row;
+            }
+        }
+        for(j = 0; j < nbp; j += nr){
+            const unsigned char *rj[4] = {r[0] + j, r[1] + j, r[2] + j, r[3] + j};
+            qgemm_interleave(rj, nr, dst + (j/nr)*panel + (size_t)p*4*nr);
+        }
+    }
+}
+
+typedef struct {
+    int N;
+    const qgemm_weights *W;
+    const qgemm_source *B;
+    const float *w_scale;
+    float x_scale;
+    const float *bias;
+    ACTIVATION activation;
+    float *C;
+    int ldc_i, ldc_j;
+    int mc, nc, m_blocks;
+} qgemm_job;
+
+static void qgemm_run_task(void *arg, int task, void *buffer)
+{
+    qgemm_job *job = arg;
+    const qgemm_weights *W = job->W;
+    qgemm_kernel_info k = W->kernel;
+    int mr = k.mr, nr = k.nr;
+    int i0 = (task % job->m_blocks)*job->mc;
+    int j0 = (task / job->m_blocks)*job->nc;
+    int mb = (W->M - i0 < job->mc) ? W->M - i0 : job->mc;
+    int nb = (job->N - j0 < job->nc) ? job->N - j0 : job->nc;
+    size_t b_size = (size_t)W->k4*4*((nb + nr - 1)/nr*nr);
+    unsigned char *pb = buffer;
+    if(b_size > gemm_parallel_buffer_size()) pb = calloc(b_size, 1);
+    int acc[QGEMM_MAX_MR*QGEMM_MAX_NR];
+    unsigned char rows_buffer[5*(QGEMM_NC + QGEMM_MAX_NR)];
+    int i, j, r, c;
+    qgemm_pack_b(job->B, W->K, W->k4, j0, nb, nr, rows_buffer, pb);
+    for(i = i0; i < i0 + mb; i += mr){
+        int rows = (i0 + mb - i < mr) ? i0 + mb - i : mr;
+        const void *a = (const char *)W->a + (i/mr)*W->panel_size;
+        for(j = 0; j < nb; j += nr){
+            int cols = (nb - j < nr) ? nb - j : nr;
+            k.kernel(W->k4, a, pb + (size_t)j*W->k4*4, acc);
+            for(r = 0; r < rows; ++r){
+                float scale = job->w_scale[i + r]*job->x_scale;
+                float bias = job->bias ? job->bias[i + r] : 0;
+                int comp = W->compensation[i + r];
+                const int *row = acc + r*nr;
+                float *dst = job->C + (size_t)(i + r)*job->ldc_i + (size_t)(j0 + j)*job->ldc_j;
+                if(job->ldc_j == 1){
+                    for(c = 0; c < cols; ++c) dst[c] = (row[c] - comp)*scale + bias;
+                } else {
+                    for(c = 0; c < cols; ++c) dst[(size_t)c*job->ldc_j] = (row[c] - comp)*scale + bias;
+                }
+            }
+        }
+        if(job->activation == LINEAR) continue;
+        for(r = 0; r < rows; ++r){
+            float *dst = job->C + (size_t)(i + r)*job->ldc_i + (size_t)j0*job->ldc_j;
+            if(job->ldc_j == 1){
+                activate_array(dst, nb, job->activation);
+            } else {
+                for(c = 0; c < nb; ++c){
+                    dst[(size_t)c*job->ldc_j] = activate(dst[(size_t)c*job->ldc_j], job->activation);
+                }
+            }
+        }
+    }
+    if(pb != buffer) free(pb);
+}
+
+void qgemm(int N, const qgemm_weights *W, const qgemm_source *B,
+        const float *w_scale, float x_scale, const float *bias, ACTIVATION a,
+        float *C, int ldc_i, int ldc_j)
+{
+    if(W->M <= 0 || N <= 0) return;
+    int mr = W->kernel.mr, nr = W->kernel.nr;
+    qgemm_job job = {N, W, B, w_scale, x_scale, bias, a, C, ldc_i, ldc_j, 0, 0, 0};
+    /* the packed columns of B fill the per thread buffer */
+    int nc = gemm_parallel_buffer_size()/((size_t)W->k4*4)/nr*nr;
+    if(nc > QGEMM_NC) nc = QGEMM_NC;
+    if(nc < nr) nc = nr;
+    job.nc = nc;
+    int n_blocks = (N + nc - 1)/nc;
+    /* few columns : cut the rows too, packing B once per row block */
+    int m_panels = (W->M + mr - 1)/mr;
+    int threads = gemm_get_threads();
+    int m_blocks = 1;
+    if(threads > 1 && n_blocks < 2*threads){
+        m_blocks = (2*threads + n_blocks - 1)/n_blocks;
+        if(m_blocks > m_panels) m_blocks = m_panels;
+    }
+    job.mc = (m_panels + m_blocks - 1)/m_blocks*mr;
+    job.m_blocks = (W->M + job.mc - 1)/job.mc;
+    gemm_parallel_for(job.m_blocks*n_blocks, qgemm_run_task, &job);
+}
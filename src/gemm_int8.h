@@ -0,0 +1,59 @@
+#ifndef GEMM_INT8_H
+#define GEMM_INT8_H
+
+#include "activations.h"
+
+/*
+ * Int8 gemm of the quantized inference path.
+ *
+ * Weights are signed and symmetric, w = scale_w[row]*q with q in
+ * [-127, 127]. Activations are symmetric too, x = scale_x*q, but are stored
+ * as q + QGEMM_ZERO in unsigned bytes : the dot product instructions multiply
+ * unsigned by signed bytes. The shift is removed in the epilogue with a per
+ * row compensation computed when packing the weights.
+ */
+#define QGEMM_ZERO 128
+
+/* Weights packed for the selected kernel, allocated by qgemm_pack_weights and
+ * freed with free(). */
+typedef struct qgemm_weights qgemm_weights;
+
+/*
+ * Source of the K x N right hand side, in shifted unsigned bytes. When size
+ * is 0, B(k, j) = data[k*ld_k + j*ld_j]. Else B is the im2col matrix of the
+ * c x h x w image data for a size x size convolution of the given stride and
+ * padding, out_w being the output width; the padding reads QGEMM_ZERO.
+ */
+typedef struct {
+    const unsigned char *data;
+    int ld_k, ld_j;
+    int c, h, w, size, stride, pad, out_w;
+} qgemm_source;
+
+/* Packs the M x K row major int8 weights W. */
+qgemm_weights *qgemm_pack_weights(const signed char *W, int M, int K);
+
+/* q[i] = clamp(round(x[i]/scale), -127, 127) + QGEMM_ZERO */
+void quantize_u8(const float *x, int n, float scale, unsigned char *q);
+
+/*
+ * C(i, j) = activate(w_scale[i]*x_scale*sum_k W(i, k)*B(k, j) + bias[i], a)
+ * with B unshifted, stored at C[i*ldc_i + j*ldc_j]. The int32 accumulators
+ * are requantized to floats in the epilogue of each tile. bias may be NULL.
+ * Runs on the gemm thread pool.
+ */
+void qgemm(int N, const qgemm_weights *W, const qgemm_source *B,
+        const float *w_scale, float x_scale, const float *bias, ACTIVATION a,
+        float *C, int ldc_i, int ldc_j);
+
+/* Name of the int8 micro-kernel selected for this cpu (avx512vnni, avxvnni,
+ * avx2 or generic). */
+const char *qgemm_kernel_name();
+
+#ifdef DEBUG
+/* Forces an int8 micro-kernel. Returns 0 if it is not supported by this cpu.
+ * Weights packed before must be packed again. */
+int qgemm_set_kernel(const char *name);
+#endif
+
+#endif
@@ -1,5 +1,6 @@
 #include "gini_utils.h"
 
+#include <limits.h>
 #include <math.h>
 #include "distance_to_boundary.h"
 #include "utils.h"
@@ -15,6 +16,8 @@
 /**
  * Computes P(A <= 1/n sum_{i=1}^n 1_{X_i <= s} <= B).
  * Where X_i are independant uniform probabilities over [0, 1].
+ * The count follows a binomial law B(n, s), its tail is computed by
+ * binomial_range_proba which is thread safe and doesn't overflow.
  *
  * \param A The inferior bound.
  * \param B The superior bound.
@@ -26,32 +29,11 @@ static long double proba_uninform_count(long double A, long double B,
         int n, long double s) {
     if (s <= 0.) return 0.;
     if (s >= 1.) return 1.;
-    long double p = 0.;
     A = constrain_long_double(0., 1., A);
     B = constrain_long_double(0., 1., B);
-    /*
-    if (n*A - floor(n*A) < 1E-10) {
-        p = pow(1 - s, n - floor(n * B)) - pow(1 - s, n - floor(n * A) + 1);
-    } else 
-        p = pow(1 - s, n - floor(n * B)) - pow(1 - s, n - floor(n * A));
-    */
     int to = floor(n * B);
     int from = (n*A - floor(n*A) <= 1E-12) ? floor(n*A) : ceil(n*A);
-    for (int i = from; i <= to; ++i) {
-        p += binomial(n, i) * powl(s, i) * powl(1. - s, n - i);
-    }
-    // sitch the computation to put the biggest exponents on the smallest
-    // value between s and 1-s.
-    //if (n - from > to && s < 0.5) {
-    //     normal
-    /*} else {
-        p = 1.;
-        s = 1. - s;
-        for (int i = from; i <= to; ++i) {
-            p -= binomial(i, n) * powl(s, i) * powl(1. - s, n - i);
-        }
-    }
-    */
+    long double p = binomial_range_proba(n, from, to, s);
     return p / n;
 }
 
@@ -79,59 +61,75 @@ double proba_gain_inferior_to(double t, double s, int n) {
 }
 
 /**
- * Computes the Gini index of a two classes set.
- * 
- * \param x The number of elements of the first class.
- * \param y The number of elements of the second class.
- * \return The gini index. 2xy/(x+y)^2.
- */
-static double gini(double x, double y)
-{
-    return 2. * x * y / ( (x + y)*(x + y) );
-}
-
-/**
- * Computes \hat G(R, I, s) = n^+ / n * G(R^+) + n^- / n * G(R^-).
- * with the notations from Toward Safe Machine Learning.
+ * Computes the gains 0.5 - \hat G(R, I, s) of n candidate splits, where
+ * \hat G(R, I, s) = n^+ / n * G(R^+) + n^- / n * G(R^-) with the notations
+ * from Toward Safe Machine Learning and G(R) = 2xy/(x+y)^2 is the Gini
+ * index of a node with x empty and y real samples.
+ *
+ * The candidates are evaluated in one branchless pass over contiguous
+ * arrays so that the loop is vectorized by the compiler. The constraints
+ * are computed as masks : forbidden candidates get a gain of -1 and the
+ * number of candidates violating each constraint is added to cause.
+ *
+ * \param n The number of candidates.
+ * \param bins The split values of the candidates. Size n.
+ * \param cdf The number of samples <= bins[i]. Size n.
+ * \param min The lower bound of the node on the feature.
+ * \param max The upper bound of the node on the feature.
+ * \param n_samples The number of samples in the node.
+ * \param n_empty The number of empty samples in the node.
+ * \param node_volume The volume of the node.
+ * \param min_samples Minimum number of samples (real + empty) per child.
+ * \param min_volume Minimum volume per child.
+ * \param min_length_p Minimum relative length per child.
+ * \param gains Output parameter. Size n.
+ * \param cause Output parameter. Counters of the violated constraints.
  */
-static double gini_after_split(float min, float max, float s, size_t n_left,
-        size_t n_right, size_t n_empty, double node_volume, int min_samples,
-        double min_volume, double min_length_p, int *forbidden_split,
-        forbidden_split_cause *cause) {
-    *forbidden_split = 0;
+unit_static void gini_gains(size_t n, const float *bins, const size_t *cdf,
+        float min, float max, size_t n_samples, size_t n_empty,
+        double node_volume, int min_samples, double min_volume,
+        double min_length_p, double *gains, forbidden_split_cause *cause) {
     double l = max - min;
     if (l == 0.) {
-        *forbidden_split = 1;
-        return 1.;
-    }
-    double prop_left = ((double) (s - min)) / ((double)l);
-    double prop_right = ((double) (max - s)) / ((double) l);
-    double n_empty_left = n_empty * prop_left;
-    double n_empty_right = n_empty * prop_right;
-    double volume_left = node_volume * prop_left;
-    double volume_right = node_volume * prop_right;
-    if (n_empty_left + n_left < min_samples
-            || n_empty_right + n_right < min_samples) {
-        ++cause->count_min_samples_hit;
-        *forbidden_split = 1;
-    }
-    if (volume_left < min_volume
-            || volume_right < min_volume) {
-        ++cause->count_min_volume_p_hit;
-        *forbidden_split = 1;
+        for (size_t i = 0; i < n; ++i) gains[i] = -1.;
+        return;
     }
-    if (prop_left < min_length_p
-            || prop_right < min_length_p) {
-        ++cause->count_min_length_p_hit;
-        *forbidden_split = 1;
+    debug_assert(n_samples <= INT_MAX);
+    double inv_l = 1. / l;
+    double total = (double) n_samples + (double) n_empty;
+    /* all the lanes are doubles so that the loop is vectorized even
+     * without AVX. Counts are exact up to 2^53. */
+    double count_min_samples = 0.;
+    double count_min_volume = 0.;
+    double count_min_length = 0.;
+    for (size_t i = 0; i < n; ++i) {
+        /* through int : there is no vector size_t to double conversion. */
+        double n_left = (double) (int) cdf[i];
+        double n_right = (double) n_samples - n_left;
+        double prop_left = ((double) bins[i] - min) * inv_l;
+        double prop_right = ((double) max - bins[i]) * inv_l;
+        double n_empty_left = n_empty * prop_left;
+        double n_empty_right = n_empty * prop_right;
+        double total_left = n_empty_left + n_left;
+        double total_right = n_empty_right + n_right;
+        double mask_samples = (total_left < min_samples
+                || total_right < min_samples) ? 1. : 0.;
+        double mask_volume = (node_volume * prop_left < min_volume
+                || node_volume * prop_right < min_volume) ? 1. : 0.;
+        double mask_length = (prop_left < min_length_p
+                || prop_right < min_length_p) ? 1. : 0.;
+        count_min_samples += mask_samples;
+        count_min_volume += mask_volume;
+        count_min_length += mask_length;
+        /* G(R^+) * n^+ / n = 2xy / ((x+y) * n) */
+        double score = 2. * (n_empty_left * n_left / total_left
+                + n_empty_right * n_right / total_right) / total;
+        gains[i] = (mask_samples + mask_volume + mask_length > 0.) ?
+            -1. : 0.5 - score;
     }
-    if (*forbidden_split) return 1.;
-    double gini_left = gini(n_empty_left, n_left);
-    double gini_right = gini(n_empty_right, n_right);
-    double total_left = n_left + n_empty_left;
-    double total_right = n_right + n_empty_right;
-    double total = total_right + total_left;
-    return gini_left * total_left / total + gini_right * total_right / total;
+    cause->count_min_samples_hit += (size_t) count_min_samples;
+    cause->count_min_volume_p_hit += (size_t) count_min_volume;
+    cause->count_min_length_p_hit += (size_t) count_min_length;
 }
 
 /**
@@ -205,6 +203,17 @@ unit_static void hist(size_t n, size_t step, const float *X, float lower_bond,
     }
 }
 
+/**
+ * Per feature profiling counters, summed in the criterion_args profile
+ * once the feature threads are joined.
+ */
+typedef struct split_profile {
+    double sort_time;
+    double hist_time;
+    double gain_time;
+    size_t bytes_allocated;
+} split_profile;
+
 typedef struct split_args {
     int feat;
     float node_min;
@@ -212,16 +221,23 @@ typedef struct split_args {
     float *X;
     criterion_args *c_args;
     forbidden_split_cause *cause;
+    split_profile *profile;
     double *best_gain;
     float *best_split;
     int *forbidden_split;
     int multi_threads;
+    rand_stream rng;  // own stream : the feature threads don't share one.
 } split_args;
 
 /**
  * Finds the best split point on feature feat.
+ * All the bins are evaluated in one contiguous pass when max_tries_p >= 1.
+ * Otherwise floor(n_bins * max_tries_p) bins are drawn from rng with a
+ * partial Fisher-Yates shuffle and gathered in contiguous arrays before
+ * the pass.
  */
-static void best_split_on_feature(float node_min, float node_max,
+static void best_split_on_feature(rand_stream *rng,
+        float node_min, float node_max,
         size_t n_samples, size_t n_empty, double node_volume, int min_samples,
         double min_volume, double min_length_p,
         float max_tries_p, size_t n_bins, const float *bins,
@@ -230,27 +246,41 @@ static void best_split_on_feature(float node_min, float node_max,
     *forbidden_split = 1;
     int local_best_gain_index = -1;
     double local_best_gain = 0.;
-    size_t *random_index = random_index_order_size_t(0, n_bins);
     size_t max_bins = floor(n_bins * max_tries_p);
     if (!max_bins) max_bins = 1;
+    if (max_bins > n_bins) max_bins = n_bins;
+    size_t *random_index = NULL;
+    const float *candidate_bins = bins;
+    const size_t *candidate_cdf = cdf;
+    float *sampled_bins = NULL;
+    size_t *sampled_cdf = NULL;
+    if (max_bins < n_bins) {
+        random_index = random_index_sample_size_t(rng, n_bins, max_bins);
+        sampled_bins = malloc(max_bins * sizeof(float));
+        sampled_cdf = malloc(max_bins * sizeof(size_t));
+        for (size_t j = 0; j < max_bins; ++j) {
+            sampled_bins[j] = bins[random_index[j]];
+            sampled_cdf[j] = cdf[random_index[j]];
+        }
+        candidate_bins = sampled_bins;
+        candidate_cdf = sampled_cdf;
+    }
+    double *gains = malloc(max_bins * sizeof(double));
+    gini_gains(max_bins, candidate_bins, candidate_cdf, node_min, node_max,
+            n_samples, n_empty, node_volume, min_samples, min_volume,
+            min_length_p, gains, cause);
     for (size_t j = 0; j < max_bins; ++j) {
-        size_t index = random_index[j];
-        float bin = bins[index];
-        debug_assert((node_min <= bin) && (bin <= node_max));
-        size_t n_left = cdf[index];
-        size_t n_right = n_samples - cdf[index];
-        int local_forbidden_split = 0;
-        double score = gini_after_split(node_min, node_max, bin, n_left,
-                n_right, n_empty, node_volume, min_samples, min_volume,
-                min_length_p, &local_forbidden_split, cause);
-        if (local_forbidden_split) continue;
-        double tmp_gain = 0.5 - score;
-        if (tmp_gain > local_best_gain) {
-            local_best_gain = tmp_gain;
-            local_best_gain_index = index;
+        debug_assert((node_min <= candidate_bins[j])
+                && (candidate_bins[j] <= node_max));
+        if (gains[j] > local_best_gain) {
+            local_best_gain = gains[j];
+            local_best_gain_index = random_index ? random_index[j] : j;
             *forbidden_split = 0;
         }
     }
+    free(gains);
+    free(sampled_bins);
+    free(sampled_cdf);
     free(random_index);
     *best_gain = local_best_gain;
     *best_index = local_best_gain_index;
@@ -264,20 +294,32 @@ static void *fill_best_splits(void *args) {
     size_t n_samples = c_args->node->n_samples;
     int n_features = c_args->fspt->n_features;
     size_t n_bins = 0;
+    split_profile *profile = a->profile;
     size_t *cdf = malloc(2 * n_samples * sizeof(size_t));
     float *bins = malloc(2 * n_samples * sizeof(float));
+    profile->bytes_allocated +=
+        2 * n_samples * (sizeof(size_t) + sizeof(float));
+    double start = what_time_is_it_now();
+    double stop;
     if (a->multi_threads) {
         float *x = malloc(n_samples * sizeof(float));
+        profile->bytes_allocated += n_samples * sizeof(float);
         copy_cpu(n_samples, X + feat, n_features, x, 1);
         qsort_float(n_samples, x);
+        stop = what_time_is_it_now();
+        profile->sort_time += stop - start;
         hist(n_samples, 1, x, a->node_min, &n_bins,
                 cdf, bins);
         free(x);
     } else {
         qsort_float_on_index(feat, n_samples, n_features, X);
+        stop = what_time_is_it_now();
+        profile->sort_time += stop - start;
         hist(n_samples, n_features, X + feat, a->node_min, &n_bins,
                 cdf, bins);
     }
+    start = what_time_is_it_now();
+    profile->hist_time += start - stop;
     if (n_bins < 1) {
         *a->best_gain = -1.;
         *a->best_split = 0.f;
@@ -289,12 +331,14 @@ static void *fill_best_splits(void *args) {
     int local_best_gain_index = 0;
     double local_best_gain = 0.;
     int local_forbidden_split = 1;
-    best_split_on_feature(a->node_min, a->node_max, n_samples,
-            c_args->node->n_empty, c_args->node->volume, c_args->min_samples,
+    best_split_on_feature(&a->rng, a->node_min, a->node_max, n_samples,
+            c_args->node->n_empty, c_args->node->volume,
+            weighted_min_samples(c_args),
             c_args->min_volume_p * c_args->fspt->volume, c_args->min_length_p, 
             c_args->max_tries_p, n_bins,
             bins, cdf, &local_best_gain, &local_best_gain_index,
             &local_forbidden_split, a->cause);
+    profile->gain_time += what_time_is_it_now() - start;
 
     if (!local_forbidden_split) {
         float fspt_min = c_args->fspt->feature_limit[2*feat];
@@ -320,13 +364,15 @@ void gini_criterion(criterion_args *args) {
     fspt_t *fspt = args->fspt;
     fspt_node *node = args->node;
     args->end_of_fitting = 0;
+    args->increment_count = 0;
     if (node->n_samples == 0) {
         ++args->count_no_sample_hit;
         node->cause = NO_SAMPLE;
         args->forbidden_split = 1;
         return;
     }
-    if (node->n_samples + node->n_empty < (size_t) 2 * args->min_samples) {
+    if (node->n_samples + node->n_empty
+            < (size_t) 2 * weighted_min_samples(args)) {
         ++args->count_min_samples_hit;
         node->cause = MIN_SAMPLES;
         args->forbidden_split = 1;
@@ -368,13 +414,16 @@ void gini_criterion(criterion_args *args) {
             return;
         }
         */
+        double start = what_time_is_it_now();
         p_value = dist_to_bound_test(fspt->n_features, node->n_samples,
                 node->samples, feature_limit);
+        args->profile->uniformity_time += what_time_is_it_now() - start;
         debug_print("p-value uniformity test = %g", p_value);
         if (p_value > args->unf_alpha) {
             ++args->count_uniformity_hit;
             node->cause = UNIFORMITY;
             args->forbidden_split = 1;
+            free(feature_limit);
             return;
         }
     }
@@ -388,12 +437,19 @@ void gini_criterion(criterion_args *args) {
     }
     double *best_gains = malloc(fspt->n_features * sizeof(double));
     float *best_splits = malloc(fspt->n_features * sizeof(float));
-    int *random_features = random_index_order(0, fspt->n_features);
+    rand_stream *rng = args->rng ? args->rng : thread_rand_stream();
     float *X = node->samples;
     int forbidden_split = 1;
     int max_features = floor(fspt->n_features * args->max_features_p);
+    size_t *random_features =
+        random_index_sample_size_t(rng, fspt->n_features, max_features);
     forbidden_split_cause *causes =
         calloc(max_features, sizeof(forbidden_split_cause));
+    split_profile *profiles = calloc(max_features, sizeof(split_profile));
+    args->profile->bytes_allocated += 2 * fspt->n_features * sizeof(float)
+        + fspt->n_features * (sizeof(double) + sizeof(float) + sizeof(size_t))
+        + max_features * (sizeof(forbidden_split_cause)
+                + sizeof(split_profile) + sizeof(split_args));
     pthread_t *threads = NULL;
     if (args->multi_threads) {
         threads = calloc(max_features, sizeof(pthread_t));
@@ -409,10 +465,13 @@ void gini_criterion(criterion_args *args) {
         sp_args->X = X;
         sp_args->c_args = args;
         sp_args->cause = causes + i;
+        sp_args->profile = profiles + i;
         sp_args->best_gain = best_gains + i;
         sp_args->best_split = best_splits + i;
         sp_args->forbidden_split = &forbidden_split;
         sp_args->multi_threads = args->multi_threads;
+        /* seeds drawn in order : independent of the thread scheduling. */
+        rand_stream_seed(&sp_args->rng, rand_stream_next(rng), feat);
         if (args->multi_threads) {
             pthread_create(threads + i, 0, fill_best_splits, (void *)sp_args);
         } else {
@@ -429,6 +488,13 @@ void gini_criterion(criterion_args *args) {
         }
         free(threads);
     }
+    for (int i = 0; i < max_features; ++i) {
+        args->profile->sort_time += profiles[i].sort_time;
+        args->profile->hist_time += profiles[i].hist_time;
+        args->profile->gain_time += profiles[i].gain_time;
+        args->profile->bytes_allocated += profiles[i].bytes_allocated;
+    }
+    free(profiles);
     if (forbidden_split) {
         determine_cause(max_features, causes, args);
         args->forbidden_split = 1;
@@ -437,15 +503,19 @@ void gini_criterion(criterion_args *args) {
         args->best_index = random_features[rand_idx];
         double best_gain = best_gains[rand_idx];
         args->best_split = best_splits[rand_idx];
+        args->best_gain = best_gain;
         args->forbidden_split = 0;
         if (args->uniformity_test_level != ALLWAYS_TEST_UNIFORMITY
                 && best_gain < args->gini_gain_thresh) {
             double p_value = 0.;
             if (args->uniformity_test_level == MIXED_TEST_UNIFORMITY
                     && args->unf_alpha < 1.) {
+                double start = what_time_is_it_now();
                 p_value = dist_to_bound_test(fspt->n_features,
                         node->n_samples, node->samples,
                         feature_limit);
+                args->profile->uniformity_time +=
+                    what_time_is_it_now() - start;
                 debug_print("p-value uniformity test = %g", p_value);
                 /*
                 struct unf_options options = {0};
@@ -34,6 +34,11 @@ void free_layer(layer l)
     if(l.scales)             free(l.scales);
     if(l.scale_updates)      free(l.scale_updates);
     if(l.weights)            free(l.weights);
+    if(l.winograd_weights)   free(l.winograd_weights);
+    if(l.qweights)           free(l.qweights);
+    if(l.qweight_scales)     free(l.qweight_scales);
+    if(l.qpacked)            free(l.qpacked);
+    if(l.qinput)             free(l.qinput);
     if(l.weight_updates)     free(l.weight_updates);
     if(l.delta)              free(l.delta);
     if(l.output)             free(l.output);
@@ -60,6 +65,11 @@ void free_layer(layer l)
             if (l.fspts[i]) free_fspt(l.fspts[i]);
         free(l.fspts);
     }
+    if(l.fspt_ensemble) {
+        for (int i = 0; i < l.classes * l.fspt_ensemble_size; ++i)
+            if (l.fspt_ensemble[i]) free_fspt(l.fspt_ensemble[i]);
+        free(l.fspt_ensemble);
+    }
     if(l.fspt_training_data) {
         for (int i = 0; i < l.classes; ++i)
             if (l.fspt_training_data[i]) free(l.fspt_training_data[i]);
@@ -67,6 +77,15 @@ void free_layer(layer l)
     }
     if(l.fspt_n_training_data) free(l.fspt_n_training_data);
     if(l.fspt_n_max_training_data) free(l.fspt_n_max_training_data);
+    if(l.fspt_n_seen_data) free(l.fspt_n_seen_data);
+    if(l.fspt_stratum_seen) free(l.fspt_stratum_seen);
+    if(l.fspt_stratum_kept) free(l.fspt_stratum_kept);
+    if(l.fspt_training_strata) {
+        for (int i = 0; i < l.classes; ++i)
+            if (l.fspt_training_strata[i]) free(l.fspt_training_strata[i]);
+        free(l.fspt_training_strata);
+    }
+    if(l.fspt_reduction) free_fspt_reduction(l.fspt_reduction);
 
 #ifdef GPU
     if(l.indexes_gpu)             cuda_free((float *)l.indexes_gpu);
@@ -0,0 +1,292 @@
+#include "mapped_weights.h"
+#include "batchnorm_layer.h"
+#include "connected_layer.h"
+#include "convolutional_layer.h"
+#include "fspt_layer.h"
+#include "local_layer.h"
+#include "quantize.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * Mapped weights files.
+ *
+ * A header and a table of tensors, then every float tensor at an aligned
+ * offset, in the layout the layers use, then the fspt trees and the int8
+ * section as in the regular weights files. The loader maps the whole file
+ * private and writable and points the layer weights to their tensor : no
+ * read nor copy at startup, the pages come from the page cache on first use
+ * and are shared by all the processes mapping the file until they are
+ * written (copy-on-write when training or fusing batchnorm). The tensors of
+ * layers fused before saving are flagged, so fuse_network leaves them.
+ */
+
+#define MAPPED_WEIGHTS_VERSION 1
+
+typedef struct {
+    int magic;
+    int version;
+    int n_tensors;
+    int align;
+    size_t seen;
+    size_t stream;          // offset of the fspt trees and the int8 section.
+} mapped_header;
+
+enum {MAPPED_BIASES, MAPPED_SCALES, MAPPED_ROLLING_MEAN, MAPPED_ROLLING_VARIANCE,
+    MAPPED_WEIGHTS, MAPPED_KINDS};
+
+typedef struct {
+    int layer;
+    int kind;
+    int fused;              // batchnorm folded in the weights.
+    int pad;
+    size_t offset;          // bytes from the start of the file.
+    size_t count;           // floats.
+} mapped_tensor;
+
+static int mapped_supported(layer l)
+{
+    return l.type == CONVOLUTIONAL || l.type == DECONVOLUTIONAL
+        || l.type == CONNECTED || l.type == BATCHNORM || l.type == LOCAL;
+}
+
+/* Field of l holding tensor kind and its number of floats, 0 if the layer
+ * has no such tensor. */
+static float **mapped_field(layer *l, int kind, size_t *count)
+{
+    size_t channels = 0;
+    size_t weights = 0;
+    if(l->type == CONVOLUTIONAL || l->type == DECONVOLUTIONAL){
+        channels = l->n;
+        weights = l->nweights;
+    } else if(l->type == CONNECTED){
+        channels = l->outputs;
+        weights = (size_t)l->outputs*l->inputs;
+    } else if(l->type == BATCHNORM){
+        channels = l->c;
+    } else if(l->type == LOCAL){
+        channels = l->outputs;
+        weights = (size_t)l->size*l->size*l->c*l->n*l->out_w*l->out_h;
+    }
+    float **field = 0;
+    *count = kind == MAPPED_WEIGHTS ? weights : channels;
+    switch(kind){
+        case MAPPED_BIASES:
+            if(l->type != BATCHNORM) field = &l->biases;
+            break;
+        case MAPPED_SCALES:
+            field = &l->scales;
+            break;
+        case MAPPED_ROLLING_MEAN:
+            field = &l->rolling_mean;
+            break;
+        case MAPPED_ROLLING_VARIANCE:
+            field = &l->rolling_variance;
+            break;
+        case MAPPED_WEIGHTS:
+            field = &l->weights;
+            break;
+    }
+    if(l->type == LOCAL && kind != MAPPED_BIASES && kind != MAPPED_WEIGHTS) field = 0;
+    if(!field || !*field || !*count) return 0;
+    return field;
+}
+
+static size_t align_offset(size_t offset)
+{
+    return (offset + MAPPED_WEIGHTS_ALIGN - 1)/MAPPED_WEIGHTS_ALIGN*MAPPED_WEIGHTS_ALIGN;
+}
+
+static void pad_file(FILE *fp, size_t offset)
+{
+    static const char zeros[MAPPED_WEIGHTS_ALIGN] = {0};
+    long pos = ftell(fp);
+    if(pos < 0 || (size_t)pos > offset) error("Mapped weights: bad offset");
+    fwrite(zeros, 1, offset - pos, fp);
+}
+
+/* Layers whose batchnorm was folded by fuse_network : the cfg had one, the
+ * rolling statistics are still allocated. */
+static int layer_fused(layer l)
+{
+    return (l.type == CONVOLUTIONAL || l.type == CONNECTED)
+        && !l.batch_normalize && l.rolling_mean;
+}
+
+void save_mapped_weights(network *net, char *filename)
+{
+    int i, k;
+    int n = 0;
+    for(i = 0; i < net->n; ++i){
+        layer *l = net->layers + i;
+        if(l->dontsave) continue;
+        if(l->type == RNN || l->type == CRNN || l->type == LSTM || l->type == GRU){
+            fprintf(stderr, "Mapped weights: layer %d (%s) is not supported\n", i, get_layer_string(l->type));
+            error("Can't save mapped weights");
+        }
+#ifdef GPU
+        if(net->gpu_index >= 0){
+            if(l->type == CONVOLUTIONAL || l->type == DECONVOLUTIONAL) pull_convolutional_layer(*l);
+            if(l->type == CONNECTED) pull_connected_layer(*l);
+            if(l->type == BATCHNORM) pull_batchnorm_layer(*l);
+            if(l->type == LOCAL) pull_local_layer(*l);
+        }
+#endif
+        for(k = 0; k < MAPPED_KINDS; ++k){
+            size_t count;
+            if(mapped_supported(*l) && mapped_field(l, k, &count)) ++n;
+        }
+    }
+    mapped_tensor *tensors = calloc(n, sizeof(mapped_tensor));
+    size_t offset = align_offset(sizeof(mapped_header) + n*sizeof(mapped_tensor));
+    int t = 0;
+    for(i = 0; i < net->n; ++i){
+        layer *l = net->layers + i;
+        if(l->dontsave || !mapped_supported(*l)) continue;
+        for(k = 0; k < MAPPED_KINDS; ++k){
+            size_t count;
+            if(!mapped_field(l, k, &count)) continue;
+            mapped_tensor e = {i, k, layer_fused(*l), 0, offset, count};
+            tensors[t++] = e;
+            offset = align_offset(offset + count*sizeof(float));
+        }
+    }
+    mapped_header header = {MAPPED_WEIGHTS_MAGIC, MAPPED_WEIGHTS_VERSION, n,
+        MAPPED_WEIGHTS_ALIGN, *net->seen, offset};
+
+    fprintf(stderr, "Saving mapped weights to %s\n", filename);
+    FILE *fp = fopen(filename, "wb");
+    if(!fp) file_error(filename);
+    fwrite(&header, sizeof(mapped_header), 1, fp);
+    fwrite(tensors, sizeof(mapped_tensor), n, fp);
+    for(t = 0; t < n; ++t){
+        size_t count;
+        float **field = mapped_field(net->layers + tensors[t].layer, tensors[t].kind, &count);
+        pad_file(fp, tensors[t].offset);
+        fwrite(*field, sizeof(float), count, fp);
+    }
+    pad_file(fp, header.stream);
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        if(l.type == FSPT && !l.dontsave) save_fspt_trees(l, fp);
+    }
+    save_int8_weights(net, fp);
+    fclose(fp);
+    free(tensors);
+}
+
+void load_mapped_weights(network *net, char *filename)
+{
+    int i, t;
+    mapped_header header;
+    if(net->weights_map) error("Mapped weights: the network already maps weights");
+    FILE *fp = fopen(filename, "rb");
+    if(!fp) file_error(filename);
+    if(fread(&header, sizeof(mapped_header), 1, fp) != 1
+            || header.magic != MAPPED_WEIGHTS_MAGIC) error("Mapped weights: bad header");
+    if(header.version != MAPPED_WEIGHTS_VERSION) error("Mapped weights: unknown version");
+    if(header.align <= 0 || header.n_tensors < 0) error("Mapped weights: bad header");
+    mapped_tensor *tensors = calloc(header.n_tensors, sizeof(mapped_tensor));
+    if((int)fread(tensors, sizeof(mapped_tensor), header.n_tensors, fp) != header.n_tensors){
+        error("Mapped weights: truncated table");
+    }
+    struct stat st;
+    if(fstat(fileno(fp), &st)) file_error(filename);
+    size_t size = st.st_size;
+    /* private : the pages stay shared with the page cache until written */
+    char *map = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(fp), 0);
+    if(map == MAP_FAILED) file_error(filename);
+
+    for(t = 0; t < header.n_tensors; ++t){
+        mapped_tensor e = tensors[t];
+        size_t count;
+        if(e.layer < 0 || e.layer >= net->n || e.kind < 0 || e.kind >= MAPPED_KINDS){
+            error("Mapped weights: bad tensor");
+        }
+        layer *l = net->layers + e.layer;
+        if(l->dontload) continue;
+        float **field = mapped_supported(*l) ? mapped_field(l, e.kind, &count) : 0;
+        if(!field || count != e.count || e.offset % header.align
+                || e.offset + e.count*sizeof(float) > size){
+            fprintf(stderr, "Mapped weights: tensor %d of layer %d doesn't match the network\n", e.kind, e.layer);
+            error("Can't load mapped weights");
+        }
+        free(*field);
+        *field = (float *)(map + e.offset);
+        if(e.fused && l->batch_normalize){
+            l->batch_normalize = 0;
+            free(l->x);
+            free(l->x_norm);
+            l->x = l->x_norm = 0;
+        }
+    }
+    net->weights_map = map;
+    net->weights_map_size = size;
+    *net->seen = header.seen;
+
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        if(l.dontload) continue;
+        if(l.type == CONVOLUTIONAL) transform_convolutional_weights(l);
+#ifdef GPU
+        if(net->gpu_index >= 0){
+            if(l.type == CONVOLUTIONAL || l.type == DECONVOLUTIONAL) push_convolutional_layer(l);
+            if(l.type == CONNECTED) push_connected_layer(l);
+            if(l.type == BATCHNORM) push_batchnorm_layer(l);
+            if(l.type == LOCAL) push_local_layer(l);
+        }
+#endif
+    }
+
+    if(fseek(fp, header.stream, SEEK_SET)) file_error(filename);
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        if(l.type == FSPT && !l.dontload) load_fspt_trees(l, fp);
+    }
+    load_int8_weights(net, fp);
+    fprintf(stderr, "mapped %d tensors, %.1f MB...", header.n_tensors, size/1e6);
+    fclose(fp);
+    free(tensors);
+}
+
+void load_mapped_fspt_trees(network *net, char *filename)
+{
+    int i;
+    mapped_header header;
+    FILE *fp = fopen(filename, "rb");
+    if(!fp) file_error(filename);
+    if(fread(&header, sizeof(mapped_header), 1, fp) != 1
+            || header.magic != MAPPED_WEIGHTS_MAGIC) error("Mapped weights: bad header");
+    if(header.version != MAPPED_WEIGHTS_VERSION) error("Mapped weights: unknown version");
+    if(fseek(fp, header.stream, SEEK_SET)) file_error(filename);
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        if(l.type == FSPT && !l.dontload) load_fspt_trees(l, fp);
+    }
+    fclose(fp);
+}
+
+void unmap_network_weights(network *net)
+{
+    int i, k;
+    if(!net->weights_map) return;
+    char *begin = net->weights_map;
+    char *end = begin + net->weights_map_size;
+    for(i = 0; i < net->n; ++i){
+        layer *l = net->layers + i;
+        if(!mapped_supported(*l)) continue;
+        for(k = 0; k < MAPPED_KINDS; ++k){
+            size_t count;
+            float **field = mapped_field(l, k, &count);
+            if(field && (char *)*field >= begin && (char *)*field < end) *field = 0;
+        }
+    }
+    munmap(net->weights_map, net->weights_map_size);
+    net->weights_map = 0;
+    net->weights_map_size = 0;
+}
@@ -0,0 +1,26 @@
+#ifndef MAPPED_WEIGHTS_H
+#define MAPPED_WEIGHTS_H
+
+#include "darknet.h"
+
+/* First int of a mapped weights file, where the regular weights files have
+ * their major version. */
+#define MAPPED_WEIGHTS_MAGIC 0x574d4b44 /* "DKMW" */
+
+/* Tensors are aligned on this boundary in the file, a multiple of the page
+ * size of the usual systems. */
+#define MAPPED_WEIGHTS_ALIGN 4096
+
+/* Maps filename, written by save_mapped_weights, and points the weights of
+ * the layers of net to the mapping. Called by load_weights. */
+void load_mapped_weights(network *net, char *filename);
+
+/* Loads only the fspt trees of filename, written by save_mapped_weights, in
+ * the fspt layers of net. Called by load_fspt_weights. */
+void load_mapped_fspt_trees(network *net, char *filename);
+
+/* Unmaps the weights of net. The layer weights pointing to the mapping are
+ * set to 0 first, so free_layer leaves them. */
+void unmap_network_weights(network *net);
+
+#endif
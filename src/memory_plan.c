@@ -0,0 +1,294 @@
+#include "memory_plan.h"
+#include "network.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Inference memory planner.
+ *
+ * Each layer output is a tensor living from the layer that writes it to the
+ * last layer that reads it. Layers are run in order, so the lifetimes are
+ * intervals of layer indexes and two outputs whose intervals do not
+ * intersect can share the same memory. The outputs are greedily assigned to
+ * slots of one arena, reusing the best fitting free slot.
+ *
+ * Some outputs are views in the tensor of another output: dropout and
+ * single input routes alias their input, shortcuts accumulate in their
+ * input when it is dead afterwards and, with a batch of 1, the producers of
+ * a concatenation write in their slice of the route output. The layers skip
+ * their copy when the source is already the destination.
+ */
+
+typedef struct {
+    size_t size;       // floats.
+    int last_use;      // index of the last layer reading the current tensor.
+    size_t offset;
+} plan_slot;
+
+int memory_plan_supported(LAYER_TYPE type)
+{
+    switch(type){
+        case CONVOLUTIONAL:
+        case CONNECTED:
+        case MAXPOOL:
+        case AVGPOOL:
+        case SOFTMAX:
+        case DETECTION:
+        case DROPOUT:
+        case CROP:
+        case ROUTE:
+        case COST:
+        case NORMALIZATION:
+        case SHORTCUT:
+        case ACTIVE:
+        case BATCHNORM:
+        case REGION:
+        case YOLO:
+        case REORG:
+        case UPSAMPLE:
+        case FSPT:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/* Loss layers write their delta in forward, even when not training. */
+static int forward_uses_delta(LAYER_TYPE type)
+{
+    return type == SOFTMAX || type == DETECTION || type == COST
+        || type == REGION || type == YOLO;
+}
+
+/* Outputs read after forward_network: detections and the network output. */
+static int output_read_after_forward(network *net, int i)
+{
+    layer l = net->layers[i];
+    return i == net->n - 1 || l.truth || l.type == YOLO || l.type == REGION
+        || l.type == DETECTION || l.type == FSPT;
+}
+
+static void use(network *net, int *last_use, int layer, int i)
+{
+    if(layer < 0 || layer >= net->n) return;
+    if(last_use[layer] < i) last_use[layer] = i;
+}
+
+/* Index of the last layer reading the output of each layer. */
+static int *compute_last_use(network *net)
+{
+    int i, j;
+    int *last_use = calloc(net->n, sizeof(int));
+    for(i = 0; i < net->n; ++i){
+        last_use[i] = i;
+    }
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        use(net, last_use, i - 1, i);
+        if(l.type == ROUTE){
+            for(j = 0; j < l.n; ++j) use(net, last_use, l.input_layers[j], i);
+        } else if(l.type == SHORTCUT){
+            use(net, last_use, l.index, i);
+        } else if(l.type == FSPT){
+            /* the fspt inputs are also read by get_fspt_detections */
+            for(j = 0; j < l.inputs; ++j) use(net, last_use, l.input_layers[j], net->n);
+            use(net, last_use, l.yolo_layer, net->n);
+        }
+        if(output_read_after_forward(net, i)) use(net, last_use, i, net->n);
+    }
+    return last_use;
+}
+
+int *memory_plan_kept_outputs(network *net)
+{
+    int i;
+    int *kept = compute_last_use(net);
+    for(i = 0; i < net->n; ++i) kept[i] = kept[i] == net->n;
+    return kept;
+}
+
+typedef struct {
+    int *tensor;       // tensor[i] : first layer of the tensor holding output i.
+    size_t *offset;    // offset of output i in its tensor, in floats.
+    size_t *size;      // size[t] : floats of tensor t, 0 if t is not a tensor.
+    int *last_use;     // last_use[t] : last layer reading tensor t.
+    int *members;      // members[t] : number of outputs in tensor t.
+} plan_tensors;
+
+static void join_tensor(plan_tensors *p, int i, int t, size_t offset, int last_use)
+{
+    int old = p->tensor[i];
+    p->size[old] = 0;
+    --p->members[old];
+    p->tensor[i] = t;
+    p->offset[i] = offset;
+    ++p->members[t];
+    if(p->last_use[t] < last_use) p->last_use[t] = last_use;
+}
+
+/*
+ * With a batch of 1, the producers of a concatenation write straight into
+ * their slice of the route output. Only producers owning their own tensor
+ * can be moved, else the route keeps copying.
+ */
+static int plan_route_view(network *net, plan_tensors *p, const int *last_use, int r)
+{
+    layer l = net->layers[r];
+    int k, j;
+    int root = r;
+    for(k = 0; k < l.n; ++k){
+        int q = l.input_layers[k];
+        if(q < 0 || q >= r || p->tensor[q] != q || p->members[q] != 1) return 0;
+        if(net->layers[q].outputs != l.input_sizes[k]) return 0;
+        for(j = 0; j < k; ++j) if(l.input_layers[j] == q) return 0;
+        if(q < root) root = q;
+    }
+    size_t offset = 0;
+    int last = last_use[r];
+    for(k = 0; k < l.n; ++k){
+        int q = l.input_layers[k];
+        if(p->last_use[q] > last) last = p->last_use[q];
+    }
+    for(k = 0; k < l.n; ++k){
+        int q = l.input_layers[k];
+        if(q == root) p->offset[q] = offset;
+        else join_tensor(p, q, root, offset, last);
+        offset += l.input_sizes[k];
+    }
+    p->size[root] = (size_t)l.outputs;
+    join_tensor(p, r, root, 0, last);
+    return 1;
+}
+
+static int plan_views(network *net, plan_tensors *p, const int *last_use)
+{
+    int i;
+    int views = 0;
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        p->tensor[i] = i;
+        p->size[i] = (size_t)l.outputs*l.batch;
+        p->last_use[i] = last_use[i];
+        p->members[i] = 1;
+        if(i == 0) continue;
+        if(l.type == DROPOUT){
+            join_tensor(p, i, p->tensor[i-1], p->offset[i-1], last_use[i]);
+        } else if(l.type == ROUTE && l.n == 1){
+            int q = l.input_layers[0];
+            join_tensor(p, i, p->tensor[q], p->offset[q], last_use[i]);
+            ++views;
+        } else if(l.type == ROUTE && l.batch == 1){
+            views += plan_route_view(net, p, last_use, i);
+        } else if(l.type == SHORTCUT){
+            /* accumulate in the input when nothing reads it afterwards */
+            int t = p->tensor[i-1];
+            if(p->last_use[t] == i && p->tensor[l.index] != t
+                    && net->layers[i-1].outputs == l.outputs){
+                join_tensor(p, i, t, p->offset[i-1], last_use[i]);
+                ++views;
+            }
+        }
+    }
+    return views;
+}
+
+static size_t align_floats(size_t n)
+{
+    return (n + MEMORY_PLAN_ALIGN - 1)/MEMORY_PLAN_ALIGN*MEMORY_PLAN_ALIGN;
+}
+
+static void free_training_buffers(layer *l)
+{
+    if(l->type == DROPOUT){
+        l->delta = 0;
+        return;
+    }
+    if(!forward_uses_delta(l->type)){
+        free(l->delta);
+        l->delta = 0;
+    }
+    free(l->x_norm);
+    free(l->weight_updates);
+    free(l->bias_updates);
+    free(l->scale_updates);
+    free(l->mean_delta);
+    free(l->variance_delta);
+    l->x_norm = l->weight_updates = l->bias_updates = l->scale_updates = 0;
+    l->mean_delta = l->variance_delta = 0;
+    free(l->x);
+    l->x = 0;
+}
+
+size_t plan_network_memory(network *net)
+{
+    int i, s;
+    if(net->arena || net->gpu_index >= 0) return 0;
+    for(i = 0; i < net->n; ++i){
+        if(!memory_plan_supported(net->layers[i].type)){
+            fprintf(stderr, "Memory plan: layer %d is not supported, outputs are not shared\n", i);
+            return 0;
+        }
+    }
+    int *last_use = compute_last_use(net);
+    plan_tensors p;
+    p.tensor = calloc(net->n, sizeof(int));
+    p.offset = calloc(net->n, sizeof(size_t));
+    p.size = calloc(net->n, sizeof(size_t));
+    p.last_use = calloc(net->n, sizeof(int));
+    p.members = calloc(net->n, sizeof(int));
+    int views = plan_views(net, &p, last_use);
+    int *slot_of = calloc(net->n, sizeof(int));
+    plan_slot *slots = calloc(net->n, sizeof(plan_slot));
+    int n_slots = 0;
+    size_t before = 0;
+
+    for(i = 0; i < net->n; ++i){
+        if(net->layers[i].type != DROPOUT) before += align_floats((size_t)net->layers[i].outputs*net->layers[i].batch);
+        if(!p.size[i]) continue;
+        size_t size = align_floats(p.size[i]);
+        /* best fit among the free slots, else grow the largest free one */
+        int best = -1;
+        int largest = -1;
+        for(s = 0; s < n_slots; ++s){
+            if(slots[s].last_use >= i) continue;
+            if(slots[s].size >= size && (best < 0 || slots[s].size < slots[best].size)) best = s;
+            if(largest < 0 || slots[s].size > slots[largest].size) largest = s;
+        }
+        if(best < 0) best = largest;
+        if(best < 0) best = n_slots++;
+        if(slots[best].size < size) slots[best].size = size;
+        slots[best].last_use = p.last_use[i];
+        slot_of[i] = best;
+    }
+
+    size_t total = 0;
+    for(s = 0; s < n_slots; ++s){
+        slots[s].offset = total;
+        total += slots[s].size;
+    }
+    net->arena = calloc(total, sizeof(float));
+    if(!net->arena) malloc_error();
+
+    for(i = 0; i < net->n; ++i){
+        layer *l = net->layers + i;
+        if(l->type != DROPOUT) free(l->output);
+        l->output = net->arena + slots[slot_of[p.tensor[i]]].offset + p.offset[i];
+        free_training_buffers(l);
+    }
+    net->output = net->layers[net->n - 1].output;
+    shrink_network_workspace(net);
+
+    fprintf(stderr, "Memory plan: %d outputs in %d slots, %d views, %.1f MB -> %.1f MB\n",
+            net->n, n_slots, views, before*sizeof(float)/1e6, total*sizeof(float)/1e6);
+    free(last_use);
+    free(p.tensor);
+    free(p.offset);
+    free(p.size);
+    free(p.last_use);
+    free(p.members);
+    free(slot_of);
+    free(slots);
+    return total*sizeof(float);
+}
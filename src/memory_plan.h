@@ -0,0 +1,18 @@
+#ifndef MEMORY_PLAN_H
+#define MEMORY_PLAN_H
+
+#include "darknet.h"
+
+/* Floats of a planned output are aligned on this boundary in the arena. */
+#define MEMORY_PLAN_ALIGN 16
+
+/* Returns 1 if the outputs of the layers of this type can be placed in the
+ * arena by plan_network_memory. */
+int memory_plan_supported(LAYER_TYPE type);
+
+/* Flags of the outputs read after forward_network : the network output,
+ * the detections and the fspt inputs. Their memory is not reused by other
+ * outputs in the arena. Free with free(). */
+int *memory_plan_kept_outputs(network *net);
+
+#endif
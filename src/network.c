@@ -30,6 +30,10 @@
 #include "upsample_layer.h"
 #include "shortcut_layer.h"
 #include "fspt_layer.h"
+#include "gemm.h"
+#include "profiler.h"
+#include "replicas.h"
+#include "mapped_weights.h"
 #include "parser.h"
 #include "data.h"
 
@@ -205,6 +209,7 @@ void forward_network(network *netp)
         return;
     }
 #endif
+    if(forward_network_replicas(netp)) return;
     network net = *netp;
     int i;
     for(i = 0; i < net.n; ++i){
@@ -213,7 +218,9 @@ void forward_network(network *netp)
         if(l.delta){
             fill_cpu(l.outputs * l.batch, 0, l.delta, 1);
         }
+        double start = net.profile ? profile_time(&net) : 0;
         l.forward(l, net);
+        if(net.profile) profile_layer(&net, i, 0, start);
         net.input = l.output;
         if(l.truth) {
             net.truth = l.output;
@@ -294,7 +301,9 @@ void backward_network(network *netp)
             net.delta = prev.delta;
         }
         net.index = i;
+        double start = net.profile ? profile_time(&net) : 0;
         l.backward(l, net);
+        if(net.profile) profile_layer(&net, i, 1, start);
     }
 }
 
@@ -382,6 +391,9 @@ void set_batch_network(network *net, int b)
     int i;
     for(i = 0; i < net->n; ++i){
         net->layers[i].batch = b;
+        if(net->layers[i].qinput){
+            net->layers[i].qinput = realloc(net->layers[i].qinput, (size_t)net->layers[i].inputs*b);
+        }
 #ifdef CUDNN
         if(net->layers[i].type == CONVOLUTIONAL){
             cudnn_convolutional_setup(net->layers + i);
@@ -395,8 +407,46 @@ void set_batch_network(network *net, int b)
     }
 }
 
+void fuse_network(network *net)
+{
+    int i;
+    int fused = 0;
+    for(i = 0; i < net->n; ++i){
+        layer *l = net->layers + i;
+        if(!l->batch_normalize) continue;
+        if(l->type == CONVOLUTIONAL){
+            fuse_convolutional_batchnorm(l);
+            ++fused;
+        } else if(l->type == CONNECTED){
+            fuse_connected_batchnorm(l);
+            ++fused;
+        }
+    }
+    if(fused) fprintf(stderr, "Fused batchnorm of %d layers\n", fused);
+    shrink_network_workspace(net);
+}
+
+/* Once the network only runs forward, the convolutions drop the im2col
+ * workspace of their backward and net->workspace shrinks to the largest
+ * forward need. */
+void shrink_network_workspace(network *net)
+{
+    int i;
+    if(net->gpu_index >= 0) return;
+    size_t workspace_size = 0;
+    for(i = 0; i < net->n; ++i){
+        layer *l = net->layers + i;
+        if(l->type == CONVOLUTIONAL) set_convolutional_forward_only(l);
+        if(l->workspace_size > workspace_size) workspace_size = l->workspace_size;
+    }
+    free(net->workspace);
+    net->workspace = workspace_size ? calloc(1, workspace_size) : 0;
+    if(workspace_size && !net->workspace) malloc_error();
+}
+
 int resize_network(network *net, int w, int h)
 {
+    if(net->arena) error("Can't resize a network with a memory plan");
 #ifdef GPU
     cuda_set_device(net->gpu_index);
     cuda_free(net->workspace);
@@ -1000,9 +1050,14 @@ float network_accuracy_multi(network *net, data d, int n)
 void free_network(network *net)
 {
     int i;
+    free_network_profile(net);
+    free_network_replicas(net);
+    unmap_network_weights(net);
     for(i = 0; i < net->n; ++i){
+        if(net->arena) net->layers[i].output = 0;
         free_layer(net->layers[i]);
     }
+    free(net->arena);
     free(net->layers);
     if(net->input) free(net->input);
     if(net->truth) free(net->truth);
@@ -1021,6 +1076,16 @@ void free_network(network *net)
     free(net);
 }
 
+void free_network_view(network *view)
+{
+    int i;
+    for(i = 0; i < view->n; ++i){
+        if(view->layers[i].type == FSPT) free_layer(view->layers[i]);
+    }
+    free(view->layers);
+    free(view);
+}
+
 // Some day...
 // ^ What the hell is this comment for?
 
@@ -1063,11 +1128,15 @@ static void *fit_fspt_thread(void *ptr) {
     return 0;
 }
 
-static void *score_fspt_thread(void *ptr) {
-    fspt_fit_args args = *(fspt_fit_args *)ptr;
-    fspt_layer_rescore_class(args.l, args.class);
-    free(ptr);
-    return 0;
+typedef struct{
+    layer *layers;  // the fspt layers.
+    int classes;
+} fspt_score_args;
+
+static void score_fspt_task(void *arg, int task, void *buffer) {
+    fspt_score_args *args = (fspt_score_args *)arg;
+    fspt_layer_rescore_class(args->layers[task / args->classes],
+            task % args->classes);
 }
 
 static pthread_t fit_fspt_in_thread(layer l, int class, int refit, int merge) {
@@ -1082,16 +1151,6 @@ static pthread_t fit_fspt_in_thread(layer l, int class, int refit, int merge) {
     return thread;
 }
 
-static pthread_t score_fspt_in_thread(layer l, int class) {
-    pthread_t thread;
-    fspt_fit_args *ptr = (fspt_fit_args *)calloc(1, sizeof(fspt_fit_args));
-    ptr->l= l;
-    ptr->class = class;
-    if(pthread_create(&thread, 0, score_fspt_thread, ptr))
-        error("Thread creation failed");
-    return thread;
-}
-
 void fspt_layers_set_samples(network *net, int refit, int merge) {
     int n = net->n;
     for (int i = 0; i < n; ++i) {
@@ -1102,6 +1161,58 @@ void fspt_layers_set_samples(network *net, int refit, int merge) {
     }
 }
 
+/**
+ * Saves the extracted training data of all the fspt layers to a shard file.
+ * See fspt_layer_save_shard_file.
+ *
+ * \param net The network.
+ * \param filename The shard file.
+ * \return 1 if successfully saved, 0 otherwise.
+ */
+int save_fspt_shard(network *net, const char *filename) {
+    FILE *fp = fopen(filename, "wb");
+    if (!fp) file_error(filename);
+    int succ = 1;
+    for (int i = 0; i < net->n; ++i) {
+        layer l = net->layers[i];
+        if (l.type == FSPT) {
+            fspt_layer_save_shard_file(fp, l, &succ);
+        }
+    }
+    fclose(fp);
+    return succ;
+}
+
+/**
+ * Merges the shard files written by save_fspt_shard into the training data
+ * of the fspt layers. See fspt_layer_merge_shard_files.
+ *
+ * \param net The network. Must have the same fspt layers as the networks
+ *            that wrote the shards.
+ * \param n The number of shard files.
+ * \param filenames The shard files.
+ * \param dedup If true, drops duplicated samples.
+ * \return 1 if successfully merged, 0 otherwise.
+ */
+int merge_fspt_shards(network *net, int n, char **filenames, int dedup) {
+    if (n <= 0) return 0;
+    FILE **fps = calloc((size_t) n, sizeof(FILE *));
+    for (int s = 0; s < n; ++s) {
+        fps[s] = fopen(filenames[s], "rb");
+        if (!fps[s]) file_error(filenames[s]);
+    }
+    int succ = 1;
+    for (int i = 0; i < net->n && succ; ++i) {
+        layer l = net->layers[i];
+        if (l.type == FSPT) {
+            fspt_layer_merge_shard_files(l, n, fps, dedup, &succ);
+        }
+    }
+    for (int s = 0; s < n; ++s) fclose(fps[s]);
+    free(fps);
+    return succ;
+}
+
 void fit_fspts(network *net, int classes, int refit, int one_thread,
         int merge) {
     int n = net->n;
@@ -1119,6 +1230,7 @@ void fit_fspts(network *net, int classes, int refit, int one_thread,
         for (int i = 0; i < n; ++i) {
             layer l = net->layers[i];
             if (l.type == FSPT) {
+                fspt_layer_fit_reduction(l);
                 for (int class = 0; class < classes; ++class) {
                     threads[classes * n_fspt_layers + class] =
                         fit_fspt_in_thread(l, class, refit, merge);
@@ -1137,7 +1249,6 @@ void fit_fspts(network *net, int classes, int refit, int one_thread,
 
 void score_fspts(network *net, int classes, int one_thread) {
     int n = net->n;
-    int n_fspt_layers = 0;
     if (one_thread) {
         for (int i = 0; i < n; ++i) {
             layer l = net->layers[i];
@@ -1146,24 +1257,15 @@ void score_fspts(network *net, int classes, int one_thread) {
             }
         }
     } else {
-        pthread_t *threads =
-            (pthread_t *) calloc(n * classes, sizeof(pthread_t));
+        /* one task per class of each layer, run on the gemm thread pool */
+        fspt_score_args args = {calloc(n, sizeof(layer)), classes};
+        int n_fspt_layers = 0;
         for (int i = 0; i < n; ++i) {
-            layer l = net->layers[i];
-            if (l.type == FSPT) {
-                for (int class = 0; class < classes; ++class) {
-                    threads[classes * n_fspt_layers + class] =
-                        score_fspt_in_thread(l, class);
-                }
-                ++n_fspt_layers;
-            }
-        }
-        threads =
-            realloc(threads, classes * n_fspt_layers * sizeof(pthread_t));
-        for (int i = 0; i < classes * n_fspt_layers; ++i) {
-            pthread_join(threads[i], 0);
+            if (net->layers[i].type == FSPT)
+                args.layers[n_fspt_layers++] = net->layers[i];
         }
-        free(threads);
+        gemm_parallel_for(n_fspt_layers * classes, score_fspt_task, &args);
+        free(args.layers);
     }
 }
 
@@ -1185,7 +1287,9 @@ void forward_network_gpu(network *netp)
         if(l.delta_gpu){
             fill_gpu(l.outputs * l.batch, 0, l.delta_gpu, 1);
         }
+        double start = net.profile ? profile_time(&net) : 0;
         l.forward_gpu(l, net);
+        if(net.profile) profile_layer(&net, i, 0, start);
         net.input_gpu = l.output_gpu;
         net.input = l.output;
         if(l.truth) {
@@ -1216,7 +1320,9 @@ void backward_network_gpu(network *netp)
             net.delta_gpu = prev.delta_gpu;
         }
         net.index = i;
+        double start = net.profile ? profile_time(&net) : 0;
         l.backward_gpu(l, net);
+        if(net.profile) profile_layer(&net, i, 1, start);
     }
 }
 
@@ -1470,6 +1576,7 @@ void reset_weights(layer l) {
     if (l.type == FSPT) {
         for (int class = 0; class < l.classes; ++class) {
             l.fspt_n_training_data[class] = 0;
+            fspt_layer_reset_sampling(l, class);
         }
     }
 }
@@ -21,11 +21,15 @@ extern float network_accuracy_multi(network *net, data d, int n);
 extern int get_predicted_class_network(network *net);
 extern void print_network(network *net);
 extern int resize_network(network *net, int w, int h);
+extern void shrink_network_workspace(network *net);
 extern void calc_network_cost(network *net);
 extern void fit_fspts(network *net, int classes, int refit, int one_thread,
         int merge);
 extern void fspt_layers_set_samples(network *net, int refit, int merge);
 extern void score_fspts(network *net, int classes, int one_thread);
+extern int save_fspt_shard(network *net, const char *filename);
+extern int merge_fspt_shards(network *net, int n, char **filenames,
+        int dedup);
 extern void validate_networks_fspt(network **nets, int n, data d, int interval);
 extern void validate_network_fspt(network *net, data d);
 extern detection **get_network_boxes_batch(network *net, int w, int h,
@@ -38,6 +38,8 @@
 #include "lstm_layer.h"
 #include "fspt_layer.h"
 #include "fspt.h"
+#include "mapped_weights.h"
+#include "quantize.h"
 #include "fspt_score.h"
 #include "fspt_criterion.h"
 #include "utils.h"
@@ -212,6 +214,10 @@ convolutional_layer parse_convolutional(list *options, size_params params)
     convolutional_layer layer = make_convolutional_layer(batch,h,w,c,n,groups,size,stride,padding,activation, batch_normalize, binary, xnor, params.net->adam);
     layer.flipped = option_find_int_quiet(options, "flipped", 0);
     layer.dot = option_find_float_quiet(options, "dot", 0);
+    /* a forward only layer does not keep the im2col workspace */
+    layer.onlyforward = option_find_int_quiet(options, "onlyforward", 0);
+    char *algo_s = option_find_str_quiet(options, "conv_algo", "auto");
+    set_convolutional_algorithm(&layer, get_conv_algorithm(algo_s));
     layer.projection = params.projection
         + params.prod_strides * (layer.size - 1);
     layer.prod_strides = params.prod_strides * layer.stride;
@@ -811,6 +817,27 @@ layer parse_fspt(list *options, size_params params)
             }
         }
     }
+    /* reduction */
+    char *reduction_string = option_find_str_quiet(options, "reduction", "none");
+    REDUCTION_METHOD reduction_method =
+        string_to_reduction_method(reduction_string);
+    fspt_reduction *reduction = NULL;
+    if (reduction_method != NO_REDUCTION) {
+        int reduction_dim = option_find_int(options, "reduction_dim",
+                n_features / 4);
+        assert(0 < reduction_dim && reduction_dim <= n_features);
+        unsigned int reduction_seed =
+            option_find_int_quiet(options, "reduction_seed", 0);
+        size_t reduction_max_samples =
+            option_find_int_quiet(options, "reduction_max_samples", 20000);
+        reduction = make_fspt_reduction(reduction_method, n_features,
+                reduction_dim, reduction_seed, reduction_max_samples,
+                feature_limit, feature_importance);
+        n_features = reduction_dim;
+    } else if (strcmp(reduction_string, "none") != 0) {
+        fprintf(stderr, "Unknown reduction %s, no reduction used.\n",
+                reduction_string);
+    }
     /* criterion */
     char *criterion_string = option_find_str(options, "criterion", "gini");
     criterion_func criterion = string_to_fspt_criterion(criterion_string);
@@ -878,6 +905,7 @@ layer parse_fspt(list *options, size_params params)
             "uniformity_test_level", 0);
     c_args.unf_alpha = option_find_float_quiet(options,
             "uniformity_alpha", .05);
+    c_args.seed = option_find_int_quiet(options, "fspt_seed", 0);
     /* score args */
     score_args s_args = {0};
     s_args.score_function = string_to_score_function_number(score_string);
@@ -918,16 +946,54 @@ layer parse_fspt(list *options, size_params params)
         option_find_float_quiet(options, "auto_calibration_score", 0.8);
     assert(0. <= s_args.auto_calibration_score
             && s_args.auto_calibration_score < 1.);
+    s_args.n_threads = option_find_int_quiet(options, "score_threads", 4);
+    assert(1 <= s_args.n_threads);
 
     /* build the layer */
     layer fspt_layer = make_fspt_layer(n, input_layers, yolo_layer_idx,
             net, feature_limit, feature_importance,
-            criterion, score, params.batch, c_args, s_args, activation);
+            criterion, score, params.batch, c_args, s_args, activation,
+            reduction);
     fspt_layer.projection = params.projection;
     fspt_layer.prod_strides = params.prod_strides;
     /* samples */
     fspt_layer.load_samples = option_find_int_quiet(options, "load_samples",1);
     fspt_layer.save_samples = option_find_int_quiet(options, "save_samples",1);
+    /* simplification */
+    fspt_layer.fspt_simplify_thresh =
+        option_find_float_quiet(options, "simplify_thresh", -1.);
+    fspt_layer.fspt_simplify_tolerance =
+        option_find_float_quiet(options, "simplify_tolerance", 0.);
+    assert(0. <= fspt_layer.fspt_simplify_tolerance);
+    /* sampling */
+    char *sampling_string = option_find_str_quiet(options, "sampling", "all");
+    if (strcmp(sampling_string, "reservoir") == 0) {
+        fspt_layer.fspt_sampling = FSPT_SAMPLING_RESERVOIR;
+    } else if (strcmp(sampling_string, "stratified") == 0) {
+        fspt_layer.fspt_sampling = FSPT_SAMPLING_STRATIFIED;
+    } else {
+        if (strcmp(sampling_string, "all") != 0)
+            fprintf(stderr, "Unknown sampling %s, all samples kept.\n",
+                    sampling_string);
+        fspt_layer.fspt_sampling = FSPT_SAMPLING_ALL;
+    }
+    int max_samples_per_class =
+        option_find_int_quiet(options, "max_samples_per_class", 0);
+    assert(0 <= max_samples_per_class);
+    fspt_layer.fspt_max_samples = max_samples_per_class;
+    /* inference only */
+    fspt_layer.fspt_compact = option_find_int_quiet(options, "compact", 0);
+    fspt_layer.fspt_compact_bounds =
+        option_find_int_quiet(options, "compact_bounds", 0);
+    /* ensemble */
+    int ensemble_size = option_find_int_quiet(options, "ensemble_size", 1);
+    assert(1 <= ensemble_size);
+    int ensemble_bootstrap =
+        option_find_int_quiet(options, "ensemble_bootstrap", 0);
+    char *aggregation_string =
+        option_find_str_quiet(options, "ensemble_aggregation", "mean");
+    fspt_layer_make_ensemble(&fspt_layer, ensemble_size, ensemble_bootstrap,
+            string_to_ensemble_aggregation(aggregation_string));
     return fspt_layer;
 }
 
@@ -1200,9 +1266,80 @@ network *parse_network_cfg(char *filename)
         net->workspace = calloc(1, workspace_size);
 #endif
     }
+    if(network_profile_prefix) profile_network(net);
+    if(network_replicas > 1) replicate_network(net, network_replicas);
     return net;
 }
 
+network *parse_network_view_cfg(network *base, char *filename)
+{
+    list *sections = read_cfg(filename);
+    node *n = sections->front;
+    if(!n) error("Config file has no sections");
+    section *s = (section *)n->val;
+    if(!is_network(s)) error("First section must be [net] or [network]");
+    int same = sections->size - 1 == base->n
+        && option_find_int_quiet(s->options, "width", 0) == base->w
+        && option_find_int_quiet(s->options, "height", 0) == base->h;
+    free_section(s);
+    n = n->next;
+    int count = 0;
+    for(node *m = n; m && same; m = m->next, ++count){
+        s = (section *)m->val;
+        same = string_to_layer_type(s->type) == base->layers[count].type;
+    }
+    if(!same){
+        for(; n; n = n->next) free_section((section *)n->val);
+        free_list(sections);
+        return 0;
+    }
+
+    network *view = calloc(1, sizeof(network));
+    *view = *base;
+    view->layers = calloc(base->n, sizeof(layer));
+    memcpy(view->layers, base->layers, base->n*sizeof(layer));
+    view->arena = 0;
+    view->profile = 0;
+    view->replicas = 0;
+    view->weights_map = 0;
+    view->weights_map_size = 0;
+
+    size_params params = {0};
+    params.batch = base->batch;
+    params.time_steps = base->time_steps;
+    params.net = view;
+    labels = make_list();
+    count = 0;
+    while(n){
+        s = (section *)n->val;
+        layer l = view->layers[count];
+        if(l.type == FSPT){
+            layer prev = view->layers[count - 1];
+            params.index = count;
+            params.h = prev.out_h;
+            params.w = prev.out_w;
+            params.c = prev.out_c;
+            params.inputs = prev.outputs;
+            params.projection = prev.projection;
+            params.prod_strides = prev.prod_strides;
+            fprintf(stderr, "%5d ", count);
+            l = parse_fspt(s->options, params);
+            l.ref = copy_string(option_find_str_quiet(s->options, "ref", view->layers[count].ref));
+            l.dontsave = option_find_int_quiet(s->options, "dontsave", 0);
+            l.dontload = option_find_int_quiet(s->options, "dontload", 0);
+            view->layers[count] = l;
+        }
+        list_insert(labels, copy_string(l.ref));
+        free_section(s);
+        n = n->next;
+        ++count;
+    }
+    free_list(sections);
+    free_list_contents(labels);
+    free_list(labels);
+    return view;
+}
+
 list *read_cfg(char *filename)
 {
     FILE *file = fopen(filename, "r");
@@ -1283,7 +1420,8 @@ void save_convolutional_weights(layer l, FILE *fp)
 #endif
     int num = l.nweights;
     fwrite(l.biases, sizeof(float), l.n, fp);
-    if (l.batch_normalize){
+    /* rolling_mean stays allocated on fused layers, keep the cfg layout */
+    if (l.batch_normalize || l.rolling_mean){
         fwrite(l.scales, sizeof(float), l.n, fp);
         fwrite(l.rolling_mean, sizeof(float), l.n, fp);
         fwrite(l.rolling_variance, sizeof(float), l.n, fp);
@@ -1312,7 +1450,7 @@ void save_connected_weights(layer l, FILE *fp)
 #endif
     fwrite(l.biases, sizeof(float), l.outputs, fp);
     fwrite(l.weights, sizeof(float), l.outputs*l.inputs, fp);
-    if (l.batch_normalize){
+    if (l.batch_normalize || l.rolling_mean){
         fwrite(l.scales, sizeof(float), l.outputs, fp);
         fwrite(l.rolling_mean, sizeof(float), l.outputs, fp);
         fwrite(l.rolling_variance, sizeof(float), l.outputs, fp);
@@ -1392,6 +1530,7 @@ void save_weights_upto(network *net, char *filename, int cutoff)
             save_fspt_trees(l, fp);
         }
     }
+    if(cutoff >= net->n) save_int8_weights(net, fp);
     fclose(fp);
 }
 void save_weights(network *net, char *filename)
@@ -1523,6 +1662,7 @@ void load_convolutional_weights(layer l, FILE *fp)
     if (l.flipped) {
         transpose_matrix(l.weights, l.c*l.size*l.size, l.n);
     }
+    transform_convolutional_weights(l);
     //if (l.binary) binarize_weights(l.weights, l.n, l.c*l.size*l.size, l.weights);
 #ifdef GPU
     if(gpu_index >= 0){
@@ -1532,6 +1672,92 @@ void load_convolutional_weights(layer l, FILE *fp)
 }
 
 
+/* Number of floats of l in a weights file, as read by the load functions.
+ * Fused layers keep their rolling_mean and the batchnorm of their cfg. */
+static size_t convolutional_weights_count(layer l)
+{
+    int n = l.numload ? l.numload : l.n;
+    size_t count = n + (size_t)l.c/l.groups*n*l.size*l.size;
+    if((l.batch_normalize || l.rolling_mean) && !l.dontloadscales) count += 3*n;
+    return count;
+}
+
+static size_t connected_weights_count(layer l)
+{
+    size_t count = l.outputs + (size_t)l.outputs*l.inputs;
+    if((l.batch_normalize || l.rolling_mean) && !l.dontloadscales) count += 3*l.outputs;
+    return count;
+}
+
+static size_t layer_weights_count(layer l)
+{
+    switch(l.type){
+        case CONVOLUTIONAL:
+        case DECONVOLUTIONAL:
+            return convolutional_weights_count(l);
+        case CONNECTED:
+            return connected_weights_count(l);
+        case BATCHNORM:
+            return 3*(size_t)l.c;
+        case CRNN:
+            return convolutional_weights_count(*l.input_layer)
+                + convolutional_weights_count(*l.self_layer)
+                + convolutional_weights_count(*l.output_layer);
+        case RNN:
+            return connected_weights_count(*l.input_layer)
+                + connected_weights_count(*l.self_layer)
+                + connected_weights_count(*l.output_layer);
+        case LSTM:
+            return connected_weights_count(*l.wi) + connected_weights_count(*l.wf)
+                + connected_weights_count(*l.wo) + connected_weights_count(*l.wg)
+                + connected_weights_count(*l.ui) + connected_weights_count(*l.uf)
+                + connected_weights_count(*l.uo) + connected_weights_count(*l.ug);
+        case GRU:
+            return connected_weights_count(*l.wz) + connected_weights_count(*l.wr)
+                + connected_weights_count(*l.wh) + connected_weights_count(*l.uz)
+                + connected_weights_count(*l.ur) + connected_weights_count(*l.uh);
+        case LOCAL:
+            return l.outputs + (size_t)l.size*l.size*l.c*l.n*l.out_w*l.out_h;
+        default:
+            return 0;
+    }
+}
+
+void load_fspt_weights(network *net, char *filename)
+{
+    fprintf(stderr, "Loading fspt trees from %s...", filename);
+    FILE *fp = fopen(filename, "rb");
+    if(!fp) file_error(filename);
+    int major = 0;
+    int minor = 0;
+    int revision = 0;
+    fread(&major, sizeof(int), 1, fp);
+    if(major == MAPPED_WEIGHTS_MAGIC){
+        fclose(fp);
+        load_mapped_fspt_trees(net, filename);
+        fprintf(stderr, "Done!\n");
+        return;
+    }
+    fread(&minor, sizeof(int), 1, fp);
+    fread(&revision, sizeof(int), 1, fp);
+    long seen_size = ((major*10 + minor) >= 2 && major < 1000 && minor < 1000) ?
+        sizeof(size_t) : sizeof(int);
+    if(fseek(fp, seen_size, SEEK_CUR)) file_error(filename);
+
+    int i;
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        if(l.dontload) continue;
+        if(l.type == FSPT){
+            load_fspt_trees(l, fp);
+        } else if(fseek(fp, layer_weights_count(l)*sizeof(float), SEEK_CUR)){
+            file_error(filename);
+        }
+    }
+    fprintf(stderr, "Done!\n");
+    fclose(fp);
+}
+
 void load_weights_upto(network *net, char *filename, int start, int cutoff)
 {
 #ifdef GPU
@@ -1548,6 +1774,13 @@ void load_weights_upto(network *net, char *filename, int start, int cutoff)
     int minor;
     int revision;
     fread(&major, sizeof(int), 1, fp);
+    if(major == MAPPED_WEIGHTS_MAGIC){
+        fclose(fp);
+        if(start != 0 || cutoff < net->n) error("Mapped weights are loaded whole");
+        load_mapped_weights(net, filename);
+        fprintf(stderr, "Done!\n");
+        return;
+    }
     fread(&minor, sizeof(int), 1, fp);
     fread(&revision, sizeof(int), 1, fp);
     if ((major*10 + minor) >= 2 && major < 1000 && minor < 1000){
@@ -1621,6 +1854,7 @@ void load_weights_upto(network *net, char *filename, int start, int cutoff)
             load_fspt_trees(l, fp);
         }
     }
+    if(start == 0 && cutoff >= net->n) load_int8_weights(net, fp);
     fprintf(stderr, "Done!\n");
     fclose(fp);
 }
@@ -0,0 +1,336 @@
+#include "profiler.h"
+#include "network.h"
+#include "utils.h"
+#include "cuda.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Per layer profiler of forward_network and backward_network. Each layer
+ * call is timed (after a device synchronization on the gpu) and its flops
+ * and bytes are estimated from the layer shape, so the table shows where
+ * the time goes and how far each layer is from the machine throughput.
+ */
+
+char *network_profile_prefix = 0;
+
+/* profiles of the networks enabled with network_profile_prefix, saved when
+ * the network is freed or at exit */
+typedef struct profile_entry {
+    struct network_profile *profile;
+    int id;
+    struct profile_entry *next;
+} profile_entry;
+
+static profile_entry *profile_entries = 0;
+static int profile_ids = 0;
+
+static void save_profile(struct network_profile *p, char *prefix, int id);
+static void print_profile(struct network_profile *p, FILE *stream);
+
+static void save_profiles_at_exit()
+{
+    while(profile_entries){
+        profile_entry *e = profile_entries;
+        profile_entries = e->next;
+        print_profile(e->profile, stderr);
+        save_profile(e->profile, network_profile_prefix, e->id);
+        free(e);
+    }
+}
+
+static double profile_clock()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec*1e-9;
+}
+
+double profile_time(network *net)
+{
+#ifdef GPU
+    if(net->gpu_index >= 0) cudaDeviceSynchronize();
+#endif
+    return profile_clock();
+}
+
+void profile_network(network *net)
+{
+    if(net->profile) return;
+    struct network_profile *p = calloc(1, sizeof(struct network_profile));
+    p->n = net->n;
+    p->layers = calloc(net->n, sizeof(layer_profile));
+    p->origin = profile_clock();
+    int i;
+    for(i = 0; i < net->n; ++i){
+        p->layers[i].type = net->layers[i].type;
+    }
+    net->profile = p;
+    if(network_profile_prefix){
+        if(!profile_entries && !profile_ids) atexit(save_profiles_at_exit);
+        profile_entry *e = calloc(1, sizeof(profile_entry));
+        e->profile = p;
+        e->id = profile_ids++;
+        e->next = profile_entries;
+        profile_entries = e;
+    }
+}
+
+struct network_profile *make_replica_profile(struct network_profile *base)
+{
+    struct network_profile *p = calloc(1, sizeof(struct network_profile));
+    p->n = base->n;
+    p->layers = calloc(base->n, sizeof(layer_profile));
+    p->origin = base->origin;
+    int i;
+    for(i = 0; i < base->n; ++i){
+        p->layers[i].type = base->layers[i].type;
+    }
+    return p;
+}
+
+void free_replica_profile(struct network_profile *p)
+{
+    if(!p) return;
+    free(p->layers);
+    free(p->events);
+    free(p);
+}
+
+static void add_profile_event(struct network_profile *p, profile_event e)
+{
+    if(p->n_events >= PROFILE_MAX_EVENTS) return;
+    if(p->n_events == p->max_events){
+        p->max_events = p->max_events ? 2*p->max_events : 1024;
+        p->events = realloc(p->events, p->max_events*sizeof(profile_event));
+        if(!p->events) malloc_error();
+    }
+    p->events[p->n_events++] = e;
+}
+
+void merge_replica_profiles(struct network_profile *p,
+        struct network_profile **replicas, int n)
+{
+    int i, r;
+    for(i = 0; i < p->n; ++i){
+        layer_profile *lp = p->layers + i;
+        double forward_time = 0, backward_time = 0;
+        int forward_calls = 0, backward_calls = 0;
+        for(r = 0; r < n; ++r){
+            layer_profile *rp = replicas[r]->layers + i;
+            if(rp->forward_time > forward_time) forward_time = rp->forward_time;
+            if(rp->backward_time > backward_time) backward_time = rp->backward_time;
+            if(rp->forward_calls > forward_calls) forward_calls = rp->forward_calls;
+            if(rp->backward_calls > backward_calls) backward_calls = rp->backward_calls;
+            lp->flops += rp->flops;
+            lp->bytes += rp->bytes;
+            if(rp->forward_calls){
+                lp->out_w = rp->out_w;
+                lp->out_h = rp->out_h;
+                lp->out_c = rp->out_c;
+            }
+        }
+        lp->forward_time += forward_time;
+        lp->backward_time += backward_time;
+        lp->forward_calls += forward_calls;
+        lp->backward_calls += backward_calls;
+    }
+    for(r = 0; r < n; ++r){
+        struct network_profile *rp = replicas[r];
+        for(i = 0; i < rp->n_events; ++i){
+            profile_event e = rp->events[i];
+            e.thread = r;
+            add_profile_event(p, e);
+        }
+        rp->n_events = 0;
+        for(i = 0; i < rp->n; ++i){
+            LAYER_TYPE type = rp->layers[i].type;
+            memset(rp->layers + i, 0, sizeof(layer_profile));
+            rp->layers[i].type = type;
+        }
+    }
+}
+
+static int has_weights(LAYER_TYPE type)
+{
+    return type == CONVOLUTIONAL || type == DECONVOLUTIONAL
+        || type == CONNECTED || type == LOCAL;
+}
+
+double layer_forward_flops(layer l)
+{
+    double out = (double)l.outputs*l.batch;
+    switch(l.type){
+        case CONVOLUTIONAL:
+            return 2.*l.c/l.groups*l.size*l.size*l.n*l.out_h*l.out_w*l.batch + out;
+        case DECONVOLUTIONAL:
+            return 2.*l.c*l.n*l.size*l.size*l.h*l.w*l.batch + out;
+        case CONNECTED:
+            return 2.*l.inputs*l.outputs*l.batch + out;
+        case LOCAL:
+            return 2.*l.size*l.size*l.c*out;
+        case MAXPOOL:
+            return out*l.size*l.size;
+        case AVGPOOL:
+            return (double)l.inputs*l.batch;
+        default:
+            return out;
+    }
+}
+
+double layer_forward_bytes(layer l)
+{
+    double in = (double)l.inputs*l.batch;
+    double out = (double)l.outputs*l.batch;
+    double weights = 0;
+    switch(l.type){
+        case CONVOLUTIONAL:
+            weights = (double)l.c/l.groups*l.n*l.size*l.size + l.n;
+            break;
+        case DECONVOLUTIONAL:
+            weights = (double)l.c*l.n*l.size*l.size + l.n;
+            break;
+        case CONNECTED:
+            weights = (double)l.inputs*l.outputs + l.outputs;
+            break;
+        case LOCAL:
+            weights = (double)l.size*l.size*l.c*l.outputs + l.outputs;
+            break;
+        case ROUTE:
+            in = out;
+            break;
+        case SHORTCUT:
+            in = 2*out;
+            break;
+        default:
+            break;
+    }
+    return sizeof(float)*(in + out + weights);
+}
+
+void profile_layer(network *net, int i, int backward, double start)
+{
+    struct network_profile *p = net->profile;
+    double end = profile_time(net);
+    layer l = net->layers[i];
+    layer_profile *lp = p->layers + i;
+    double scale = (backward && has_weights(l.type)) ? 2 : 1;
+    lp->flops += scale*layer_forward_flops(l);
+    lp->bytes += scale*layer_forward_bytes(l);
+    if(backward){
+        lp->backward_time += end - start;
+        ++lp->backward_calls;
+    } else {
+        lp->forward_time += end - start;
+        ++lp->forward_calls;
+        lp->out_w = l.out_w;
+        lp->out_h = l.out_h;
+        lp->out_c = l.out_c;
+    }
+    profile_event e = {start - p->origin, end - start, i, backward, 0};
+    add_profile_event(p, e);
+}
+
+static double profile_total(struct network_profile *p)
+{
+    int i;
+    double total = 0;
+    for(i = 0; i < p->n; ++i){
+        total += p->layers[i].forward_time + p->layers[i].backward_time;
+    }
+    return total;
+}
+
+static void print_profile(struct network_profile *p, FILE *stream)
+{
+    int i;
+    double total = profile_total(p);
+    int passes = p->n ? p->layers[0].forward_calls : 0;
+    fprintf(stream, "Profile of %d layers, %d forward passes, %.3f s\n", p->n, passes, total);
+    fprintf(stream, "layer type            output         fwd ms    bwd ms   time   GFLOP  GFLOP/s      MB    GB/s\n");
+    for(i = 0; i < p->n; ++i){
+        layer_profile l = p->layers[i];
+        double time = l.forward_time + l.backward_time;
+        int calls = l.forward_calls ? l.forward_calls : 1;
+        fprintf(stream, "%5d %-13.13s %4d x%4d x%4d %9.3f %9.3f %5.1f%% %7.3f %8.2f %7.2f %7.2f\n",
+                i, get_layer_string(l.type), l.out_w, l.out_h, l.out_c,
+                l.forward_calls ? 1e3*l.forward_time/l.forward_calls : 0,
+                l.backward_calls ? 1e3*l.backward_time/l.backward_calls : 0,
+                total ? 100*time/total : 0, l.flops/calls/1e9,
+                time ? l.flops/time/1e9 : 0, l.bytes/calls/1e6,
+                time ? l.bytes/time/1e9 : 0);
+    }
+}
+
+static void save_profile(struct network_profile *p, char *prefix, int id)
+{
+    int i;
+    char base[1024];
+    char buff[1100];
+    if(id) snprintf(base, sizeof(base), "%s.%d", prefix, id);
+    else snprintf(base, sizeof(base), "%s", prefix);
+    snprintf(buff, sizeof(buff), "%s.json", base);
+    FILE *fp = fopen(buff, "w");
+    if(!fp) file_error(buff);
+    fprintf(fp, "{\"total_s\" : %g, \"layers\" : [\n", profile_total(p));
+    for(i = 0; i < p->n; ++i){
+        layer_profile l = p->layers[i];
+        double time = l.forward_time + l.backward_time;
+        fprintf(fp, "{\"index\" : %d, \"type\" : \"%s\", \"output\" : [%d, %d, %d], \
+\"forward_calls\" : %d, \"forward_s\" : %g, \"backward_calls\" : %d, \
+\"backward_s\" : %g, \"flops\" : %g, \"bytes\" : %g, \"gflops_per_s\" : %g, \
+\"gbytes_per_s\" : %g}%s\n", i, get_layer_string(l.type), l.out_w, l.out_h,
+                l.out_c, l.forward_calls, l.forward_time, l.backward_calls,
+                l.backward_time, l.flops, l.bytes, time ? l.flops/time/1e9 : 0,
+                time ? l.bytes/time/1e9 : 0, i + 1 < p->n ? "," : "");
+    }
+    fprintf(fp, "]}\n");
+    fclose(fp);
+
+    snprintf(buff, sizeof(buff), "%s.trace.json", base);
+    fp = fopen(buff, "w");
+    if(!fp) file_error(buff);
+    fprintf(fp, "{\"traceEvents\" : [\n");
+    for(i = 0; i < p->n_events; ++i){
+        profile_event e = p->events[i];
+        fprintf(fp, "{\"name\" : \"%d %s\", \"cat\" : \"%s\", \"ph\" : \"X\", \
+\"ts\" : %.3f, \"dur\" : %.3f, \"pid\" : 0, \"tid\" : %d}%s\n", e.layer,
+                get_layer_string(p->layers[e.layer].type),
+                e.backward ? "backward" : "forward", 1e6*e.start,
+                1e6*e.duration, e.thread, i + 1 < p->n_events ? "," : "");
+    }
+    fprintf(fp, "]}\n");
+    fclose(fp);
+    fprintf(stderr, "Profile saved in %s.json and %s.trace.json\n", base, base);
+}
+
+void print_network_profile(network *net, FILE *stream)
+{
+    if(net->profile) print_profile(net->profile, stream);
+}
+
+void save_network_profile(network *net, char *prefix)
+{
+    if(net->profile) save_profile(net->profile, prefix, 0);
+}
+
+void free_network_profile(network *net)
+{
+    struct network_profile *p = net->profile;
+    if(!p) return;
+    profile_entry **e = &profile_entries;
+    while(*e && (*e)->profile != p) e = &(*e)->next;
+    if(*e){
+        profile_entry *found = *e;
+        *e = found->next;
+        print_profile(p, stderr);
+        save_profile(p, network_profile_prefix, found->id);
+        free(found);
+    }
+    free(p->layers);
+    free(p->events);
+    free(p);
+    net->profile = 0;
+}
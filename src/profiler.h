@@ -0,0 +1,63 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdio.h>
+
+#include "darknet.h"
+
+/* Trace events kept for the chrome trace, the table keeps aggregating. */
+#define PROFILE_MAX_EVENTS 200000
+
+typedef struct {
+    LAYER_TYPE type;
+    double forward_time;    // seconds, summed over the calls.
+    double backward_time;
+    int forward_calls;
+    int backward_calls;
+    double flops;           // estimated, summed over forward and backward.
+    double bytes;           // estimated bytes read and written, summed.
+    int out_w, out_h, out_c;
+} layer_profile;
+
+typedef struct {
+    double start;           // seconds since the profile was enabled.
+    double duration;
+    int layer;
+    int backward;
+    int thread;             // replica running the layer, 0 without replicas.
+} profile_event;
+
+struct network_profile {
+    layer_profile *layers;
+    int n;
+    profile_event *events;
+    int n_events;
+    int max_events;
+    double origin;
+};
+
+/* Time for profile_layer, after waiting for the gpu when the network runs
+ * on it. */
+double profile_time(network *net);
+
+/* Accounts the forward or backward of layer i started at start. */
+void profile_layer(network *net, int i, int backward, double start);
+
+/* Profile of a replica of the network profiled by base, with the same
+ * origin. */
+struct network_profile *make_replica_profile(struct network_profile *base);
+void free_replica_profile(struct network_profile *p);
+
+/* Adds one forward of the n replicas to p and clears the replica profiles.
+ * The replicas run concurrently : a layer takes the longest time among the
+ * replicas, its flops and bytes are summed and its events keep the replica
+ * index as thread. */
+void merge_replica_profiles(struct network_profile *p,
+        struct network_profile **replicas, int n);
+
+/* Estimated flops and bytes read and written by one forward of l. The
+ * backward of layers with weights is counted twice the forward. */
+double layer_forward_flops(layer l);
+double layer_forward_bytes(layer l);
+
+#endif
@@ -0,0 +1,194 @@
+#include "quantize.h"
+#include "gemm_int8.h"
+#include "image.h"
+#include "utils.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Post-training int8 quantization.
+ *
+ * Weights get one symmetric scale per output channel, max|w|/127. The input
+ * of each quantized layer gets one symmetric scale, max|x|/127 over the
+ * calibration images, inputs beyond being clipped. Layers still output
+ * floats : the int32 accumulators are requantized in the gemm epilogue,
+ * with the bias and the activation, and the next quantized layer quantizes
+ * its input while reading it. Routes, shortcuts and the detection layers
+ * are unchanged.
+ */
+
+#define INT8_SECTION_MAGIC 0x38544e49 /* "INT8" */
+#define INT8_SECTION_VERSION 1
+
+int quantize_supported(layer l)
+{
+    if(l.type == CONVOLUTIONAL){
+        return l.groups == 1 && !l.binary && !l.xnor && l.weights;
+    }
+    return l.type == CONNECTED && l.weights;
+}
+
+/* rows x cols of the weight matrix of l */
+static void quantize_shape(layer l, int *rows, int *cols)
+{
+    if(l.type == CONVOLUTIONAL){
+        *rows = l.n;
+        *cols = l.c*l.size*l.size;
+    } else {
+        *rows = l.outputs;
+        *cols = l.inputs;
+    }
+}
+
+void free_layer_int8(layer *l)
+{
+    free(l->qweights);
+    free(l->qweight_scales);
+    free(l->qpacked);
+    free(l->qinput);
+    l->qweights = 0;
+    l->qweight_scales = 0;
+    l->qpacked = 0;
+    l->qinput = 0;
+    l->qinput_scale = 0;
+}
+
+/* Takes ownership of weights and scales. */
+static void set_layer_int8(layer *l, signed char *weights, float *scales, float input_scale)
+{
+    int rows, cols;
+    quantize_shape(*l, &rows, &cols);
+    free_layer_int8(l);
+    l->qweights = weights;
+    l->qweight_scales = scales;
+    l->qinput_scale = input_scale;
+    l->qpacked = qgemm_pack_weights(weights, rows, cols);
+    l->qinput = calloc((size_t)l->inputs*l->batch, 1);
+    if(!l->qinput) malloc_error();
+}
+
+void quantize_layer(layer *l, float input_scale)
+{
+    int rows, cols, i, j;
+    if(l->batch_normalize) error("quantize_layer: fuse batchnorm first");
+    quantize_shape(*l, &rows, &cols);
+    signed char *weights = calloc((size_t)rows*cols, 1);
+    float *scales = calloc(rows, sizeof(float));
+    for(i = 0; i < rows; ++i){
+        const float *w = l->weights + (size_t)i*cols;
+        float max = 0;
+        for(j = 0; j < cols; ++j) if(fabsf(w[j]) > max) max = fabsf(w[j]);
+        scales[i] = max ? max/127 : 1;
+        for(j = 0; j < cols; ++j) weights[(size_t)i*cols + j] = (signed char)lrintf(w[j]/scales[i]);
+    }
+    set_layer_int8(l, weights, scales, input_scale ? input_scale : 1.f/127);
+}
+
+/* forward_network recording max|input| of the layers to quantize */
+static void calibrate_network(network *net, float *input, float *absmax)
+{
+    network n = *net;
+    int i, j;
+    n.input = input;
+    n.truth = 0;
+    n.train = 0;
+    n.train_fspt = 0;
+    n.delta = 0;
+    for(i = 0; i < n.n; ++i){
+        n.index = i;
+        layer l = n.layers[i];
+        if(quantize_supported(l)){
+            for(j = 0; j < l.inputs*l.batch; ++j){
+                if(fabsf(n.input[j]) > absmax[i]) absmax[i] = fabsf(n.input[j]);
+            }
+        }
+        l.forward(l, n);
+        n.input = l.output;
+        if(l.truth) n.truth = l.output;
+    }
+}
+
+void quantize_network(network *net, char **paths, int n)
+{
+    int i, j;
+    if(net->gpu_index >= 0) error("quantize_network: int8 inference runs on the cpu");
+    fuse_network(net);
+    for(i = 0; i < net->n; ++i) free_layer_int8(net->layers + i);
+    float *absmax = calloc(net->n, sizeof(float));
+    float *input = calloc((size_t)net->inputs*net->batch, sizeof(float));
+    for(i = 0; i < n; ++i){
+        image im = load_image_color(paths[i], 0, 0);
+        image sized = letterbox_image(im, net->w, net->h);
+        for(j = 0; j < net->batch; ++j){
+            memcpy(input + (size_t)j*net->inputs, sized.data, net->inputs*sizeof(float));
+        }
+        calibrate_network(net, input, absmax);
+        free_image(im);
+        free_image(sized);
+        if((i + 1) % 100 == 0) fprintf(stderr, "Calibration: %d/%d images\n", i + 1, n);
+    }
+    int quantized = 0;
+    for(i = 0; i < net->n; ++i){
+        layer *l = net->layers + i;
+        if(!quantize_supported(*l)) continue;
+        quantize_layer(l, absmax[i]/127);
+        ++quantized;
+    }
+    fprintf(stderr, "Quantized %d layers to int8 on %d images, %s kernel\n",
+            quantized, n, qgemm_kernel_name());
+    free(absmax);
+    free(input);
+}
+
+void save_int8_weights(network *net, FILE *fp)
+{
+    int i;
+    int count = 0;
+    for(i = 0; i < net->n; ++i) if(net->layers[i].qpacked) ++count;
+    if(!count) return;
+    int header[3] = {INT8_SECTION_MAGIC, INT8_SECTION_VERSION, count};
+    fwrite(header, sizeof(int), 3, fp);
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        if(!l.qpacked) continue;
+        int rows, cols;
+        quantize_shape(l, &rows, &cols);
+        int shape[3] = {i, rows, cols};
+        fwrite(shape, sizeof(int), 3, fp);
+        fwrite(&l.qinput_scale, sizeof(float), 1, fp);
+        fwrite(l.qweight_scales, sizeof(float), rows, fp);
+        fwrite(l.qweights, 1, (size_t)rows*cols, fp);
+    }
+}
+
+void load_int8_weights(network *net, FILE *fp)
+{
+    int header[3];
+    int i;
+    if(fread(header, sizeof(int), 3, fp) != 3 || header[0] != INT8_SECTION_MAGIC) return;
+    if(header[1] != INT8_SECTION_VERSION) error("Unknown int8 weights version");
+    if(net->gpu_index >= 0){
+        fprintf(stderr, "int8 weights ignored on the gpu\n");
+        return;
+    }
+    for(i = 0; i < header[2]; ++i){
+        int shape[3], rows, cols;
+        float input_scale;
+        if(fread(shape, sizeof(int), 3, fp) != 3) error("Truncated int8 weights");
+        if(shape[0] < 0 || shape[0] >= net->n) error("Bad int8 weights layer");
+        layer *l = net->layers + shape[0];
+        if(!quantize_supported(*l)) error("int8 weights for a layer without int8 path");
+        quantize_shape(*l, &rows, &cols);
+        if(shape[1] != rows || shape[2] != cols) error("int8 weights don't match the network");
+        signed char *weights = calloc((size_t)rows*cols, 1);
+        float *scales = calloc(rows, sizeof(float));
+        size_t n = fread(&input_scale, sizeof(float), 1, fp);
+        n += fread(scales, sizeof(float), rows, fp);
+        n += fread(weights, 1, (size_t)rows*cols, fp);
+        if(n != 1 + rows + (size_t)rows*cols) error("Truncated int8 weights");
+        set_layer_int8(l, weights, scales, input_scale);
+    }
+    fprintf(stderr, "int8 (%d layers, %s kernel)...", header[2], qgemm_kernel_name());
+}
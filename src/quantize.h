@@ -0,0 +1,25 @@
+#ifndef QUANTIZE_H
+#define QUANTIZE_H
+
+#include <stdio.h>
+
+#include "darknet.h"
+
+/* Returns 1 if l has an int8 path : convolutions without groups nor binary
+ * weights, and connected layers. */
+int quantize_supported(layer l);
+
+/* Quantizes the weights of l per output channel, for inputs quantized with
+ * input_scale, and allocates its int8 buffers. Batchnorm must be fused. */
+void quantize_layer(layer *l, float input_scale);
+
+/* Drops the int8 state of l, which runs in float again. */
+void free_layer_int8(layer *l);
+
+/* Optional section of the weights file after the float weights, holding the
+ * scales and int8 weights of the quantized layers. load_int8_weights leaves
+ * the network in float when the section is missing. */
+void save_int8_weights(network *net, FILE *fp);
+void load_int8_weights(network *net, FILE *fp);
+
+#endif
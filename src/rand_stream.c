@@ -0,0 +1,79 @@
+#include "rand_stream.h"
+
+/* xoshiro256** by David Blackman and Sebastiano Vigna (public domain),
+ * seeded with splitmix64. */
+
+static uint64_t global_seed = 0x5eed5eed5eed5eedULL;
+static uint64_t next_stream_id = 1;
+
+static __thread rand_stream thread_stream;
+static __thread int thread_stream_seeded = 0;
+
+static uint64_t splitmix64(uint64_t *x) {
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static inline uint64_t rotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+void rand_stream_seed(rand_stream *r, uint64_t seed, uint64_t stream_id) {
+    uint64_t x = seed ^ splitmix64(&stream_id);
+    for (int i = 0; i < 4; ++i) r->s[i] = splitmix64(&x);
+}
+
+uint64_t rand_stream_next(rand_stream *r) {
+    uint64_t *s = r->s;
+    uint64_t result = rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+    return result;
+}
+
+uint32_t rand_stream_uint(rand_stream *r, uint32_t n) {
+    /* Lemire's multiply and reject. */
+    uint64_t m = (uint64_t) (uint32_t) (rand_stream_next(r) >> 32) * n;
+    uint32_t low = (uint32_t) m;
+    if (low < n) {
+        uint32_t thresh = -n % n;
+        while (low < thresh) {
+            m = (uint64_t) (uint32_t) (rand_stream_next(r) >> 32) * n;
+            low = (uint32_t) m;
+        }
+    }
+    return m >> 32;
+}
+
+double rand_stream_double(rand_stream *r) {
+    return (rand_stream_next(r) >> 11) * 0x1.0p-53;
+}
+
+rand_stream *thread_rand_stream(void) {
+    if (!thread_stream_seeded) {
+        uint64_t id = __atomic_fetch_add(&next_stream_id, 1, __ATOMIC_RELAXED);
+        rand_stream_seed(&thread_stream,
+                __atomic_load_n(&global_seed, __ATOMIC_RELAXED), id);
+        thread_stream_seeded = 1;
+    }
+    return &thread_stream;
+}
+
+void thread_rand_stream_seed(uint64_t seed) {
+    rand_stream_seed(&thread_stream, seed, 0);
+    thread_stream_seeded = 1;
+}
+
+void set_rand_stream_global_seed(uint64_t seed) {
+    __atomic_store_n(&global_seed, seed, __ATOMIC_RELAXED);
+    /* the calling thread takes the stream id 0 */
+    __atomic_store_n(&next_stream_id, 1, __ATOMIC_RELAXED);
+    thread_rand_stream_seed(seed);
+}
@@ -0,0 +1,76 @@
+#ifndef RAND_STREAM_H
+#define RAND_STREAM_H
+
+#include <stdint.h>
+
+/**
+ * State of a xoshiro256** pseudo random generator. Not shared : each
+ * thread or worker owns its stream so drawing numbers takes no lock and
+ * the sequence only depends on the seed of the stream.
+ */
+typedef struct rand_stream {
+    uint64_t s[4];
+} rand_stream;
+
+/**
+ * Seeds a stream. Streams seeded with the same seed and different stream
+ * ids are independent.
+ *
+ * \param r The stream.
+ * \param seed The seed.
+ * \param stream_id The id of the stream (worker, tree...).
+ */
+extern void rand_stream_seed(rand_stream *r, uint64_t seed,
+        uint64_t stream_id);
+
+/**
+ * \param r The stream.
+ * \return The next 64 random bits of the stream.
+ */
+extern uint64_t rand_stream_next(rand_stream *r);
+
+/**
+ * Draws an integer uniformly in [0, n) without modulo bias.
+ *
+ * \param r The stream.
+ * \param n The upper bound (excluded). n > 0.
+ * \return The integer.
+ */
+extern uint32_t rand_stream_uint(rand_stream *r, uint32_t n);
+
+/**
+ * Draws a double uniformly in [0, 1).
+ *
+ * \param r The stream.
+ * \return The double.
+ */
+extern double rand_stream_double(rand_stream *r);
+
+/**
+ * Gives the stream of the calling thread. The first call of each thread
+ * seeds its stream with the global seed and a fresh stream id, unless
+ * the thread called thread_rand_stream_seed before.
+ *
+ * \return The stream of the calling thread.
+ */
+extern rand_stream *thread_rand_stream(void);
+
+/**
+ * Seeds the stream of the calling thread. Used by workers that receive
+ * their seed from the thread that spawned them, so that their sequence
+ * doesn't depend on the scheduling.
+ *
+ * \param seed The seed.
+ */
+extern void thread_rand_stream_seed(uint64_t seed);
+
+/**
+ * Sets the global seed used by the threads that don't seed their stream
+ * explicitly and reseeds the stream of the calling thread, which takes the
+ * stream id 0. The other threads take the next ids.
+ *
+ * \param seed The seed.
+ */
+extern void set_rand_stream_global_seed(uint64_t seed);
+
+#endif /* RAND_STREAM_H */
@@ -0,0 +1,344 @@
+#include "replicas.h"
+#include "fspt_layer.h"
+#include "fspt_reduction.h"
+#include "gemm.h"
+#include "memory_plan.h"
+#include "network.h"
+#include "profiler.h"
+#include "utils.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Cpu data parallelism. forward_network splits the batch of the network
+ * between replicas run by one thread each. The layers of a replica are
+ * copies of the layers of the base network, refreshed before each forward,
+ * so they share the weights, the fspts and everything else the forward only
+ * reads. Each replica has its own batch, workspace and costs, and :
+ *  - without memory plan, its slice of the per image buffers of the base
+ *    network (outputs, deltas, indexes...), so the base outputs are complete
+ *    after the forward without any copy.
+ *  - with a memory plan, its own outputs since the arena reuses the memory
+ *    of dead outputs while other replicas may still read it. The outputs
+ *    read after forward_network are then copied to the base network.
+ * The fspt layers of a replica keep all the samples they extract. They are
+ * moved to the base layers after the forward, through their sampling. Their
+ * reduction shares the fitted projection of the base layer but has its own
+ * workspace. A profiled base network gets the profiles of the replicas
+ * merged after each forward.
+ */
+
+int network_replicas = 0;
+
+typedef struct {
+    network net;
+    int offset;             // first image in the batch of the base network.
+    layer *own;             // buffers owned by the replica, per layer.
+    size_t *own_outputs;    // floats allocated in own[i].output.
+    float *costs;           // per layer.
+    float cost;
+    size_t workspace_size;  // bytes.
+    struct network_profile *profile;    // when the base network is profiled.
+} network_replica;
+
+struct network_replicas {
+    int n;                  // replicas requested.
+    int batch;              // of the base network when the replicas were made.
+    float *arena;           // of the base network when the replicas were made.
+    int supported;
+    int active;             // replicas running, min(n, batch).
+    int *kept;              // outputs copied to a planned base network.
+    network_replica *replicas;
+};
+
+static int replica_supported(layer l)
+{
+    switch(l.type){
+        case CONVOLUTIONAL:
+            return !l.binary && !l.xnor;
+        case CONNECTED:
+        case MAXPOOL:
+        case AVGPOOL:
+        case SOFTMAX:
+        case DETECTION:
+        case DROPOUT:
+        case ROUTE:
+        case COST:
+        case NORMALIZATION:
+        case SHORTCUT:
+        case ACTIVE:
+        case BATCHNORM:
+        case REGION:
+        case YOLO:
+        case REORG:
+        case UPSAMPLE:
+        case FSPT:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static void make_own_fspt(layer *own, layer l)
+{
+    own->fspt_input = calloc(l.total, sizeof(float));
+    own->fspt_training_data = calloc(l.classes, sizeof(float *));
+    own->fspt_training_strata = calloc(l.classes, sizeof(int *));
+    own->fspt_n_training_data = calloc(l.classes, sizeof(size_t));
+    own->fspt_n_max_training_data = calloc(l.classes, sizeof(size_t));
+    own->fspt_n_seen_data = calloc(l.classes, sizeof(size_t));
+    own->fspt_stratum_seen = calloc(l.classes*l.n, sizeof(size_t));
+    own->fspt_stratum_kept = calloc(l.classes*l.n, sizeof(size_t));
+    if(l.fspt_reduction){
+        own->fspt_reduction = calloc(1, sizeof(fspt_reduction));
+        own->fspt_reduction->workspace = calloc(l.fspt_reduction->n_inputs, sizeof(float));
+    }
+}
+
+static void free_own_fspt(layer own, int classes)
+{
+    int k;
+    for(k = 0; own.fspt_training_data && k < classes; ++k){
+        free(own.fspt_training_data[k]);
+        free(own.fspt_training_strata[k]);
+    }
+    free(own.fspt_input);
+    free(own.fspt_training_data);
+    free(own.fspt_training_strata);
+    free(own.fspt_n_training_data);
+    free(own.fspt_n_max_training_data);
+    free(own.fspt_n_seen_data);
+    free(own.fspt_stratum_seen);
+    free(own.fspt_stratum_kept);
+    if(own.fspt_reduction){
+        free(own.fspt_reduction->workspace);
+        free(own.fspt_reduction);
+    }
+}
+
+static void free_replicas(network *net)
+{
+    struct network_replicas *p = net->replicas;
+    int r, i;
+    for(r = 0; r < p->active && p->replicas; ++r){
+        network_replica *rep = p->replicas + r;
+        for(i = 0; i < net->n; ++i){
+            free(rep->own[i].output);
+            if(net->layers[i].type == FSPT) free_own_fspt(rep->own[i], net->layers[i].classes);
+        }
+        free(rep->own);
+        free(rep->own_outputs);
+        free(rep->costs);
+        free(rep->net.layers);
+        free(rep->net.workspace);
+        free_replica_profile(rep->profile);
+    }
+    free(p->replicas);
+    free(p->kept);
+    p->replicas = 0;
+    p->kept = 0;
+    p->active = 0;
+}
+
+static void make_replicas(network *net)
+{
+    struct network_replicas *p = net->replicas;
+    int r, i;
+    free_replicas(net);
+    p->batch = net->batch;
+    p->arena = net->arena;
+    p->supported = 1;
+    for(i = 0; i < net->n; ++i){
+        if(!replica_supported(net->layers[i])){
+            fprintf(stderr, "Replicas: layer %d is not supported, the batch runs on one thread\n", i);
+            p->supported = 0;
+            return;
+        }
+    }
+    p->active = p->n < net->batch ? p->n : net->batch;
+    p->replicas = calloc(p->active, sizeof(network_replica));
+    if(net->arena) p->kept = memory_plan_kept_outputs(net);
+    int offset = 0;
+    for(r = 0; r < p->active; ++r){
+        network_replica *rep = p->replicas + r;
+        rep->offset = offset;
+        rep->net.batch = net->batch/p->active + (r < net->batch%p->active);
+        offset += rep->net.batch;
+        rep->net.layers = calloc(net->n, sizeof(layer));
+        rep->own = calloc(net->n, sizeof(layer));
+        rep->own_outputs = calloc(net->n, sizeof(size_t));
+        rep->costs = calloc(net->n, sizeof(float));
+        for(i = 0; i < net->n; ++i){
+            if(net->layers[i].type == FSPT) make_own_fspt(rep->own + i, net->layers[i]);
+        }
+    }
+    fprintf(stderr, "Replicas: batch of %d split over %d threads\n", net->batch, p->active);
+}
+
+static float *slice(float *buffer, int per_image, int offset)
+{
+    return buffer ? buffer + (size_t)offset*per_image : 0;
+}
+
+/* Copies the layers of base to the replica and points them to the buffers
+ * of the replica. */
+static void refresh_replica(network *base, network_replica *rep)
+{
+    int i;
+    network *net = &rep->net;
+    layer *layers = net->layers;
+    float *workspace = net->workspace;
+    int batch = net->batch;
+    int off = rep->offset;
+    size_t workspace_size = 0;
+
+    *net = *base;
+    net->layers = layers;
+    net->batch = batch;
+    net->input = slice(base->input, base->inputs, off);
+    net->truth = slice(base->truth, base->truths, off);
+    net->delta = 0;
+    net->arena = 0;
+    net->profile = base->profile ? rep->profile : 0;
+    net->replicas = 0;
+    net->cost = &rep->cost;
+    for(i = 0; i < base->n; ++i){
+        layer *l = layers + i;
+        layer *own = rep->own + i;
+        *l = base->layers[i];
+        l->batch = batch;
+        if(l->workspace_size > workspace_size) workspace_size = l->workspace_size;
+        if(l->type == DROPOUT && i > 0){
+            l->output = layers[i-1].output;
+        } else if(base->arena){
+            size_t size = (size_t)l->outputs*batch;
+            if(rep->own_outputs[i] < size){
+                own->output = realloc(own->output, size*sizeof(float));
+                if(!own->output) malloc_error();
+                rep->own_outputs[i] = size;
+            }
+            l->output = own->output;
+        } else {
+            l->output = slice(l->output, l->outputs, off);
+        }
+        l->delta = slice(l->delta, l->outputs, off);
+        l->x = slice(l->x, l->outputs, off);
+        l->x_norm = slice(l->x_norm, l->outputs, off);
+        l->loss = slice(l->loss, l->outputs, off);
+        l->squared = slice(l->squared, l->inputs, off);
+        l->norms = slice(l->norms, l->inputs, off);
+        if(l->indexes) l->indexes += (size_t)off*l->outputs;
+        if(l->qinput) l->qinput += (size_t)off*l->inputs;
+        if(l->cost) l->cost = rep->costs + i;
+        if(l->type == FSPT){
+            l->fspt_input = own->fspt_input;
+            l->fspt_training_data = own->fspt_training_data;
+            l->fspt_training_strata = own->fspt_training_strata;
+            l->fspt_n_training_data = own->fspt_n_training_data;
+            l->fspt_n_max_training_data = own->fspt_n_max_training_data;
+            l->fspt_n_seen_data = own->fspt_n_seen_data;
+            l->fspt_stratum_seen = own->fspt_stratum_seen;
+            l->fspt_stratum_kept = own->fspt_stratum_kept;
+            l->fspt_sampling = FSPT_SAMPLING_ALL;
+            l->fspt_max_samples = 0;
+            if(own->fspt_reduction){
+                float *reduction_workspace = own->fspt_reduction->workspace;
+                *own->fspt_reduction = *l->fspt_reduction;
+                own->fspt_reduction->workspace = reduction_workspace;
+                l->fspt_reduction = own->fspt_reduction;
+            }
+        }
+    }
+    net->output = layers[base->n - 1].output;
+    if(rep->workspace_size < workspace_size){
+        free(workspace);
+        workspace = calloc(1, workspace_size);
+        if(!workspace) malloc_error();
+        rep->workspace_size = workspace_size;
+    }
+    net->workspace = workspace;
+}
+
+typedef struct {
+    network *base;
+    network_replica *rep;
+} replica_args;
+
+static void *forward_replica(void *ptr)
+{
+    replica_args args = *(replica_args *)ptr;
+    refresh_replica(args.base, args.rep);
+    gemm_run_alone(1);
+    forward_network(&args.rep->net);
+    gemm_run_alone(0);
+    return 0;
+}
+
+int forward_network_replicas(network *net)
+{
+    struct network_replicas *p = net->replicas;
+    int r, i;
+    if(!p || p->n < 2 || net->train || net->batch < 2 || net->gpu_index >= 0) return 0;
+    if(p->batch != net->batch || p->arena != net->arena) make_replicas(net);
+    if(!p->supported) return 0;
+
+    pthread_t *threads = calloc(p->active, sizeof(pthread_t));
+    replica_args *args = calloc(p->active, sizeof(replica_args));
+    for(r = 0; r < p->active; ++r){
+        args[r].base = net;
+        args[r].rep = p->replicas + r;
+        if(net->profile && !p->replicas[r].profile){
+            p->replicas[r].profile = make_replica_profile(net->profile);
+        }
+    }
+    for(r = 1; r < p->active; ++r){
+        if(pthread_create(threads + r, 0, forward_replica, args + r)) error("Thread creation failed");
+    }
+    forward_replica(args);
+    for(r = 1; r < p->active; ++r){
+        pthread_join(threads[r], 0);
+    }
+    free(threads);
+    free(args);
+    if(net->profile){
+        struct network_profile **profiles = calloc(p->active, sizeof(struct network_profile *));
+        for(r = 0; r < p->active; ++r) profiles[r] = p->replicas[r].profile;
+        merge_replica_profiles(net->profile, profiles, p->active);
+        free(profiles);
+    }
+
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        if(l.cost) l.cost[0] = 0;
+        for(r = 0; r < p->active; ++r){
+            network_replica *rep = p->replicas + r;
+            if(l.cost) l.cost[0] += rep->costs[i];
+            if(l.type == FSPT) fspt_layer_merge_replica(rep->net.layers[i], l);
+            if(p->kept && p->kept[i]){
+                memcpy(l.output + (size_t)rep->offset*l.outputs, rep->net.layers[i].output,
+                        (size_t)rep->net.batch*l.outputs*sizeof(float));
+            }
+        }
+    }
+    calc_network_cost(net);
+    return 1;
+}
+
+void replicate_network(network *net, int n)
+{
+    free_network_replicas(net);
+    if(n < 2) return;
+    net->replicas = calloc(1, sizeof(struct network_replicas));
+    net->replicas->n = n;
+}
+
+void free_network_replicas(network *net)
+{
+    if(!net->replicas) return;
+    free_replicas(net);
+    free(net->replicas);
+    net->replicas = 0;
+}
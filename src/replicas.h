@@ -0,0 +1,13 @@
+#ifndef REPLICAS_H
+#define REPLICAS_H
+
+#include "darknet.h"
+
+/* Runs forward_network on the replicas of net, see replicate_network.
+ * Returns 0 without running anything when the replicas can't be used :
+ * training, a batch of 1, the gpu or unsupported layers. */
+int forward_network_replicas(network *net);
+
+void free_network_replicas(network *net);
+
+#endif
@@ -80,7 +80,10 @@ void forward_route_layer(const route_layer l, network net)
         float *input = net.layers[index].output;
         int input_size = l.input_sizes[i];
         for(j = 0; j < l.batch; ++j){
-            copy_cpu(input_size, input + j*input_size, 1, l.output + offset + j*l.outputs, 1);
+            float *out = l.output + offset + j*l.outputs;
+            /* the producer already wrote in place, see plan_network_memory */
+            if(out == input + j*input_size) continue;
+            copy_cpu(input_size, input + j*input_size, 1, out, 1);
         }
         offset += input_size;
     }
@@ -12,18 +12,25 @@
 #include <time.h>
 #include <unistd.h>
 
-#include "prng.h"
+#include "rand_stream.h"
 
-#define RAND() prng_get_int()
+/* Per thread stream : no lock and no shared state between threads. */
+#define RAND() ((int) (rand_stream_next(thread_rand_stream()) >> 33))
 #define L_RAND_MAX INT_MAX
 
+#define PASCAL_N_MAX 1024
+
+/**
+ * Shared pascal triangle. The rows are never moved once built so readers
+ * only need an acquire load of n_max, the mutex serializes the writers.
+ */
 typedef struct pascal_t {
-    int n_max;
-    long **t;
+    int n_max;  // rows [0, n_max] are built.
+    long *t[PASCAL_N_MAX + 1];
     pthread_mutex_t m;
 } pascal_t;
 
-static volatile pascal_t pascal = {0, 0, PTHREAD_MUTEX_INITIALIZER};
+static pascal_t pascal = {-1, {0}, PTHREAD_MUTEX_INITIALIZER};
 
 // Start time as a timespec
 struct timespec start_time;
@@ -177,6 +184,21 @@ size_t *random_index_order_size_t(size_t min, size_t max)
     return inds;
 }
 
+size_t *random_index_sample_size_t(rand_stream *r, size_t n, size_t k)
+{
+    if (!r) r = thread_rand_stream();
+    size_t *inds = calloc(n, sizeof(size_t));
+    for (size_t i = 0; i < n; ++i) inds[i] = i;
+    if (k >= n && n) k = n - 1;
+    for (size_t i = 0; i < k; ++i) {
+        size_t index = i + rand_stream_next(r) % (n - i);
+        size_t swap = inds[i];
+        inds[i] = inds[index];
+        inds[index] = swap;
+    }
+    return inds;
+}
+
 int *random_index_order(int min, int max)
 {
     int *inds = calloc(max-min, sizeof(int));
@@ -933,6 +955,71 @@ void qsort_float_on_index(size_t index, size_t n, size_t size,
     }
 }
 
+int cmp_float_rows(size_t size, const float *a, const float *b) {
+    for (size_t i = 0; i < size; ++i) {
+        if (a[i] < b[i]) return -1;
+        if (a[i] > b[i]) return 1;
+    }
+    return 0;
+}
+
+static void swap_float_rows(size_t size, float *a, float *b) {
+    if (a == b) return;
+    for (size_t i = 0; i < size; ++i) {
+        float swap = a[i];
+        a[i] = b[i];
+        b[i] = swap;
+    }
+}
+
+/**
+ * Recursive part of qsort_float_rows. Recurses on the smallest side of
+ * the partition and loops on the largest one to bound the stack depth.
+ *
+ * \param n The number of vectors in the array.
+ * \param size The number of feature of each vectors.
+ * \param base Output paramter. Pointer to the array of size (n*size).
+ * \param pivot Workspace of size `size`.
+ */
+static void qsort_float_rows_rec(size_t n, size_t size, float *base,
+        float *pivot) {
+    while (n > 1) {
+        memcpy(pivot, base + (n / 2) * size, size * sizeof(float));
+        /* [0, lt) < pivot, [lt, gt) == pivot, [gt, n) > pivot */
+        size_t lt = 0;
+        size_t i = 0;
+        size_t gt = n;
+        while (i < gt) {
+            int cmp = cmp_float_rows(size, base + i * size, pivot);
+            if (cmp < 0) {
+                swap_float_rows(size, base + lt * size, base + i * size);
+                ++lt;
+                ++i;
+            } else if (cmp > 0) {
+                --gt;
+                swap_float_rows(size, base + i * size, base + gt * size);
+            } else {
+                ++i;
+            }
+        }
+        if (lt < n - gt) {
+            qsort_float_rows_rec(lt, size, base, pivot);
+            base += gt * size;
+            n -= gt;
+        } else {
+            qsort_float_rows_rec(n - gt, size, base + gt * size, pivot);
+            n = lt;
+        }
+    }
+}
+
+void qsort_float_rows(size_t n, size_t size, float *base) {
+    if (n < 2 || !size) return;
+    float *pivot = malloc(size * sizeof(float));
+    qsort_float_rows_rec(n, size, base, pivot);
+    free(pivot);
+}
+
 static int cmp_float(const void *fp1, const void *fp2) {
     float f1 = *(float *) fp1;
     float f2 = *(float *) fp2;
@@ -1015,41 +1102,119 @@ void solve_polynome(polynome_t *poly) {
 
 long binomial(int n, int k) {
     if (n < 0 || k < 0 || k > n) return 0;
-    if (n == 0 && k == 0) return 1;
-    if (pascal.n_max == 0) {
-        pthread_mutex_lock((pthread_mutex_t *) &pascal.m);
-        if (pascal.n_max == 0) {
-            pascal.t = calloc(n + 1, sizeof(long *));
-
-            for (int i = 0; i < n + 1; ++i) {
-                pascal.t[i] = calloc(i + 1, sizeof(long));
-                pascal.t[i][0] = 1;
-                for(int j = 1; j < i; ++j)
-                    pascal.t[i][j] = pascal.t[i-1][j] + pascal.t[i-1][j-1];
-                pascal.t[i][i] = 1;
-            }
-            pascal.n_max = n;
+    if (n > PASCAL_N_MAX) {
+        long double b = roundl(expl(log_binomial(n, k)));
+        return (b >= (long double) LONG_MAX) ? LONG_MAX : (long) b;
+    }
+    if (__atomic_load_n(&pascal.n_max, __ATOMIC_ACQUIRE) < n) {
+        pthread_mutex_lock(&pascal.m);
+        for (int i = pascal.n_max + 1; i < n + 1; ++i) {
+            long *row = calloc(i + 1, sizeof(long));
+            row[0] = 1;
+            for(int j = 1; j < i; ++j)
+                row[j] = pascal.t[i-1][j] + pascal.t[i-1][j-1];
+            row[i] = 1;
+            pascal.t[i] = row;
         }
-        pthread_mutex_unlock((pthread_mutex_t *) &pascal.m);
+        if (pascal.n_max < n)
+            __atomic_store_n(&pascal.n_max, n, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&pascal.m);
     }
+    return pascal.t[n][k];
+}
 
-    if (pascal.n_max < n) {
-        pthread_mutex_lock((pthread_mutex_t *) &pascal.m);
-        if (pascal.n_max < n) {
-            pascal.t = realloc(pascal.t, (n + 1)* sizeof(long *));
-            for (int i = pascal.n_max; i < n + 1; ++i) {
-                pascal.t[i] = calloc(i + 1, sizeof(long));
-                pascal.t[i][0] = 1;
-                for(int j = 1; j < i; ++j)
-                    pascal.t[i][j] = pascal.t[i-1][j] + pascal.t[i-1][j-1];
-                pascal.t[i][i] = 1;
-            }
-            pascal.n_max = n;
-        }
-        pthread_mutex_unlock((pthread_mutex_t *) &pascal.m);
+/**
+ * Thread safe log(Gamma(x)). lgammal writes the sign in a global.
+ */
+static long double log_gamma(long double x) {
+    int sign = 0;
+    return lgammal_r(x, &sign);
+}
+
+long double log_binomial(int n, int k) {
+    if (n < 0 || k < 0 || k > n) return -INFINITY;
+    return log_gamma(n + 1.L) - log_gamma(k + 1.L) - log_gamma(n - k + 1.L);
+}
+
+/**
+ * Continued fraction of the regularized incomplete beta function,
+ * evaluated with the modified Lentz method. Converges quickly for
+ * x < (a + 1) / (a + b + 2).
+ */
+static long double incomplete_beta_cf(long double a, long double b,
+        long double x) {
+    const long double tiny = 1e-4000L;
+    const long double eps = 1e-16L;
+    int max_iter = 200 + (int) (10 * sqrtl(a + b));
+    long double qab = a + b;
+    long double qap = a + 1.L;
+    long double qam = a - 1.L;
+    long double c = 1.L;
+    long double d = 1.L - qab * x / qap;
+    if (fabsl(d) < tiny) d = tiny;
+    d = 1.L / d;
+    long double h = d;
+    for (int m = 1; m <= max_iter; ++m) {
+        int m2 = 2 * m;
+        long double aa = m * (b - m) * x / ((qam + m2) * (a + m2));
+        d = 1.L + aa * d;
+        if (fabsl(d) < tiny) d = tiny;
+        c = 1.L + aa / c;
+        if (fabsl(c) < tiny) c = tiny;
+        d = 1.L / d;
+        h *= d * c;
+        aa = -(a + m) * (qab + m) * x / ((a + m2) * (qap + m2));
+        d = 1.L + aa * d;
+        if (fabsl(d) < tiny) d = tiny;
+        c = 1.L + aa / c;
+        if (fabsl(c) < tiny) c = tiny;
+        d = 1.L / d;
+        long double del = d * c;
+        h *= del;
+        if (fabsl(del - 1.L) < eps) break;
     }
+    return h;
+}
 
-    return pascal.t[n][k] ;
+/**
+ * Regularized incomplete beta function I_x(a, b). The prefactor
+ * x^a (1-x)^b / B(a, b) is computed in log space.
+ */
+static long double incomplete_beta(long double a, long double b,
+        long double x) {
+    if (x <= 0.L) return 0.L;
+    if (x >= 1.L) return 1.L;
+    long double log_front = log_gamma(a + b) - log_gamma(a) - log_gamma(b)
+        + a * logl(x) + b * log1pl(-x);
+    if (x < (a + 1.L) / (a + b + 2.L))
+        return expl(log_front) * incomplete_beta_cf(a, b, x) / a;
+    return 1.L - expl(log_front) * incomplete_beta_cf(b, a, 1.L - x) / b;
+}
+
+long double binomial_range_proba(int n, int from, int to, long double s) {
+    if (from < 0) from = 0;
+    if (to > n) to = n;
+    if (from > to) return 0.L;
+    if (s <= 0.L) return from == 0;
+    if (s >= 1.L) return to == n;
+    /* P(X >= k) = I_s(k, n - k + 1) and P(X <= k) = I_{1-s}(n - k, k + 1).
+     * The difference is taken on the tails that are small to avoid
+     * cancellation. */
+    long double p;
+    if (from == 0 && to == n) {
+        p = 1.L;
+    } else if (from == 0) {
+        p = incomplete_beta(n - to, to + 1, 1.L - s);
+    } else if (to == n) {
+        p = incomplete_beta(from, n - from + 1, s);
+    } else if (to < n * s) {
+        p = incomplete_beta(n - to, to + 1, 1.L - s)
+            - incomplete_beta(n - from + 1, from, 1.L - s);
+    } else {
+        p = incomplete_beta(from, n - from + 1, s)
+            - incomplete_beta(to + 1, n - to, s);
+    }
+    return (p < 0.L) ? 0.L : p;
 }
 
 int *copy_int_array(size_t n, const int *a) {
@@ -5,6 +5,7 @@
 #include <assert.h>
 #include "darknet.h"
 #include "list.h"
+#include "rand_stream.h"
 
 #define TIME(a) \
     do { \
@@ -104,6 +105,20 @@ extern int int_index(int *a, int val, int n);
 extern int max_index_double(double *a, int n);
 extern int max_index_size_t(size_t *a, int n);
 extern size_t *random_index_order_size_t(size_t min, size_t max);
+
+/**
+ * Draws k distinct indices uniformly in [0, n) with a partial Fisher-Yates
+ * shuffle : only k random numbers are drawn instead of the n - 1 of a full
+ * permutation.
+ *
+ * \param r The random stream. If NULL, uses the stream of the thread.
+ * \param n The number of indices to choose from.
+ * \param k The number of indices to draw. k <= n.
+ * \return The array of size n whose k first elements are the drawn
+ *         indices. Caller must free.
+ */
+extern size_t *random_index_sample_size_t(rand_stream *r, size_t n,
+        size_t k);
 extern char *itoa(int val, int base);
 extern void qsort_float(size_t n, float *base);
 extern void add_millis_to_timespec (struct timespec * ts, long msec);
@@ -138,6 +153,28 @@ extern int equals_int_array(size_t n, const int *a, const int *b);
 extern void qsort_float_on_index(size_t index, size_t n, size_t size,
         float *base);
 
+/**
+ * Lexicographic comparison of two float vectors of the same size.
+ *
+ * \param size The number of features of each vectors.
+ * \param a The first vector.
+ * \param b The second vector.
+ * \return A negative value if a < b, 0 if a == b and a positive value
+ *         if a > b.
+ */
+extern int cmp_float_rows(size_t size, const float *a, const float *b);
+
+/**
+ * Sorts the vectors of a bidimensional array of size (n*size) in
+ * lexicographic ascending order. Uses a three-way partition so that
+ * arrays with many duplicated vectors are sorted efficiently.
+ *
+ * \param n The number of vectors in the array.
+ * \param size The number of feature of each vectors.
+ * \param base Output paramter. Pointer to the array of size (n*size).
+ */
+extern void qsort_float_rows(size_t n, size_t size, float *base);
+
 /**
  * Gives the median of an array already sorted.
  *
@@ -181,7 +218,10 @@ extern void solve_polynome(polynome_t *poly);
 
 /**
  * Computes the binomial coefficients
- * k among n. Use shared pascal triangle in thread safe way.
+ * k among n. Use shared pascal triangle in thread safe way, the triangle
+ * is never reallocated so lookups don't take the lock. Above
+ * n = 1024 the coefficient is computed from log_binomial and
+ * saturates at LONG_MAX. Overflows past n = 66 like the triangle.
  *
  * \param n the total number of elements.
  * \param k The number of elements to choose among n.
@@ -189,5 +229,30 @@ extern void solve_polynome(polynome_t *poly);
  */
 extern long binomial(int n, int k);
 
+/**
+ * Computes the logarithm of the binomial coefficient k among n with the
+ * thread safe lgammal_r. Doesn't overflow.
+ *
+ * \param n the total number of elements.
+ * \param k The number of elements to choose among n.
+ * \return log(k among n), -INFINITY if k is not in [0, n].
+ */
+extern long double log_binomial(int n, int k);
+
+/**
+ * Computes P(from <= X <= to) where X follows a binomial distribution
+ * B(n, s). Uses the regularized incomplete beta function with a log space
+ * prefactor, so it is accurate for n in the millions, and it is thread
+ * safe.
+ *
+ * \param n The number of trials.
+ * \param from The first number of successes (included).
+ * \param to The last number of successes (included).
+ * \param s The probability of success.
+ * \return The probability.
+ */
+extern long double binomial_range_proba(int n, int from, int to,
+        long double s);
+
 #endif
 
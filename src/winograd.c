@@ -0,0 +1,237 @@
+#include "winograd.h"
+#include "gemm.h"
+
+#include <string.h>
+
+/*
+ * Winograd minimal filtering F(m x m, 3 x 3) (Lavin & Gray). With
+ * alpha = m + 2, an alpha x alpha input tile d and a 3 x 3 filter g give the
+ * m x m output tile
+ *     Y = AT [(G g GT) . (BT d B)] A
+ * The alpha^2 element-wise products over the channels are alpha^2
+ * independent gemms between the transformed weights and the transformed
+ * input tiles.
+ */
+
+static const float BT_2[4*4] = {
+    1,  0, -1,  0,
+    0,  1,  1,  0,
+    0, -1,  1,  0,
+    0,  1,  0, -1};
+static const float G_2[4*3] = {
+    1,    0,  0,
+    .5,  .5, .5,
+    .5, -.5, .5,
+    0,    0,  1};
+static const float AT_2[2*4] = {
+    1, 1,  1,  0,
+    0, 1, -1, -1};
+
+static const float BT_4[6*6] = {
+    4,  0, -5,  0, 1, 0,
+    0, -4, -4,  1, 1, 0,
+    0,  4, -4, -1, 1, 0,
+    0, -2, -1,  2, 1, 0,
+    0,  2, -1, -2, 1, 0,
+    0,  4,  0, -5, 0, 1};
+static const float G_4[6*3] = {
+    1./4,      0,     0,
+    -1./6, -1./6, -1./6,
+    -1./6,  1./6, -1./6,
+    1./24, 1./12,  1./6,
+    1./24, -1./12, 1./6,
+    0,         0,     1};
+static const float AT_4[4*6] = {
+    1, 1,  1, 1,  1, 0,
+    0, 1, -1, 2, -2, 0,
+    0, 1,  1, 4,  4, 0,
+    0, 1, -1, 8, -8, 1};
+
+/* Y (rows x rows) = L (rows x cols) X (cols x cols) LT */
+static void sandwich(const float *L, int rows, int cols, const float *X,
+        float *Y)
+{
+    float tmp[6*6];
+    int i, j, k;
+    for(i = 0; i < rows; ++i){
+        for(j = 0; j < cols; ++j){
+            float sum = 0;
+            for(k = 0; k < cols; ++k) sum += L[i*cols + k]*X[k*cols + j];
+            tmp[i*cols + j] = sum;
+        }
+    }
+    for(i = 0; i < rows; ++i){
+        for(j = 0; j < rows; ++j){
+            float sum = 0;
+            for(k = 0; k < cols; ++k) sum += tmp[i*cols + k]*L[j*cols + k];
+            Y[i*rows + j] = sum;
+        }
+    }
+}
+
+/* BT d B for F(2x2, 3x3) */
+static void input_transform_2(const float *d, float *V)
+{
+    float t[16];
+    int j;
+    for(j = 0; j < 4; ++j){
+        t[0*4 + j] = d[0*4 + j] - d[2*4 + j];
+        t[1*4 + j] = d[1*4 + j] + d[2*4 + j];
+        t[2*4 + j] = d[2*4 + j] - d[1*4 + j];
+        t[3*4 + j] = d[1*4 + j] - d[3*4 + j];
+    }
+    for(j = 0; j < 4; ++j){
+        V[j*4 + 0] = t[j*4 + 0] - t[j*4 + 2];
+        V[j*4 + 1] = t[j*4 + 1] + t[j*4 + 2];
+        V[j*4 + 2] = t[j*4 + 2] - t[j*4 + 1];
+        V[j*4 + 3] = t[j*4 + 1] - t[j*4 + 3];
+    }
+}
+
+/* AT M A for F(2x2, 3x3) */
+static void output_transform_2(const float *M, float *Y)
+{
+    float t[8];
+    int j;
+    for(j = 0; j < 4; ++j){
+        t[0*4 + j] = M[0*4 + j] + M[1*4 + j] + M[2*4 + j];
+        t[1*4 + j] = M[1*4 + j] - M[2*4 + j] - M[3*4 + j];
+    }
+    for(j = 0; j < 2; ++j){
+        Y[j*2 + 0] = t[j*4 + 0] + t[j*4 + 1] + t[j*4 + 2];
+        Y[j*2 + 1] = t[j*4 + 1] - t[j*4 + 2] - t[j*4 + 3];
+    }
+}
+
+/* G g GT where G is alpha x 3 : the sandwich of a non square matrix */
+static void transform_filter(const float *G, int alpha, const float *g,
+        float *U)
+{
+    float tmp[6*3];
+    int i, j, k;
+    for(i = 0; i < alpha; ++i){
+        for(j = 0; j < 3; ++j){
+            float sum = 0;
+            for(k = 0; k < 3; ++k) sum += G[i*3 + k]*g[k*3 + j];
+            tmp[i*3 + j] = sum;
+        }
+    }
+    for(i = 0; i < alpha; ++i){
+        for(j = 0; j < alpha; ++j){
+            float sum = 0;
+            for(k = 0; k < 3; ++k) sum += tmp[i*3 + k]*G[j*3 + k];
+            U[i*alpha + j] = sum;
+        }
+    }
+}
+
+int winograd_tile_size(int m)
+{
+    return m + 2;
+}
+
+size_t winograd_weights_size(int m, int n, int c)
+{
+    int alpha = winograd_tile_size(m);
+    return (size_t)alpha*alpha*n*c;
+}
+
+static int winograd_block(int m, int out_h, int out_w)
+{
+    int n_tiles = ((out_h + m - 1)/m)*((out_w + m - 1)/m);
+    return n_tiles < WINOGRAD_TILE_BLOCK ? n_tiles : WINOGRAD_TILE_BLOCK;
+}
+
+size_t winograd_workspace_size(int m, int n, int c, int out_h, int out_w)
+{
+    int alpha = winograd_tile_size(m);
+    return (size_t)alpha*alpha*(c + n)*winograd_block(m, out_h, out_w)*sizeof(float);
+}
+
+void winograd_transform_weights(int m, const float *weights, int n, int c,
+        float *transformed)
+{
+    int alpha = winograd_tile_size(m);
+    const float *G = (m == 2) ? G_2 : G_4;
+    float U[6*6];
+    int f, ch, e;
+    for(f = 0; f < n; ++f){
+        for(ch = 0; ch < c; ++ch){
+            transform_filter(G, alpha, weights + (f*c + ch)*9, U);
+            for(e = 0; e < alpha*alpha; ++e){
+                transformed[((size_t)e*n + f)*c + ch] = U[e];
+            }
+        }
+    }
+}
+
+void winograd_convolution(int m, const float *im, int c, int h, int w,
+        int pad, const float *transformed, int n, int out_h, int out_w,
+        float *workspace, float *output)
+{
+    int alpha = winograd_tile_size(m);
+    int n_elem = alpha*alpha;
+    const float *BT = (m == 2) ? BT_2 : BT_4;
+    const float *AT = (m == 2) ? AT_2 : AT_4;
+    int tiles_w = (out_w + m - 1)/m;
+    int tiles_h = (out_h + m - 1)/m;
+    int n_tiles = tiles_w*tiles_h;
+    float *V = workspace;
+    float *M = workspace + (size_t)n_elem*c*winograd_block(m, out_h, out_w);
+    float d[6*6], tile[6*6], Y[4*4];
+    int t0, t, ch, f, e, i, j;
+    for(t0 = 0; t0 < n_tiles; t0 += WINOGRAD_TILE_BLOCK){
+        int T = (n_tiles - t0 < WINOGRAD_TILE_BLOCK) ?
+            n_tiles - t0 : WINOGRAD_TILE_BLOCK;
+        /* V[e][ch][t] = (BT d B)[e] */
+        for(ch = 0; ch < c; ++ch){
+            const float *plane = im + (size_t)ch*h*w;
+            for(t = 0; t < T; ++t){
+                int y0 = ((t0 + t)/tiles_w)*m - pad;
+                int x0 = ((t0 + t)%tiles_w)*m - pad;
+                if(y0 >= 0 && x0 >= 0 && y0 + alpha <= h && x0 + alpha <= w){
+                    for(i = 0; i < alpha; ++i){
+                        memcpy(d + i*alpha, plane + (y0 + i)*w + x0, alpha*sizeof(float));
+                    }
+                } else {
+                    for(i = 0; i < alpha; ++i){
+                        int y = y0 + i;
+                        for(j = 0; j < alpha; ++j){
+                            int x = x0 + j;
+                            d[i*alpha + j] = (y < 0 || y >= h || x < 0 || x >= w)
+                                ? 0 : plane[y*w + x];
+                        }
+                    }
+                }
+                if(m == 2) input_transform_2(d, tile);
+                else sandwich(BT, alpha, alpha, d, tile);
+                for(e = 0; e < n_elem; ++e){
+                    V[((size_t)e*c + ch)*T + t] = tile[e];
+                }
+            }
+        }
+        /* M[e] = U[e] V[e] */
+        for(e = 0; e < n_elem; ++e){
+            gemm(0, 0, n, T, c, 1, (float *)transformed + (size_t)e*n*c, c,
+                    V + (size_t)e*c*T, T, 0, M + (size_t)e*n*T, T);
+        }
+        /* output = AT M A, tiles do not overlap */
+        for(f = 0; f < n; ++f){
+            float *out = output + (size_t)f*out_h*out_w;
+            for(t = 0; t < T; ++t){
+                int y0 = ((t0 + t)/tiles_w)*m;
+                int x0 = ((t0 + t)%tiles_w)*m;
+                for(e = 0; e < n_elem; ++e){
+                    tile[e] = M[((size_t)e*n + f)*T + t];
+                }
+                if(m == 2) output_transform_2(tile, Y);
+                else sandwich(AT, m, alpha, tile, Y);
+                for(i = 0; i < m && y0 + i < out_h; ++i){
+                    for(j = 0; j < m && x0 + j < out_w; ++j){
+                        out[(y0 + i)*out_w + x0 + j] = Y[i*m + j];
+                    }
+                }
+            }
+        }
+    }
+}
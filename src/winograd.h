@@ -0,0 +1,32 @@
+#ifndef WINOGRAD_H
+#define WINOGRAD_H
+
+#include <stddef.h>
+
+/* Number of output tiles transformed at once. Bounds the workspace. */
+#define WINOGRAD_TILE_BLOCK 256
+
+/* Size of one side of the output tile of F(m x m, 3 x 3), m = 2 or 4. */
+int winograd_tile_size(int m);
+
+/* Number of floats of the pre-transformed weights of n filters of c
+ * channels. */
+size_t winograd_weights_size(int m, int n, int c);
+
+/* Bytes of workspace used by winograd_convolution for c input and n output
+ * channels and an out_h x out_w output. */
+size_t winograd_workspace_size(int m, int n, int c, int out_h, int out_w);
+
+/* Transforms n filters of c channels of 3 x 3 weights into
+ * transformed[(m+2)^2][n][c]. */
+void winograd_transform_weights(int m, const float *weights, int n, int c,
+        float *transformed);
+
+/* Convolution of a c x h x w image with n 3 x 3 filters of stride 1,
+ * written to the n x out_h x out_w output.
+ * transformed comes from winograd_transform_weights. */
+void winograd_convolution(int m, const float *im, int c, int h, int w,
+        int pad, const float *transformed, int n, int out_h, int out_w,
+        float *workspace, float *output);
+
+#endif